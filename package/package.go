@@ -27,7 +27,13 @@ func GetPackage() *denv.Package {
 	maintest.AddDependencies(unittestpkg.GetMainLib()...)
 	maintest.AddDependency(mainlib)
 
+	// benchmark application (source/bench)
+	mainbench := denv.SetupCppAppProject(mainpkg, "cvkmem_bench", "bench")
+	mainbench.AddDependencies(basepkg.GetMainLib()...)
+	mainbench.AddDependency(mainlib)
+
 	mainpkg.AddMainLib(mainlib)
 	mainpkg.AddUnittest(maintest)
+	mainpkg.AddMainApp(mainbench)
 	return mainpkg
 }
@@ -0,0 +1,287 @@
+#include "ccore/c_target.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem_bench/bench.h"
+
+namespace ncore
+{
+    namespace nbench
+    {
+        static f64 sFragmentation(nalloc::trace_engine_t* engine)
+        {
+            nalloc::storage_report_t report;
+            engine->storageReport(report);
+            return report.totalFreeSpace == 0 ? 0.0 : 1.0 - (f64)report.largestFreeRegion / (f64)report.totalFreeSpace;
+        }
+
+        // ----------------------------------------------------------------------------------------------------
+        // Latency: per size class, a ring of live allocations fills up to half of the heap, then random members
+        // of the ring are replaced one at a time and every free and allocate is timed on its own. Requests of a
+        // class are in (size / 2, size]. The heap is at least 8 MB so that the small classes fit a few slabs.
+        // The clock read adds a constant of a few tens of nanoseconds.
+
+        static constexpr u64 sLatencySizes[]   = {64, 256, 1024, 4096, 16384, 65536, 262144, 1048576};
+        static constexpr u32 NUM_LATENCY_SIZES = sizeof(sLatencySizes) / sizeof(sLatencySizes[0]);
+
+        void benchLatency(alloc_t* allocator, options_t const& options, writer_t& out)
+        {
+            u32 const maxLive    = options.quick ? 1024 : 4096;
+            u32 const iterations = options.quick ? 20000 : 200000;
+
+            nalloc::handle_t* live         = g_allocate_array<nalloc::handle_t>(allocator, maxLive);
+            u32*              allocSamples = g_allocate_array<u32>(allocator, iterations);
+            u32*              freeSamples  = g_allocate_array<u32>(allocator, iterations);
+
+            for (u32 e = 0; e < NUM_ENGINES; ++e)
+            {
+                for (u32 s = 0; s < NUM_LATENCY_SIZES; ++s)
+                {
+                    u64 const size = sLatencySizes[s];
+                    if (size < minEngineSize(e) || size > maxEngineSize(e))
+                        continue;
+
+                    // At most 512 MB of heap
+                    u32 const numLive = (u32)((u64)maxLive * size * 2 <= (512ull << 20) ? maxLive : (512ull << 20) / (size * 2));
+                    u64 const heap    = (u64)numLive * size * 2 < (8ull << 20) ? (8ull << 20) : (u64)numLive * size * 2;
+
+                    char const*             name;
+                    nalloc::trace_engine_t* engine = createEngine(allocator, e, name);
+                    engine->begin(heap, 1, nalloc::PLACEMENT_FAST);
+
+                    random_t random(options.seed + s);
+                    u64      offset;
+                    for (u32 i = 0; i < numLive; ++i)
+                        live[i] = engine->allocate(size / 2 + 1 + random.range((u32)(size / 2)), 1, nalloc::RESOURCE_ANY, offset);
+
+                    u32 numAllocSamples = 0;
+                    u32 numFreeSamples  = 0;
+                    u64 failures        = 0;
+                    for (u32 i = 0; i < iterations; ++i)
+                    {
+                        u32 const slot    = random.range(numLive);
+                        u64 const request = size / 2 + 1 + random.range((u32)(size / 2));
+
+                        if (live[slot] != nalloc::INVALID_HANDLE)
+                        {
+                            u64 const start = nowNs();
+                            engine->free(live[slot]);
+                            freeSamples[numFreeSamples++] = (u32)(nowNs() - start);
+                        }
+
+                        u64 const start = nowNs();
+                        live[slot]      = engine->allocate(request, 1, nalloc::RESOURCE_ANY, offset);
+                        u64 const ns    = nowNs() - start;
+                        if (live[slot] == nalloc::INVALID_HANDLE)
+                            failures++;
+                        else
+                            allocSamples[numAllocSamples++] = (u32)ns;
+                    }
+
+                    percentiles_t percentiles;
+                    computePercentiles(allocSamples, numAllocSamples, percentiles);
+                    out.begin("latency");
+                    out.field("engine", name);
+                    out.field("op", "allocate");
+                    out.field("size_class", size);
+                    out.field("live", (u64)numLive);
+                    out.field("failures", failures);
+                    writePercentiles(out, percentiles);
+                    out.end();
+
+                    computePercentiles(freeSamples, numFreeSamples, percentiles);
+                    out.begin("latency");
+                    out.field("engine", name);
+                    out.field("op", "free");
+                    out.field("size_class", size);
+                    out.field("live", (u64)numLive);
+                    writePercentiles(out, percentiles);
+                    out.end();
+
+                    destroyEngine(allocator, e, engine);
+                }
+            }
+
+            g_deallocate_array(allocator, freeSamples);
+            g_deallocate_array(allocator, allocSamples);
+            g_deallocate_array(allocator, live);
+        }
+
+        // ----------------------------------------------------------------------------------------------------
+        // Churn: sizes spread over the powers of 2 from 64 B to 64 KB, the heap is filled to half, then a
+        // random live allocation is freed and a new one is made for a fixed number of rounds. Only the whole
+        // loop is timed.
+
+        void benchChurn(alloc_t* allocator, options_t const& options, writer_t& out)
+        {
+            u64 const heap    = 256ull << 20;
+            u32 const maxLive = 65536;
+            u32 const rounds  = options.quick ? 200000 : 2000000;
+            u64 const maxSize = 65536;
+
+            nalloc::handle_t* live  = g_allocate_array<nalloc::handle_t>(allocator, maxLive);
+            u64*              sizes = g_allocate_array<u64>(allocator, maxLive);
+
+            for (u32 e = 0; e < NUM_ENGINES; ++e)
+            {
+                char const*             name;
+                nalloc::trace_engine_t* engine = createEngine(allocator, e, name);
+                engine->begin(heap, 1, nalloc::PLACEMENT_FAST);
+
+                random_t random(options.seed);
+                u64      offset;
+                u64      liveBytes = 0;
+                u32      numLive   = 0;
+                while (numLive < maxLive && liveBytes < heap / 2)
+                {
+                    sizes[numLive] = random.logUniform(64, maxSize);
+                    live[numLive]  = engine->allocate(sizes[numLive], 1, nalloc::RESOURCE_ANY, offset);
+                    if (live[numLive] == nalloc::INVALID_HANDLE)
+                        break;
+                    liveBytes += sizes[numLive++];
+                }
+
+                u64       failures = 0;
+                u64 const start    = nowNs();
+                for (u32 i = 0; i < rounds; ++i)
+                {
+                    u32 const slot = random.range(numLive);
+                    if (live[slot] != nalloc::INVALID_HANDLE)
+                    {
+                        engine->free(live[slot]);
+                        liveBytes -= sizes[slot];
+                    }
+                    sizes[slot] = random.logUniform(64, maxSize);
+                    live[slot]  = engine->allocate(sizes[slot], 1, nalloc::RESOURCE_ANY, offset);
+                    if (live[slot] == nalloc::INVALID_HANDLE)
+                        failures++;
+                    else
+                        liveBytes += sizes[slot];
+                }
+                u64 const ns = nowNs() - start;
+
+                out.begin("churn");
+                out.field("engine", name);
+                out.field("heap", heap);
+                out.field("live", (u64)numLive);
+                out.field("rounds", (u64)rounds);
+                out.field("failures", failures);
+                out.field("ns_per_round", (f64)ns / (f64)rounds);
+                out.field("rounds_per_sec", (f64)rounds * 1e9 / (f64)(ns > 0 ? ns : 1));
+                out.field("live_bytes", liveBytes);
+                out.field("fragmentation", sFragmentation(engine));
+                out.end();
+
+                destroyEngine(allocator, e, engine);
+            }
+
+            g_deallocate_array(allocator, sizes);
+            g_deallocate_array(allocator, live);
+        }
+
+        // ----------------------------------------------------------------------------------------------------
+        // Fill to failure: sizes spread over the powers of 2 from 64 B to 1 MB (to the largest size of the
+        // engine), allocate until 64 requests in a row fail. Reports the utilization at the first failure and
+        // at the end, then frees every other allocation and fills again to see how well the holes are reused.
+
+        struct fill_result_t
+        {
+            u64 count;
+            u64 firstFailureBytes;
+            u64 bytes;
+        };
+
+        static void sFill(nalloc::trace_engine_t* engine, random_t& random, u64 maxSize, nalloc::handle_t* live, u64* sizes, u32 maxLive, u32& numLive, u64& liveBytes, fill_result_t& result)
+        {
+            u32 const maxFailuresInARow = 64;
+
+            result                   = fill_result_t();
+            result.firstFailureBytes = ~(u64)0;
+            u32 failuresInARow       = 0;
+            u64 offset;
+            while (numLive < maxLive && failuresInARow < maxFailuresInARow)
+            {
+                u64 const              size   = random.logUniform(64, maxSize);
+                nalloc::handle_t const handle = engine->allocate(size, 1, nalloc::RESOURCE_ANY, offset);
+                if (handle == nalloc::INVALID_HANDLE)
+                {
+                    if (result.firstFailureBytes == ~(u64)0)
+                        result.firstFailureBytes = liveBytes;
+                    failuresInARow++;
+                    continue;
+                }
+                failuresInARow   = 0;
+                live[numLive]    = handle;
+                sizes[numLive++] = size;
+                liveBytes += size;
+                result.count++;
+            }
+            if (result.firstFailureBytes == ~(u64)0)
+                result.firstFailureBytes = liveBytes;
+            result.bytes = liveBytes;
+        }
+
+        static void sWriteFill(writer_t& out, char const* name, char const* phase, u64 heap, fill_result_t const& result, nalloc::trace_engine_t* engine)
+        {
+            out.begin("fill");
+            out.field("engine", name);
+            out.field("phase", phase);
+            out.field("heap", heap);
+            out.field("allocations", result.count);
+            out.field("live_bytes", result.bytes);
+            out.field("first_failure_utilization", (f64)result.firstFailureBytes / (f64)heap);
+            out.field("utilization", (f64)result.bytes / (f64)heap);
+            out.field("fragmentation", sFragmentation(engine));
+            out.end();
+        }
+
+        void benchFill(alloc_t* allocator, options_t const& options, writer_t& out)
+        {
+            u64 const heap    = options.quick ? (64ull << 20) : (256ull << 20);
+            u32 const maxLive = 1 << 20;
+
+            nalloc::handle_t* live  = g_allocate_array<nalloc::handle_t>(allocator, maxLive);
+            u64*              sizes = g_allocate_array<u64>(allocator, maxLive);
+
+            for (u32 e = 0; e < NUM_ENGINES; ++e)
+            {
+                u64 const maxSize = maxEngineSize(e) < 1048576 ? maxEngineSize(e) : 1048576;
+
+                char const*             name;
+                nalloc::trace_engine_t* engine = createEngine(allocator, e, name);
+                engine->begin(heap, 1, nalloc::PLACEMENT_FAST);
+
+                random_t      random(options.seed);
+                fill_result_t result;
+                u32           numLive   = 0;
+                u64           liveBytes = 0;
+                sFill(engine, random, maxSize, live, sizes, maxLive, numLive, liveBytes, result);
+                sWriteFill(out, name, "initial", heap, result, engine);
+
+                // Free every other allocation, the holes are as large as the allocations they held
+                u32 numKept = 0;
+                for (u32 i = 0; i < numLive; ++i)
+                {
+                    if ((i & 1) == 0)
+                    {
+                        live[numKept]    = live[i];
+                        sizes[numKept++] = sizes[i];
+                    }
+                    else
+                    {
+                        engine->free(live[i]);
+                        liveBytes -= sizes[i];
+                    }
+                }
+                numLive = numKept;
+
+                sFill(engine, random, maxSize, live, sizes, maxLive, numLive, liveBytes, result);
+                sWriteFill(out, name, "refill", heap, result, engine);
+
+                destroyEngine(allocator, e, engine);
+            }
+
+            g_deallocate_array(allocator, sizes);
+            g_deallocate_array(allocator, live);
+        }
+    }  // namespace nbench
+}  // namespace ncore
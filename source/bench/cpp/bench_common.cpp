@@ -0,0 +1,293 @@
+#include "ccore/c_target.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/private/c_vkpageallocator.h"
+#include "cvkmem/private/c_vkslaballocator.h"
+#include "cvkmem_bench/bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+namespace ncore
+{
+    namespace nbench
+    {
+        writer_t::writer_t()
+            : m_fields(0)
+        {
+        }
+
+        void writer_t::begin(char const* bench)
+        {
+            m_fields = 0;
+            fputc('{', stdout);
+            field("bench", bench);
+        }
+
+        // Keys and values are identifiers and file names, only quotes and backslashes need escaping
+        static void sWriteString(char const* str)
+        {
+            fputc('"', stdout);
+            for (; *str != 0; ++str)
+            {
+                if (*str == '"' || *str == '\\')
+                    fputc('\\', stdout);
+                fputc(*str, stdout);
+            }
+            fputc('"', stdout);
+        }
+
+        static void sWriteKey(char const* key, u32& fields)
+        {
+            if (fields++ > 0)
+                fputc(',', stdout);
+            sWriteString(key);
+            fputc(':', stdout);
+        }
+
+        void writer_t::field(char const* key, char const* value)
+        {
+            sWriteKey(key, m_fields);
+            sWriteString(value);
+        }
+
+        void writer_t::field(char const* key, u64 value)
+        {
+            sWriteKey(key, m_fields);
+            fprintf(stdout, "%llu", (unsigned long long)value);
+        }
+
+        void writer_t::field(char const* key, f64 value)
+        {
+            sWriteKey(key, m_fields);
+            fprintf(stdout, "%.6g", value);
+        }
+
+        void writer_t::end()
+        {
+            fputs("}\n", stdout);
+            fflush(stdout);
+        }
+
+        u64 nowNs() { return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+
+        u64 random_t::logUniform(u64 minSize, u64 maxSize)
+        {
+            // Pick a power of 2 first, then a size within it
+            u32 const minShift = 63 - __builtin_clzll(minSize);
+            u32 const maxShift = 63 - __builtin_clzll(maxSize);
+            u32 const shift    = minShift + range(maxShift - minShift + 1);
+            u64 const size     = ((u64)1 << shift) + (((u64)next() << shift) >> 32);
+            return size < minSize ? minSize : (size > maxSize ? maxSize : size);
+        }
+
+        void computePercentiles(u32* samples, u32 count, percentiles_t& out)
+        {
+            out = percentiles_t();
+            if (count == 0)
+                return;
+
+            std::sort(samples, samples + count);
+            u64 total = 0;
+            for (u32 i = 0; i < count; ++i)
+                total += samples[i];
+
+            out.count  = count;
+            out.meanNs = (f64)total / (f64)count;
+            out.p50Ns  = samples[(u64)count * 500 / 1000];
+            out.p90Ns  = samples[(u64)count * 900 / 1000];
+            out.p99Ns  = samples[(u64)count * 990 / 1000];
+            out.p999Ns = samples[(u64)count * 999 / 1000];
+            out.maxNs  = samples[count - 1];
+        }
+
+        void writePercentiles(writer_t& out, percentiles_t const& percentiles)
+        {
+            out.field("count", percentiles.count);
+            out.field("mean_ns", percentiles.meanNs);
+            out.field("p50_ns", percentiles.p50Ns);
+            out.field("p90_ns", percentiles.p90Ns);
+            out.field("p99_ns", percentiles.p99Ns);
+            out.field("p999_ns", percentiles.p999Ns);
+            out.field("max_ns", percentiles.maxNs);
+        }
+
+        bool selected(options_t const& options, char const* bench) { return options.filter == nullptr || strstr(bench, options.filter) != nullptr; }
+
+        // ----------------------------------------------------------------------------------------------------
+        // Engines of the allocators that a trace cannot be recorded from. They serve what they can and report
+        // the rest as failed, reallocation and growing are not supported.
+
+        class page_engine_t : public nalloc::trace_engine_t
+        {
+        public:
+            static constexpr u64 PAGE_SIZE = 4096;
+
+            page_engine_t(alloc_t* allocator)
+                : m_allocator(allocator)
+                , m_initialized(false)
+            {
+            }
+            virtual ~page_engine_t()
+            {
+                if (m_initialized)
+                    m_engine.destroy();
+            }
+
+        protected:
+            virtual void v_begin(u64 size, u64 /*granularity*/, u32 /*placement*/)
+            {
+                if (m_initialized)
+                    m_engine.destroy();
+                m_engine.init(m_allocator, (u32)size, 0xffffffff, (u32)PAGE_SIZE);
+                m_initialized = true;
+            }
+            virtual nalloc::handle_t v_allocate(u64 size, u64 alignment, u32 resource, u64& outOffset)
+            {
+                nalloc::handle_t const handle = m_engine.allocateHandle((u32)size, (u32)alignment, resource);
+                if (handle != nalloc::INVALID_HANDLE)
+                    outOffset = m_engine.getOffset(handle);
+                return handle;
+            }
+            virtual bool v_free(nalloc::handle_t handle) { return m_engine.freeHandle(handle); }
+            virtual bool v_reallocate(nalloc::handle_t /*handle*/, u64 /*newSize*/) { return false; }
+            virtual bool v_grow(u64 /*newSize*/) { return false; }
+            virtual u64  v_shrinkToFit() { return m_engine.size(); }
+            virtual u32  v_allocateMany(u64 const* sizes, u32 count, u32 resource, nalloc::handle_t* outHandles, u64* outOffsets)
+            {
+                u32 numAllocated = 0;
+                for (u32 i = 0; i < count; ++i)
+                {
+                    outHandles[i] = v_allocate(sizes[i], 1, resource, outOffsets[i]);
+                    if (outHandles[i] != nalloc::INVALID_HANDLE)
+                        numAllocated++;
+                }
+                return numAllocated;
+            }
+            virtual u32 v_freeMany(nalloc::handle_t const* handles, u32 count)
+            {
+                u32 numFreed = 0;
+                for (u32 i = 0; i < count; ++i)
+                    numFreed += m_engine.freeHandle(handles[i]) ? 1 : 0;
+                return numFreed;
+            }
+            virtual void v_storageReport(nalloc::storage_report_t& report) const { m_engine.storageReport(report); }
+
+        private:
+            alloc_t*                 m_allocator;
+            bool                     m_initialized;
+            nalloc::page_allocator_t m_engine;
+        };
+
+        // Power of 2 size classes from 64 B to 64 KB in 1 MB slabs, on a block allocator that spans the heap
+        class slab_engine_t : public nalloc::trace_engine_t
+        {
+        public:
+            static constexpr u32 NUM_CLASSES = 11;
+            static constexpr u64 MAX_SIZE    = 65536;
+
+            slab_engine_t(alloc_t* allocator)
+                : m_allocator(allocator)
+                , m_initialized(false)
+            {
+            }
+            virtual ~slab_engine_t() { release(); }
+
+        protected:
+            void release()
+            {
+                if (m_initialized)
+                {
+                    m_engine.destroy();
+                    m_parent.destroy();
+                    m_initialized = false;
+                }
+            }
+
+            virtual void v_begin(u64 size, u64 granularity, u32 /*placement*/)
+            {
+                release();
+                u32 classSizes[NUM_CLASSES];
+                for (u32 i = 0; i < NUM_CLASSES; ++i)
+                    classSizes[i] = 64u << i;
+                m_parent.init(m_allocator, (u32)size, 0xffffffff, (u32)granularity, nalloc::PLACEMENT_FAST);
+                m_engine.init(m_allocator, &m_parent, classSizes, NUM_CLASSES);
+                m_initialized = true;
+            }
+            virtual nalloc::handle_t v_allocate(u64 size, u64 alignment, u32 /*resource*/, u64& outOffset)
+            {
+                // Slots of a power of 2 class are aligned to the class size
+                if (size > MAX_SIZE || alignment > MAX_SIZE)
+                    return nalloc::INVALID_HANDLE;
+                nalloc::handle_t const handle = m_engine.allocate((u32)(size < alignment ? alignment : size));
+                if (handle != nalloc::INVALID_HANDLE)
+                    outOffset = m_engine.getOffset(handle);
+                return handle;
+            }
+            virtual bool v_free(nalloc::handle_t handle) { return m_engine.free(handle); }
+            virtual bool v_reallocate(nalloc::handle_t /*handle*/, u64 /*newSize*/) { return false; }
+            virtual bool v_grow(u64 /*newSize*/) { return false; }
+            virtual u64  v_shrinkToFit() { return m_parent.size(); }
+            virtual u32  v_allocateMany(u64 const* sizes, u32 count, u32 resource, nalloc::handle_t* outHandles, u64* outOffsets)
+            {
+                u32 numAllocated = 0;
+                for (u32 i = 0; i < count; ++i)
+                {
+                    outHandles[i] = v_allocate(sizes[i], 1, resource, outOffsets[i]);
+                    if (outHandles[i] != nalloc::INVALID_HANDLE)
+                        numAllocated++;
+                }
+                return numAllocated;
+            }
+            virtual u32 v_freeMany(nalloc::handle_t const* handles, u32 count)
+            {
+                u32 numFreed = 0;
+                for (u32 i = 0; i < count; ++i)
+                    numFreed += m_engine.free(handles[i]) ? 1 : 0;
+                return numFreed;
+            }
+            virtual void v_storageReport(nalloc::storage_report_t& report) const { m_parent.storageReport(report); }  // Free slots of a slab count as used
+
+        private:
+            alloc_t*                  m_allocator;
+            bool                      m_initialized;
+            nalloc::block_allocator_t m_parent;
+            nalloc::slab_allocator_t  m_engine;
+        };
+
+        static char const* sEngineNames[NUM_ENGINES] = {"block_fast", "block_best_fit", "block_lowest_address", "page", "slab"};
+
+        nalloc::trace_engine_t* createEngine(alloc_t* allocator, u32 index, char const*& outName)
+        {
+            if (index >= NUM_ENGINES)
+                return nullptr;
+            outName = sEngineNames[index];
+            switch (index)
+            {
+                case 0: return allocator->construct<nalloc::block_trace_engine_t>(allocator, nalloc::PLACEMENT_FAST);
+                case 1: return allocator->construct<nalloc::block_trace_engine_t>(allocator, nalloc::PLACEMENT_BEST_FIT);
+                case 2: return allocator->construct<nalloc::block_trace_engine_t>(allocator, nalloc::PLACEMENT_LOWEST_ADDRESS);
+                case 3: return allocator->construct<page_engine_t>(allocator);
+                default: return allocator->construct<slab_engine_t>(allocator);
+            }
+        }
+
+        void destroyEngine(alloc_t* allocator, u32 index, nalloc::trace_engine_t* engine)
+        {
+            // The destructor of the interface is protected, engines are destroyed as their own type
+            if (engine == nullptr)
+                return;
+            if (index < 3)
+                allocator->destruct(static_cast<nalloc::block_trace_engine_t*>(engine));
+            else if (index == 3)
+                allocator->destruct(static_cast<page_engine_t*>(engine));
+            else
+                allocator->destruct(static_cast<slab_engine_t*>(engine));
+        }
+
+        u64 minEngineSize(u32 index) { return index == 3 ? page_engine_t::PAGE_SIZE : 1; }
+        u64 maxEngineSize(u32 index) { return index == 4 ? slab_engine_t::MAX_SIZE : ~(u64)0; }
+    }  // namespace nbench
+}  // namespace ncore
@@ -0,0 +1,83 @@
+#include "cbase/c_base.h"
+#include "cbase/c_allocator.h"
+#include "cbase/c_context.h"
+
+#include "cvkmem_bench/bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// cvkmem_bench [--quick] [--filter <name>] [--threads <n>] [--seed <n>] [--record <file>] [--trace <file>]...
+//
+// Writes one JSON object per line to stdout, the first line describes the run. Benchmarks are 'latency',
+// 'churn', 'fill', 'scaling' and 'trace', --filter runs those whose name contains the given text.
+// Without --trace the trace benchmark records and replays a synthetic trace, --record saves it to a file.
+
+static void sUsage()
+{
+    fprintf(stderr, "usage: cvkmem_bench [--quick] [--filter <name>] [--threads <n>] [--seed <n>] [--record <file>] [--trace <file>]...\n");
+}
+
+int main(int argc, char** argv)
+{
+    using namespace ncore;
+
+    nbench::options_t options;
+    char const**      traces    = (char const**)malloc(sizeof(char const*) * (argc > 1 ? argc : 1));
+    u32               numTraces = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        bool const hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--quick") == 0)
+            options.quick = true;
+        else if (strcmp(argv[i], "--filter") == 0 && hasValue)
+            options.filter = argv[++i];
+        else if (strcmp(argv[i], "--threads") == 0 && hasValue)
+            options.maxThreads = (u32)strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--seed") == 0 && hasValue)
+            options.seed = (u64)strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--record") == 0 && hasValue)
+            options.record = argv[++i];
+        else if (strcmp(argv[i], "--trace") == 0 && hasValue)
+            traces[numTraces++] = argv[++i];
+        else
+        {
+            sUsage();
+            free(traces);
+            return 1;
+        }
+    }
+    options.traces    = traces;
+    options.numTraces = numTraces;
+
+    cbase::init();
+    alloc_t* allocator = context_t::system_alloc();
+
+    nbench::writer_t out;
+    out.begin("meta");
+    out.field("format", (u64)1);
+    out.field("quick", options.quick ? "yes" : "no");
+    out.field("seed", options.seed);
+#if defined(TARGET_DEBUG)
+    out.field("build", "debug");
+#else
+    out.field("build", "release");
+#endif
+    out.end();
+
+    if (nbench::selected(options, "latency"))
+        nbench::benchLatency(allocator, options, out);
+    if (nbench::selected(options, "churn"))
+        nbench::benchChurn(allocator, options, out);
+    if (nbench::selected(options, "fill"))
+        nbench::benchFill(allocator, options, out);
+    if (nbench::selected(options, "scaling"))
+        nbench::benchScaling(allocator, options, out);
+    if (nbench::selected(options, "trace"))
+        nbench::benchTrace(allocator, options, out);
+
+    cbase::exit();
+    free(traces);
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include "ccore/c_target.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/private/c_vkshardedallocator.h"
+#include "cvkmem_bench/bench.h"
+
+#include <atomic>
+#include <thread>
+
+namespace ncore
+{
+    namespace nbench
+    {
+        // Scaling: every thread keeps a ring of live allocations of 64 B to 64 KB in a sharded allocator with
+        // one shard per thread and replaces random members of it. Run with and without the per-thread caches,
+        // all threads start together and the slowest thread determines the duration.
+
+        typedef nalloc::sharded_allocator_t sharded_t;
+
+        struct scaling_thread_t
+        {
+            sharded_t*               sharded;
+            sharded_t::allocation_t* live;
+            bool*                    valid;
+            std::atomic<u32>*        ready;
+            u32                      numThreads;
+            u32                      numLive;
+            u32                      rounds;
+            bool                     useCache;
+            u64                      seed;
+            u64                      failures;
+            u64                      ns;
+        };
+
+        static void sScalingThread(scaling_thread_t* thread)
+        {
+            sharded_t*          sharded = thread->sharded;
+            sharded_t::cache_t* cache   = thread->useCache ? sharded->createCache() : nullptr;
+            random_t            random(thread->seed);
+
+            thread->ready->fetch_add(1);
+            while (thread->ready->load() < thread->numThreads)
+                std::this_thread::yield();
+
+            u64 const start = nowNs();
+            for (u32 i = 0; i < thread->numLive; ++i)
+                thread->valid[i] = sharded->allocate(cache, (u32)random.logUniform(64, 65536), 1, nalloc::RESOURCE_ANY, thread->live[i]);
+            for (u32 i = 0; i < thread->rounds; ++i)
+            {
+                u32 const slot = random.range(thread->numLive);
+                if (thread->valid[slot])
+                    sharded->free(cache, thread->live[slot]);
+                thread->valid[slot] = sharded->allocate(cache, (u32)random.logUniform(64, 65536), 1, nalloc::RESOURCE_ANY, thread->live[slot]);
+                if (!thread->valid[slot])
+                    thread->failures++;
+            }
+            for (u32 i = 0; i < thread->numLive; ++i)
+            {
+                if (thread->valid[i])
+                    sharded->free(cache, thread->live[i]);
+            }
+            thread->ns = nowNs() - start;
+
+            if (cache != nullptr)
+                sharded->destroyCache(cache);
+        }
+
+        // Powers of 2, then maxThreads itself when it is not one
+        static u32 sNextThreadCount(u32 numThreads, u32 maxThreads)
+        {
+            if (numThreads < maxThreads && numThreads * 2 > maxThreads)
+                return maxThreads;
+            return numThreads * 2;
+        }
+
+        void benchScaling(alloc_t* allocator, options_t const& options, writer_t& out)
+        {
+            u32 const numLive    = 1024;
+            u32 const rounds     = options.quick ? 50000 : 500000;
+            u32       maxThreads = options.maxThreads;
+            if (maxThreads == 0)
+                maxThreads = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+
+            scaling_thread_t* threads = g_allocate_array<scaling_thread_t>(allocator, maxThreads);
+            std::thread*      workers = g_allocate_array<std::thread>(allocator, maxThreads);
+
+            for (u32 cached = 0; cached < 2; ++cached)
+            {
+                for (u32 numThreads = 1; numThreads <= maxThreads; numThreads = sNextThreadCount(numThreads, maxThreads))
+                {
+                    // 64 MB per thread, far more than the live allocations of a thread take, within the 4 GB a
+                    // sharded allocator manages
+                    u64 const heapSize = (u64)numThreads * (64u << 20);
+                    sharded_t sharded;
+                    sharded.init(allocator, heapSize < 0xffffffffull ? (u32)heapSize : 0xfff00000u, numThreads);
+
+                    std::atomic<u32> ready(0);
+                    for (u32 t = 0; t < numThreads; ++t)
+                    {
+                        scaling_thread_t& thread = threads[t];
+                        thread.sharded           = &sharded;
+                        thread.live              = g_allocate_array<sharded_t::allocation_t>(allocator, numLive);
+                        thread.valid             = g_allocate_array<bool>(allocator, numLive);
+                        thread.ready             = &ready;
+                        thread.numThreads        = numThreads;
+                        thread.numLive           = numLive;
+                        thread.rounds            = rounds;
+                        thread.useCache          = cached != 0;
+                        thread.seed              = options.seed + t;
+                        thread.failures          = 0;
+                        thread.ns                = 0;
+                    }
+                    for (u32 t = 0; t < numThreads; ++t)
+                        new (&workers[t]) std::thread(sScalingThread, &threads[t]);
+
+                    u64 maxNs    = 0;
+                    u64 failures = 0;
+                    for (u32 t = 0; t < numThreads; ++t)
+                    {
+                        workers[t].join();
+                        workers[t].~thread();
+                        maxNs = threads[t].ns > maxNs ? threads[t].ns : maxNs;
+                        failures += threads[t].failures;
+                        g_deallocate_array(allocator, threads[t].valid);
+                        g_deallocate_array(allocator, threads[t].live);
+                    }
+                    sharded.destroy();
+
+                    // Every round is a free and an allocate, the fill and drain count as one operation each
+                    u64 const ops = (u64)numThreads * ((u64)rounds * 2 + (u64)numLive * 2);
+                    out.begin("scaling");
+                    out.field("engine", "sharded");
+                    out.field("cache", cached != 0 ? "on" : "off");
+                    out.field("threads", (u64)numThreads);
+                    out.field("ops", ops);
+                    out.field("failures", failures);
+                    out.field("ops_per_sec", (f64)ops * 1e9 / (f64)(maxNs > 0 ? maxNs : 1));
+                    out.field("ns_per_op_per_thread", (f64)maxNs * numThreads / (f64)ops);
+                    out.end();
+                }
+            }
+
+            g_deallocate_array(allocator, workers);
+            g_deallocate_array(allocator, threads);
+        }
+    }  // namespace nbench
+}  // namespace ncore
@@ -0,0 +1,204 @@
+#include "ccore/c_target.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem_bench/bench.h"
+
+#include <stdio.h>
+
+namespace ncore
+{
+    namespace nbench
+    {
+        // Records a frame-like workload on a 256 MB heap: long lived resources, per-frame transients that are
+        // allocated and freed in batches, and buffers that are resized now and then.
+        static void sRecordSynthetic(alloc_t* allocator, options_t const& options, nalloc::trace_memory_sink_t& sink)
+        {
+            u32 const frames       = options.quick ? 200 : 2000;
+            u32 const maxPersist   = 512;
+            u32 const maxTransient = 256;
+
+            nalloc::block_allocator_t block;
+            block.init(allocator, 256u << 20, 0xffffffff, 1024, nalloc::PLACEMENT_BEST_FIT);
+
+            nalloc::trace_recorder_t recorder;
+            recorder.init(allocator, &sink);
+            block.setTrace(&recorder);
+
+            nalloc::handle_t* persist        = g_allocate_array<nalloc::handle_t>(allocator, maxPersist);
+            nalloc::handle_t* transient      = g_allocate_array<nalloc::handle_t>(allocator, maxTransient);
+            u32*              transientSizes = g_allocate_array<u32>(allocator, maxTransient);
+            for (u32 i = 0; i < maxPersist; ++i)
+                persist[i] = nalloc::INVALID_HANDLE;
+
+            random_t random(options.seed);
+            for (u32 frame = 0; frame < frames; ++frame)
+            {
+                // Streaming: replace a few long lived resources, buffers and images alternate
+                for (u32 i = 0; i < 16; ++i)
+                {
+                    u32 const slot = random.range(maxPersist);
+                    if (persist[slot] != nalloc::INVALID_HANDLE)
+                        block.freeHandle(persist[slot]);
+                    u32 const resource = (slot & 1) ? nalloc::RESOURCE_OPTIMAL : nalloc::RESOURCE_LINEAR;
+                    persist[slot]      = block.allocateHandle((u32)random.logUniform(256, 4 << 20), 256, resource);
+                }
+
+                // Resize a buffer in place when possible
+                u32 const slot = random.range(maxPersist);
+                if (persist[slot] != nalloc::INVALID_HANDLE)
+                    block.reallocate(persist[slot], (u32)random.logUniform(256, 4 << 20));
+
+                // Per-frame transients
+                u32 const numTransient = 32 + random.range(maxTransient - 32);
+                for (u32 i = 0; i < numTransient; ++i)
+                    transientSizes[i] = (u32)random.logUniform(64, 64 << 10);
+                u32 const numAllocated = block.allocateMany(transientSizes, numTransient, transient, 64, nalloc::RESOURCE_LINEAR);
+                block.freeMany(transient, numAllocated);
+            }
+
+            for (u32 i = 0; i < maxPersist; ++i)
+            {
+                if (persist[i] != nalloc::INVALID_HANDLE)
+                    block.freeHandle(persist[i]);
+            }
+
+            g_deallocate_array(allocator, transientSizes);
+            g_deallocate_array(allocator, transient);
+            g_deallocate_array(allocator, persist);
+
+            block.setTrace(nullptr);
+            recorder.destroy();
+            block.destroy();
+        }
+
+        static u8* sReadFile(alloc_t* allocator, char const* path, u32& outSize)
+        {
+            FILE* file = fopen(path, "rb");
+            if (file == nullptr)
+                return nullptr;
+
+            u8*  data = nullptr;
+            long size = 0;
+            if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) > 0 && size < 0x7fffffff && fseek(file, 0, SEEK_SET) == 0)
+            {
+                data = g_allocate_array<u8>(allocator, (u32)size);
+                if (fread(data, 1, (size_t)size, file) != (size_t)size)
+                {
+                    g_deallocate_array(allocator, data);
+                    data = nullptr;
+                }
+            }
+            fclose(file);
+            outSize = (u32)size;
+            return data;
+        }
+
+        static bool sWriteFile(char const* path, u8 const* data, u32 size)
+        {
+            FILE* file = fopen(path, "wb");
+            if (file == nullptr)
+                return false;
+            bool const written = fwrite(data, 1, size, file) == size;
+            return fclose(file) == 0 && written;
+        }
+
+        static void sWriteOpStats(writer_t& out, char const* prefix, nalloc::trace_op_stats_t const& stats)
+        {
+            char key[64];
+            snprintf(key, sizeof(key), "%s_count", prefix);
+            out.field(key, stats.count);
+            snprintf(key, sizeof(key), "%s_failures", prefix);
+            out.field(key, stats.failures);
+            snprintf(key, sizeof(key), "%s_mean_ns", prefix);
+            out.field(key, stats.count > 0 ? (f64)stats.totalNs / (f64)stats.count : 0.0);
+            snprintf(key, sizeof(key), "%s_max_ns", prefix);
+            out.field(key, stats.maxNs);
+        }
+
+        // Replays one trace into the recorded placement and every engine, the replay with the recorded
+        // placement reproduces the recording and shows the cost of the allocator on its own workload.
+        static void sReplay(alloc_t* allocator, options_t const& options, writer_t& out, char const* traceName, u8 const* trace, u32 traceSize)
+        {
+            nalloc::trace_replayer_t replayer;
+            replayer.init(allocator);
+
+            u32 const sampleInterval = options.quick ? 4096 : 1024;
+            for (u32 e = 0; e <= NUM_ENGINES; ++e)
+            {
+                char const*             name;
+                nalloc::trace_engine_t* engine;
+                if (e == NUM_ENGINES)
+                {
+                    name   = "block_recorded";
+                    engine = allocator->construct<nalloc::block_trace_engine_t>(allocator);
+                }
+                else
+                {
+                    engine = createEngine(allocator, e, name);
+                }
+
+                bool const complete = replayer.replay(trace, traceSize, engine, sampleInterval);
+
+                nalloc::trace_report_t report;
+                replayer.getReport(report);
+                nalloc::trace_sample_t const* samples;
+                u32 const                     numSamples       = replayer.getSamples(samples);
+                f64                           maxFragmentation = 0.0;
+                f64                           fragmentation    = 0.0;
+                for (u32 i = 0; i < numSamples; ++i)
+                {
+                    fragmentation    = samples[i].freeBytes == 0 ? 0.0 : 1.0 - (f64)samples[i].largestFreeRegion / (f64)samples[i].freeBytes;
+                    maxFragmentation = fragmentation > maxFragmentation ? fragmentation : maxFragmentation;
+                }
+
+                out.begin("trace");
+                out.field("trace", traceName);
+                out.field("engine", name);
+                out.field("complete", complete ? "yes" : "no");
+                out.field("events", report.events);
+                sWriteOpStats(out, "allocate", report.allocate);
+                sWriteOpStats(out, "free", report.free);
+                sWriteOpStats(out, "reallocate", report.reallocate);
+                out.field("unknown_handles", report.unknownHandles);
+                out.field("divergences", report.divergences);
+                out.field("peak_used_bytes", report.peakUsedBytes);
+                out.field("fragmentation", fragmentation);
+                out.field("max_fragmentation", maxFragmentation);
+                out.end();
+
+                if (e == NUM_ENGINES)
+                    allocator->destruct(static_cast<nalloc::block_trace_engine_t*>(engine));
+                else
+                    destroyEngine(allocator, e, engine);
+            }
+
+            replayer.destroy();
+        }
+
+        void benchTrace(alloc_t* allocator, options_t const& options, writer_t& out)
+        {
+            if (options.numTraces == 0)
+            {
+                nalloc::trace_memory_sink_t sink(allocator);
+                sRecordSynthetic(allocator, options, sink);
+                if (options.record != nullptr && !sWriteFile(options.record, sink.data(), sink.size()))
+                    fprintf(stderr, "cvkmem_bench: cannot write '%s'\n", options.record);
+                sReplay(allocator, options, out, "synthetic", sink.data(), sink.size());
+                return;
+            }
+
+            for (u32 i = 0; i < options.numTraces; ++i)
+            {
+                u32 traceSize = 0;
+                u8* trace     = sReadFile(allocator, options.traces[i], traceSize);
+                if (trace == nullptr)
+                {
+                    fprintf(stderr, "cvkmem_bench: cannot read '%s'\n", options.traces[i]);
+                    continue;
+                }
+                sReplay(allocator, options, out, options.traces[i], trace, traceSize);
+                g_deallocate_array(allocator, trace);
+            }
+        }
+    }  // namespace nbench
+}  // namespace ncore
@@ -0,0 +1,100 @@
+#ifndef __CVKMEM_BENCH_H_
+#define __CVKMEM_BENCH_H_
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "cvkmem/private/c_vkblockallocator.h"
+#include "cvkmem/private/c_vktrace.h"
+
+namespace ncore
+{
+    class alloc_t;
+
+    namespace nbench
+    {
+        struct options_t
+        {
+            bool               quick      = false;    // Fewer iterations, for smoke runs
+            char const*        filter     = nullptr;  // Only run the benchmarks whose name contains this
+            char const* const* traces     = nullptr;  // Trace files to replay (see c_vktrace.h)
+            u32                numTraces  = 0;
+            char const*        record     = nullptr;  // Write the synthetic trace to this file
+            u32                maxThreads = 0;        // 0: the hardware concurrency
+            u64                seed       = 1;
+        };
+
+        // Results go to stdout as JSON lines, one object per measurement, so that runs of two releases can be
+        // compared by a script. Every object has a "bench" key.
+        class writer_t
+        {
+        public:
+            writer_t();
+
+            void begin(char const* bench);
+            void field(char const* key, char const* value);
+            void field(char const* key, u64 value);
+            void field(char const* key, f64 value);
+            void end();
+
+        private:
+            u32 m_fields;
+        };
+
+        u64 nowNs();
+
+        // Small, fast, deterministic random numbers for workloads
+        struct random_t
+        {
+            u64 state;
+
+            explicit random_t(u64 seed)
+                : state(seed * 0x9e3779b97f4a7c15ull + 1)
+            {
+            }
+            u32 next()
+            {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                return (u32)(state >> 16);
+            }
+            u32 range(u32 n) { return (u32)(((u64)next() * n) >> 32); }
+            u64 logUniform(u64 minSize, u64 maxSize);  // Sizes spread evenly over the powers of 2 in [minSize, maxSize]
+        };
+
+        // Latency distribution of one operation
+        struct percentiles_t
+        {
+            u64 count;
+            f64 meanNs;
+            u64 p50Ns;
+            u64 p90Ns;
+            u64 p99Ns;
+            u64 p999Ns;
+            u64 maxNs;
+        };
+
+        void computePercentiles(u32* samples, u32 count, percentiles_t& out);  // Sorts 'samples'
+        void writePercentiles(writer_t& out, percentiles_t const& percentiles);
+
+        // Engines are driven through the trace engine interface, so that synthetic workloads and recorded
+        // traces exercise every allocator the same way. Returns nullptr for an unknown index.
+        static constexpr u32 NUM_ENGINES = 5;
+        nalloc::trace_engine_t* createEngine(alloc_t* allocator, u32 index, char const*& outName);
+        void                    destroyEngine(alloc_t* allocator, u32 index, nalloc::trace_engine_t* engine);
+        u64                     minEngineSize(u32 index);  // Smallest request that does not waste most of a page
+        u64                     maxEngineSize(u32 index);  // Largest request the engine serves
+
+        bool selected(options_t const& options, char const* bench);
+
+        void benchLatency(alloc_t* allocator, options_t const& options, writer_t& out);
+        void benchChurn(alloc_t* allocator, options_t const& options, writer_t& out);
+        void benchFill(alloc_t* allocator, options_t const& options, writer_t& out);
+        void benchScaling(alloc_t* allocator, options_t const& options, writer_t& out);
+        void benchTrace(alloc_t* allocator, options_t const& options, writer_t& out);
+    }  // namespace nbench
+}  // namespace ncore
+
+#endif  // __CVKMEM_BENCH_H_
@@ -0,0 +1,395 @@
+#include "ccore/c_target.h"
+#include "ccore/c_debug.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/c_vkaliasplanner.h"
+#include "cvkmem/private/c_vkblockallocator.h"
+
+namespace ncore
+{
+    namespace nvkmem
+    {
+        struct alias_planner_t::context_t
+        {
+            alloc_t* m_allocator;
+            u64      m_granularity;
+
+            // The input of the cached plan and its result
+            transient_resource_t* m_resources;
+            u64*                  m_offsets;
+            u32                   m_count;
+            u32                   m_capacity;
+            bool                  m_valid;
+            u64                   m_heapSize;
+            u64                   m_fullHeapSize;  // Heap size of the last full plan
+
+            // Scratch, placed resources ordered by offset and resources ordered for placement
+            u32* m_placed;
+            u32  m_numPlaced;
+            u32* m_order;
+
+            alias_barrier_t* m_barriers;
+            u32              m_numBarriers;
+            u32              m_maxBarriers;
+
+            u32 m_numLastPlaced;
+            u32 m_fullPlans;
+            u32 m_incrementalPlans;
+            u32 m_cachedPlans;
+        };
+
+        static inline u64 sAlignUp(u64 value, u64 alignment) { return (value + alignment - 1) & ~(alignment - 1); }
+
+        static inline bool sLifetimesOverlap(transient_resource_t const& a, transient_resource_t const& b) { return a.firstPass <= b.lastPass && b.firstPass <= a.lastPass; }
+
+        static inline bool sSameResource(transient_resource_t const& a, transient_resource_t const& b)
+        {
+            return a.size == b.size && a.alignment == b.alignment && a.firstPass == b.firstPass && a.lastPass == b.lastPass && a.resource == b.resource;
+        }
+
+        // Memory range of a placed resource as seen by a resource of type 'resource', widened to whole
+        // granularity pages when the two may not share a page
+        static void sPlacedRange(alias_planner_t::context_t const* ctx, u32 index, u32 resource, u64& outBegin, u64& outEnd)
+        {
+            outBegin                 = ctx->m_offsets[index];
+            outEnd                   = outBegin + ctx->m_resources[index].size;
+            u32 const placedResource = ctx->m_resources[index].resource;
+            if (ctx->m_granularity > 1 && placedResource != nalloc::RESOURCE_ANY && resource != nalloc::RESOURCE_ANY && placedResource != resource)
+            {
+                outBegin = outBegin & ~(ctx->m_granularity - 1);
+                outEnd   = sAlignUp(outEnd, ctx->m_granularity);
+            }
+        }
+
+        static void sInsertPlaced(alias_planner_t::context_t* ctx, u32 index)
+        {
+            u64 const offset = ctx->m_offsets[index];
+            u32       lo     = 0;
+            u32       hi     = ctx->m_numPlaced;
+            while (lo < hi)
+            {
+                u32 const mid = (lo + hi) / 2;
+                if (ctx->m_offsets[ctx->m_placed[mid]] <= offset)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            for (u32 i = ctx->m_numPlaced; i > lo; --i)
+                ctx->m_placed[i] = ctx->m_placed[i - 1];
+            ctx->m_placed[lo] = index;
+            ctx->m_numPlaced++;
+        }
+
+        // First fit, the placed resources are visited in offset order and every one that is alive at the same
+        // time pushes the candidate offset past its end
+        static void sPlace(alias_planner_t::context_t* ctx, u32 index)
+        {
+            transient_resource_t const& resource  = ctx->m_resources[index];
+            u64 const                   alignment = resource.alignment > 1 ? resource.alignment : 1;
+            u64                         offset    = 0;
+            u32                         skipped   = 0xffffffff;
+            for (u32 i = 0; i < ctx->m_numPlaced; ++i)
+            {
+                // A widened range starts at most a granularity page before its offset, once a resource starts a
+                // whole page beyond the candidate no later one can reach it
+                u32 const other = ctx->m_placed[i];
+                if (ctx->m_offsets[other] >= sAlignUp(offset + resource.size, ctx->m_granularity))
+                    break;
+                if (!sLifetimesOverlap(resource, ctx->m_resources[other]))
+                    continue;
+                u64 begin, end;
+                sPlacedRange(ctx, other, resource.resource, begin, end);
+                if (end <= offset)
+                    continue;
+                if (begin >= offset + resource.size)
+                {
+                    // Beyond the candidate for now, but a widened range further on may move the candidate into it
+                    if (skipped == 0xffffffff)
+                        skipped = i;
+                    continue;
+                }
+                offset = sAlignUp(end, alignment);
+                if (skipped != 0xffffffff)
+                {
+                    i       = skipped - 1;
+                    skipped = 0xffffffff;
+                }
+            }
+            ctx->m_offsets[index] = offset;
+            sInsertPlaced(ctx, index);
+            if (offset + resource.size > ctx->m_heapSize)
+                ctx->m_heapSize = offset + resource.size;
+        }
+
+        // Orders m_order[0, count) largest first, ties by index so that equal inputs give equal plans
+        static void sSortBySize(alias_planner_t::context_t* ctx, u32 count)
+        {
+            u32* order = ctx->m_order;
+            for (u32 i = 1; i < count; ++i)
+            {
+                u32 const index = order[i];
+                u64 const size  = ctx->m_resources[index].size;
+                u32       j     = i;
+                while (j > 0 && (ctx->m_resources[order[j - 1]].size < size || (ctx->m_resources[order[j - 1]].size == size && order[j - 1] > index)))
+                {
+                    order[j] = order[j - 1];
+                    --j;
+                }
+                order[j] = index;
+            }
+        }
+
+        static void sPushBarrier(alias_planner_t::context_t* ctx, u32 before, u32 after)
+        {
+            if (ctx->m_numBarriers == ctx->m_maxBarriers)
+            {
+                u32 const maxBarriers = ctx->m_maxBarriers == 0 ? 64 : ctx->m_maxBarriers * 2;
+                ctx->m_barriers       = g_reallocate_array(ctx->m_allocator, ctx->m_barriers, ctx->m_maxBarriers, maxBarriers);
+                ctx->m_maxBarriers    = maxBarriers;
+            }
+            alias_barrier_t& barrier = ctx->m_barriers[ctx->m_numBarriers++];
+            barrier.before           = before;
+            barrier.after            = after;
+            barrier.pass             = ctx->m_resources[after].firstPass;
+        }
+
+        // Resource 'after' needs a barrier against every earlier resource 'before' it overlaps in memory,
+        // unless a resource alive in between covers all of their common memory and already took it over
+        static void sBuildBarriers(alias_planner_t::context_t* ctx)
+        {
+            u32 const count = ctx->m_count;
+            u32*      order = ctx->m_order;
+            for (u32 i = 0; i < count; ++i)
+                order[i] = i;
+            for (u32 i = 1; i < count; ++i)
+            {
+                u32 const index = order[i];
+                u32       j     = i;
+                while (j > 0 && ctx->m_resources[order[j - 1]].firstPass > ctx->m_resources[index].firstPass)
+                {
+                    order[j] = order[j - 1];
+                    --j;
+                }
+                order[j] = index;
+            }
+
+            ctx->m_numBarriers = 0;
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32 const                   after  = order[i];
+                transient_resource_t const& b      = ctx->m_resources[after];
+                u64 const                   bBegin = ctx->m_offsets[after];
+                u64 const                   bEnd   = bBegin + b.size;
+                for (u32 p = 0; p < ctx->m_numPlaced; ++p)
+                {
+                    u32 const before = ctx->m_placed[p];
+                    u64 const aBegin = ctx->m_offsets[before];
+                    if (aBegin >= bEnd)
+                        break;
+                    transient_resource_t const& a    = ctx->m_resources[before];
+                    u64 const                   aEnd = aBegin + a.size;
+                    if (aEnd <= bBegin || a.lastPass >= b.firstPass)
+                        continue;
+
+                    u64 const commonBegin = aBegin > bBegin ? aBegin : bBegin;
+                    u64 const commonEnd   = aEnd < bEnd ? aEnd : bEnd;
+                    bool      covered     = false;
+                    for (u32 c = 0; c < ctx->m_numPlaced && !covered; ++c)
+                    {
+                        u32 const cIndex = ctx->m_placed[c];
+                        u64 const cBegin = ctx->m_offsets[cIndex];
+                        if (cBegin > commonBegin)
+                            break;
+                        transient_resource_t const& r = ctx->m_resources[cIndex];
+                        covered                       = cBegin + r.size >= commonEnd && r.firstPass > a.lastPass && r.lastPass < b.firstPass;
+                    }
+                    if (!covered)
+                        sPushBarrier(ctx, before, after);
+                }
+            }
+        }
+
+        static void sFullPlan(alias_planner_t::context_t* ctx)
+        {
+            ctx->m_heapSize  = 0;
+            ctx->m_numPlaced = 0;
+            for (u32 i = 0; i < ctx->m_count; ++i)
+                ctx->m_order[i] = i;
+            sSortBySize(ctx, ctx->m_count);
+            for (u32 i = 0; i < ctx->m_count; ++i)
+                sPlace(ctx, ctx->m_order[i]);
+            ctx->m_fullHeapSize  = ctx->m_heapSize;
+            ctx->m_numLastPlaced = ctx->m_count;
+            ctx->m_fullPlans++;
+        }
+
+        alias_planner_t::alias_planner_t()
+            : m_context(nullptr)
+        {
+        }
+
+        alias_planner_t::~alias_planner_t() {}
+
+        void alias_planner_t::init(alloc_t* allocator, u64 bufferImageGranularity)
+        {
+            ASSERT(!m_context);
+            ASSERT((bufferImageGranularity & (bufferImageGranularity - 1)) == 0);
+            m_context                     = allocator->construct<context_t>();
+            m_context->m_allocator        = allocator;
+            m_context->m_granularity      = bufferImageGranularity > 1 ? bufferImageGranularity : 1;
+            m_context->m_resources        = nullptr;
+            m_context->m_offsets          = nullptr;
+            m_context->m_count            = 0;
+            m_context->m_capacity         = 0;
+            m_context->m_valid            = false;
+            m_context->m_heapSize         = 0;
+            m_context->m_fullHeapSize     = 0;
+            m_context->m_placed           = nullptr;
+            m_context->m_numPlaced        = 0;
+            m_context->m_order            = nullptr;
+            m_context->m_barriers         = nullptr;
+            m_context->m_numBarriers      = 0;
+            m_context->m_maxBarriers      = 0;
+            m_context->m_numLastPlaced    = 0;
+            m_context->m_fullPlans        = 0;
+            m_context->m_incrementalPlans = 0;
+            m_context->m_cachedPlans      = 0;
+        }
+
+        void alias_planner_t::destroy()
+        {
+            ASSERT(m_context);
+            alloc_t* allocator = m_context->m_allocator;
+            if (m_context->m_capacity > 0)
+            {
+                g_deallocate_array(allocator, m_context->m_resources);
+                g_deallocate_array(allocator, m_context->m_offsets);
+                g_deallocate_array(allocator, m_context->m_placed);
+                g_deallocate_array(allocator, m_context->m_order);
+            }
+            if (m_context->m_barriers != nullptr)
+                g_deallocate_array(allocator, m_context->m_barriers);
+            allocator->destruct(m_context);
+            m_context = nullptr;
+        }
+
+        u64 alias_planner_t::plan(transient_resource_t const* resources, u32 count)
+        {
+            context_t* ctx = m_context;
+            if (count > ctx->m_capacity)
+            {
+                u32 capacity = ctx->m_capacity == 0 ? 64 : ctx->m_capacity;
+                while (capacity < count)
+                    capacity *= 2;
+                ctx->m_resources = g_reallocate_array(ctx->m_allocator, ctx->m_resources, ctx->m_count, capacity);
+                ctx->m_offsets   = g_reallocate_array(ctx->m_allocator, ctx->m_offsets, ctx->m_count, capacity);
+                ctx->m_placed    = g_reallocate_array(ctx->m_allocator, ctx->m_placed, ctx->m_numPlaced, capacity);
+                ctx->m_order     = g_reallocate_array(ctx->m_allocator, ctx->m_order, 0u, capacity);
+                ctx->m_capacity  = capacity;
+            }
+
+            // Changed and new resources go to the front of m_order
+            u32 const kept       = ctx->m_valid ? (count < ctx->m_count ? count : ctx->m_count) : 0;
+            u32       numChanged = 0;
+            for (u32 i = 0; i < count; ++i)
+            {
+                if (i >= kept || !sSameResource(ctx->m_resources[i], resources[i]))
+                {
+                    ctx->m_resources[i]        = resources[i];
+                    ctx->m_order[numChanged++] = i;
+                }
+            }
+
+            if (numChanged == 0 && count == ctx->m_count && ctx->m_valid)
+            {
+                ctx->m_numLastPlaced = 0;
+                ctx->m_cachedPlans++;
+                return ctx->m_heapSize;
+            }
+
+            ctx->m_count = count;
+            if (!ctx->m_valid || numChanged * 4 > count)
+            {
+                sFullPlan(ctx);
+            }
+            else
+            {
+                // Unchanged resources stay where they are, the placed list drops the changed and removed ones
+                u32 n = 0;
+                for (u32 i = 0; i < ctx->m_numPlaced; ++i)
+                {
+                    u32 const index = ctx->m_placed[i];
+                    if (index < count)
+                        ctx->m_placed[n++] = index;
+                }
+                ctx->m_numPlaced = n;
+                for (u32 i = 0; i < numChanged; ++i)
+                {
+                    u32 const index = ctx->m_order[i];
+                    for (u32 p = 0; p < ctx->m_numPlaced; ++p)
+                    {
+                        if (ctx->m_placed[p] == index)
+                        {
+                            for (u32 q = p + 1; q < ctx->m_numPlaced; ++q)
+                                ctx->m_placed[q - 1] = ctx->m_placed[q];
+                            ctx->m_numPlaced--;
+                            break;
+                        }
+                    }
+                }
+
+                ctx->m_heapSize = 0;
+                for (u32 i = 0; i < ctx->m_numPlaced; ++i)
+                {
+                    u32 const index = ctx->m_placed[i];
+                    u64 const end   = ctx->m_offsets[index] + ctx->m_resources[index].size;
+                    if (end > ctx->m_heapSize)
+                        ctx->m_heapSize = end;
+                }
+                sSortBySize(ctx, numChanged);
+                for (u32 i = 0; i < numChanged; ++i)
+                    sPlace(ctx, ctx->m_order[i]);
+                ctx->m_numLastPlaced = numChanged;
+                ctx->m_incrementalPlans++;
+
+                if (ctx->m_heapSize > ctx->m_fullHeapSize + ctx->m_fullHeapSize / 4)
+                    sFullPlan(ctx);
+            }
+
+            ctx->m_valid = true;
+            sBuildBarriers(ctx);
+            return ctx->m_heapSize;
+        }
+
+        void alias_planner_t::invalidate() { m_context->m_valid = false; }
+
+        u64 alias_planner_t::heapSize() const { return m_context->m_heapSize; }
+
+        u64 alias_planner_t::getOffset(u32 index) const
+        {
+            ASSERT(index < m_context->m_count);
+            return m_context->m_offsets[index];
+        }
+
+        u32 alias_planner_t::getBarriers(alias_barrier_t const*& outBarriers) const
+        {
+            outBarriers = m_context->m_barriers;
+            return m_context->m_numBarriers;
+        }
+
+        void alias_planner_t::getStats(alias_stats_t& outStats) const
+        {
+            context_t const* ctx   = m_context;
+            outStats.heapSize      = ctx->m_heapSize;
+            outStats.unaliasedSize = 0;
+            for (u32 i = 0; i < ctx->m_count; ++i)
+                outStats.unaliasedSize += ctx->m_resources[i].size;
+            outStats.numBarriers      = ctx->m_numBarriers;
+            outStats.numPlaced        = ctx->m_numLastPlaced;
+            outStats.fullPlans        = ctx->m_fullPlans;
+            outStats.incrementalPlans = ctx->m_incrementalPlans;
+            outStats.cachedPlans      = ctx->m_cachedPlans;
+        }
+
+    }  // namespace nvkmem
+}  // namespace ncore
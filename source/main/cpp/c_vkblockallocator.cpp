@@ -1,4 +1,11 @@
+#include "ccore/c_target.h"
+#include "ccore/c_debug.h"
+#include "cbase/c_allocator.h"
+
 #include "cvkmem/private/c_vkblockallocator.h"
+#include "cvkmem/private/c_vktrace.h"
+
+#include <string.h>
 
 // block_allocator_t based on Sebastian Aaltonen's Offset block_allocator_t:
 // https://github.com/sebbbi/OffsetAllocator/blob/main/offsetAllocator.cpp
@@ -7,172 +14,432 @@ namespace ncore
 {
     namespace nalloc
     {
-#define ASSERT(x)
+        static constexpr u32 NO_SPACE = 0xffffffff;
+
+        // Maximum number of nodes inspected per bin when an aligned allocation searches
+        // bins that are not guaranteed to fit the request.
+        static constexpr u32 MAX_ALIGNED_SEARCH_NODES = 8;
+
+        // Number of upcoming requests allocateMany sums up when it picks a free node to carve from
+        static constexpr u32 MAX_BATCH_LOOKAHEAD = 64;
+
+        // Node storage grows in chunks that never move, chunk 'c' holds (NODE_CHUNK_SIZE << c) nodes.
+        // Node indices (and allocation_t pointers) therefore stay valid while the pool grows.
+        static constexpr u32 NODE_CHUNK_SHIFT = 8;
+        static constexpr u32 NODE_CHUNK_SIZE  = 1 << NODE_CHUNK_SHIFT;
+        static constexpr u32 MAX_NODE_CHUNKS  = 32 - NODE_CHUNK_SHIFT;
+
+        inline u32 lzcnt_nonzero(u32 v)
+        {
+#ifdef _MSC_VER
+            unsigned long retVal;
+            _BitScanReverse(&retVal, v);
+            return 31 - retVal;
+#else
+            return __builtin_clz(v);
+#endif
+        }
 
-        static constexpr u32 TOP_BINS_INDEX_SHIFT = 3;
-        static constexpr u32 LEAF_BINS_INDEX_MASK = 0x7;
+        inline u32 lzcnt_nonzero(u64 v)
+        {
+#ifdef _MSC_VER
+            unsigned long retVal;
+            _BitScanReverse64(&retVal, v);
+            return 63 - retVal;
+#else
+            return __builtin_clzll(v);
+#endif
+        }
+
+        inline u32 tzcnt_nonzero(u32 v)
+        {
+#ifdef _MSC_VER
+            unsigned long retVal;
+            _BitScanForward(&retVal, v);
+            return retVal;
+#else
+            return __builtin_ctz(v);
+#endif
+        }
 
-        struct block_allocator_t::context_t
+        inline u32 tzcnt_nonzero(u64 v)
         {
-            // 16 bit offsets mode will halve the metadata storage cost
-            // But it only supports up to 65536 maximum allocation count
-#ifdef USE_16_BIT_NODE_INDICES
-            typedef u16 index_t;
+#ifdef _MSC_VER
+            unsigned long retVal;
+            _BitScanForward64(&retVal, v);
+            return retVal;
 #else
-            typedef u32 index_t;
+            return __builtin_ctzll(v);
 #endif
+        }
+
+        template <bool TCondition, typename TTrue, typename TFalse>
+        struct select_T
+        {
+            typedef TTrue type;
+        };
+        template <typename TTrue, typename TFalse>
+        struct select_T<false, TTrue, TFalse>
+        {
+            typedef TFalse type;
+        };
+
+        // The bin tables and masks are sized by the configuration, the top bin mask has a bit per
+        // top bin and each leaf bin mask has a bit per leaf bin.
+        // Nodes are stored as a structure of arrays split by access pattern, so that bin list walks
+        // and neighbor merges touch as few cache lines as possible.
+        template <typename TConfig>
+        struct block_allocator_T<TConfig>::context_t
+        {
+            typedef block_allocator_T<TConfig>     allocator_t;
+            typedef typename allocator_t::offset_t offset_t;
+            typedef typename allocator_t::index_t  index_t;
+
+            typedef typename select_T<(TConfig::NUM_TOP_BINS <= 32), u32, u64>::type          top_mask_t;
+            typedef typename select_T<(TConfig::BINS_PER_LEAF <= 16), u16, u32>::type         leaf_mask16_t;
+            typedef typename select_T<(TConfig::BINS_PER_LEAF <= 8), u8, leaf_mask16_t>::type leaf_mask_t;
+            typedef typename select_T<(TConfig::HANDLE_INDEX_BITS >= 24), u8, u16>::type      generation_t;
+
+            static constexpr u32 MANTISSA_BITS        = TConfig::MANTISSA_BITS;
+            static constexpr u32 NUM_TOP_BINS         = TConfig::NUM_TOP_BINS;
+            static constexpr u32 NUM_LEAF_BINS        = TConfig::NUM_LEAF_BINS;
+            static constexpr u32 TOP_BINS_INDEX_SHIFT = TConfig::MANTISSA_BITS;
+            static constexpr u32 LEAF_BINS_INDEX_MASK = TConfig::BINS_PER_LEAF - 1;
+            static constexpr u32 HANDLE_INDEX_BITS    = TConfig::HANDLE_INDEX_BITS;
+            static constexpr u32 HANDLE_INDEX_MASK    = (1u << HANDLE_INDEX_BITS) - 1;
+
+            static constexpr index_t unused    = (index_t)(~(index_t)0) >> 1;
+            static constexpr index_t usedBit   = unused + 1;
+            static constexpr index_t pending   = unused - 1;  // Bin link 'prev' of a node that freeMany is about to merge
+            static constexpr u32     MAX_NODES = (u32)pending < HANDLE_INDEX_MASK ? (u32)pending : HANDLE_INDEX_MASK;
+
+            // Bin list links, the freelist is linked through 'next'.
+            // Used nodes are not in a bin, they store their resource tag in 'prev'.
+            struct link_t
+            {
+                index_t prev;
+                index_t next;
+            };
+
+            // Address ordered neighbor links, the top bit of 'next' is the used flag
+            struct neighbor_t
+            {
+                index_t prev;
+                index_t next;
+
+                void setUsed(bool used) { next = used ? (index_t)(next | usedBit) : (index_t)(next & unused); }
+                bool isUsed() const { return (next & usedBit) != 0; }
 
-            void init(u32 size, u32 maxAllocs);
+                index_t getNext() const { return next & unused; }
+                index_t getPrev() const { return prev; }
+
+                void setNext(u32 index) { next = (index_t)((next & usedBit) | (index & unused)); }
+                void setPrev(u32 index) { prev = (index_t)index; }
+            };
+
+            // The range of a node, an allocation_t* points at the range of a used node
+            struct range_t
+            {
+                offset_t offset;
+                offset_t size;
+            };
+
+            // Treap links of a free node, the ordered placement policies keep the nodes of a bin in a search
+            // tree so that a node finds its place in the sorted bin list in O(log n). The bin list is still
+            // the in-order sequence of the tree. Not allocated for PLACEMENT_FAST.
+            struct tree_t
+            {
+                index_t left;
+                index_t right;
+                index_t parent;
+            };
+
+            context_t();
+
+            void init(alloc_t* allocator, offset_t size, u32 maxAllocs, offset_t bufferImageGranularity, u32 placement);
             void reset();
             void destroy();
+            bool growNodes();
 
-            inline u32 nodeToIdx(node_t* node) const { return (u32)(node - m_nodes); }
-
-            u32     m_size;
-            u32     m_maxAllocs;
-            u32     m_freeStorage;
-            u32     m_usedBinsTop;
-            u8      m_usedBins[NUM_TOP_BINS];
-            index_t m_binIndices[NUM_LEAF_BINS];
-            node_t* m_nodes;
-            u32     m_freeNodeIndex;
-            node_t* m_freeNodeHead;
-            u32     m_freeOffset;
-        };
+            inline bool hasFreeNodes(u32 count) { return m_freeNodeCount >= count || (growNodes() && m_freeNodeCount >= count); }
+
+            static inline u32 chunkOfIndex(u32 index) { return 31 - lzcnt_nonzero((index >> NODE_CHUNK_SHIFT) + 1); }
+            static inline u32 firstIndexOfChunk(u32 chunk) { return ((1u << chunk) - 1) << NODE_CHUNK_SHIFT; }
+            static inline u64 chunkBytes(u32 chunkSize, u32 placement)
+            {
+                u64 const treeSize = (placement != PLACEMENT_FAST) ? sizeof(tree_t) : 0;
+                return (u64)chunkSize * (sizeof(range_t) + sizeof(link_t) + sizeof(neighbor_t) + treeSize + sizeof(generation_t));
+            }
+            void setChunk(u32 chunk, u8* mem, u32 chunkSize);
+
+            // Every chunk is full except for the last one, which may have been clamped to m_maxAllocs
+            inline u32 chunkSize(u32 chunk) const { return (chunk + 1 < m_numChunks) ? (NODE_CHUNK_SIZE << chunk) : (m_numNodes - firstIndexOfChunk(chunk)); }
+
+            inline link_t& link(u32 index) const
+            {
+                u32 const chunk = chunkOfIndex(index);
+                return m_links[chunk][index - firstIndexOfChunk(chunk)];
+            }
+            inline neighbor_t& neighbor(u32 index) const
+            {
+                u32 const chunk = chunkOfIndex(index);
+                return m_neighbors[chunk][index - firstIndexOfChunk(chunk)];
+            }
+            inline range_t& range(u32 index) const
+            {
+                u32 const chunk = chunkOfIndex(index);
+                return m_ranges[chunk][index - firstIndexOfChunk(chunk)];
+            }
+            inline tree_t& tree(u32 index) const
+            {
+                u32 const chunk = chunkOfIndex(index);
+                return m_trees[chunk][index - firstIndexOfChunk(chunk)];
+            }
+            inline generation_t& generation(u32 index) const
+            {
+                u32 const chunk = chunkOfIndex(index);
+                return m_generations[chunk][index - firstIndexOfChunk(chunk)];
+            }
+
+            inline u32 resource(u32 index) const { return link(index).prev; }
+
+            // Find the node that owns a range, only used by the allocation_t compatibility layer
+            u32 rangeToIndex(range_t const* range) const
+            {
+                for (u32 c = 0; c < m_numChunks; ++c)
+                {
+                    if (range >= m_ranges[c] && range < (m_ranges[c] + chunkSize(c)))
+                        return firstIndexOfChunk(c) + (u32)(range - m_ranges[c]);
+                }
+                return unused;
+            }
+
+            inline handle_t toHandle(u32 index) const { return ((handle_t)generation(index) << HANDLE_INDEX_BITS) | index; }
+
+            // Returns the node index of a live allocation, or 'unused' for a stale or invalid handle
+            inline u32 fromHandle(handle_t handle) const
+            {
+                u32 const index = handle & HANDLE_INDEX_MASK;
+                if (index >= m_numNodes || !neighbor(index).isUsed())
+                    return unused;
+                if (generation(index) != (generation_t)(handle >> HANDLE_INDEX_BITS))
+                    return unused;
+                return index;
+            }
 
-        typedef block_allocator_t::context_t context_t;
-        typedef context_t::index_t           index_t;
+            alloc_t*          m_allocator;
+            offset_t          m_size;
+            u32               m_maxAllocs;
+            offset_t          m_granularity;
+            u32               m_placement;
+            handle_t          m_defragCursor;   // Used node where the defragmentation pass continues
+            bool              m_defragSeeking;  // Walking back to the start of the heap
+            bool              m_movesPlanned;   // Destinations reserved by defragPlan, until defragCommit or defragCancel
+            bool              m_restored;       // The state came from a snapshot, a trace cannot start from it
+            offset_t          m_freeStorage;
+            top_mask_t        m_usedBinsTop;
+            leaf_mask_t       m_usedBins[NUM_TOP_BINS];
+            index_t           m_binIndices[NUM_LEAF_BINS];
+            index_t           m_binRoots[NUM_LEAF_BINS];  // Treap root per bin, ordered placement policies only
+            range_t*          m_ranges[MAX_NODE_CHUNKS];  // Start of the chunk allocation
+            link_t*           m_links[MAX_NODE_CHUNKS];
+            neighbor_t*       m_neighbors[MAX_NODE_CHUNKS];
+            tree_t*           m_trees[MAX_NODE_CHUNKS];
+            generation_t*     m_generations[MAX_NODE_CHUNKS];
+            u32               m_numChunks;
+            u32               m_borrowedChunks;  // Bit per chunk that lives in a snapshot image (restoreInPlace)
+            u32               m_numNodes;
+            u32               m_freeNodeCount;
+            u32               m_freeNodeHead;
+            u32               m_tailNode;  // Node at the end of the heap (no next neighbor), 'unused' for an empty heap
+            trace_recorder_t* m_trace;     // nullptr unless recording
+        };
 
-        context_t::context_t()
-            : m_size(0)
+        template <typename TConfig>
+        block_allocator_T<TConfig>::context_t::context_t()
+            : m_allocator(nullptr)
+            , m_size(0)
             , m_maxAllocs(0)
+            , m_granularity(1)
+            , m_placement(PLACEMENT_FAST)
+            , m_defragCursor(INVALID_HANDLE)
+            , m_defragSeeking(false)
+            , m_movesPlanned(false)
+            , m_restored(false)
             , m_freeStorage(0)
             , m_usedBinsTop(0)
-            , m_nodes(nullptr)
-            , m_freeNodeIndex(0)
-            , m_freeNodeHead(nullptr)
-            , m_freeOffset(0)
+            , m_numChunks(0)
+            , m_borrowedChunks(0)
+            , m_numNodes(0)
+            , m_freeNodeCount(0)
+            , m_freeNodeHead(unused)
+            , m_tailNode(unused)
+            , m_trace(nullptr)
         {
+            for (u32 i = 0; i < MAX_NODE_CHUNKS; i++)
+            {
+                m_ranges[i]      = nullptr;
+                m_links[i]       = nullptr;
+                m_neighbors[i]   = nullptr;
+                m_trees[i]       = nullptr;
+                m_generations[i] = nullptr;
+            }
         }
 
-        void context_t::init(u32 size, u32 maxAllocs)
+        template <typename TConfig>
+        void block_allocator_T<TConfig>::context_t::init(alloc_t* allocator, offset_t size, u32 maxAllocs, offset_t bufferImageGranularity, u32 placement)
         {
-            m_size       = size;
-            m_maxAllocs  = maxAllocs;
-            m_freeOffset = maxAllocs - 1;
-            if (sizeof(index_t) == 2)
-            {
-                ASSERT(maxAllocs <= 65536);
-            }
+            m_allocator   = allocator;
+            m_size        = size;
+            m_maxAllocs   = maxAllocs < MAX_NODES ? maxAllocs : MAX_NODES;
+            m_granularity = bufferImageGranularity > 1 ? bufferImageGranularity : 1;
+            ASSERT((m_granularity & (m_granularity - 1)) == 0);
+            m_placement = placement;
             reset();
         }
 
-        void context_t::destroy()
+        template <typename TConfig>
+        void block_allocator_T<TConfig>::context_t::destroy()
         {
-            if (m_nodes)
+            for (u32 c = 0; c < m_numChunks; ++c)
             {
-                delete[] m_nodes;
-                m_nodes = nullptr;
+                if ((m_borrowedChunks & (1u << c)) == 0)
+                    m_allocator->deallocate(m_ranges[c]);
+                m_ranges[c]      = nullptr;
+                m_links[c]       = nullptr;
+                m_neighbors[c]   = nullptr;
+                m_trees[c]       = nullptr;
+                m_generations[c] = nullptr;
             }
+            m_numChunks      = 0;
+            m_borrowedChunks = 0;
+            m_numNodes       = 0;
+            m_freeNodeCount  = 0;
+            m_freeNodeHead   = unused;
         }
 
-        void context_t::reset()
+        template <typename TConfig>
+        void block_allocator_T<TConfig>::context_t::reset()
         {
-            m_freeStorage = 0;
-            m_usedBinsTop = 0;
-            m_freeOffset  = m_maxAllocs - 1;
+            m_freeStorage   = 0;
+            m_usedBinsTop   = 0;
+            m_defragCursor  = INVALID_HANDLE;
+            m_defragSeeking = false;
+            m_movesPlanned  = false;
+            m_tailNode      = unused;
 
             for (u32 i = 0; i < NUM_TOP_BINS; i++)
                 m_usedBins[i] = 0;
 
             for (u32 i = 0; i < NUM_LEAF_BINS; i++)
-                m_binIndices[i] = node_t::unused;
-
-            if (m_nodes == nullptr)
-                m_nodes = new node_t[m_maxAllocs];
+            {
+                m_binIndices[i] = unused;
+                m_binRoots[i]   = unused;
+            }
 
-            m_freeNodeIndex = 0;
-            m_freeNodeHead  = nullptr;
+            // Keep the chunks we already have, chain all their nodes into the freelist
+            m_freeNodeHead = unused;
+            for (u32 i = m_numNodes; i > 0; --i)
+            {
+                link(i - 1).next     = (index_t)m_freeNodeHead;
+                neighbor(i - 1).next = unused;
+                neighbor(i - 1).prev = unused;
+                m_freeNodeHead       = i - 1;
+            }
+            m_freeNodeCount = m_numNodes;
         }
 
-        static u32  sInsertNodeIntoBin(context_t* ctx, u32 size, u32 offset);
-        static void sRemoveNodeFromBin(context_t* ctx, u32 nodeIndex);
-
-        struct block_allocator_t::node_t
-        {
-            static constexpr index_t unused = 0xffffffff;
-
-            u32     dataOffset  = 0;
-            u32     dataSize    = 0;
-            index_t binListPrev = unused;
-            index_t binListNext = unused;
-
-            void setUsed(bool used) { neighborNext = used ? (neighborNext | 0x80000000) : (neighborNext & 0x7fffffff); }
-            bool isUsed() const { return neighborNext & 0x80000000; }
-
-            index_t getNeighborNext() const { return neighborNext & 0x7fffffff; }
-            index_t getNeighborPrev() const { return neighborPrev; }
-
-            void setNeighborNext(index_t index) { neighborNext = (neighborNext & 0x80000000) | (index & 0x7fffffff); }
-            void setNeighborPrev(index_t index) { neighborPrev = index; }
-
-            index_t neighborPrev = unused;
-            index_t neighborNext = unused;
-        };
-
-        typedef block_allocator_t::node_t node_t;
-
-        inline u32 lzcnt_nonzero(u32 v)
+        // A chunk is a single allocation holding the ranges, links, neighbors, trees and generations arrays
+        template <typename TConfig>
+        void block_allocator_T<TConfig>::context_t::setChunk(u32 chunk, u8* mem, u32 chunkSize)
         {
-#ifdef _MSC_VER
-            unsigned long retVal;
-            _BitScanReverse(&retVal, v);
-            return 31 - retVal;
-#else
-            return __builtin_clz(v);
-#endif
+            m_ranges[chunk]    = (range_t*)mem;
+            m_links[chunk]     = (link_t*)(mem + chunkSize * sizeof(range_t));
+            m_neighbors[chunk] = (neighbor_t*)((u8*)m_links[chunk] + chunkSize * sizeof(link_t));
+            m_trees[chunk]     = nullptr;
+            u8* generations    = (u8*)m_neighbors[chunk] + chunkSize * sizeof(neighbor_t);
+            if (m_placement != PLACEMENT_FAST)
+            {
+                m_trees[chunk] = (tree_t*)generations;
+                generations += chunkSize * sizeof(tree_t);
+            }
+            m_generations[chunk] = (generation_t*)generations;
         }
 
-        inline u32 tzcnt_nonzero(u32 v)
+        // Append the next chunk of nodes to the pool and push them onto the freelist
+        template <typename TConfig>
+        bool block_allocator_T<TConfig>::context_t::growNodes()
         {
-#ifdef _MSC_VER
-            unsigned long retVal;
-            _BitScanForward(&retVal, v);
-            return retVal;
-#else
-            return __builtin_ctz(v);
-#endif
+            if (m_numNodes >= m_maxAllocs || m_numChunks == MAX_NODE_CHUNKS)
+                return false;
+
+            u32 const chunk     = m_numChunks;
+            u32 const first     = firstIndexOfChunk(chunk);
+            u32       chunkSize = NODE_CHUNK_SIZE << chunk;
+            if (chunkSize > (m_maxAllocs - first))
+                chunkSize = m_maxAllocs - first;
+
+            u64 const bytes = chunkBytes(chunkSize, m_placement);
+            if (bytes > 0xffffffff)
+                return false;
+
+            u8* mem = (u8*)m_allocator->allocate((u32)bytes, sizeof(offset_t));
+            if (mem == nullptr)
+                return false;
+
+            setChunk(chunk, mem, chunkSize);
+            range_t*      ranges      = m_ranges[chunk];
+            link_t*       links       = m_links[chunk];
+            neighbor_t*   neighbors   = m_neighbors[chunk];
+            generation_t* generations = m_generations[chunk];
+
+            for (u32 i = chunkSize; i > 0; --i)
+            {
+                ranges[i - 1].offset  = 0;
+                ranges[i - 1].size    = 0;
+                neighbors[i - 1].prev = unused;
+                neighbors[i - 1].next = unused;
+                generations[i - 1]    = 0;
+                links[i - 1].prev     = unused;
+                links[i - 1].next     = (index_t)m_freeNodeHead;
+                m_freeNodeHead        = first + i - 1;
+            }
+
+            m_numChunks += 1;
+            m_numNodes += chunkSize;
+            m_freeNodeCount += chunkSize;
+            return true;
         }
 
         namespace SmallFloat
         {
-            static constexpr u32 MANTISSA_BITS  = 3;
-            static constexpr u32 MANTISSA_VALUE = 1 << MANTISSA_BITS;
-            static constexpr u32 MANTISSA_MASK  = MANTISSA_VALUE - 1;
-
             // Bin sizes follow floating point (exponent + mantissa) distribution (piecewise linear log approx)
             // This ensures that for each size class, the average overhead percentage stays the same
-            u32 uintToFloatRoundUp(u32 size)
+            template <u32 MANTISSA_BITS, typename T>
+            u32 uintToFloatRoundUp(T size)
             {
+                u32 const MANTISSA_VALUE = 1 << MANTISSA_BITS;
+                u32 const MANTISSA_MASK  = MANTISSA_VALUE - 1;
+
                 u32 exp      = 0;
                 u32 mantissa = 0;
 
                 if (size < MANTISSA_VALUE)
                 {
                     // Denorm: 0..(MANTISSA_VALUE-1)
-                    mantissa = size;
+                    mantissa = (u32)size;
                 }
                 else
                 {
                     // Normalized: Hidden high bit always 1. Not stored. Just like float.
                     u32 leadingZeros  = lzcnt_nonzero(size);
-                    u32 highestSetBit = 31 - leadingZeros;
+                    u32 highestSetBit = (sizeof(T) * 8 - 1) - leadingZeros;
 
                     u32 mantissaStartBit = highestSetBit - MANTISSA_BITS;
                     exp                  = mantissaStartBit + 1;
-                    mantissa             = (size >> mantissaStartBit) & MANTISSA_MASK;
+                    mantissa             = (u32)(size >> mantissaStartBit) & MANTISSA_MASK;
 
-                    u32 lowBitsMask = (1 << mantissaStartBit) - 1;
+                    T lowBitsMask = ((T)1 << mantissaStartBit) - 1;
 
                     // Round up!
                     if ((size & lowBitsMask) != 0)
@@ -182,32 +449,40 @@ namespace ncore
                 return (exp << MANTISSA_BITS) + mantissa;  // + allows mantissa->exp overflow for round up
             }
 
-            u32 uintToFloatRoundDown(u32 size)
+            template <u32 MANTISSA_BITS, typename T>
+            u32 uintToFloatRoundDown(T size)
             {
+                u32 const MANTISSA_VALUE = 1 << MANTISSA_BITS;
+                u32 const MANTISSA_MASK  = MANTISSA_VALUE - 1;
+
                 u32 exp      = 0;
                 u32 mantissa = 0;
 
                 if (size < MANTISSA_VALUE)
                 {
                     // Denorm: 0..(MANTISSA_VALUE-1)
-                    mantissa = size;
+                    mantissa = (u32)size;
                 }
                 else
                 {
                     // Normalized: Hidden high bit always 1. Not stored. Just like float.
                     u32 leadingZeros  = lzcnt_nonzero(size);
-                    u32 highestSetBit = 31 - leadingZeros;
+                    u32 highestSetBit = (sizeof(T) * 8 - 1) - leadingZeros;
 
                     u32 mantissaStartBit = highestSetBit - MANTISSA_BITS;
                     exp                  = mantissaStartBit + 1;
-                    mantissa             = (size >> mantissaStartBit) & MANTISSA_MASK;
+                    mantissa             = (u32)(size >> mantissaStartBit) & MANTISSA_MASK;
                 }
 
                 return (exp << MANTISSA_BITS) | mantissa;
             }
 
-            u32 floatToUint(u32 floatValue)
+            template <u32 MANTISSA_BITS, typename T>
+            T floatToUint(u32 floatValue)
             {
+                u32 const MANTISSA_VALUE = 1 << MANTISSA_BITS;
+                u32 const MANTISSA_MASK  = MANTISSA_VALUE - 1;
+
                 u32 exponent = floatValue >> MANTISSA_BITS;
                 u32 mantissa = floatValue & MANTISSA_MASK;
                 if (exponent == 0)
@@ -217,279 +492,366 @@ namespace ncore
                 }
                 else
                 {
-                    return (mantissa | MANTISSA_VALUE) << (exponent - 1);
+                    return (T)(mantissa | MANTISSA_VALUE) << (exponent - 1);
                 }
             }
         }  // namespace SmallFloat
 
         // Utility functions
-        u32 findLowestSetBitAfter(u32 bitMask, u32 startBitIndex)
+        template <typename T>
+        u32 findLowestSetBitAfter(T bitMask, u32 startBitIndex)
         {
-            u32 maskBeforeStartIndex = (1 << startBitIndex) - 1;
-            u32 maskAfterStartIndex  = ~maskBeforeStartIndex;
-            u32 bitsAfter            = bitMask & maskAfterStartIndex;
+            if (startBitIndex >= sizeof(T) * 8)
+                return NO_SPACE;
+            T maskBeforeStartIndex = ((T)1 << startBitIndex) - 1;
+            T maskAfterStartIndex  = ~maskBeforeStartIndex;
+            T bitsAfter            = bitMask & maskAfterStartIndex;
             if (bitsAfter == 0)
-                return allocation_t::NO_SPACE;
+                return NO_SPACE;
             return tzcnt_nonzero(bitsAfter);
         }
 
-        // block_allocator_t...
-        block_allocator_t::block_allocator_t()
-            : m_context(nullptr)
+        // Returns the first non-empty bin with an index >= binIndex, or NO_SPACE
+        template <typename TContext>
+        static u32 sFindNonEmptyBin(TContext const* ctx, u32 binIndex)
         {
-        }
+            typedef typename TContext::top_mask_t top_mask_t;
 
-        block_allocator_t::block_allocator_t(block_allocator_t&& other)
-            : m_context(other.m_context)
-        {
-            other.m_context = nullptr;
-        }
+            u32 const minTopBinIndex  = binIndex >> TContext::TOP_BINS_INDEX_SHIFT;
+            u32 const minLeafBinIndex = binIndex & TContext::LEAF_BINS_INDEX_MASK;
 
-        block_allocator_t::~block_allocator_t() {}
+            u32 topBinIndex  = minTopBinIndex;
+            u32 leafBinIndex = NO_SPACE;
 
-        void block_allocator_t::init(u32 size, u32 maxAllocs)
-        {
-            ASSERT(!m_context);
+            // If top bin exists, scan its leaf bin. This can fail (NO_SPACE).
+            if (topBinIndex < TContext::NUM_TOP_BINS && (ctx->m_usedBinsTop & ((top_mask_t)1 << topBinIndex)))
+            {
+                leafBinIndex = findLowestSetBitAfter((u32)ctx->m_usedBins[topBinIndex], minLeafBinIndex);
+            }
+
+            // If we didn't find space in top bin, we search top bin from +1
+            if (leafBinIndex == NO_SPACE)
+            {
+                topBinIndex = findLowestSetBitAfter(ctx->m_usedBinsTop, minTopBinIndex + 1);
 
-            m_context = new context_t();
-            m_context->init(size, maxAllocs);
-            m_context->reset();
+                // Out of space?
+                if (topBinIndex == NO_SPACE)
+                    return NO_SPACE;
 
-            // Start state: Whole storage as one big node
-            // Algorithm will split remainders and push them back as smaller nodes
-            sInsertNodeIntoBin(m_context, m_context->m_size, 0);
+                // All leaf bins here fit the alloc, since the top bin was rounded up. Start leaf search from bit 0.
+                // NOTE: This search can't fail since at least one leaf bit was set because the top bit was set.
+                leafBinIndex = tzcnt_nonzero((u32)ctx->m_usedBins[topBinIndex]);
+            }
+
+            return (topBinIndex << TContext::TOP_BINS_INDEX_SHIFT) | leafBinIndex;
         }
 
-        void block_allocator_t::destroy()
+        template <typename T>
+        static inline T sAlignUp(T offset, T alignment)
         {
-            ASSERT(m_context);
-            m_context->destroy();
-            delete m_context;
-            m_context = nullptr;
+            return (offset + alignment - 1) & ~(alignment - 1);
         }
 
-        allocation_t* block_allocator_t::allocate(u32 size)
+        // Two resources conflict when one is linear and the other optimal tiled
+        static inline bool sResourcesConflict(u32 a, u32 b) { return a != RESOURCE_ANY && b != RESOURCE_ANY && a != b; }
+
+        // Does a used node of a conflicting resource type end inside the page that starts at 'pageStart'?
+        // Walks back from the free node over the (used and free) nodes that share that page.
+        template <typename TContext>
+        static bool sConflictBefore(TContext const* ctx, u32 nodeIndex, typename TContext::offset_t pageStart, u32 resource)
         {
-            // Out of allocations?
-            if (m_context->m_freeOffset == 0)
+            u32 index = ctx->neighbor(nodeIndex).getPrev();
+            while (index != TContext::unused)
             {
-                return nullptr;
+                typename TContext::range_t const& range = ctx->range(index);
+                if (range.offset + range.size <= pageStart)
+                    break;
+                if (ctx->neighbor(index).isUsed() && sResourcesConflict(ctx->resource(index), resource))
+                    return true;
+                index = ctx->neighbor(index).getPrev();
             }
+            return false;
+        }
 
-            // Round up to bin index to ensure that alloc >= bin
-            // Gives us min bin index that fits the size
-            u32 minBinIndex = SmallFloat::uintToFloatRoundUp(size);
-
-            u32 minTopBinIndex  = minBinIndex >> TOP_BINS_INDEX_SHIFT;
-            u32 minLeafBinIndex = minBinIndex & LEAF_BINS_INDEX_MASK;
-
-            u32 topBinIndex  = minTopBinIndex;
-            u32 leafBinIndex = allocation_t::NO_SPACE;
-
-            // If top bin exists, scan its leaf bin. This can fail (NO_SPACE).
-            if (m_context->m_usedBinsTop & (1 << topBinIndex))
+        // Does a used node of a conflicting resource type start inside the page that starts at 'pageStart'?
+        template <typename TContext>
+        static bool sConflictAfter(TContext const* ctx, u32 nodeIndex, typename TContext::offset_t pageStart, u32 resource)
+        {
+            u32 index = ctx->neighbor(nodeIndex).getNext();
+            while (index != TContext::unused)
             {
-                leafBinIndex = findLowestSetBitAfter(m_context->m_usedBins[topBinIndex], minLeafBinIndex);
+                if ((ctx->range(index).offset - pageStart) >= ctx->m_granularity)
+                    break;
+                if (ctx->neighbor(index).isUsed() && sResourcesConflict(ctx->resource(index), resource))
+                    return true;
+                index = ctx->neighbor(index).getNext();
             }
+            return false;
+        }
 
-            // If we didn't find space in top bin, we search top bin from +1
-            if (leafBinIndex == allocation_t::NO_SPACE)
-            {
-                topBinIndex = findLowestSetBitAfter(m_context->m_usedBinsTop, minTopBinIndex + 1);
-
-                // Out of space?
-                if (topBinIndex == allocation_t::NO_SPACE)
-                {
-                    return nullptr;
-                }
+        // Can the free node hold 'size' bytes at 'alignment' without sharing a bufferImageGranularity page
+        // with a resource of a conflicting type? Returns the aligned offset in 'outOffset'.
+        template <typename TContext, typename TOffset>
+        static bool sFitNode(TContext const* ctx, u32 nodeIndex, TOffset size, TOffset alignment, u32 resource, TOffset& outOffset)
+        {
+            typename TContext::range_t const& range = ctx->range(nodeIndex);
 
-                // All leaf bins here fit the alloc, since the top bin was rounded up. Start leaf search from bit 0.
-                // NOTE: This search can't fail since at least one leaf bit was set because the top bit was set.
-                leafBinIndex = tzcnt_nonzero(m_context->m_usedBins[topBinIndex]);
-            }
-
-            u32 binIndex = (topBinIndex << TOP_BINS_INDEX_SHIFT) | leafBinIndex;
-
-            // Pop the top node of the bin. Bin top = node.next.
-            u32 const     nodeIndex     = m_context->m_binIndices[binIndex];
-            node_t* const node          = &m_context->m_nodes[nodeIndex];
-            u32 const     nodeTotalSize = node->dataSize;
-            node->dataSize              = size;
-            node->setUsed(true);
-            m_context->m_binIndices[binIndex] = node->binListNext;
-            if (node->binListNext != node_t::unused)
-                m_context->m_nodes[node->binListNext].binListPrev = node_t::unused;
-            m_context->m_freeStorage -= nodeTotalSize;
-#ifdef DEBUG_VERBOSE
-            printf("Free storage: %u (-%u) (allocate)\n", m_freeStorage, nodeTotalSize);
-#endif
+            TOffset const nodeEnd = range.offset + range.size;
+            TOffset       offset  = sAlignUp(range.offset, alignment);
+            if (offset < range.offset || offset > nodeEnd || (nodeEnd - offset) < size)
+                return false;
 
-            // Bin empty?
-            if (m_context->m_binIndices[binIndex] == node_t::unused)
+            TOffset const granularity = ctx->m_granularity;
+            if (granularity > 1 && resource != RESOURCE_ANY)
             {
-                // Remove a leaf bin mask bit
-                m_context->m_usedBins[topBinIndex] &= ~(1 << leafBinIndex);
-
-                // All leaf bins empty?
-                if (m_context->m_usedBins[topBinIndex] == 0)
+                TOffset const pageMask = ~(granularity - 1);
+                if (sConflictBefore(ctx, nodeIndex, offset & pageMask, resource))
                 {
-                    // Remove a top bin mask bit
-                    m_context->m_usedBinsTop &= ~(1 << topBinIndex);
+                    // Move to the start of the next page
+                    offset = sAlignUp(offset, granularity);
+                    if (offset < range.offset || offset > nodeEnd || (nodeEnd - offset) < size)
+                        return false;
                 }
+                if (((offset + size - 1) & pageMask) == (nodeEnd & pageMask) && sConflictAfter(ctx, nodeIndex, nodeEnd & pageMask, resource))
+                    return false;
             }
 
-            // Push back reminder N elements to a lower bin
-            u32 reminderSize = nodeTotalSize - size;
-            if (reminderSize > 0)
-            {
-                u32 const newNodeIndex = sInsertNodeIntoBin(m_context, reminderSize, node->dataOffset + size);
-
-                // Link nodes next to each other so that we can merge them later if both are free
-                // And update the old next neighbor to point to the new node (in middle)
-                if (node->getNeighborNext() != node_t::unused)
-                    m_context->m_nodes[node->getNeighborNext()].setNeighborPrev(newNodeIndex);
-                m_context->m_nodes[newNodeIndex].setNeighborPrev(nodeIndex);
-                m_context->m_nodes[newNodeIndex].setNeighborNext(node->getNeighborNext());
-                node->setNeighborNext(newNodeIndex);
-            }
-
-            return (allocation_t*)node;  //{.offset = node.dataOffset, .metadata = nodeIndex};
+            outOffset = offset;
+            return true;
         }
 
-        void block_allocator_t::free(allocation_t* allocation)
+        // Bin list order of the ordered placement policies, does the node sort before a node of 'size' at 'offset'?
+        template <typename TContext>
+        static inline bool sSortsBefore(TContext const* ctx, u32 nodeIndex, typename TContext::offset_t size, typename TContext::offset_t offset)
         {
-            // ASSERT(allocation != nullptr);
-            if (!m_context->m_nodes)
-                return;
+            typename TContext::range_t const& range = ctx->range(nodeIndex);
+            if (ctx->m_placement == PLACEMENT_BEST_FIT && range.size != size)
+                return range.size < size;
+            return range.offset < offset;
+        }
 
-            node_t* const node = (node_t*)allocation;
+        // Treap priority of a node, a hash of its index. The tree is balanced in expectation and its shape only
+        // depends on the operations, so a snapshot or a replayed trace gives the same tree.
+        static inline u32 sTreePriority(u32 nodeIndex)
+        {
+            u32 h = nodeIndex;
+            h ^= h >> 16;
+            h *= 0x85ebca6b;
+            h ^= h >> 13;
+            h *= 0xc2b2ae35;
+            h ^= h >> 16;
+            return h;
+        }
 
-            // Double delete check
-            ASSERT(node->used == true);
+        // Rotate a node above its parent
+        template <typename TContext>
+        static void sTreeRotateUp(TContext* ctx, u32 binIndex, u32 nodeIndex)
+        {
+            typedef typename TContext::index_t index_t;
 
-            // Merge with neighbors...
-            u32 offset = node->dataOffset;
-            u32 size   = node->dataSize;
+            typename TContext::tree_t& node   = ctx->tree(nodeIndex);
+            u32 const                  parent = node.parent;
+            typename TContext::tree_t& p      = ctx->tree(parent);
+            u32 const                  grand  = p.parent;
 
-            if ((node->getNeighborPrev() != node_t::unused) && (m_context->m_nodes[node->getNeighborPrev()].isUsed() == false))
+            if (p.left == nodeIndex)
             {
-                // Previous (contiguous) free node: Change offset to previous node offset. Sum sizes
-                node_t& prevNode = m_context->m_nodes[node->getNeighborPrev()];
-                offset           = prevNode.dataOffset;
-                size += prevNode.dataSize;
-
-                // Remove node from the bin linked list and put it in the freelist
-                sRemoveNodeFromBin(m_context, node->getNeighborPrev());
-
-                ASSERT(prevNode.neighborNext == nodeIndex);
-                node->setNeighborPrev(prevNode.getNeighborPrev());
+                p.left = node.right;
+                if (node.right != TContext::unused)
+                    ctx->tree(node.right).parent = (index_t)parent;
+                node.right = (index_t)parent;
             }
-
-            if ((node->getNeighborNext() != node_t::unused) && (m_context->m_nodes[node->getNeighborNext()].isUsed() == false))
+            else
             {
-                // Next (contiguous) free node: Offset remains the same. Sum sizes.
-                node_t& nextNode = m_context->m_nodes[node->getNeighborNext()];
-                size += nextNode.dataSize;
+                p.right = node.left;
+                if (node.left != TContext::unused)
+                    ctx->tree(node.left).parent = (index_t)parent;
+                node.left = (index_t)parent;
+            }
+            p.parent    = (index_t)nodeIndex;
+            node.parent = (index_t)grand;
 
-                // Remove node from the bin linked list and put it in the freelist
-                sRemoveNodeFromBin(m_context, node->getNeighborNext());
+            if (grand == TContext::unused)
+                ctx->m_binRoots[binIndex] = (index_t)nodeIndex;
+            else if (ctx->tree(grand).left == parent)
+                ctx->tree(grand).left = (index_t)nodeIndex;
+            else
+                ctx->tree(grand).right = (index_t)nodeIndex;
+        }
 
-                ASSERT(nextNode.neighborPrev == nodeIndex);
-                node->setNeighborNext(nextNode.getNeighborNext());
-            }
+        // Add a node (its range is set) to the tree of its bin, returns the nodes before and after it in bin order
+        template <typename TContext>
+        static void sTreeInsert(TContext* ctx, u32 binIndex, u32 nodeIndex, u32& outPrev, u32& outNext)
+        {
+            typedef typename TContext::index_t index_t;
 
-            u32 neighborNext = node->getNeighborNext();
-            u32 neighborPrev = node->getNeighborPrev();
+            typename TContext::range_t const& range = ctx->range(nodeIndex);
 
-            // Insert the removed node to freelist
-#ifdef DEBUG_VERBOSE
-            printf("Putting node %u into freelist[%u] (free)\n", nodeIndex, m_freeOffset + 1);
-#endif
-            node_t** nodeNext         = (node_t**)node;
-            *nodeNext                 = m_context->m_freeNodeHead;
-            m_context->m_freeNodeHead = node;
+            u32  parent = TContext::unused;
+            u32  node   = ctx->m_binRoots[binIndex];
+            bool left   = false;
+            outPrev     = TContext::unused;
+            outNext     = TContext::unused;
+            while (node != TContext::unused)
+            {
+                parent = node;
+                left   = !sSortsBefore(ctx, node, range.size, range.offset);
+                if (left)
+                {
+                    outNext = node;
+                    node    = ctx->tree(node).left;
+                }
+                else
+                {
+                    outPrev = node;
+                    node    = ctx->tree(node).right;
+                }
+            }
 
-            // Insert the (combined) free node to bin
-            u32 combinedNodeIndex = sInsertNodeIntoBin(m_context, size, offset);
+            typename TContext::tree_t& tree = ctx->tree(nodeIndex);
+            tree.left                       = TContext::unused;
+            tree.right                      = TContext::unused;
+            tree.parent                     = (index_t)parent;
+            if (parent == TContext::unused)
+                ctx->m_binRoots[binIndex] = (index_t)nodeIndex;
+            else if (left)
+                ctx->tree(parent).left = (index_t)nodeIndex;
+            else
+                ctx->tree(parent).right = (index_t)nodeIndex;
 
-            // Connect neighbors with the new combined node
-            if (neighborNext != node_t::unused)
+            u32 const priority = sTreePriority(nodeIndex);
+            while (tree.parent != TContext::unused && sTreePriority(tree.parent) < priority)
+                sTreeRotateUp(ctx, binIndex, nodeIndex);
+        }
+
+        // Rotate the node down until it has at most one child, then splice it out
+        template <typename TContext>
+        static void sTreeRemove(TContext* ctx, u32 binIndex, u32 nodeIndex)
+        {
+            typename TContext::tree_t& tree = ctx->tree(nodeIndex);
+            while (tree.left != TContext::unused && tree.right != TContext::unused)
             {
-                m_context->m_nodes[combinedNodeIndex].setNeighborNext(neighborNext);
-                m_context->m_nodes[neighborNext].setNeighborPrev(combinedNodeIndex);
+                u32 const child = (sTreePriority(tree.left) > sTreePriority(tree.right)) ? tree.left : tree.right;
+                sTreeRotateUp(ctx, binIndex, child);
             }
-            if (neighborPrev != node_t::unused)
+
+            u32 const child  = (tree.left != TContext::unused) ? tree.left : tree.right;
+            u32 const parent = tree.parent;
+            if (child != TContext::unused)
+                ctx->tree(child).parent = tree.parent;
+            if (parent == TContext::unused)
+                ctx->m_binRoots[binIndex] = (typename TContext::index_t)child;
+            else if (ctx->tree(parent).left == nodeIndex)
+                ctx->tree(parent).left = (typename TContext::index_t)child;
+            else
+                ctx->tree(parent).right = (typename TContext::index_t)child;
+        }
+
+        // First node of a PLACEMENT_BEST_FIT bin that holds at least 'size' bytes, the bin is ordered by size
+        template <typename TContext>
+        static u32 sTreeLowerBound(TContext const* ctx, u32 binIndex, typename TContext::offset_t size)
+        {
+            u32 found = TContext::unused;
+            u32 node  = ctx->m_binRoots[binIndex];
+            while (node != TContext::unused)
             {
-                m_context->m_nodes[combinedNodeIndex].setNeighborPrev(neighborPrev);
-                m_context->m_nodes[neighborPrev].setNeighborNext(combinedNodeIndex);
+                if (ctx->range(node).size >= size)
+                {
+                    found = node;
+                    node  = ctx->tree(node).left;
+                }
+                else
+                {
+                    node = ctx->tree(node).right;
+                }
             }
+            return found;
         }
 
-        u32 sInsertNodeIntoBin(context_t* ctx, u32 size, u32 dataOffset)
+        template <typename TContext>
+        static u32 sInsertNodeIntoBin(TContext* ctx, typename TContext::offset_t size, typename TContext::offset_t dataOffset)
         {
+            typedef typename TContext::index_t    index_t;
+            typedef typename TContext::top_mask_t top_mask_t;
+
             // Round down to bin index to ensure that bin >= alloc
-            u32 binIndex = SmallFloat::uintToFloatRoundDown(size);
+            u32 binIndex = SmallFloat::uintToFloatRoundDown<TContext::MANTISSA_BITS>(size);
 
-            u32 topBinIndex  = binIndex >> TOP_BINS_INDEX_SHIFT;
-            u32 leafBinIndex = binIndex & LEAF_BINS_INDEX_MASK;
+            u32 topBinIndex  = binIndex >> TContext::TOP_BINS_INDEX_SHIFT;
+            u32 leafBinIndex = binIndex & TContext::LEAF_BINS_INDEX_MASK;
 
             // Bin was empty before?
-            if (ctx->m_binIndices[binIndex] == node_t::unused)
+            if (ctx->m_binIndices[binIndex] == TContext::unused)
             {
                 // Set bin mask bits
                 ctx->m_usedBins[topBinIndex] |= 1 << leafBinIndex;
-                ctx->m_usedBinsTop |= 1 << topBinIndex;
+                ctx->m_usedBinsTop |= (top_mask_t)1 << topBinIndex;
             }
 
-            // Take a freelist node and insert on top of the bin linked list (next = old top)
-            u32 topNodeIndex = ctx->m_binIndices[binIndex];
-
-            u32 const nodeIndex = ctx->nodeToIdx(ctx->m_freeNodeHead);
-            ctx->m_freeNodeHead = *((node_t**)ctx->m_freeNodeHead);
-
-#ifdef DEBUG_VERBOSE
-            printf("Getting node %u from freelist[%u]\n", nodeIndex, m_freeOffset + 1);
-#endif
-            ctx->m_nodes[nodeIndex] = {.dataOffset = dataOffset, .dataSize = size, .binListNext = topNodeIndex, .binListPrev = node_t::unused};
-            if (topNodeIndex != node_t::unused)
-                ctx->m_nodes[topNodeIndex].binListPrev = nodeIndex;
-            ctx->m_binIndices[binIndex] = nodeIndex;
+            // Take a freelist node and insert on top of the bin linked list (next = old top).
+            // The ordered placement policies insert it in between its neighbors in the bin tree.
+            u32 const nodeIndex = ctx->m_freeNodeHead;
+            ctx->m_freeNodeHead = ctx->link(nodeIndex).next;
+            ctx->m_freeNodeCount -= 1;
+
+            ctx->range(nodeIndex).offset = dataOffset;
+            ctx->range(nodeIndex).size   = size;
+
+            u32 prevNodeIndex = TContext::unused;
+            u32 nextNodeIndex = ctx->m_binIndices[binIndex];
+            if (ctx->m_placement != PLACEMENT_FAST)
+                sTreeInsert(ctx, binIndex, nodeIndex, prevNodeIndex, nextNodeIndex);
+
+            ctx->link(nodeIndex).prev     = (index_t)prevNodeIndex;
+            ctx->link(nodeIndex).next     = (index_t)nextNodeIndex;
+            ctx->neighbor(nodeIndex).prev = TContext::unused;
+            ctx->neighbor(nodeIndex).next = TContext::unused;
+            if (nextNodeIndex != TContext::unused)
+                ctx->link(nextNodeIndex).prev = (index_t)nodeIndex;
+            if (prevNodeIndex != TContext::unused)
+                ctx->link(prevNodeIndex).next = (index_t)nodeIndex;
+            else
+                ctx->m_binIndices[binIndex] = (index_t)nodeIndex;
 
             ctx->m_freeStorage += size;
-#ifdef DEBUG_VERBOSE
-            printf("Free storconst age: %u (+%u) (sInsertNodeIntoBin)\n", m_freeStorage, size);
-#endif
 
             return nodeIndex;
         }
 
-        void sRemoveNodeFromBin(context_t* ctx, u32 nodeIndex)
+        // Remove the node from its bin linked list, the node itself is left untouched
+        template <typename TContext>
+        static void sUnlinkNodeFromBin(TContext* ctx, u32 nodeIndex)
         {
-            node_t* const node = &ctx->m_nodes[nodeIndex];
+            typedef typename TContext::top_mask_t top_mask_t;
+
+            typename TContext::link_t const& link = ctx->link(nodeIndex);
 
-            if (node->binListPrev != node_t::unused)
+            if (ctx->m_placement != PLACEMENT_FAST)
+                sTreeRemove(ctx, SmallFloat::uintToFloatRoundDown<TContext::MANTISSA_BITS>(ctx->range(nodeIndex).size), nodeIndex);
+
+            if (link.prev != TContext::unused)
             {
                 // Easy case: We have previous node-> Just remove this node from the middle of the list.
-                ctx->m_nodes[node->binListPrev].binListNext = node->binListNext;
-                if (node->binListNext != node_t::unused)
-                    ctx->m_nodes[node->binListNext].binListPrev = node->binListPrev;
+                ctx->link(link.prev).next = link.next;
+                if (link.next != TContext::unused)
+                    ctx->link(link.next).prev = link.prev;
             }
             else
             {
                 // Hard case: We are the first node in a bin. Find the bin.
 
                 // Round down to bin index to ensure that bin >= alloc
-                u32 const binIndex = SmallFloat::uintToFloatRoundDown(node->dataSize);
+                u32 const binIndex = SmallFloat::uintToFloatRoundDown<TContext::MANTISSA_BITS>(ctx->range(nodeIndex).size);
 
-                u32 const topBinIndex  = binIndex >> TOP_BINS_INDEX_SHIFT;
-                u32 const leafBinIndex = binIndex & LEAF_BINS_INDEX_MASK;
+                u32 const topBinIndex  = binIndex >> TContext::TOP_BINS_INDEX_SHIFT;
+                u32 const leafBinIndex = binIndex & TContext::LEAF_BINS_INDEX_MASK;
 
-                ctx->m_binIndices[binIndex] = node->binListNext;
-                if (node->binListNext != node_t::unused)
-                    ctx->m_nodes[node->binListNext].binListPrev = node_t::unused;
+                ctx->m_binIndices[binIndex] = link.next;
+                if (link.next != TContext::unused)
+                    ctx->link(link.next).prev = TContext::unused;
 
                 // Bin empty?
-                if (ctx->m_binIndices[binIndex] == node_t::unused)
+                if (ctx->m_binIndices[binIndex] == TContext::unused)
                 {
                     // Remove a leaf bin mask bit
                     ctx->m_usedBins[topBinIndex] &= ~(1 << leafBinIndex);
@@ -498,68 +860,1345 @@ namespace ncore
                     if (ctx->m_usedBins[topBinIndex] == 0)
                     {
                         // Remove a top bin mask bit
-                        ctx->m_usedBinsTop &= ~(1 << topBinIndex);
+                        ctx->m_usedBinsTop &= ~((top_mask_t)1 << topBinIndex);
                     }
                 }
             }
+        }
 
-            // Insert the node to freelist
-#ifdef DEBUG_VERBOSE
-            printf("Putting node %u into freelist[%u] (sRemoveNodeFromBin)\n", nodeIndex, m_freeOffset + 1);
-#endif
-            // ctx->m_freeNodes[++ctx->m_freeOffset] = nodeIndex;
-            *((node_t**)node)   = ctx->m_freeNodeHead;
-            ctx->m_freeNodeHead = node;
+        // Put a node that is no longer referenced back on the freelist
+        template <typename TContext>
+        static inline void sReleaseNode(TContext* ctx, u32 nodeIndex)
+        {
+            ctx->link(nodeIndex).next = (typename TContext::index_t)ctx->m_freeNodeHead;
+            ctx->m_freeNodeHead       = nodeIndex;
+            ctx->m_freeNodeCount += 1;
+        }
 
-            ctx->m_freeStorage -= node->dataSize;
-#ifdef DEBUG_VERBOSE
-            printf("Free storage: %u (-%u) (sRemoveNodeFromBin)\n", m_freeStorage, node->dataSize);
-#endif
+        template <typename TContext>
+        static void sRemoveNodeFromBin(TContext* ctx, u32 nodeIndex)
+        {
+            sUnlinkNodeFromBin(ctx, nodeIndex);
+            ctx->m_freeStorage -= ctx->range(nodeIndex).size;
+
+            // Insert the node to freelist
+            sReleaseNode(ctx, nodeIndex);
         }
 
-        void block_allocator_t::storageReport(storage_report_t& report) const
+        // The free node that serves 'size' bytes under the placement policy, 'unused' when there is none
+        template <typename TContext>
+        static u32 sFindFreeNode(TContext const* ctx, typename TContext::offset_t size)
         {
-            u32 largestFreeRegion = 0;
-            u32 freeStorage       = 0;
+            // Round up to bin index to ensure that alloc >= bin
+            // Gives us min bin index that fits the size
+            u32 const minBinIndex = SmallFloat::uintToFloatRoundUp<TContext::MANTISSA_BITS>(size);
 
-            // Out of allocations? -> Zero free space
-            if (m_context->m_freeOffset > 0)
+            // Best fit first looks in the bin below, it holds nodes that are smaller than any node in the
+            // bins above but may still fit. The bin is sorted by size so the first node that fits is the best.
+            if (ctx->m_placement == PLACEMENT_BEST_FIT)
             {
-                freeStorage = m_context->m_freeStorage;
-                if (m_context->m_usedBinsTop)
+                u32 const lowerBinIndex = SmallFloat::uintToFloatRoundDown<TContext::MANTISSA_BITS>(size);
+                if (lowerBinIndex != minBinIndex)
                 {
-                    u32 topBinIndex   = 31 - lzcnt_nonzero(m_context->m_usedBinsTop);
-                    u32 leafBinIndex  = 31 - lzcnt_nonzero(m_context->m_usedBins[topBinIndex]);
-                    largestFreeRegion = SmallFloat::floatToUint((topBinIndex << TOP_BINS_INDEX_SHIFT) | leafBinIndex);
-                    ASSERT(freeStorage >= largestFreeRegion);
+                    u32 const nodeIndex = sTreeLowerBound(ctx, lowerBinIndex, size);
+                    if (nodeIndex != TContext::unused)
+                        return nodeIndex;
                 }
             }
 
-            report                  = {.totalFreeSpace = freeStorage, .largestFreeRegion = largestFreeRegion};
-            report.numberOfBins     = NUM_LEAF_BINS;
-            report.numberOfUsedBins = 0;
-            for (u32 i = 0; i < NUM_LEAF_BINS; i++)
-                report.numberOfUsedBins += (m_context->m_binIndices[i] != node_t::unused) ? 1 : 0;
+            u32 const binIndex = sFindNonEmptyBin(ctx, minBinIndex);
+            if (binIndex == NO_SPACE)
+                return TContext::unused;
+
+            // Take the top node of the bin
+            return ctx->m_binIndices[binIndex];
         }
 
-        void block_allocator_t::storageBinState(u32 binIndex, bin_report_t& binState) const
+        // Split 'size' bytes from the start of a free node, the node becomes used
+        template <typename TContext>
+        static u32 sAllocate(TContext* ctx, typename TContext::offset_t size)
         {
-            if (binIndex >= NUM_LEAF_BINS)
-            {
-                binState = {.size = 0, .count = 0};
+            typedef typename TContext::offset_t offset_t;
+
+            // Out of allocations?
+            if (!ctx->hasFreeNodes(1))
+                return TContext::unused;
+
+            u32 const nodeIndex = sFindFreeNode(ctx, size);
+            if (nodeIndex == TContext::unused)
+                return TContext::unused;
+
+            typename TContext::range_t&    range         = ctx->range(nodeIndex);
+            typename TContext::neighbor_t& neighbor      = ctx->neighbor(nodeIndex);
+            offset_t const                 nodeTotalSize = range.size;
+            sUnlinkNodeFromBin(ctx, nodeIndex);
+            ctx->m_freeStorage -= nodeTotalSize;
+
+            range.size = size;
+            neighbor.setUsed(true);
+            ctx->link(nodeIndex).prev = RESOURCE_ANY;
+
+            // Push back reminder N elements to a lower bin
+            offset_t const reminderSize = nodeTotalSize - size;
+            if (reminderSize > 0)
+            {
+                u32 const newNodeIndex = sInsertNodeIntoBin(ctx, reminderSize, range.offset + size);
+
+                // Link nodes next to each other so that we can merge them later if both are free
+                // And update the old next neighbor to point to the new node (in middle)
+                if (neighbor.getNext() != TContext::unused)
+                    ctx->neighbor(neighbor.getNext()).setPrev(newNodeIndex);
+                else
+                    ctx->m_tailNode = newNodeIndex;
+                ctx->neighbor(newNodeIndex).setPrev(nodeIndex);
+                ctx->neighbor(newNodeIndex).setNext(neighbor.getNext());
+                neighbor.setNext(newNodeIndex);
+            }
+
+            return nodeIndex;
+        }
+
+        // Turn a free node into an allocation of 'size' bytes at 'alignedOffset', returning the leading padding
+        // and the trailing remainder to the bins. The caller made sure there are 2 free nodes.
+        template <typename TContext>
+        static u32 sPlaceInNode(TContext* ctx, u32 nodeIndex, typename TContext::offset_t alignedOffset, typename TContext::offset_t size, u32 resource)
+        {
+            typedef typename TContext::offset_t offset_t;
+
+            typename TContext::range_t&    range         = ctx->range(nodeIndex);
+            typename TContext::neighbor_t& neighbor      = ctx->neighbor(nodeIndex);
+            offset_t const                 nodeOffset    = range.offset;
+            offset_t const                 nodeTotalSize = range.size;
+            sUnlinkNodeFromBin(ctx, nodeIndex);
+            ctx->m_freeStorage -= nodeTotalSize;
+
+            range.offset = alignedOffset;
+            range.size   = size;
+            neighbor.setUsed(true);
+            ctx->link(nodeIndex).prev = (typename TContext::index_t)resource;
+
+            // Return the leading padding to the bins as its own node, placed in between our previous neighbor and us
+            offset_t const paddingSize = alignedOffset - nodeOffset;
+            if (paddingSize > 0)
+            {
+                u32 const padNodeIndex = sInsertNodeIntoBin(ctx, paddingSize, nodeOffset);
+                if (neighbor.getPrev() != TContext::unused)
+                    ctx->neighbor(neighbor.getPrev()).setNext(padNodeIndex);
+                ctx->neighbor(padNodeIndex).setPrev(neighbor.getPrev());
+                ctx->neighbor(padNodeIndex).setNext(nodeIndex);
+                neighbor.setPrev(padNodeIndex);
+            }
+
+            // Push back reminder N elements to a lower bin
+            offset_t const reminderSize = nodeTotalSize - paddingSize - size;
+            if (reminderSize > 0)
+            {
+                u32 const newNodeIndex = sInsertNodeIntoBin(ctx, reminderSize, alignedOffset + size);
+                if (neighbor.getNext() != TContext::unused)
+                    ctx->neighbor(neighbor.getNext()).setPrev(newNodeIndex);
+                else
+                    ctx->m_tailNode = newNodeIndex;
+                ctx->neighbor(newNodeIndex).setPrev(nodeIndex);
+                ctx->neighbor(newNodeIndex).setNext(neighbor.getNext());
+                neighbor.setNext(newNodeIndex);
+            }
+
+            return nodeIndex;
+        }
+
+        template <typename TContext>
+        static u32 sAllocateAligned(TContext* ctx, typename TContext::offset_t size, typename TContext::offset_t alignment, u32 resource)
+        {
+            typedef typename TContext::offset_t offset_t;
+
+            ASSERT((alignment & (alignment - 1)) == 0);
+            offset_t const granularity = (resource != RESOURCE_ANY) ? ctx->m_granularity : 1;
+            if (alignment <= 1 && granularity <= 1)
+                return sAllocate(ctx, size);
+
+            if (alignment == 0)
+                alignment = 1;
+
+            // Leading padding and trailing remainder both need a node
+            if (!ctx->hasFreeNodes(2))
+                return TContext::unused;
+
+            // Any node in a bin at or above 'guaranteedBinIndex' fits the request, whatever its offset
+            // and neighbors. Bins between the minimum and the guaranteed bin are inspected node by node.
+            offset_t const maxOffset   = (offset_t)~(offset_t)0;
+            offset_t       extraSize   = alignment - 1;
+            u32            binOverflow = 0;
+            if (granularity > 1)
+            {
+                binOverflow |= (granularity > (maxOffset - extraSize) / 2) ? 1 : 0;
+                extraSize += 2 * granularity - 1;
+            }
+            binOverflow |= (size > maxOffset - extraSize) ? 1 : 0;
+
+            u32 const minBinIndex        = SmallFloat::uintToFloatRoundUp<TContext::MANTISSA_BITS>(size);
+            u32 const guaranteedBinIndex = binOverflow ? TContext::NUM_LEAF_BINS : SmallFloat::uintToFloatRoundUp<TContext::MANTISSA_BITS>((offset_t)(size + extraSize));
+
+            u32      nodeIndex     = TContext::unused;
+            offset_t alignedOffset = 0;
+            for (u32 binIndex = sFindNonEmptyBin(ctx, minBinIndex); binIndex != NO_SPACE; binIndex = sFindNonEmptyBin(ctx, binIndex + 1))
+            {
+                u32 candidate = ctx->m_binIndices[binIndex];
+                for (u32 i = 0; candidate != TContext::unused; ++i)
+                {
+                    if (binIndex < guaranteedBinIndex && i == MAX_ALIGNED_SEARCH_NODES)
+                        break;
+                    if (sFitNode(ctx, candidate, size, alignment, resource, alignedOffset))
+                    {
+                        nodeIndex = candidate;
+                        break;
+                    }
+                    candidate = ctx->link(candidate).next;
+                }
+                if (nodeIndex != TContext::unused)
+                    break;
+            }
+
+            // Out of space?
+            if (nodeIndex == TContext::unused)
+                return TContext::unused;
+
+            return sPlaceInNode(ctx, nodeIndex, alignedOffset, size, resource);
+        }
+
+        template <typename TContext>
+        static void sFree(TContext* ctx, u32 nodeIndex)
+        {
+            typedef typename TContext::offset_t offset_t;
+
+            typename TContext::neighbor_t& neighbor = ctx->neighbor(nodeIndex);
+
+            // Double delete check
+            ASSERT(neighbor.isUsed() == true);
+
+            // Any handle to this allocation is stale from now on
+            ctx->generation(nodeIndex) += 1;
+
+            // Merge with neighbors...
+            offset_t offset = ctx->range(nodeIndex).offset;
+            offset_t size   = ctx->range(nodeIndex).size;
+
+            if ((neighbor.getPrev() != TContext::unused) && (ctx->neighbor(neighbor.getPrev()).isUsed() == false))
+            {
+                // Previous (contiguous) free node: Change offset to previous node offset. Sum sizes
+                u32 const prevIndex = neighbor.getPrev();
+                offset              = ctx->range(prevIndex).offset;
+                size += ctx->range(prevIndex).size;
+
+                // Remove node from the bin linked list and put it in the freelist
+                u32 const prevPrev = ctx->neighbor(prevIndex).getPrev();
+                sRemoveNodeFromBin(ctx, prevIndex);
+                neighbor.setPrev(prevPrev);
+            }
+
+            if ((neighbor.getNext() != TContext::unused) && (ctx->neighbor(neighbor.getNext()).isUsed() == false))
+            {
+                // Next (contiguous) free node: Offset remains the same. Sum sizes.
+                u32 const nextIndex = neighbor.getNext();
+                size += ctx->range(nextIndex).size;
+
+                // Remove node from the bin linked list and put it in the freelist
+                u32 const nextNext = ctx->neighbor(nextIndex).getNext();
+                sRemoveNodeFromBin(ctx, nextIndex);
+                neighbor.setNext(nextNext);
+            }
+
+            u32 const neighborNext = neighbor.getNext();
+            u32 const neighborPrev = neighbor.getPrev();
+
+            // Insert the removed node to freelist
+            neighbor.setUsed(false);
+            sReleaseNode(ctx, nodeIndex);
+
+            // Insert the (combined) free node to bin
+            u32 const combinedNodeIndex = sInsertNodeIntoBin(ctx, size, offset);
+
+            // Connect neighbors with the new combined node
+            if (neighborNext != TContext::unused)
+            {
+                ctx->neighbor(combinedNodeIndex).setNext(neighborNext);
+                ctx->neighbor(neighborNext).setPrev(combinedNodeIndex);
+            }
+            else
+            {
+                ctx->m_tailNode = combinedNodeIndex;
+            }
+            if (neighborPrev != TContext::unused)
+            {
+                ctx->neighbor(combinedNodeIndex).setPrev(neighborPrev);
+                ctx->neighbor(neighborPrev).setNext(combinedNodeIndex);
+            }
+        }
+
+        // Take a node from the freelist, the caller links it into the neighbor chain
+        template <typename TContext>
+        static inline u32 sAcquireNode(TContext* ctx)
+        {
+            u32 const nodeIndex = ctx->m_freeNodeHead;
+            ctx->m_freeNodeHead = ctx->link(nodeIndex).next;
+            ctx->m_freeNodeCount -= 1;
+            return nodeIndex;
+        }
+
+        // Put the unused tail of a carved node in a bin, in between the last carved node and its old next neighbor
+        template <typename TContext>
+        static void sInsertRemainder(TContext* ctx, typename TContext::offset_t offset, typename TContext::offset_t size, u32 prevIndex, u32 nextIndex)
+        {
+            if (size == 0)
+                return;
+            u32 const remainderIndex = sInsertNodeIntoBin(ctx, size, offset);
+            ctx->neighbor(remainderIndex).setPrev(prevIndex);
+            ctx->neighbor(remainderIndex).setNext(nextIndex);
+            ctx->neighbor(prevIndex).setNext(remainderIndex);
+            if (nextIndex != TContext::unused)
+                ctx->neighbor(nextIndex).setPrev(remainderIndex);
+            else
+                ctx->m_tailNode = remainderIndex;
+        }
+
+        // Carve consecutive requests from one free node, the node is taken out of its bin once and the
+        // final remainder is put back in a bin once. A new node is picked by the placement policy for the
+        // sum of the upcoming requests, so a batch usually ends up in a single contiguous range.
+        template <typename TContext>
+        static u32 sAllocateMany(TContext* ctx, typename TContext::offset_t const* sizes, u32 count, handle_t* outHandles)
+        {
+            typedef typename TContext::offset_t offset_t;
+
+            offset_t carveOffset = 0;
+            offset_t carveSize   = 0;
+            u32      carvePrev   = TContext::unused;  // Last node carved, the remainder follows it
+            u32      carveNext   = TContext::unused;  // Neighbor after the remainder
+
+            u32 numAllocated = 0;
+            for (u32 i = 0; i < count; ++i)
+            {
+                offset_t const size = sizes[i];
+                outHandles[i]       = INVALID_HANDLE;
+
+                // A node for this allocation and one for the remainder
+                if (!ctx->hasFreeNodes(2))
+                    continue;
+
+                u32 nodeIndex;
+                if (carvePrev != TContext::unused && carveSize >= size)
+                {
+                    nodeIndex                    = sAcquireNode(ctx);
+                    ctx->range(nodeIndex).offset = carveOffset;
+                    ctx->range(nodeIndex).size   = size;
+                    ctx->neighbor(nodeIndex).setPrev(carvePrev);
+                    ctx->neighbor(nodeIndex).next = TContext::unused;
+                    ctx->neighbor(nodeIndex).setNext(carveNext);
+                    ctx->neighbor(carvePrev).setNext(nodeIndex);
+                    if (carveNext != TContext::unused)
+                        ctx->neighbor(carveNext).setPrev(nodeIndex);
+                    else
+                        ctx->m_tailNode = nodeIndex;
+                    carveSize -= size;
+                }
+                else
+                {
+                    // Return what is left of the current node to the bins
+                    if (carvePrev != TContext::unused)
+                        sInsertRemainder(ctx, carveOffset, carveSize, carvePrev, carveNext);
+                    carvePrev = TContext::unused;
+
+                    offset_t const maxOffset = (offset_t)~(offset_t)0;
+                    offset_t       batchSize = 0;
+                    for (u32 j = i; j < count && j < (i + MAX_BATCH_LOOKAHEAD); ++j)
+                        batchSize = (sizes[j] > maxOffset - batchSize) ? maxOffset : (batchSize + sizes[j]);
+
+                    nodeIndex = TContext::unused;
+                    if (batchSize > size)
+                        nodeIndex = sFindFreeNode(ctx, batchSize);
+                    if (nodeIndex == TContext::unused)
+                        nodeIndex = sFindFreeNode(ctx, size);
+                    if (nodeIndex == TContext::unused)
+                        continue;
+
+                    offset_t const nodeTotalSize = ctx->range(nodeIndex).size;
+                    sUnlinkNodeFromBin(ctx, nodeIndex);
+                    ctx->m_freeStorage -= nodeTotalSize;
+                    ctx->range(nodeIndex).size = size;
+
+                    carveSize = nodeTotalSize - size;
+                    carveNext = ctx->neighbor(nodeIndex).getNext();
+                }
+
+                ctx->neighbor(nodeIndex).setUsed(true);
+                ctx->link(nodeIndex).prev = RESOURCE_ANY;
+                carveOffset               = ctx->range(nodeIndex).offset + size;
+                carvePrev                 = nodeIndex;
+
+                outHandles[i] = ctx->toHandle(nodeIndex);
+                numAllocated += 1;
+            }
+
+            if (carvePrev != TContext::unused)
+                sInsertRemainder(ctx, carveOffset, carveSize, carvePrev, carveNext);
+
+            return numAllocated;
+        }
+
+        // Resize a used node in place, the space after it is taken from or given back to the next free neighbor
+        template <typename TContext>
+        static bool sReallocate(TContext* ctx, u32 nodeIndex, typename TContext::offset_t newSize)
+        {
+            typedef typename TContext::offset_t offset_t;
+
+            typename TContext::range_t&    range    = ctx->range(nodeIndex);
+            typename TContext::neighbor_t& neighbor = ctx->neighbor(nodeIndex);
+            if (newSize == range.size)
+                return true;
+
+            u32 next = neighbor.getNext();
+            u32 free = TContext::unused;
+            if (next != TContext::unused && !ctx->neighbor(next).isUsed())
+            {
+                free = next;
+                next = ctx->neighbor(free).getNext();
+            }
+
+            offset_t const freeSize = free != TContext::unused ? ctx->range(free).size : 0;
+            offset_t       tailSize;
+            if (newSize > range.size)
+            {
+                offset_t const growth = newSize - range.size;
+                if (free == TContext::unused || freeSize < growth)
+                    return false;
+
+                // The grown range may not reach into a page with a conflicting resource after the free range
+                u32 const resource = ctx->resource(nodeIndex);
+                if (ctx->m_granularity > 1 && resource != RESOURCE_ANY)
+                {
+                    offset_t const pageStart = (range.offset + newSize - 1) & ~(ctx->m_granularity - 1);
+                    if (sConflictAfter(ctx, free, pageStart, resource))
+                        return false;
+                }
+                tailSize = freeSize - growth;
+            }
+            else
+            {
+                tailSize = freeSize + (range.size - newSize);
+            }
+
+            // The free neighbor is replaced by a node for the new tail
+            if (free == TContext::unused && !ctx->hasFreeNodes(1))
+                return false;
+            if (free != TContext::unused)
+                sRemoveNodeFromBin(ctx, free);
+
+            range.size = newSize;
+            neighbor.setNext(next);
+            if (next != TContext::unused)
+                ctx->neighbor(next).setPrev(nodeIndex);
+            else
+                ctx->m_tailNode = nodeIndex;
+            if (tailSize > 0)
+                sInsertRemainder(ctx, range.offset + newSize, tailSize, nodeIndex, next);
+            return true;
+        }
+
+        // Free a batch of allocations. The batch is first marked 'pending' (not used and not in a bin), then
+        // every run of pending and free nodes that are adjacent in memory is merged and put in a bin as a
+        // single node. Returns the number of allocations freed, stale handles and duplicates are skipped.
+        // 'outFreedHandles' (may be nullptr) receives the handles that were freed, in batch order.
+        template <typename TContext>
+        static u32 sFreeMany(TContext* ctx, handle_t const* handles, u32 count, typename TContext::offset_t& outFreedBytes, handle_t* outFreedHandles)
+        {
+            typedef typename TContext::offset_t offset_t;
+
+            u32 numFreed  = 0;
+            outFreedBytes = 0;
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32 const nodeIndex = ctx->fromHandle(handles[i]);
+                if (nodeIndex == TContext::unused)
+                    continue;
+                ctx->generation(nodeIndex) += 1;
+                ctx->neighbor(nodeIndex).setUsed(false);
+                ctx->link(nodeIndex).prev = TContext::pending;
+                outFreedBytes += ctx->range(nodeIndex).size;
+                if (outFreedHandles != nullptr)
+                    outFreedHandles[numFreed] = handles[i];
+                numFreed += 1;
+            }
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32 const nodeIndex = handles[i] & TContext::HANDLE_INDEX_MASK;
+                if (nodeIndex >= ctx->m_numNodes || ctx->neighbor(nodeIndex).isUsed() || ctx->link(nodeIndex).prev != TContext::pending)
+                    continue;
+
+                // Find the extent of the run, no two free nodes are adjacent so this only walks over the batch
+                u32 first = nodeIndex;
+                u32 prev  = ctx->neighbor(first).getPrev();
+                while (prev != TContext::unused && !ctx->neighbor(prev).isUsed())
+                {
+                    first = prev;
+                    prev  = ctx->neighbor(first).getPrev();
+                }
+
+                // Release every node of the run, free nodes leave their bin
+                offset_t const offset = ctx->range(first).offset;
+                offset_t       size   = 0;
+                u32            next   = first;
+                while (next != TContext::unused && !ctx->neighbor(next).isUsed())
+                {
+                    u32 const node = next;
+                    next           = ctx->neighbor(node).getNext();
+                    size += ctx->range(node).size;
+                    if (ctx->link(node).prev == TContext::pending)
+                    {
+                        ctx->link(node).prev = TContext::unused;
+                        sReleaseNode(ctx, node);
+                    }
+                    else
+                    {
+                        sRemoveNodeFromBin(ctx, node);
+                    }
+                }
+
+                u32 const combinedNodeIndex = sInsertNodeIntoBin(ctx, size, offset);
+                if (next != TContext::unused)
+                {
+                    ctx->neighbor(combinedNodeIndex).setNext(next);
+                    ctx->neighbor(next).setPrev(combinedNodeIndex);
+                }
+                else
+                {
+                    ctx->m_tailNode = combinedNodeIndex;
+                }
+                if (prev != TContext::unused)
+                {
+                    ctx->neighbor(combinedNodeIndex).setPrev(prev);
+                    ctx->neighbor(prev).setNext(combinedNodeIndex);
+                }
+            }
+
+            return numFreed;
+        }
+
+        // Find the free space with the lowest offset, below 'limitOffset', that can hold 'size' bytes.
+        // Inspects the bins that fit the size, a bounded number of nodes per bin and 'visits' nodes in total.
+        template <typename TContext>
+        static u32 sFindLowerSpace(TContext const* ctx, typename TContext::offset_t size, typename TContext::offset_t alignment, u32 resource, typename TContext::offset_t limitOffset, u32& visits, typename TContext::offset_t& outOffset)
+        {
+            typedef typename TContext::offset_t offset_t;
+
+            u32      bestIndex  = TContext::unused;
+            offset_t bestOffset = limitOffset;
+
+            u32 const minBinIndex = SmallFloat::uintToFloatRoundUp<TContext::MANTISSA_BITS>(size);
+            for (u32 binIndex = sFindNonEmptyBin(ctx, minBinIndex); binIndex != NO_SPACE && visits > 0; binIndex = sFindNonEmptyBin(ctx, binIndex + 1))
+            {
+                u32 candidate = ctx->m_binIndices[binIndex];
+                for (u32 i = 0; candidate != TContext::unused && i < MAX_ALIGNED_SEARCH_NODES && visits > 0; ++i)
+                {
+                    visits -= 1;
+                    offset_t offset;
+                    if (ctx->range(candidate).offset < bestOffset && sFitNode(ctx, candidate, size, alignment, resource, offset))
+                    {
+                        if (offset < bestOffset && (limitOffset - offset) >= size)
+                        {
+                            bestIndex  = candidate;
+                            bestOffset = offset;
+                        }
+                    }
+                    candidate = ctx->link(candidate).next;
+                }
+            }
+
+            outOffset = bestOffset;
+            return bestIndex;
+        }
+
+        // Exchange the places of two used nodes in the neighbor chain together with their ranges and resource
+        // tags, the node indices (and so the handles) stay the same.
+        template <typename TContext>
+        static void sSwapNodes(TContext* ctx, u32 a, u32 b)
+        {
+            typedef typename TContext::range_t    range_t;
+            typedef typename TContext::neighbor_t neighbor_t;
+            typedef typename TContext::index_t    index_t;
+
+            range_t const rangeA = ctx->range(a);
+            ctx->range(a)        = ctx->range(b);
+            ctx->range(b)        = rangeA;
+
+            index_t const resourceA = ctx->link(a).prev;
+            ctx->link(a).prev       = ctx->link(b).prev;
+            ctx->link(b).prev       = resourceA;
+
+            neighbor_t const neighborA = ctx->neighbor(a);
+            ctx->neighbor(a)           = ctx->neighbor(b);
+            ctx->neighbor(b)           = neighborA;
+
+            // Nodes that were adjacent now point at themselves, point them at each other
+            u32 const nodes[2] = {a, b};
+            for (u32 i = 0; i < 2; ++i)
+            {
+                u32 const node  = nodes[i];
+                u32 const other = nodes[1 - i];
+                if (ctx->neighbor(node).getPrev() == node)
+                    ctx->neighbor(node).setPrev(other);
+                if (ctx->neighbor(node).getNext() == node)
+                    ctx->neighbor(node).setNext(other);
+            }
+
+            // Outer neighbors
+            for (u32 i = 0; i < 2; ++i)
+            {
+                u32 const node = nodes[i];
+                u32 const prev = ctx->neighbor(node).getPrev();
+                u32 const next = ctx->neighbor(node).getNext();
+                if (prev != TContext::unused && prev != a && prev != b)
+                    ctx->neighbor(prev).setNext(node);
+                if (next != TContext::unused && next != a && next != b)
+                    ctx->neighbor(next).setPrev(node);
+            }
+            if (ctx->m_tailNode == a || ctx->m_tailNode == b)
+                ctx->m_tailNode = ctx->m_tailNode == a ? b : a;
+        }
+
+        // One budget-limited step of a defragmentation pass. The pass first walks back to the start of the heap,
+        // then visits the used nodes in address order and moves each one to the lowest free space below it.
+        template <typename TContext>
+        static bool sDefragPlan(TContext* ctx, typename TContext::allocator_t::defrag_move_t* outMoves, u32 maxMoves, u32& outNumMoves, typename TContext::offset_t maxBytes, u32 visits, typename TContext::offset_t maxAlignment)
+        {
+            typedef typename TContext::offset_t offset_t;
+
+            outNumMoves = 0;
+
+            u32 node = ctx->fromHandle(ctx->m_defragCursor);
+            if (node == TContext::unused)
+            {
+                // Start a new pass from any free node, without free space there is nothing to compact
+                u32 const binIndex = sFindNonEmptyBin(ctx, 0);
+                if (binIndex == NO_SPACE)
+                    return false;
+                node                 = ctx->m_binIndices[binIndex];
+                ctx->m_defragSeeking = true;
+            }
+
+            if (ctx->m_defragSeeking)
+            {
+                while (ctx->neighbor(node).getPrev() != TContext::unused && visits > 0)
+                {
+                    node = ctx->neighbor(node).getPrev();
+                    visits -= 1;
+                }
+                if (ctx->neighbor(node).getPrev() != TContext::unused)
+                {
+                    // Out of budget, no two free nodes are adjacent so 'node' or its previous neighbor is used
+                    if (!ctx->neighbor(node).isUsed())
+                        node = ctx->neighbor(node).getPrev();
+                    ctx->m_defragCursor = ctx->toHandle(node);
+                    return true;
+                }
+                ctx->m_defragSeeking = false;
+            }
+
+            offset_t bytes = 0;
+            while (node != TContext::unused && visits > 0 && outNumMoves < maxMoves)
+            {
+                visits -= 1;
+                if (ctx->neighbor(node).isUsed())
+                {
+                    offset_t const offset = ctx->range(node).offset;
+                    offset_t const size   = ctx->range(node).size;
+                    if (offset > 0 && size > 0 && size <= (maxBytes - bytes) && ctx->hasFreeNodes(2))
+                    {
+                        offset_t const lowestBit = offset & (~offset + 1);
+                        offset_t const alignment = lowestBit < maxAlignment ? lowestBit : maxAlignment;
+                        u32 const      resource  = ctx->resource(node);
+
+                        offset_t  dstOffset;
+                        u32 const space = sFindLowerSpace(ctx, size, alignment, resource, offset, visits, dstOffset);
+                        if (space != TContext::unused)
+                        {
+                            u32 const target = sPlaceInNode(ctx, space, dstOffset, size, resource);
+
+                            typename TContext::allocator_t::defrag_move_t& move = outMoves[outNumMoves++];
+                            move.handle                                         = ctx->toHandle(node);
+                            move.target                                         = ctx->toHandle(target);
+                            move.srcOffset                                      = offset;
+                            move.dstOffset                                      = dstOffset;
+                            move.size                                           = size;
+                            bytes += size;
+                        }
+                    }
+                }
+                node = ctx->neighbor(node).getNext();
+            }
+
+            // Continue at the next used node, it has not been visited so it is not moved by this plan
+            if (node != TContext::unused && !ctx->neighbor(node).isUsed())
+                node = ctx->neighbor(node).getNext();
+
+            if (node == TContext::unused)
+            {
+                // Pass complete, the next call starts a new one
+                ctx->m_defragCursor = INVALID_HANDLE;
+                return false;
+            }
+
+            ctx->m_defragCursor = ctx->toHandle(node);
+            return true;
+        }
+
+        // Snapshot image: header, bin tables, then every node chunk exactly as it is laid out in memory, each
+        // starting at an 8 byte boundary. Restoring is a copy per chunk, or no copy at all when the chunks are
+        // used in place.
+        static constexpr u32 SNAPSHOT_MAGIC   = 0x4c4b4c42;  // 'BLKL'
+        static constexpr u32 SNAPSHOT_VERSION = 3;
+
+        struct snapshot_header_t
+        {
+            u32 magic;
+            u32 version;
+            u32 config;  // sizeof(index_t), MANTISSA_BITS and sizeof(offset_t)
+            u32 imageSize;
+            u64 size;
+            u64 granularity;
+            u64 freeStorage;
+            u64 usedBinsTop;
+            u32 maxAllocs;
+            u32 placement;
+            u32 defragCursor;
+            u32 defragSeeking;
+            u32 numChunks;
+            u32 numNodes;
+            u32 freeNodeCount;
+            u32 freeNodeHead;
+            u32 tailNode;
+        };
+
+        static inline u32 sAlign8(u32 offset) { return (offset + 7) & ~7u; }
+
+        template <typename TContext>
+        static inline u32 sSnapshotConfig()
+        {
+            return ((u32)sizeof(typename TContext::index_t) << 16) | (TContext::MANTISSA_BITS << 8) | (u32)sizeof(typename TContext::offset_t);
+        }
+
+        // Offset of the first chunk in the image
+        template <typename TContext>
+        static inline u32 sSnapshotChunksOffset()
+        {
+            u32 const usedBins = sizeof(typename TContext::leaf_mask_t) * TContext::NUM_TOP_BINS;
+            u32 const bins     = sizeof(typename TContext::index_t) * TContext::NUM_LEAF_BINS;
+            return sAlign8(sAlign8(sAlign8((u32)sizeof(snapshot_header_t) + usedBins) + bins) + bins);
+        }
+
+        // Validates the header, the bins and the chunk layout they describe, returns the image size or 0.
+        // The nodes themselves are not walked, restoring stays a copy.
+        template <typename TContext>
+        static u32 sSnapshotCheck(void const* image, u32 imageSize)
+        {
+            typedef typename TContext::offset_t    offset_t;
+            typedef typename TContext::index_t     index_t;
+            typedef typename TContext::leaf_mask_t leaf_mask_t;
+            typedef typename TContext::top_mask_t  top_mask_t;
+
+            if (image == nullptr || imageSize < sSnapshotChunksOffset<TContext>() || ((uint_t)image & 7) != 0)
+                return 0;
+            snapshot_header_t const* header = (snapshot_header_t const*)image;
+            if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION || header->config != sSnapshotConfig<TContext>())
+                return 0;
+            if (header->imageSize > imageSize || header->numChunks > MAX_NODE_CHUNKS || header->numChunks == 0)
+                return 0;
+            if (header->numNodes <= TContext::firstIndexOfChunk(header->numChunks - 1) || header->numNodes > TContext::firstIndexOfChunk(header->numChunks))
+                return 0;
+            if (header->numNodes > TContext::MAX_NODES || header->maxAllocs > TContext::MAX_NODES || header->placement > PLACEMENT_BEST_FIT)
+                return 0;
+            if (header->size != (offset_t)header->size || header->freeStorage > header->size)
+                return 0;
+            if (header->granularity == 0 || (header->granularity & (header->granularity - 1)) != 0)
+                return 0;
+            if (header->freeNodeCount > header->numNodes || (header->freeNodeCount == 0) != (header->freeNodeHead == TContext::unused))
+                return 0;
+            if (header->freeNodeHead != TContext::unused && header->freeNodeHead >= header->numNodes)
+                return 0;
+            if (header->tailNode == TContext::unused ? header->size > 0 : header->tailNode >= header->numNodes)
+                return 0;
+
+            // Every bin that is marked as used has a node, every other bin has none
+            u8 const*          bytes      = (u8 const*)image;
+            leaf_mask_t const* usedBins   = (leaf_mask_t const*)(bytes + sizeof(snapshot_header_t));
+            index_t const*     binIndices = (index_t const*)(bytes + sAlign8(sizeof(snapshot_header_t) + sizeof(leaf_mask_t) * TContext::NUM_TOP_BINS));
+            index_t const*     binRoots   = (index_t const*)((u8 const*)binIndices + sAlign8(sizeof(index_t) * TContext::NUM_LEAF_BINS));
+            for (u32 top = 0; top < TContext::NUM_TOP_BINS; ++top)
+            {
+                bool const topUsed = (header->usedBinsTop & ((top_mask_t)1 << top)) != 0;
+                if (topUsed != (usedBins[top] != 0))
+                    return 0;
+            }
+            if (TContext::NUM_TOP_BINS < 64 && (header->usedBinsTop >> TContext::NUM_TOP_BINS) != 0)
+                return 0;
+            for (u32 bin = 0; bin < TContext::NUM_LEAF_BINS; ++bin)
+            {
+                bool const used = (usedBins[bin >> TContext::TOP_BINS_INDEX_SHIFT] & (1u << (bin & TContext::LEAF_BINS_INDEX_MASK))) != 0;
+                if (used != (binIndices[bin] != TContext::unused))
+                    return 0;
+                if (binIndices[bin] != TContext::unused && binIndices[bin] >= header->numNodes)
+                    return 0;
+                if (binRoots[bin] != TContext::unused && binRoots[bin] >= header->numNodes)
+                    return 0;
+            }
+
+            u32 end = sSnapshotChunksOffset<TContext>();
+            for (u32 c = 0; c < header->numChunks; ++c)
+            {
+                u32 const chunkSize = (c + 1 < header->numChunks) ? (NODE_CHUNK_SIZE << c) : (header->numNodes - TContext::firstIndexOfChunk(c));
+                end                 = sAlign8(end + (u32)TContext::chunkBytes(chunkSize, header->placement));
+            }
+            return end == header->imageSize ? end : 0;
+        }
+
+        // Initializes an empty context from a checked image, the chunks are copied or borrowed from the image
+        template <typename TContext>
+        static bool sSnapshotLoad(TContext* ctx, alloc_t* allocator, u8* image, bool inPlace)
+        {
+            snapshot_header_t const* header = (snapshot_header_t const*)image;
+            ctx->m_allocator                = allocator;
+            ctx->m_size                     = (typename TContext::offset_t)header->size;
+            ctx->m_maxAllocs                = header->maxAllocs;
+            ctx->m_granularity              = (typename TContext::offset_t)header->granularity;
+            ctx->m_placement                = header->placement;
+            ctx->m_defragCursor             = header->defragCursor;
+            ctx->m_defragSeeking            = header->defragSeeking != 0;
+            ctx->m_restored                 = true;
+            ctx->m_freeStorage              = (typename TContext::offset_t)header->freeStorage;
+            ctx->m_usedBinsTop              = (typename TContext::top_mask_t)header->usedBinsTop;
+
+            u32 offset = sizeof(snapshot_header_t);
+            memcpy(ctx->m_usedBins, image + offset, sizeof(ctx->m_usedBins));
+            offset = sAlign8(offset + sizeof(ctx->m_usedBins));
+            memcpy(ctx->m_binIndices, image + offset, sizeof(ctx->m_binIndices));
+            offset = sAlign8(offset + sizeof(ctx->m_binIndices));
+            memcpy(ctx->m_binRoots, image + offset, sizeof(ctx->m_binRoots));
+            offset = sSnapshotChunksOffset<TContext>();
+
+            ctx->m_numNodes  = header->numNodes;
+            ctx->m_numChunks = header->numChunks;
+            for (u32 c = 0; c < header->numChunks; ++c)
+            {
+                u32 const chunkSize = ctx->chunkSize(c);
+                u32 const bytes     = (u32)TContext::chunkBytes(chunkSize, ctx->m_placement);
+                u8*       mem       = image + offset;
+                if (inPlace)
+                {
+                    ctx->m_borrowedChunks |= 1u << c;
+                }
+                else
+                {
+                    mem = (u8*)allocator->allocate(bytes, sizeof(typename TContext::offset_t));
+                    if (mem == nullptr)
+                    {
+                        ctx->m_numChunks = c;
+                        return false;
+                    }
+                    memcpy(mem, image + offset, bytes);
+                }
+                ctx->setChunk(c, mem, chunkSize);
+                offset = sAlign8(offset + bytes);
+            }
+            ctx->m_freeNodeCount = header->freeNodeCount;
+            ctx->m_freeNodeHead  = header->freeNodeHead;
+            ctx->m_tailNode      = header->tailNode;
+            return true;
+        }
+
+        // 'nodeIndex' is 'unused' for a failed allocation
+        template <typename TContext>
+        static void sTraceAllocate(TContext const* ctx, typename TContext::offset_t size, typename TContext::offset_t alignment, u32 resource, u32 nodeIndex)
+        {
+            if (nodeIndex == TContext::unused)
+                ctx->m_trace->recordAllocate(size, alignment, resource, INVALID_HANDLE, 0);
+            else
+                ctx->m_trace->recordAllocate(size, alignment, resource, ctx->toHandle(nodeIndex), ctx->range(nodeIndex).offset);
+        }
+
+        // block_allocator_t...
+        template <typename TConfig>
+        block_allocator_T<TConfig>::block_allocator_T()
+            : m_context(nullptr)
+        {
+        }
+
+        template <typename TConfig>
+        block_allocator_T<TConfig>::block_allocator_T(block_allocator_T&& other)
+            : m_context(other.m_context)
+        {
+            other.m_context = nullptr;
+        }
+
+        template <typename TConfig>
+        block_allocator_T<TConfig>::~block_allocator_T()
+        {
+        }
+
+        template <typename TConfig>
+        void block_allocator_T<TConfig>::init(alloc_t* allocator, offset_t size, u32 maxAllocs, offset_t bufferImageGranularity, u32 placement)
+        {
+            ASSERT(!m_context);
+
+            m_context = allocator->construct<context_t>();
+            m_context->init(allocator, size, maxAllocs, bufferImageGranularity, placement);
+            m_context->growNodes();
+
+            // Start state: Whole storage as one big node
+            // Algorithm will split remainders and push them back as smaller nodes
+            m_context->m_tailNode = sInsertNodeIntoBin(m_context, m_context->m_size, (offset_t)0);
+        }
+
+        template <typename TConfig>
+        void block_allocator_T<TConfig>::destroy()
+        {
+            ASSERT(m_context);
+            alloc_t* allocator = m_context->m_allocator;
+            m_context->destroy();
+            allocator->destruct(m_context);
+            m_context = nullptr;
+        }
+
+        template <typename TConfig>
+        bool block_allocator_T<TConfig>::grow(offset_t newSize)
+        {
+            if (newSize <= m_context->m_size)
+                return newSize == m_context->m_size;
+            if (!m_context->hasFreeNodes(1))
+            {
+                if (m_context->m_trace != nullptr)
+                    m_context->m_trace->recordGrow(newSize, false);
+                return false;
+            }
+
+            offset_t const oldSize = m_context->m_size;
+            u32 const      tail    = m_context->m_tailNode;
+            if (tail != context_t::unused && !m_context->neighbor(tail).isUsed())
+            {
+                // Extend the free tail, it is put in the bin of its new size
+                offset_t const offset = m_context->range(tail).offset;
+                u32 const      prev   = m_context->neighbor(tail).getPrev();
+                sRemoveNodeFromBin(m_context, tail);
+                u32 const node = sInsertNodeIntoBin(m_context, newSize - offset, offset);
+                if (prev != context_t::unused)
+                {
+                    m_context->neighbor(node).setPrev(prev);
+                    m_context->neighbor(prev).setNext(node);
+                }
+                m_context->m_tailNode = node;
+            }
+            else
+            {
+                u32 const node = sInsertNodeIntoBin(m_context, newSize - oldSize, oldSize);
+                if (tail != context_t::unused)
+                {
+                    m_context->neighbor(node).setPrev(tail);
+                    m_context->neighbor(tail).setNext(node);
+                }
+                m_context->m_tailNode = node;
+            }
+
+            m_context->m_size = newSize;
+            if (m_context->m_trace != nullptr)
+                m_context->m_trace->recordGrow(newSize, true);
+            return true;
+        }
+
+        template <typename TConfig>
+        typename block_allocator_T<TConfig>::offset_t block_allocator_T<TConfig>::shrinkToFit()
+        {
+            u32 const tail = m_context->m_tailNode;
+            if (tail != context_t::unused && !m_context->neighbor(tail).isUsed())
+            {
+                u32 const prev = m_context->neighbor(tail).getPrev();
+                if (prev != context_t::unused)
+                    m_context->neighbor(prev).setNext(context_t::unused);
+                m_context->m_size     = m_context->range(tail).offset;
+                m_context->m_tailNode = prev;
+                sRemoveNodeFromBin(m_context, tail);
+            }
+            if (m_context->m_trace != nullptr)
+                m_context->m_trace->recordShrink(m_context->m_size);
+            return m_context->m_size;
+        }
+
+        template <typename TConfig>
+        typename block_allocator_T<TConfig>::offset_t block_allocator_T<TConfig>::size() const
+        {
+            return m_context->m_size;
+        }
+
+        template <typename TConfig>
+        handle_t block_allocator_T<TConfig>::allocateHandle(offset_t size, offset_t alignment, u32 resource)
+        {
+            u32 const      nodeIndex = sAllocateAligned(m_context, size, alignment, resource);
+            handle_t const handle    = nodeIndex != context_t::unused ? m_context->toHandle(nodeIndex) : INVALID_HANDLE;
+            if (m_context->m_trace != nullptr)
+                sTraceAllocate(m_context, size, alignment, resource, nodeIndex);
+            return handle;
+        }
+
+        template <typename TConfig>
+        bool block_allocator_T<TConfig>::freeHandle(handle_t handle)
+        {
+            u32 const nodeIndex = m_context->fromHandle(handle);
+            if (nodeIndex == context_t::unused)
+                return false;
+            if (m_context->m_trace != nullptr)
+                m_context->m_trace->recordFree(handle);
+            sFree(m_context, nodeIndex);
+            return true;
+        }
+
+        template <typename TConfig>
+        bool block_allocator_T<TConfig>::reallocate(handle_t handle, offset_t newSize)
+        {
+            u32 const nodeIndex = m_context->fromHandle(handle);
+            if (nodeIndex == context_t::unused)
+                return false;
+            bool const resized = sReallocate(m_context, nodeIndex, newSize);
+            if (m_context->m_trace != nullptr)
+                m_context->m_trace->recordReallocate(handle, newSize, resized);
+            return resized;
+        }
+
+        template <typename TConfig>
+        u32 block_allocator_T<TConfig>::allocateMany(offset_t const* sizes, u32 count, handle_t* outHandles, offset_t alignment, u32 resource)
+        {
+            offset_t const granularity = (resource != RESOURCE_ANY) ? m_context->m_granularity : 1;
+            if (alignment <= 1 && granularity <= 1)
+            {
+                u32 const numAllocated = sAllocateMany(m_context, sizes, count, outHandles);
+                if (m_context->m_trace != nullptr)
+                {
+                    // A batch replays as one allocateMany, which packs its requests differently from single calls
+                    m_context->m_trace->recordBatch(count);
+                    for (u32 i = 0; i < count; ++i)
+                        sTraceAllocate(m_context, sizes[i], alignment, resource, outHandles[i] != INVALID_HANDLE ? (outHandles[i] & context_t::HANDLE_INDEX_MASK) : (u32)context_t::unused);
+                }
+                return numAllocated;
+            }
+
+            // Aligned and granularity constrained requests are placed one by one
+            u32 numAllocated = 0;
+            for (u32 i = 0; i < count; ++i)
+            {
+                outHandles[i] = allocateHandle(sizes[i], alignment, resource);
+                numAllocated += (outHandles[i] != INVALID_HANDLE) ? 1 : 0;
+            }
+            return numAllocated;
+        }
+
+        template <typename TConfig>
+        u32 block_allocator_T<TConfig>::freeMany(handle_t const* handles, u32 count, offset_t* outFreedBytes)
+        {
+            // The trace gets the allocations that were freed, without the stale handles and the duplicates
+            handle_t* freedHandles = nullptr;
+            if (m_context->m_trace != nullptr && count > 0)
+                freedHandles = g_allocate_array<handle_t>(m_context->m_allocator, count);
+
+            offset_t  freedBytes;
+            u32 const numFreed = sFreeMany(m_context, handles, count, freedBytes, freedHandles);
+            if (freedHandles != nullptr)
+            {
+                m_context->m_trace->recordBatch(numFreed);
+                for (u32 i = 0; i < numFreed; ++i)
+                    m_context->m_trace->recordFree(freedHandles[i]);
+                g_deallocate_array(m_context->m_allocator, freedHandles);
+            }
+            if (outFreedBytes != nullptr)
+                *outFreedBytes = freedBytes;
+            return numFreed;
+        }
+
+        template <typename TConfig>
+        bool block_allocator_T<TConfig>::isValid(handle_t handle) const
+        {
+            return m_context->fromHandle(handle) != context_t::unused;
+        }
+
+        template <typename TConfig>
+        typename block_allocator_T<TConfig>::offset_t block_allocator_T<TConfig>::getOffset(handle_t handle) const
+        {
+            u32 const nodeIndex = m_context->fromHandle(handle);
+            return nodeIndex != context_t::unused ? m_context->range(nodeIndex).offset : allocation_t::NO_SPACE;
+        }
+
+        template <typename TConfig>
+        typename block_allocator_T<TConfig>::offset_t block_allocator_T<TConfig>::getSize(handle_t handle) const
+        {
+            u32 const nodeIndex = m_context->fromHandle(handle);
+            return nodeIndex != context_t::unused ? m_context->range(nodeIndex).size : 0;
+        }
+
+        template <typename TConfig>
+        typename block_allocator_T<TConfig>::allocation_t* block_allocator_T<TConfig>::allocate(offset_t size)
+        {
+            u32 const nodeIndex = sAllocate(m_context, size);
+            if (m_context->m_trace != nullptr)
+                sTraceAllocate(m_context, size, (offset_t)1, RESOURCE_ANY, nodeIndex);
+            if (nodeIndex == context_t::unused)
+                return nullptr;
+            return (allocation_t*)&m_context->range(nodeIndex);
+        }
+
+        template <typename TConfig>
+        typename block_allocator_T<TConfig>::allocation_t* block_allocator_T<TConfig>::allocate(offset_t size, offset_t alignment, u32 resource)
+        {
+            u32 const nodeIndex = sAllocateAligned(m_context, size, alignment, resource);
+            if (m_context->m_trace != nullptr)
+                sTraceAllocate(m_context, size, alignment, resource, nodeIndex);
+            if (nodeIndex == context_t::unused)
+                return nullptr;
+            return (allocation_t*)&m_context->range(nodeIndex);
+        }
+
+        template <typename TConfig>
+        void block_allocator_T<TConfig>::free(allocation_t* allocation)
+        {
+            // ASSERT(allocation != nullptr);
+            u32 const nodeIndex = m_context->rangeToIndex((typename context_t::range_t const*)allocation);
+            if (nodeIndex == context_t::unused || !m_context->neighbor(nodeIndex).isUsed())
+                return;
+            if (m_context->m_trace != nullptr)
+                m_context->m_trace->recordFree(m_context->toHandle(nodeIndex));
+            sFree(m_context, nodeIndex);
+        }
+
+        template <typename TConfig>
+        bool block_allocator_T<TConfig>::reallocate(allocation_t* allocation, offset_t newSize)
+        {
+            u32 const nodeIndex = m_context->rangeToIndex((typename context_t::range_t const*)allocation);
+            if (nodeIndex == context_t::unused || !m_context->neighbor(nodeIndex).isUsed())
+                return false;
+            bool const resized = sReallocate(m_context, nodeIndex, newSize);
+            if (m_context->m_trace != nullptr)
+                m_context->m_trace->recordReallocate(m_context->toHandle(nodeIndex), newSize, resized);
+            return resized;
+        }
+
+        template <typename TConfig>
+        handle_t block_allocator_T<TConfig>::getHandle(allocation_t const* allocation) const
+        {
+            u32 const nodeIndex = m_context->rangeToIndex((typename context_t::range_t const*)allocation);
+            if (nodeIndex == context_t::unused || !m_context->neighbor(nodeIndex).isUsed())
+                return INVALID_HANDLE;
+            return m_context->toHandle(nodeIndex);
+        }
+
+        template <typename TConfig>
+        typename block_allocator_T<TConfig>::allocation_t const* block_allocator_T<TConfig>::getAllocation(handle_t handle) const
+        {
+            u32 const nodeIndex = m_context->fromHandle(handle);
+            if (nodeIndex == context_t::unused)
+                return nullptr;
+            return (allocation_t const*)&m_context->range(nodeIndex);
+        }
+
+        template <typename TConfig>
+        bool block_allocator_T<TConfig>::defragPlan(defrag_move_t* outMoves, u32 maxMoves, u32& outNumMoves, offset_t maxBytes, u32 maxVisits, offset_t maxAlignment)
+        {
+            // A trace has no events for moves, a replay would diverge from the first moved allocation on
+            if (m_context->m_trace != nullptr)
+            {
+                outNumMoves = 0;
+                return false;
+            }
+            bool const more           = sDefragPlan(m_context, outMoves, maxMoves, outNumMoves, maxBytes, maxVisits, maxAlignment > 1 ? maxAlignment : 1);
+            m_context->m_movesPlanned = outNumMoves > 0;
+            return more;
+        }
+
+        template <typename TConfig>
+        void block_allocator_T<TConfig>::defragCommit(defrag_move_t const* moves, u32 count)
+        {
+            m_context->m_movesPlanned = false;
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32 const target = m_context->fromHandle(moves[i].target);
+                if (target == context_t::unused)
+                    continue;
+
+                // The allocation takes the place of the reserved destination, the old range is freed.
+                // An allocation that was freed or resized while its move was in flight does not match the
+                // copy that was made, it stays where it is and only the destination is released.
+                u32 const node = m_context->fromHandle(moves[i].handle);
+                if (node != context_t::unused && m_context->range(node).offset == moves[i].srcOffset && m_context->range(node).size == moves[i].size)
+                    sSwapNodes(m_context, node, target);
+                sFree(m_context, target);
+            }
+        }
+
+        template <typename TConfig>
+        void block_allocator_T<TConfig>::defragCancel(defrag_move_t const* moves, u32 count)
+        {
+            m_context->m_movesPlanned = false;
+            for (u32 i = 0; i < count; ++i)
+                freeHandle(moves[i].target);
+        }
+
+        template <typename TConfig>
+        bool block_allocator_T<TConfig>::setTrace(trace_recorder_t* recorder)
+        {
+            // A replay starts from an empty heap of the recorded size, it cannot rebuild a restored heap or
+            // the destinations that defragPlan reserved
+            if (recorder != nullptr && (m_context->m_restored || m_context->m_movesPlanned))
+                return false;
+            m_context->m_trace = recorder;
+            if (recorder != nullptr)
+                recorder->recordBegin(m_context->m_size, m_context->m_granularity, m_context->m_placement);
+            return true;
+        }
+
+        template <typename TConfig>
+        void block_allocator_T<TConfig>::storageReport(storage_report_t& report) const
+        {
+            offset_t largestFreeRegion = 0;
+            offset_t freeStorage       = 0;
+
+            // Out of allocations? -> Zero free space
+            if (m_context->m_freeNodeCount > 0 || m_context->m_numNodes < m_context->m_maxAllocs)
+            {
+                freeStorage = m_context->m_freeStorage;
+                if (m_context->m_usedBinsTop)
+                {
+                    u32 topBinIndex   = (sizeof(m_context->m_usedBinsTop) * 8 - 1) - lzcnt_nonzero(m_context->m_usedBinsTop);
+                    u32 leafBinIndex  = 31 - lzcnt_nonzero((u32)m_context->m_usedBins[topBinIndex]);
+                    largestFreeRegion = SmallFloat::floatToUint<MANTISSA_BITS, offset_t>((topBinIndex << context_t::TOP_BINS_INDEX_SHIFT) | leafBinIndex);
+                    ASSERT(freeStorage >= largestFreeRegion);
+                }
+            }
+
+            report.totalFreeSpace    = freeStorage;
+            report.largestFreeRegion = largestFreeRegion;
+            report.numberOfBins      = NUM_LEAF_BINS;
+            report.numberOfUsedBins  = 0;
+            for (u32 i = 0; i < NUM_LEAF_BINS; i++)
+                report.numberOfUsedBins += (m_context->m_binIndices[i] != context_t::unused) ? 1 : 0;
+        }
+
+        template <typename TConfig>
+        void block_allocator_T<TConfig>::storageBinState(u32 binIndex, bin_report_t& binState) const
+        {
+            if (binIndex >= NUM_LEAF_BINS)
+            {
+                binState.size  = 0;
+                binState.count = 0;
                 return;
             }
 
             u32 count     = 0;
             u32 nodeIndex = m_context->m_binIndices[binIndex];
-            while (nodeIndex != node_t::unused)
+            while (nodeIndex != context_t::unused)
             {
-                nodeIndex = m_context->m_nodes[nodeIndex].binListNext;
+                nodeIndex = m_context->link(nodeIndex).next;
                 count++;
             }
-            binState = {.size = SmallFloat::floatToUint(binIndex), .count = count};
+            binState.size  = SmallFloat::floatToUint<MANTISSA_BITS, offset_t>(binIndex);
+            binState.count = count;
+        }
+
+        template <typename TConfig>
+        u32 block_allocator_T<TConfig>::saveSize() const
+        {
+            u32 size = sSnapshotChunksOffset<context_t>();
+            for (u32 c = 0; c < m_context->m_numChunks; ++c)
+                size = sAlign8(size + (u32)context_t::chunkBytes(m_context->chunkSize(c), m_context->m_placement));
+            return size;
+        }
+
+        template <typename TConfig>
+        u32 block_allocator_T<TConfig>::save(void* buffer, u32 bufferSize) const
+        {
+            context_t const* ctx       = m_context;
+            u32 const        imageSize = saveSize();
+            if (bufferSize < imageSize)
+                return 0;
+
+            u8* const image = (u8*)buffer;
+            memset(image, 0, imageSize);  // Padding is part of the image, keep it deterministic
+
+            snapshot_header_t* header = (snapshot_header_t*)image;
+            header->magic             = SNAPSHOT_MAGIC;
+            header->version           = SNAPSHOT_VERSION;
+            header->config            = sSnapshotConfig<context_t>();
+            header->imageSize         = imageSize;
+            header->size              = ctx->m_size;
+            header->granularity       = ctx->m_granularity;
+            header->freeStorage       = ctx->m_freeStorage;
+            header->usedBinsTop       = ctx->m_usedBinsTop;
+            header->maxAllocs         = ctx->m_maxAllocs;
+            header->placement         = ctx->m_placement;
+            header->defragCursor      = ctx->m_defragCursor;
+            header->defragSeeking     = ctx->m_defragSeeking ? 1 : 0;
+            header->numChunks         = ctx->m_numChunks;
+            header->numNodes          = ctx->m_numNodes;
+            header->freeNodeCount     = ctx->m_freeNodeCount;
+            header->freeNodeHead      = ctx->m_freeNodeHead;
+            header->tailNode          = ctx->m_tailNode;
+
+            u32 offset = sizeof(snapshot_header_t);
+            memcpy(image + offset, ctx->m_usedBins, sizeof(ctx->m_usedBins));
+            offset = sAlign8(offset + sizeof(ctx->m_usedBins));
+            memcpy(image + offset, ctx->m_binIndices, sizeof(ctx->m_binIndices));
+            offset = sAlign8(offset + sizeof(ctx->m_binIndices));
+            memcpy(image + offset, ctx->m_binRoots, sizeof(ctx->m_binRoots));
+            offset = sSnapshotChunksOffset<context_t>();
+
+            // The ranges, links, neighbors, trees and generations of a chunk are one allocation
+            for (u32 c = 0; c < ctx->m_numChunks; ++c)
+            {
+                u32 const bytes = (u32)context_t::chunkBytes(ctx->chunkSize(c), ctx->m_placement);
+                memcpy(image + offset, ctx->m_ranges[c], bytes);
+                offset = sAlign8(offset + bytes);
+            }
+            return imageSize;
+        }
+
+        template <typename TConfig>
+        bool block_allocator_T<TConfig>::restore(alloc_t* allocator, void const* image, u32 imageSize)
+        {
+            ASSERT(!m_context);
+            if (sSnapshotCheck<context_t>(image, imageSize) == 0)
+                return false;
+
+            m_context = allocator->construct<context_t>();
+            if (!sSnapshotLoad(m_context, allocator, (u8*)image, false))
+            {
+                destroy();
+                return false;
+            }
+            return true;
+        }
+
+        template <typename TConfig>
+        bool block_allocator_T<TConfig>::restoreInPlace(alloc_t* allocator, void* image, u32 imageSize)
+        {
+            ASSERT(!m_context);
+            if (sSnapshotCheck<context_t>(image, imageSize) == 0)
+                return false;
+
+            m_context = allocator->construct<context_t>();
+            if (!sSnapshotLoad(m_context, allocator, (u8*)image, true))
+            {
+                destroy();
+                return false;
+            }
+            return true;
         }
-    }
 
-}  // namespace nalloc
+        template class block_allocator_T<block_config_T<u16, 3, u32>>;
+        template class block_allocator_T<block_config_T<u16, 4, u32>>;
+        template class block_allocator_T<block_config_T<u32, 3, u32>>;
+        template class block_allocator_T<block_config_T<u32, 4, u32>>;
+        template class block_allocator_T<block_config_T<u32, 3, u64>>;
+        template class block_allocator_T<block_config_T<u32, 4, u64>>;
+    }  // namespace nalloc
 }  // namespace ncore
@@ -0,0 +1,203 @@
+#include "ccore/c_target.h"
+#include "ccore/c_debug.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/c_vkdeferredfree.h"
+
+#include <mutex>
+
+namespace ncore
+{
+    namespace nvkmem
+    {
+        struct deferred_entry_t
+        {
+            allocation_t allocation;
+            u64          value;
+        };
+
+        struct deferred_list_t
+        {
+            deferred_entry_t* items;
+            u32               count;
+            u32               capacity;
+        };
+
+        static void sReserve(alloc_t* allocator, deferred_list_t& list, u32 count)
+        {
+            if (list.capacity >= count)
+                return;
+            u32 capacity = list.capacity == 0 ? 64 : list.capacity;
+            while (capacity < count)
+                capacity *= 2;
+            list.items    = g_reallocate_array(allocator, list.items, list.count, capacity);
+            list.capacity = capacity;
+        }
+
+        static void sAppend(alloc_t* allocator, deferred_list_t& list, deferred_list_t& from)
+        {
+            sReserve(allocator, list, list.count + from.count);
+            for (u32 i = 0; i < from.count; ++i)
+                list.items[list.count + i] = from.items[i];
+            list.count += from.count;
+            from.count = 0;
+        }
+
+        static void sRelease(alloc_t* allocator, deferred_list_t& list)
+        {
+            if (list.items != nullptr)
+                g_deallocate_array(allocator, list.items);
+            list.items    = nullptr;
+            list.count    = 0;
+            list.capacity = 0;
+        }
+
+        struct deferred_free_t::queue_t
+        {
+            std::mutex      mutex;
+            deferred_list_t entries;
+        };
+
+        struct deferred_free_t::context_t
+        {
+            alloc_t*          m_allocator;
+            memory_manager_t* m_manager;
+
+            std::mutex      m_queuesMutex;
+            queue_t**       m_queues;
+            u32             m_numQueues;
+            u32             m_maxQueues;
+            deferred_list_t m_orphans;  // Entries of destroyed queues
+
+            // Owned by release()
+            deferred_list_t m_pending;
+            allocation_t*   m_batch;
+            u32             m_batchCapacity;
+        };
+
+        deferred_free_t::deferred_free_t()
+            : m_context(nullptr)
+        {
+        }
+
+        deferred_free_t::~deferred_free_t() {}
+
+        void deferred_free_t::init(alloc_t* allocator, memory_manager_t* manager)
+        {
+            ASSERT(!m_context);
+            m_context                  = allocator->construct<context_t>();
+            m_context->m_allocator     = allocator;
+            m_context->m_manager       = manager;
+            m_context->m_queues        = nullptr;
+            m_context->m_numQueues     = 0;
+            m_context->m_maxQueues     = 0;
+            m_context->m_orphans       = {nullptr, 0, 0};
+            m_context->m_pending       = {nullptr, 0, 0};
+            m_context->m_batch         = nullptr;
+            m_context->m_batchCapacity = 0;
+        }
+
+        void deferred_free_t::destroy()
+        {
+            ASSERT(m_context);
+            ASSERT(m_context->m_numQueues == 0);
+            release(0xffffffffffffffffull);
+
+            alloc_t* allocator = m_context->m_allocator;
+            if (m_context->m_queues != nullptr)
+                g_deallocate_array(allocator, m_context->m_queues);
+            if (m_context->m_batch != nullptr)
+                g_deallocate_array(allocator, m_context->m_batch);
+            sRelease(allocator, m_context->m_orphans);
+            sRelease(allocator, m_context->m_pending);
+            allocator->destruct(m_context);
+            m_context = nullptr;
+        }
+
+        deferred_free_t::queue_t* deferred_free_t::createQueue()
+        {
+            context_t* ctx   = m_context;
+            queue_t*   queue = ctx->m_allocator->construct<queue_t>();
+            queue->entries   = {nullptr, 0, 0};
+
+            std::lock_guard<std::mutex> lock(ctx->m_queuesMutex);
+            if (ctx->m_numQueues == ctx->m_maxQueues)
+            {
+                u32 const maxQueues = ctx->m_maxQueues == 0 ? 8 : ctx->m_maxQueues * 2;
+                ctx->m_queues       = g_reallocate_array(ctx->m_allocator, ctx->m_queues, ctx->m_maxQueues, maxQueues);
+                ctx->m_maxQueues    = maxQueues;
+            }
+            ctx->m_queues[ctx->m_numQueues++] = queue;
+            return queue;
+        }
+
+        void deferred_free_t::destroyQueue(queue_t* queue)
+        {
+            context_t* ctx = m_context;
+            {
+                std::lock_guard<std::mutex> lock(ctx->m_queuesMutex);
+                for (u32 i = 0; i < ctx->m_numQueues; ++i)
+                {
+                    if (ctx->m_queues[i] == queue)
+                    {
+                        ctx->m_queues[i] = ctx->m_queues[--ctx->m_numQueues];
+                        break;
+                    }
+                }
+                sAppend(ctx->m_allocator, ctx->m_orphans, queue->entries);
+            }
+            sRelease(ctx->m_allocator, queue->entries);
+            ctx->m_allocator->destruct(queue);
+        }
+
+        void deferred_free_t::enqueue(queue_t* queue, allocation_t const& allocation, u64 completionValue)
+        {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            sReserve(m_context->m_allocator, queue->entries, queue->entries.count + 1);
+            deferred_entry_t& entry = queue->entries.items[queue->entries.count++];
+            entry.allocation        = allocation;
+            entry.value             = completionValue;
+        }
+
+        u32 deferred_free_t::release(u64 completedValue)
+        {
+            context_t* ctx = m_context;
+
+            // Collect the queues, each queue lock is held only for the copy
+            {
+                std::lock_guard<std::mutex> lock(ctx->m_queuesMutex);
+                for (u32 i = 0; i < ctx->m_numQueues; ++i)
+                {
+                    std::lock_guard<std::mutex> queueLock(ctx->m_queues[i]->mutex);
+                    sAppend(ctx->m_allocator, ctx->m_pending, ctx->m_queues[i]->entries);
+                }
+                sAppend(ctx->m_allocator, ctx->m_pending, ctx->m_orphans);
+            }
+
+            // Split off everything the GPU is done with
+            deferred_list_t& pending = ctx->m_pending;
+            if (ctx->m_batchCapacity < pending.count)
+            {
+                if (ctx->m_batch != nullptr)
+                    g_deallocate_array(ctx->m_allocator, ctx->m_batch);
+                ctx->m_batchCapacity = pending.capacity;
+                ctx->m_batch         = g_allocate_array<allocation_t>(ctx->m_allocator, ctx->m_batchCapacity);
+            }
+            u32 numReady = 0;
+            u32 n        = 0;
+            for (u32 i = 0; i < pending.count; ++i)
+            {
+                if (pending.items[i].value <= completedValue)
+                    ctx->m_batch[numReady++] = pending.items[i].allocation;
+                else
+                    pending.items[n++] = pending.items[i];
+            }
+            pending.count = n;
+
+            return numReady > 0 ? ctx->m_manager->freeMany(ctx->m_batch, numReady) : 0;
+        }
+
+        u32 deferred_free_t::pendingCount() const { return m_context->m_pending.count; }
+
+    }  // namespace nvkmem
+}  // namespace ncore
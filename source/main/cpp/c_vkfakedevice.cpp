@@ -0,0 +1,297 @@
+#include "ccore/c_target.h"
+#include "ccore/c_debug.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/c_vkfakedevice.h"
+
+namespace ncore
+{
+    namespace nvkmem
+    {
+        // A memory object is its slot index + 1 in the low 32 bits and the slot generation in the high 32 bits
+        struct memory_object_t
+        {
+            u64  size;
+            u32  memoryType;  // MAX_MEMORY_TYPES when the slot is free
+            u32  generation;
+            u32  nextFree;
+            u8*  host;  // Backing of the mapping
+            bool mapped;
+        };
+
+        static constexpr u64 NON_COHERENT_ATOM_SIZE = 64;
+
+        static constexpr u32 NO_SLOT = 0xffffffff;
+
+        struct fake_device_t::context_t
+        {
+            alloc_t*            m_allocator;
+            memory_properties_t m_properties;
+            u64                 m_granularity;
+            u64                 m_heapUsage[MAX_MEMORY_HEAPS];
+            u64                 m_heapBudget[MAX_MEMORY_HEAPS];
+            u64                 m_externalUsage[MAX_MEMORY_HEAPS];
+            memory_object_t*    m_objects;
+            u32                 m_numObjects;
+            u32                 m_maxObjects;
+            u32                 m_freeObject;
+            u32                 m_liveObjects;
+            u64                 m_timeline;
+            bool                m_fail;
+            u32                 m_mapCalls;
+            u32                 m_flushCalls;
+            u32                 m_invalidateCalls;
+            u32                 m_rangeErrors;
+            u64                 m_flushedBytes;
+            u64                 m_invalidatedBytes;
+        };
+
+        static memory_object_t* sFindObject(fake_device_t::context_t* ctx, device_memory_t memory)
+        {
+            u32 const slot = (u32)(memory & 0xffffffff) - 1;
+            if (memory == NULL_MEMORY || slot >= ctx->m_numObjects)
+                return nullptr;
+            memory_object_t* object = &ctx->m_objects[slot];
+            if (object->memoryType == MAX_MEMORY_TYPES || object->generation != (u32)(memory >> 32))
+                return nullptr;
+            return object;
+        }
+
+        fake_device_t::fake_device_t()
+            : m_context(nullptr)
+        {
+        }
+
+        fake_device_t::~fake_device_t() {}
+
+        void fake_device_t::init(alloc_t* allocator)
+        {
+            memory_properties_t properties;
+            properties.memoryTypeCount = 5;
+            properties.memoryTypes[0]  = {MEMORY_PROPERTY_DEVICE_LOCAL, 0};
+            properties.memoryTypes[1]  = {MEMORY_PROPERTY_HOST_VISIBLE | MEMORY_PROPERTY_HOST_COHERENT, 1};
+            properties.memoryTypes[2]  = {MEMORY_PROPERTY_HOST_VISIBLE | MEMORY_PROPERTY_HOST_COHERENT | MEMORY_PROPERTY_HOST_CACHED, 1};
+            properties.memoryTypes[3]  = {MEMORY_PROPERTY_DEVICE_LOCAL | MEMORY_PROPERTY_HOST_VISIBLE | MEMORY_PROPERTY_HOST_COHERENT, 2};
+            properties.memoryTypes[4]  = {MEMORY_PROPERTY_HOST_VISIBLE | MEMORY_PROPERTY_HOST_CACHED, 1};
+            properties.memoryHeapCount = 3;
+            properties.memoryHeaps[0]  = {(u64)8 << 30, MEMORY_HEAP_DEVICE_LOCAL};
+            properties.memoryHeaps[1]  = {(u64)16 << 30, 0};
+            properties.memoryHeaps[2]  = {(u64)256 << 20, MEMORY_HEAP_DEVICE_LOCAL};
+            init(allocator, properties, 1024);
+        }
+
+        void fake_device_t::init(alloc_t* allocator, memory_properties_t const& properties, u64 bufferImageGranularity)
+        {
+            ASSERT(!m_context);
+            m_context                = allocator->construct<context_t>();
+            m_context->m_allocator   = allocator;
+            m_context->m_properties  = properties;
+            m_context->m_granularity = bufferImageGranularity;
+            for (u32 i = 0; i < MAX_MEMORY_HEAPS; ++i)
+            {
+                m_context->m_heapUsage[i]     = 0;
+                m_context->m_heapBudget[i]    = i < properties.memoryHeapCount ? properties.memoryHeaps[i].size : 0;
+                m_context->m_externalUsage[i] = 0;
+            }
+            m_context->m_objects          = nullptr;
+            m_context->m_numObjects       = 0;
+            m_context->m_maxObjects       = 0;
+            m_context->m_freeObject       = NO_SLOT;
+            m_context->m_liveObjects      = 0;
+            m_context->m_timeline         = 0;
+            m_context->m_fail             = false;
+            m_context->m_mapCalls         = 0;
+            m_context->m_flushCalls       = 0;
+            m_context->m_invalidateCalls  = 0;
+            m_context->m_rangeErrors      = 0;
+            m_context->m_flushedBytes     = 0;
+            m_context->m_invalidatedBytes = 0;
+        }
+
+        void fake_device_t::destroy()
+        {
+            ASSERT(m_context);
+            alloc_t* allocator = m_context->m_allocator;
+            for (u32 i = 0; i < m_context->m_numObjects; ++i)
+            {
+                if (m_context->m_objects[i].memoryType != MAX_MEMORY_TYPES && m_context->m_objects[i].host != nullptr)
+                    allocator->deallocate(m_context->m_objects[i].host);
+            }
+            if (m_context->m_objects != nullptr)
+                g_deallocate_array(allocator, m_context->m_objects);
+            allocator->destruct(m_context);
+            m_context = nullptr;
+        }
+
+        void fake_device_t::setFailAllocations(bool fail) { m_context->m_fail = fail; }
+        u32  fake_device_t::liveAllocations() const { return m_context->m_liveObjects; }
+        u64  fake_device_t::heapUsage(u32 heapIndex) const { return heapIndex < MAX_MEMORY_HEAPS ? m_context->m_heapUsage[heapIndex] : 0; }
+
+        u64 fake_device_t::memorySize(device_memory_t memory) const
+        {
+            memory_object_t const* object = sFindObject(m_context, memory);
+            return object != nullptr ? object->size : 0;
+        }
+
+        u32 fake_device_t::memoryType(device_memory_t memory) const
+        {
+            memory_object_t const* object = sFindObject(m_context, memory);
+            return object != nullptr ? object->memoryType : MAX_MEMORY_TYPES;
+        }
+
+        u32 fake_device_t::mapCalls() const { return m_context->m_mapCalls; }
+        u32 fake_device_t::flushCalls() const { return m_context->m_flushCalls; }
+        u32 fake_device_t::invalidateCalls() const { return m_context->m_invalidateCalls; }
+        u32 fake_device_t::rangeErrors() const { return m_context->m_rangeErrors; }
+        u64 fake_device_t::flushedBytes() const { return m_context->m_flushedBytes; }
+        u64 fake_device_t::invalidatedBytes() const { return m_context->m_invalidatedBytes; }
+
+        void fake_device_t::setHeapBudget(u32 heapIndex, u64 budget)
+        {
+            ASSERT(heapIndex < MAX_MEMORY_HEAPS);
+            m_context->m_heapBudget[heapIndex] = budget;
+        }
+
+        void fake_device_t::setExternalUsage(u32 heapIndex, u64 usage)
+        {
+            ASSERT(heapIndex < MAX_MEMORY_HEAPS);
+            m_context->m_externalUsage[heapIndex] = usage;
+        }
+
+        void fake_device_t::signal(u64 value)
+        {
+            if (value > m_context->m_timeline)
+                m_context->m_timeline = value;
+        }
+
+        u64 fake_device_t::completedValue() const { return m_context->m_timeline; }
+
+        void fake_device_t::v_getMemoryProperties(memory_properties_t& outProperties) const { outProperties = m_context->m_properties; }
+        u64  fake_device_t::v_getBufferImageGranularity() const { return m_context->m_granularity; }
+
+        void fake_device_t::v_getMemoryBudget(memory_budget_t& outBudget) const
+        {
+            for (u32 i = 0; i < MAX_MEMORY_HEAPS; ++i)
+            {
+                outBudget.heapBudget[i] = m_context->m_heapBudget[i];
+                outBudget.heapUsage[i]  = m_context->m_heapUsage[i] + m_context->m_externalUsage[i];
+            }
+        }
+
+        u64 fake_device_t::v_getNonCoherentAtomSize() const { return NON_COHERENT_ATOM_SIZE; }
+
+        void* fake_device_t::v_mapMemory(device_memory_t memory)
+        {
+            context_t*       ctx    = m_context;
+            memory_object_t* object = sFindObject(ctx, memory);
+            if (object == nullptr || object->mapped || object->size > 0xffffffffull)
+                return nullptr;
+            if ((ctx->m_properties.memoryTypes[object->memoryType].propertyFlags & MEMORY_PROPERTY_HOST_VISIBLE) == 0)
+                return nullptr;
+            if (object->host == nullptr)
+                object->host = (u8*)ctx->m_allocator->allocate((u32)object->size, 64);
+            object->mapped = true;
+            ctx->m_mapCalls++;
+            return object->host;
+        }
+
+        void fake_device_t::v_unmapMemory(device_memory_t memory)
+        {
+            memory_object_t* object = sFindObject(m_context, memory);
+            ASSERT(object != nullptr && object->mapped);
+            if (object != nullptr)
+                object->mapped = false;
+        }
+
+        // Returns the number of bytes in the ranges
+        static u64 sCheckRanges(fake_device_t::context_t* ctx, mapped_range_t const* ranges, u32 count)
+        {
+            u64 bytes = 0;
+            for (u32 i = 0; i < count; ++i)
+            {
+                bytes += ranges[i].size;
+                memory_object_t const* object = sFindObject(ctx, ranges[i].memory);
+                if (object == nullptr || !object->mapped)
+                {
+                    ctx->m_rangeErrors++;
+                    continue;
+                }
+                u64 const end = ranges[i].offset + ranges[i].size;
+                if ((ranges[i].offset % NON_COHERENT_ATOM_SIZE) != 0 || end > object->size || ((ranges[i].size % NON_COHERENT_ATOM_SIZE) != 0 && end != object->size))
+                    ctx->m_rangeErrors++;
+            }
+            return bytes;
+        }
+
+        void fake_device_t::v_flushMemoryRanges(mapped_range_t const* ranges, u32 count)
+        {
+            m_context->m_flushedBytes += sCheckRanges(m_context, ranges, count);
+            m_context->m_flushCalls++;
+        }
+
+        void fake_device_t::v_invalidateMemoryRanges(mapped_range_t const* ranges, u32 count)
+        {
+            m_context->m_invalidatedBytes += sCheckRanges(m_context, ranges, count);
+            m_context->m_invalidateCalls++;
+        }
+
+        device_memory_t fake_device_t::v_allocateMemory(u32 memoryTypeIndex, u64 size)
+        {
+            context_t* ctx = m_context;
+            if (ctx->m_fail || size == 0 || memoryTypeIndex >= ctx->m_properties.memoryTypeCount)
+                return NULL_MEMORY;
+
+            u32 const heap = ctx->m_properties.memoryTypes[memoryTypeIndex].heapIndex;
+            if (size > ctx->m_properties.memoryHeaps[heap].size - ctx->m_heapUsage[heap])
+                return NULL_MEMORY;
+
+            u32 slot = ctx->m_freeObject;
+            if (slot != NO_SLOT)
+            {
+                ctx->m_freeObject = ctx->m_objects[slot].nextFree;
+            }
+            else
+            {
+                if (ctx->m_numObjects == ctx->m_maxObjects)
+                {
+                    u32 const maxObjects = ctx->m_maxObjects == 0 ? 64 : ctx->m_maxObjects * 2;
+                    ctx->m_objects       = g_reallocate_array(ctx->m_allocator, ctx->m_objects, ctx->m_maxObjects, maxObjects);
+                    ctx->m_maxObjects    = maxObjects;
+                }
+                slot                            = ctx->m_numObjects++;
+                ctx->m_objects[slot].generation = 0;
+            }
+
+            memory_object_t& object = ctx->m_objects[slot];
+            object.size             = size;
+            object.memoryType       = memoryTypeIndex;
+            object.nextFree         = NO_SLOT;
+            object.host             = nullptr;
+            object.mapped           = false;
+            ctx->m_heapUsage[heap] += size;
+            ctx->m_liveObjects++;
+            return ((device_memory_t)object.generation << 32) | (device_memory_t)(slot + 1);
+        }
+
+        void fake_device_t::v_freeMemory(device_memory_t memory)
+        {
+            context_t*       ctx    = m_context;
+            memory_object_t* object = sFindObject(ctx, memory);
+            ASSERT(object != nullptr);
+            if (object == nullptr)
+                return;
+
+            u32 const heap = ctx->m_properties.memoryTypes[object->memoryType].heapIndex;
+            ctx->m_heapUsage[heap] -= object->size;
+            ctx->m_liveObjects--;
+            if (object->host != nullptr)
+                ctx->m_allocator->deallocate(object->host);
+
+            object->memoryType = MAX_MEMORY_TYPES;
+            object->generation++;
+            object->nextFree  = ctx->m_freeObject;
+            ctx->m_freeObject = (u32)(object - ctx->m_objects);
+        }
+
+    }  // namespace nvkmem
+}  // namespace ncore
@@ -3,10 +3,927 @@
 #include "cbase/c_integer.h"
 
 #include "cvkmem/c_vkmem.h"
+#include "cvkmem/private/c_vkblockallocator.h"
+#include "cvkmem/private/c_vkpageallocator.h"
 
 namespace ncore
 {
+    namespace nvkmem
+    {
+        static constexpr u64 MAX_BLOCK_SIZE     = (u64)1 << 31;  // Blocks are managed by a block allocator with u32 offsets
+        static constexpr u32 MAX_BLOCK_HALVINGS = 3;             // A new block may be down to 1/8th of the preferred size when memory is tight
+        static constexpr u32 TABLE_FLAGS        = 0x1f;          // Property flags covered by the memory type ranking table
+        static constexpr u32 TABLE_KEYS         = TABLE_FLAGS + 1;
 
+        // Host mapping of a device memory object, shared by all allocations in it
+        struct mapping_t
+        {
+            u8* pointer;  // nullptr while unmapped
+            u32 count;    // Mapped until the next flushMappedRanges once this drops to 0
+        };
 
+        struct block_t
+        {
+            device_memory_t           memory;
+            u64                       size;
+            u64                       allocatedBytes;
+            u32                       numAllocations;
+            u32                       heapIndex;
+            bool                      paged;  // Managed by 'pages' instead of 'allocator'
+            mapping_t                 mapping;
+            nalloc::block_allocator_t allocator;
+            nalloc::page_allocator_t  pages;
+        };
 
+        struct dedicated_t
+        {
+            device_memory_t memory;  // NULL_MEMORY for a free slot
+            u64             size;
+            mapping_t       mapping;
+        };
+
+        struct range_list_t
+        {
+            mapped_range_t* ranges;
+            u32             count;
+            u32             capacity;
+        };
+
+        // All blocks and dedicated allocations of one memory type, released blocks leave an empty slot
+        // so that the block index of every live allocation stays valid
+        struct memory_pool_t
+        {
+            block_t**    blocks;
+            u32          numBlocks;
+            u32          maxBlocks;
+            u32          numEmpty;
+            dedicated_t* dedicated;
+            u32          numDedicated;
+            u32          maxDedicated;
+        };
+
+        struct heap_state_t
+        {
+            u64 blockBytes;
+            u64 allocationBytes;
+            u64 deviceUsage;  // At the last budget query
+            u64 deviceBudget;
+            u64 blockBytesAtQuery;
+        };
+
+        struct type_ranking_t;
+
+        struct memory_manager_t::context_t
+        {
+            alloc_t*            m_allocator;
+            device_t*           m_device;
+            memory_config_t     m_config;
+            memory_properties_t m_properties;
+            u64                 m_granularity;
+            memory_stats_t      m_stats;
+            heap_state_t        m_heaps[MAX_MEMORY_HEAPS];
+            memory_pool_t       m_pools[MAX_MEMORY_TYPES];
+            type_ranking_t*     m_rankings;
+            u32                 m_numRankings;
+            u16                 m_rankingIndex[NUM_MEMORY_USAGES][TABLE_KEYS][TABLE_KEYS];
+            u32*                m_scratch;  // freeMany work space, two u32 per allocation
+            u32                 m_scratchSize;
+            u64                 m_atomSize;  // nonCoherentAtomSize
+            range_list_t        m_flushes;   // Recorded since the last flushMappedRanges
+            range_list_t        m_invalidates;
+            u32                 m_numUnmapPending;
+        };
+
+        static u32 sCountBits(u32 value)
+        {
+            u32 count = 0;
+            for (; value != 0; value &= value - 1)
+                count++;
+            return count;
+        }
+
+        // The memory types that satisfy a (required flags, preferred flags, usage) key, best type first
+        struct type_ranking_t
+        {
+            u32 typeMask;  // Bit set of the ranked types
+            u32 count;
+            u8  types[MAX_MEMORY_TYPES];
+        };
+
+        static void sBuildRanking(memory_properties_t const& properties, u32 requiredFlags, u32 preferredFlags, u32 usage, type_ranking_t& outRanking)
+        {
+            u32 avoidedFlags = 0;
+            switch (usage)
+            {
+                case MEMORY_USAGE_GPU_ONLY:
+                    preferredFlags |= MEMORY_PROPERTY_DEVICE_LOCAL;
+                    avoidedFlags |= MEMORY_PROPERTY_HOST_VISIBLE;
+                    break;
+                case MEMORY_USAGE_CPU_ONLY:
+                    requiredFlags |= MEMORY_PROPERTY_HOST_VISIBLE | MEMORY_PROPERTY_HOST_COHERENT;
+                    avoidedFlags |= MEMORY_PROPERTY_DEVICE_LOCAL;
+                    break;
+                case MEMORY_USAGE_CPU_TO_GPU:
+                    requiredFlags |= MEMORY_PROPERTY_HOST_VISIBLE;
+                    preferredFlags |= MEMORY_PROPERTY_DEVICE_LOCAL;
+                    break;
+                case MEMORY_USAGE_GPU_TO_CPU:
+                    requiredFlags |= MEMORY_PROPERTY_HOST_VISIBLE;
+                    preferredFlags |= MEMORY_PROPERTY_HOST_CACHED;
+                    break;
+                case MEMORY_USAGE_GPU_LAZY: requiredFlags |= MEMORY_PROPERTY_LAZILY_ALLOCATED; break;
+            }
+            // Lazily allocated memory can only back transient attachments
+            if (((requiredFlags | preferredFlags) & MEMORY_PROPERTY_LAZILY_ALLOCATED) == 0)
+                avoidedFlags |= MEMORY_PROPERTY_LAZILY_ALLOCATED;
+            avoidedFlags &= ~preferredFlags;
+
+            // Insertion sort on cost, ties keep the lowest type index first
+            u32 costs[MAX_MEMORY_TYPES];
+            outRanking.typeMask = 0;
+            outRanking.count    = 0;
+            for (u32 t = 0; t < properties.memoryTypeCount; ++t)
+            {
+                u32 const flags = properties.memoryTypes[t].propertyFlags;
+                if ((flags & requiredFlags) != requiredFlags)
+                    continue;
+                u32 const cost = sCountBits(preferredFlags & ~flags) + sCountBits(avoidedFlags & flags);
+                u32       i    = outRanking.count++;
+                for (; i > 0 && costs[i - 1] > cost; --i)
+                {
+                    costs[i]            = costs[i - 1];
+                    outRanking.types[i] = outRanking.types[i - 1];
+                }
+                costs[i]            = cost;
+                outRanking.types[i] = (u8)t;
+                outRanking.typeMask |= 1u << t;
+            }
+        }
+
+        static bool sSameRanking(type_ranking_t const& a, type_ranking_t const& b)
+        {
+            if (a.count != b.count)
+                return false;
+            for (u32 i = 0; i < a.count; ++i)
+            {
+                if (a.types[i] != b.types[i])
+                    return false;
+            }
+            return true;
+        }
+
+        // Every (required, preferred, usage) key within TABLE_FLAGS maps to an index in a list of distinct
+        // rankings, most keys share one of a handful of rankings
+        static void sBuildRankingTable(memory_manager_t::context_t* ctx)
+        {
+            u32 maxRankings    = 16;
+            ctx->m_rankings    = g_allocate_array<type_ranking_t>(ctx->m_allocator, maxRankings);
+            ctx->m_numRankings = 0;
+            for (u32 usage = 0; usage < NUM_MEMORY_USAGES; ++usage)
+            {
+                for (u32 required = 0; required < TABLE_KEYS; ++required)
+                {
+                    for (u32 preferred = 0; preferred < TABLE_KEYS; ++preferred)
+                    {
+                        type_ranking_t ranking;
+                        sBuildRanking(ctx->m_properties, required, preferred, usage, ranking);
+
+                        u32 index = 0;
+                        while (index < ctx->m_numRankings && !sSameRanking(ctx->m_rankings[index], ranking))
+                            index++;
+                        if (index == ctx->m_numRankings)
+                        {
+                            if (index == maxRankings)
+                            {
+                                ctx->m_rankings = g_reallocate_array(ctx->m_allocator, ctx->m_rankings, maxRankings, maxRankings * 2);
+                                maxRankings     = maxRankings * 2;
+                            }
+                            ctx->m_rankings[ctx->m_numRankings++] = ranking;
+                        }
+                        ctx->m_rankingIndex[usage][required][preferred] = (u16)index;
+                    }
+                }
+            }
+        }
+
+        // Returns the ranking of a key, keys beyond the table are ranked into 'scratch'
+        static type_ranking_t const* sFindRanking(memory_manager_t::context_t const* ctx, u32 requiredFlags, u32 preferredFlags, u32 usage, type_ranking_t& scratch)
+        {
+            if (((requiredFlags | preferredFlags) & ~TABLE_FLAGS) == 0 && usage < NUM_MEMORY_USAGES)
+                return &ctx->m_rankings[ctx->m_rankingIndex[usage][requiredFlags][preferredFlags]];
+            sBuildRanking(ctx->m_properties, requiredFlags, preferredFlags, usage, scratch);
+            return &scratch;
+        }
+
+        static block_t* sCreateBlock(memory_manager_t::context_t* ctx, u32 memoryType, u64 minSize)
+        {
+            u64 blockSize = ctx->m_config.preferredBlockSize;
+            for (u32 i = 0; i <= MAX_BLOCK_HALVINGS && blockSize >= minSize; ++i, blockSize /= 2)
+            {
+                device_memory_t const memory = ctx->m_device->allocateMemory(memoryType, blockSize);
+                ctx->m_stats.deviceAllocateCalls++;
+                if (memory == NULL_MEMORY)
+                    continue;
+
+                block_t* block        = ctx->m_allocator->construct<block_t>();
+                block->memory         = memory;
+                block->size           = blockSize;
+                block->allocatedBytes = 0;
+                block->numAllocations = 0;
+                block->heapIndex      = ctx->m_properties.memoryTypes[memoryType].heapIndex;
+                block->mapping        = {nullptr, 0};
+                block->paged          = (ctx->m_config.pageEngineHeaps & (1u << block->heapIndex)) != 0;
+                if (block->paged)
+                    block->pages.init(ctx->m_allocator, (u32)blockSize, ctx->m_config.maxAllocsPerBlock, (u32)ctx->m_config.pageSize);
+                else
+                    block->allocator.init(ctx->m_allocator, (u32)blockSize, ctx->m_config.maxAllocsPerBlock, (u32)ctx->m_granularity);
+
+                ctx->m_stats.blockCount++;
+                ctx->m_stats.blockBytes += blockSize;
+                ctx->m_heaps[block->heapIndex].blockBytes += blockSize;
+                return block;
+            }
+            return nullptr;
+        }
+
+        static void sDropRanges(range_list_t& list, device_memory_t memory)
+        {
+            u32 n = 0;
+            for (u32 i = 0; i < list.count; ++i)
+            {
+                if (list.ranges[i].memory != memory)
+                    list.ranges[n++] = list.ranges[i];
+            }
+            list.count = n;
+        }
+
+        // Device memory that is about to be freed is unmapped and its recorded ranges are dropped, like
+        // vkFreeMemory an allocation may be freed while it is still mapped
+        static void sReleaseMapping(memory_manager_t::context_t* ctx, mapping_t& mapping, device_memory_t memory)
+        {
+            if (mapping.pointer == nullptr)
+                return;
+            ctx->m_device->unmapMemory(memory);
+            if (mapping.count == 0)
+                ctx->m_numUnmapPending--;
+            mapping.pointer = nullptr;
+            mapping.count   = 0;
+            sDropRanges(ctx->m_flushes, memory);
+            sDropRanges(ctx->m_invalidates, memory);
+        }
+
+        static void sReleaseBlock(memory_manager_t::context_t* ctx, block_t* block)
+        {
+            sReleaseMapping(ctx, block->mapping, block->memory);
+            if (block->paged)
+                block->pages.destroy();
+            else
+                block->allocator.destroy();
+            ctx->m_device->freeMemory(block->memory);
+            ctx->m_stats.deviceFreeCalls++;
+            ctx->m_stats.blockCount--;
+            ctx->m_stats.blockBytes -= block->size;
+            ctx->m_heaps[block->heapIndex].blockBytes -= block->size;
+            ctx->m_allocator->destruct(block);
+        }
+
+        static bool sAllocateInBlock(memory_manager_t::context_t* ctx, block_t* block, memory_requirements_t const& requirements, u32 resource, allocation_t& outAllocation)
+        {
+            if (block->size - block->allocatedBytes < requirements.size)
+                return false;
+            nalloc::handle_t const handle = block->paged ? block->pages.allocateHandle((u32)requirements.size, (u32)requirements.alignment, resource)
+                                                         : block->allocator.allocateHandle((u32)requirements.size, (u32)requirements.alignment, resource);
+            if (handle == nalloc::INVALID_HANDLE)
+                return false;
+
+            block->allocatedBytes += requirements.size;
+            block->numAllocations++;
+            ctx->m_stats.allocationCount++;
+            ctx->m_stats.allocatedBytes += requirements.size;
+            ctx->m_heaps[block->heapIndex].allocationBytes += requirements.size;
+
+            outAllocation.memory = block->memory;
+            outAllocation.offset = block->paged ? block->pages.getOffset(handle) : block->allocator.getOffset(handle);
+            outAllocation.size   = requirements.size;
+            outAllocation.handle = handle;
+            return true;
+        }
+
+        static bool sAllocateDedicated(memory_manager_t::context_t* ctx, u32 memoryType, memory_requirements_t const& requirements, allocation_t& outAllocation)
+        {
+            memory_pool_t& pool = ctx->m_pools[memoryType];
+
+            u32 slot = 0;
+            while (slot < pool.numDedicated && pool.dedicated[slot].memory != NULL_MEMORY)
+                slot++;
+            if (slot == pool.maxDedicated)
+            {
+                u32 const maxDedicated = pool.maxDedicated == 0 ? 8 : pool.maxDedicated * 2;
+                pool.dedicated         = g_reallocate_array(ctx->m_allocator, pool.dedicated, pool.maxDedicated, maxDedicated);
+                pool.maxDedicated      = maxDedicated;
+            }
+
+            device_memory_t const memory = ctx->m_device->allocateMemory(memoryType, requirements.size);
+            ctx->m_stats.deviceAllocateCalls++;
+            if (memory == NULL_MEMORY)
+                return false;
+
+            if (slot == pool.numDedicated)
+                pool.numDedicated++;
+            pool.dedicated[slot].memory  = memory;
+            pool.dedicated[slot].size    = requirements.size;
+            pool.dedicated[slot].mapping = {nullptr, 0};
+
+            ctx->m_stats.dedicatedCount++;
+            ctx->m_stats.dedicatedBytes += requirements.size;
+            ctx->m_stats.allocationCount++;
+
+            heap_state_t& heap = ctx->m_heaps[ctx->m_properties.memoryTypes[memoryType].heapIndex];
+            heap.blockBytes += requirements.size;
+            heap.allocationBytes += requirements.size;
+
+            outAllocation.memory     = memory;
+            outAllocation.offset     = 0;
+            outAllocation.size       = requirements.size;
+            outAllocation.memoryType = memoryType;
+            outAllocation.block      = DEDICATED_BLOCK;
+            outAllocation.handle     = slot;
+            return true;
+        }
+
+        static bool sAllocateFromType(memory_manager_t::context_t* ctx, u32 memoryType, memory_requirements_t const& requirements, u32 resource, allocation_t& outAllocation)
+        {
+            // Device memory is aligned for any resource, so a dedicated allocation needs no alignment padding
+            if (requirements.size >= ctx->m_config.dedicatedThreshold || requirements.size + requirements.alignment - 1 > ctx->m_config.preferredBlockSize)
+                return sAllocateDedicated(ctx, memoryType, requirements, outAllocation);
+
+            memory_pool_t& pool      = ctx->m_pools[memoryType];
+            outAllocation.memoryType = memoryType;
+
+            u32 freeSlot = pool.numBlocks;
+            for (u32 b = 0; b < pool.numBlocks; ++b)
+            {
+                block_t* block = pool.blocks[b];
+                if (block == nullptr)
+                {
+                    if (freeSlot == pool.numBlocks)
+                        freeSlot = b;
+                    continue;
+                }
+                bool const wasEmpty = block->numAllocations == 0;
+                if (sAllocateInBlock(ctx, block, requirements, resource, outAllocation))
+                {
+                    if (wasEmpty)
+                        pool.numEmpty--;
+                    outAllocation.block = b;
+                    return true;
+                }
+            }
+
+            // Leave room for the alignment padding in a block that is smaller than preferred
+            block_t* block = sCreateBlock(ctx, memoryType, requirements.size + requirements.alignment - 1);
+            if (block == nullptr)
+                return false;
+
+            if (freeSlot == pool.maxBlocks)
+            {
+                u32 const maxBlocks = pool.maxBlocks == 0 ? 8 : pool.maxBlocks * 2;
+                pool.blocks         = g_reallocate_array(ctx->m_allocator, pool.blocks, pool.maxBlocks, maxBlocks);
+                pool.maxBlocks      = maxBlocks;
+            }
+            if (freeSlot == pool.numBlocks)
+                pool.numBlocks++;
+            pool.blocks[freeSlot] = block;
+
+            if (!sAllocateInBlock(ctx, block, requirements, resource, outAllocation))
+            {
+                // Only possible when the block is out of allocation nodes, keep it as an empty block
+                pool.numEmpty++;
+                return false;
+            }
+            outAllocation.block = freeSlot;
+            return true;
+        }
+
+        memory_manager_t::memory_manager_t()
+            : m_context(nullptr)
+        {
+        }
+
+        memory_manager_t::~memory_manager_t() {}
+
+        void memory_manager_t::init(alloc_t* allocator, device_t* device, memory_config_t const& config)
+        {
+            ASSERT(!m_context);
+            m_context              = allocator->construct<context_t>();
+            m_context->m_allocator = allocator;
+            m_context->m_device    = device;
+            m_context->m_config    = config;
+            m_context->m_stats     = memory_stats_t();
+
+            if (m_context->m_config.preferredBlockSize > MAX_BLOCK_SIZE)
+                m_context->m_config.preferredBlockSize = MAX_BLOCK_SIZE;
+
+            device->getMemoryProperties(m_context->m_properties);
+            m_context->m_granularity = device->getBufferImageGranularity();
+            if (m_context->m_granularity == 0)
+                m_context->m_granularity = 1;
+
+            // A page holds either linear or optimal resources, so it spans whole granularity units
+            ASSERT(m_context->m_config.pageSize > 0 && (m_context->m_config.pageSize & (m_context->m_config.pageSize - 1)) == 0);
+            m_context->m_config.pageSize = (m_context->m_config.pageSize + m_context->m_granularity - 1) & ~(m_context->m_granularity - 1);
+
+            for (u32 t = 0; t < MAX_MEMORY_TYPES; ++t)
+            {
+                memory_pool_t& pool = m_context->m_pools[t];
+                pool.blocks         = nullptr;
+                pool.numBlocks      = 0;
+                pool.maxBlocks      = 0;
+                pool.numEmpty       = 0;
+                pool.dedicated      = nullptr;
+                pool.numDedicated   = 0;
+                pool.maxDedicated   = 0;
+            }
+
+            for (u32 h = 0; h < MAX_MEMORY_HEAPS; ++h)
+            {
+                m_context->m_heaps[h].blockBytes      = 0;
+                m_context->m_heaps[h].allocationBytes = 0;
+            }
+            updateBudget();
+
+            sBuildRankingTable(m_context);
+            m_context->m_scratch         = nullptr;
+            m_context->m_scratchSize     = 0;
+            m_context->m_atomSize        = device->getNonCoherentAtomSize();
+            m_context->m_flushes         = {nullptr, 0, 0};
+            m_context->m_invalidates     = {nullptr, 0, 0};
+            m_context->m_numUnmapPending = 0;
+            if (m_context->m_atomSize == 0)
+                m_context->m_atomSize = 1;
+        }
+
+        void memory_manager_t::destroy()
+        {
+            ASSERT(m_context);
+            alloc_t* allocator = m_context->m_allocator;
+            for (u32 t = 0; t < MAX_MEMORY_TYPES; ++t)
+            {
+                memory_pool_t& pool = m_context->m_pools[t];
+                for (u32 b = 0; b < pool.numBlocks; ++b)
+                {
+                    if (pool.blocks[b] != nullptr)
+                        sReleaseBlock(m_context, pool.blocks[b]);
+                }
+                for (u32 d = 0; d < pool.numDedicated; ++d)
+                {
+                    if (pool.dedicated[d].memory != NULL_MEMORY)
+                    {
+                        sReleaseMapping(m_context, pool.dedicated[d].mapping, pool.dedicated[d].memory);
+                        m_context->m_device->freeMemory(pool.dedicated[d].memory);
+                    }
+                }
+                if (pool.blocks != nullptr)
+                    g_deallocate_array(allocator, pool.blocks);
+                if (pool.dedicated != nullptr)
+                    g_deallocate_array(allocator, pool.dedicated);
+            }
+            g_deallocate_array(allocator, m_context->m_rankings);
+            if (m_context->m_scratch != nullptr)
+                g_deallocate_array(allocator, m_context->m_scratch);
+            if (m_context->m_flushes.ranges != nullptr)
+                g_deallocate_array(allocator, m_context->m_flushes.ranges);
+            if (m_context->m_invalidates.ranges != nullptr)
+                g_deallocate_array(allocator, m_context->m_invalidates.ranges);
+            allocator->destruct(m_context);
+            m_context = nullptr;
+        }
+
+        bool memory_manager_t::allocate(memory_requirements_t const& requirements, u32 requiredFlags, u32 preferredFlags, u32 usage, u32 resource, allocation_t& outAllocation)
+        {
+            if (requirements.size == 0)
+                return false;
+
+            memory_requirements_t request = requirements;
+            if (request.alignment == 0)
+                request.alignment = 1;
+
+            // On failure the next type in the ranking is tried
+            type_ranking_t        scratch;
+            type_ranking_t const* ranking = sFindRanking(m_context, requiredFlags, preferredFlags, usage, scratch);
+            if ((ranking->typeMask & request.memoryTypeBits) == 0)
+                return false;
+            for (u32 i = 0; i < ranking->count; ++i)
+            {
+                u32 const memoryType = ranking->types[i];
+                if ((request.memoryTypeBits & (1u << memoryType)) == 0)
+                    continue;
+                if (sAllocateFromType(m_context, memoryType, request, resource, outAllocation))
+                    return true;
+            }
+            return false;
+        }
+
+        // Returns false for an allocation that was already freed, the slot is empty or holds other memory
+        static bool sFreeDedicated(memory_manager_t::context_t* ctx, allocation_t const& allocation)
+        {
+            memory_pool_t& pool = ctx->m_pools[allocation.memoryType];
+            if (allocation.handle >= pool.numDedicated || pool.dedicated[allocation.handle].memory != allocation.memory)
+                return false;
+
+            dedicated_t& dedicated = pool.dedicated[allocation.handle];
+            sReleaseMapping(ctx, dedicated.mapping, dedicated.memory);
+            ctx->m_device->freeMemory(dedicated.memory);
+            ctx->m_stats.deviceFreeCalls++;
+            ctx->m_stats.dedicatedCount--;
+            ctx->m_stats.dedicatedBytes -= dedicated.size;
+            ctx->m_stats.allocationCount--;
+            dedicated.memory = NULL_MEMORY;
+
+            heap_state_t& heap = ctx->m_heaps[ctx->m_properties.memoryTypes[allocation.memoryType].heapIndex];
+            heap.blockBytes -= dedicated.size;
+            heap.allocationBytes -= dedicated.size;
+            return true;
+        }
+
+        // Bookkeeping after 'count' allocations of 'bytes' in total have been freed from a block
+        static void sBlockFreed(memory_manager_t::context_t* ctx, u32 memoryType, u32 blockIndex, u32 count, u64 bytes)
+        {
+            memory_pool_t& pool  = ctx->m_pools[memoryType];
+            block_t*       block = pool.blocks[blockIndex];
+            block->allocatedBytes -= bytes;
+            block->numAllocations -= count;
+            ctx->m_stats.allocationCount -= count;
+            ctx->m_stats.allocatedBytes -= bytes;
+            ctx->m_heaps[block->heapIndex].allocationBytes -= bytes;
+            if (block->numAllocations > 0)
+                return;
+
+            // Hysteresis: keep a few empty blocks around so that a workload oscillating around a block
+            // boundary does not allocate and free device memory every frame
+            if (pool.numEmpty < ctx->m_config.maxEmptyBlocksPerType)
+            {
+                pool.numEmpty++;
+                return;
+            }
+            sReleaseBlock(ctx, block);
+            pool.blocks[blockIndex] = nullptr;
+        }
+
+        void memory_manager_t::free(allocation_t const& allocation)
+        {
+            if (allocation.block == DEDICATED_BLOCK)
+            {
+                sFreeDedicated(m_context, allocation);
+                return;
+            }
+
+            block_t* block = m_context->m_pools[allocation.memoryType].blocks[allocation.block];
+            ASSERT(block != nullptr && block->memory == allocation.memory);
+            if (block->paged ? block->pages.freeHandle(allocation.handle) : block->allocator.freeHandle(allocation.handle))
+                sBlockFreed(m_context, allocation.memoryType, allocation.block, 1, allocation.size);
+        }
+
+        u32 memory_manager_t::freeMany(allocation_t const* allocations, u32 count)
+        {
+            context_t* ctx = m_context;
+            if (ctx->m_scratchSize < count)
+            {
+                if (ctx->m_scratch != nullptr)
+                    g_deallocate_array(ctx->m_allocator, ctx->m_scratch);
+                ctx->m_scratch     = g_allocate_array<u32>(ctx->m_allocator, count * 2);
+                ctx->m_scratchSize = count;
+            }
+            u32* remaining = ctx->m_scratch;
+            u32* handles   = ctx->m_scratch + count;
+
+            u32 numFreed     = 0;
+            u32 numRemaining = 0;
+            for (u32 i = 0; i < count; ++i)
+            {
+                if (allocations[i].block == DEDICATED_BLOCK)
+                    numFreed += sFreeDedicated(ctx, allocations[i]) ? 1 : 0;
+                else
+                    remaining[numRemaining++] = i;
+            }
+
+            // One block at a time, the block allocator merges allocations that are adjacent in memory into a
+            // single free node before it touches the bins
+            while (numRemaining > 0)
+            {
+                u32 const memoryType = allocations[remaining[0]].memoryType;
+                u32 const blockIndex = allocations[remaining[0]].block;
+                block_t*  block      = ctx->m_pools[memoryType].blocks[blockIndex];
+
+                u32 numHandles = 0;
+                u32 n          = 0;
+                for (u32 i = 0; i < numRemaining; ++i)
+                {
+                    allocation_t const& allocation = allocations[remaining[i]];
+                    if (allocation.memoryType != memoryType || allocation.block != blockIndex)
+                        remaining[n++] = remaining[i];
+                    else
+                        handles[numHandles++] = remaining[i];
+                }
+                numRemaining = n;
+
+                // Only what is actually freed counts, a stale handle or a duplicate in the batch is skipped
+                u32 freed = 0;
+                u64 bytes = 0;
+                if (block->paged)
+                {
+                    for (u32 i = 0; i < numHandles; ++i)
+                    {
+                        allocation_t const& allocation = allocations[handles[i]];
+                        if (block->pages.freeHandle(allocation.handle))
+                        {
+                            freed += 1;
+                            bytes += allocation.size;
+                        }
+                    }
+                }
+                else
+                {
+                    for (u32 i = 0; i < numHandles; ++i)
+                        handles[i] = allocations[handles[i]].handle;
+                    u32 freedBytes = 0;
+                    freed          = block->allocator.freeMany(handles, numHandles, &freedBytes);
+                    bytes          = freedBytes;
+                }
+                if (freed > 0)
+                    sBlockFreed(ctx, memoryType, blockIndex, freed, bytes);
+                numFreed += freed;
+            }
+            return numFreed;
+        }
+
+        void memory_manager_t::trim()
+        {
+            for (u32 t = 0; t < MAX_MEMORY_TYPES; ++t)
+            {
+                memory_pool_t& pool = m_context->m_pools[t];
+                for (u32 b = 0; b < pool.numBlocks; ++b)
+                {
+                    if (pool.blocks[b] != nullptr && pool.blocks[b]->numAllocations == 0)
+                    {
+                        sReleaseBlock(m_context, pool.blocks[b]);
+                        pool.blocks[b] = nullptr;
+                    }
+                }
+                pool.numEmpty = 0;
+            }
+        }
+
+        u32 memory_manager_t::findMemoryTypes(u32 memoryTypeBits, u32 requiredFlags, u32 preferredFlags, u32 usage, u8* outTypes) const
+        {
+            type_ranking_t        scratch;
+            type_ranking_t const* ranking = sFindRanking(m_context, requiredFlags, preferredFlags, usage, scratch);
+            u32                   count   = 0;
+            for (u32 i = 0; i < ranking->count; ++i)
+            {
+                if ((memoryTypeBits & (1u << ranking->types[i])) != 0)
+                    outTypes[count++] = ranking->types[i];
+            }
+            return count;
+        }
+
+        void memory_manager_t::updateBudget()
+        {
+            memory_budget_t budget;
+            m_context->m_device->getMemoryBudget(budget);
+            for (u32 h = 0; h < MAX_MEMORY_HEAPS; ++h)
+            {
+                heap_state_t& heap     = m_context->m_heaps[h];
+                heap.deviceUsage       = budget.heapUsage[h];
+                heap.deviceBudget      = budget.heapBudget[h];
+                heap.blockBytesAtQuery = heap.blockBytes;
+            }
+        }
+
+        void memory_manager_t::getBudget(u32 heapIndex, heap_budget_t& outBudget) const
+        {
+            ASSERT(heapIndex < MAX_MEMORY_HEAPS);
+            heap_state_t const& heap  = m_context->m_heaps[heapIndex];
+            outBudget.blockBytes      = heap.blockBytes;
+            outBudget.allocationBytes = heap.allocationBytes;
+            outBudget.budget          = heap.deviceBudget;
+
+            // A device without usage reporting (usage 0) is estimated from the memory of the manager alone
+            if (heap.deviceUsage == 0)
+                outBudget.usage = heap.blockBytes;
+            else if (heap.deviceUsage + heap.blockBytes > heap.blockBytesAtQuery)
+                outBudget.usage = heap.deviceUsage + heap.blockBytes - heap.blockBytesAtQuery;
+            else
+                outBudget.usage = 0;
+        }
+
+        static mapping_t& sMappingOf(memory_manager_t::context_t* ctx, allocation_t const& allocation, u64& outMemorySize)
+        {
+            memory_pool_t& pool = ctx->m_pools[allocation.memoryType];
+            if (allocation.block == DEDICATED_BLOCK)
+            {
+                outMemorySize = pool.dedicated[allocation.handle].size;
+                return pool.dedicated[allocation.handle].mapping;
+            }
+            outMemorySize = pool.blocks[allocation.block]->size;
+            return pool.blocks[allocation.block]->mapping;
+        }
+
+        void* memory_manager_t::map(allocation_t const& allocation)
+        {
+            context_t* ctx = m_context;
+            if ((ctx->m_properties.memoryTypes[allocation.memoryType].propertyFlags & MEMORY_PROPERTY_HOST_VISIBLE) == 0)
+                return nullptr;
+
+            u64        memorySize;
+            mapping_t& mapping = sMappingOf(ctx, allocation, memorySize);
+            if (mapping.pointer == nullptr)
+            {
+                mapping.pointer = (u8*)ctx->m_device->mapMemory(allocation.memory);
+                if (mapping.pointer == nullptr)
+                    return nullptr;
+            }
+            else if (mapping.count == 0)
+            {
+                ctx->m_numUnmapPending--;
+            }
+            mapping.count++;
+            return mapping.pointer + allocation.offset;
+        }
+
+        void memory_manager_t::unmap(allocation_t const& allocation)
+        {
+            u64        memorySize;
+            mapping_t& mapping = sMappingOf(m_context, allocation, memorySize);
+            ASSERT(mapping.pointer != nullptr && mapping.count > 0);
+            if (--mapping.count == 0)
+                m_context->m_numUnmapPending++;
+        }
+
+        // Rounds the range out to whole atoms within the memory object and merges it into the most recent range
+        // when the two touch, which catches the common case of consecutive writes into the same block
+        static void sRecordRange(memory_manager_t::context_t* ctx, range_list_t& list, allocation_t const& allocation, u64 offset, u64 size)
+        {
+            if ((ctx->m_properties.memoryTypes[allocation.memoryType].propertyFlags & MEMORY_PROPERTY_HOST_COHERENT) != 0)
+                return;
+
+            u64 memorySize;
+            sMappingOf(ctx, allocation, memorySize);
+            u64 const allocationEnd = allocation.offset + allocation.size;
+            u64       begin         = allocation.offset + offset;
+            u64       end           = (size == WHOLE_SIZE || size > allocationEnd - begin) ? allocationEnd : begin + size;
+            if (begin >= end)
+                return;
+            begin = begin & ~(ctx->m_atomSize - 1);
+            end   = (end + ctx->m_atomSize - 1) & ~(ctx->m_atomSize - 1);
+            if (end > memorySize)
+                end = memorySize;
+
+            if (list.count > 0)
+            {
+                mapped_range_t& last = list.ranges[list.count - 1];
+                if (last.memory == allocation.memory && begin <= last.offset + last.size && end >= last.offset)
+                {
+                    u64 const lastEnd = last.offset + last.size;
+                    last.offset       = begin < last.offset ? begin : last.offset;
+                    last.size         = (end > lastEnd ? end : lastEnd) - last.offset;
+                    return;
+                }
+            }
+            if (list.count == list.capacity)
+            {
+                u32 const capacity = list.capacity == 0 ? 64 : list.capacity * 2;
+                list.ranges        = g_reallocate_array(ctx->m_allocator, list.ranges, list.count, capacity);
+                list.capacity      = capacity;
+            }
+            list.ranges[list.count++] = {allocation.memory, begin, end - begin};
+        }
+
+        void memory_manager_t::flush(allocation_t const& allocation, u64 offset, u64 size) { sRecordRange(m_context, m_context->m_flushes, allocation, offset, size); }
+        void memory_manager_t::invalidate(allocation_t const& allocation, u64 offset, u64 size) { sRecordRange(m_context, m_context->m_invalidates, allocation, offset, size); }
+
+        static inline bool sRangeLess(mapped_range_t const& a, mapped_range_t const& b) { return a.memory < b.memory || (a.memory == b.memory && a.offset < b.offset); }
+
+        static void sSiftDown(mapped_range_t* ranges, u32 root, u32 count)
+        {
+            while (true)
+            {
+                u32 child = root * 2 + 1;
+                if (child >= count)
+                    return;
+                if (child + 1 < count && sRangeLess(ranges[child], ranges[child + 1]))
+                    child++;
+                if (!sRangeLess(ranges[root], ranges[child]))
+                    return;
+                mapped_range_t const swap = ranges[root];
+                ranges[root]              = ranges[child];
+                ranges[child]             = swap;
+                root                      = child;
+            }
+        }
+
+        // Heap sort on (memory, offset), then overlapping and touching ranges of the same memory are merged and
+        // every memory object gets one device call with all of its ranges
+        static u32 sSubmitRanges(memory_manager_t::context_t* ctx, range_list_t& list, bool invalidate)
+        {
+            mapped_range_t* ranges = list.ranges;
+            u32 const       count  = list.count;
+            for (u32 i = count / 2; i > 0; --i)
+                sSiftDown(ranges, i - 1, count);
+            for (u32 end = count; end > 1; --end)
+            {
+                mapped_range_t const swap = ranges[0];
+                ranges[0]                 = ranges[end - 1];
+                ranges[end - 1]           = swap;
+                sSiftDown(ranges, 0, end - 1);
+            }
+
+            u32 n = 0;
+            for (u32 i = 0; i < count; ++i)
+            {
+                if (n > 0 && ranges[n - 1].memory == ranges[i].memory && ranges[i].offset <= ranges[n - 1].offset + ranges[n - 1].size)
+                {
+                    u64 const end = ranges[i].offset + ranges[i].size;
+                    if (end > ranges[n - 1].offset + ranges[n - 1].size)
+                        ranges[n - 1].size = end - ranges[n - 1].offset;
+                }
+                else
+                {
+                    ranges[n++] = ranges[i];
+                }
+            }
+
+            u32 calls = 0;
+            for (u32 first = 0; first < n;)
+            {
+                u32 last = first + 1;
+                while (last < n && ranges[last].memory == ranges[first].memory)
+                    last++;
+                if (invalidate)
+                    ctx->m_device->invalidateMemoryRanges(ranges + first, last - first);
+                else
+                    ctx->m_device->flushMemoryRanges(ranges + first, last - first);
+                calls++;
+                first = last;
+            }
+            list.count = 0;
+            return calls;
+        }
+
+        u32 memory_manager_t::flushMappedRanges()
+        {
+            context_t* ctx   = m_context;
+            u32        calls = sSubmitRanges(ctx, ctx->m_flushes, false);
+            calls += sSubmitRanges(ctx, ctx->m_invalidates, true);
+
+            // Ranges have to be submitted while their memory is mapped, so unmapping waits until now
+            for (u32 t = 0; t < MAX_MEMORY_TYPES && ctx->m_numUnmapPending > 0; ++t)
+            {
+                memory_pool_t& pool = ctx->m_pools[t];
+                for (u32 b = 0; b < pool.numBlocks; ++b)
+                {
+                    block_t* block = pool.blocks[b];
+                    if (block != nullptr && block->mapping.pointer != nullptr && block->mapping.count == 0)
+                    {
+                        ctx->m_device->unmapMemory(block->memory);
+                        block->mapping.pointer = nullptr;
+                        ctx->m_numUnmapPending--;
+                    }
+                }
+                for (u32 d = 0; d < pool.numDedicated; ++d)
+                {
+                    dedicated_t& dedicated = pool.dedicated[d];
+                    if (dedicated.memory != NULL_MEMORY && dedicated.mapping.pointer != nullptr && dedicated.mapping.count == 0)
+                    {
+                        ctx->m_device->unmapMemory(dedicated.memory);
+                        dedicated.mapping.pointer = nullptr;
+                        ctx->m_numUnmapPending--;
+                    }
+                }
+            }
+            return calls;
+        }
+
+        memory_properties_t const& memory_manager_t::getMemoryProperties() const { return m_context->m_properties; }
+
+        void memory_manager_t::getStats(memory_stats_t& outStats) const
+        {
+            outStats                 = m_context->m_stats;
+            outStats.emptyBlockCount = 0;
+            for (u32 t = 0; t < MAX_MEMORY_TYPES; ++t)
+                outStats.emptyBlockCount += m_context->m_pools[t].numEmpty;
+        }
+
+        void device_t::v_getMemoryBudget(memory_budget_t& outBudget) const
+        {
+            memory_properties_t properties;
+            getMemoryProperties(properties);
+            for (u32 h = 0; h < MAX_MEMORY_HEAPS; ++h)
+            {
+                outBudget.heapBudget[h] = h < properties.memoryHeapCount ? properties.memoryHeaps[h].size / 10 * 8 : 0;
+                outBudget.heapUsage[h]  = 0;
+            }
+        }
+
+    }  // namespace nvkmem
 }  // namespace ncore
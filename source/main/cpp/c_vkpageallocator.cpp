@@ -0,0 +1,622 @@
+#include "ccore/c_target.h"
+#include "ccore/c_debug.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/private/c_vkpageallocator.h"
+
+// CVKMEM_PAGE_SCAN_SCALAR turns the SIMD word scans off, for testing and for targets with slow unaligned loads
+#if defined(CVKMEM_PAGE_SCAN_SCALAR)
+#elif defined(__AVX2__)
+#    include <immintrin.h>
+#    define CVKMEM_PAGE_SCAN_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    include <emmintrin.h>
+#    define CVKMEM_PAGE_SCAN_SSE2
+#endif
+
+namespace ncore
+{
+    namespace nalloc
+    {
+        static constexpr u32 PAGE_HANDLE_INDEX_BITS = 24;
+        static constexpr u32 PAGE_HANDLE_INDEX_MASK = (1 << PAGE_HANDLE_INDEX_BITS) - 1;
+        static constexpr u32 NO_RECORD              = 0xffffffff;
+        static constexpr u64 FULL_WORD              = 0xffffffffffffffffull;
+
+        static inline u32 sLowestBit(u64 v)
+        {
+#ifdef _MSC_VER
+            unsigned long retVal;
+            _BitScanForward64(&retVal, v);
+            return retVal;
+#else
+            return __builtin_ctzll(v);
+#endif
+        }
+
+        static inline u32 sHighestBit(u64 v)
+        {
+#ifdef _MSC_VER
+            unsigned long retVal;
+            _BitScanReverse64(&retVal, v);
+            return retVal;
+#else
+            return 63 - __builtin_clzll(v);
+#endif
+        }
+
+        // Number of consecutive set bits from bit 0 up
+        static inline u32 sLowRun(u64 word) { return word == FULL_WORD ? 64 : sLowestBit(~word); }
+
+        // Number of consecutive set bits from bit 63 down
+        static inline u32 sHighRun(u64 word) { return word == FULL_WORD ? 64 : 63 - sHighestBit(~word); }
+
+        // Bit i of the result is set when words[i] has all pages free, 'count' is at most 64
+        static u64 sFullWordMask(u64 const* words, u32 count)
+        {
+            u64 mask = 0;
+            u32 i    = 0;
+#if defined(CVKMEM_PAGE_SCAN_AVX2)
+            __m256i const ones = _mm256_set1_epi64x(-1);
+            for (; i + 4 <= count; i += 4)
+            {
+                __m256i const v = _mm256_loadu_si256((__m256i const*)(words + i));
+                u32 const     m = (u32)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, ones)));
+                mask |= (u64)m << i;
+            }
+#elif defined(CVKMEM_PAGE_SCAN_SSE2)
+            __m128i const ones = _mm_set1_epi32(-1);
+            for (; i + 2 <= count; i += 2)
+            {
+                __m128i const v = _mm_loadu_si128((__m128i const*)(words + i));
+                u32 const     m = (u32)_mm_movemask_epi8(_mm_cmpeq_epi32(v, ones));
+                mask |= (u64)(((m & 0xff) == 0xff ? 1 : 0) | ((m >> 8) == 0xff ? 2 : 0)) << i;
+            }
+#endif
+            for (; i < count; ++i)
+            {
+                if (words[i] == FULL_WORD)
+                    mask |= (u64)1 << i;
+            }
+            return mask;
+        }
+
+        // Lowest bit i allowed by 'allowed' where bits [i, i + n) of 'word' are all set, 64 when there is none
+        static inline u32 sFindRunInWord(u64 word, u32 n, u64 allowed)
+        {
+            u64 x   = word;
+            u32 len = 1;
+            while (len < n && x != 0)
+            {
+                u32 const s = len < n - len ? len : n - len;
+                x &= x >> s;
+                len += s;
+            }
+            x &= allowed;
+            return x != 0 ? sLowestBit(x) : 64;
+        }
+
+        struct page_record_t
+        {
+            u32  firstPage;
+            u32  numPages;
+            u32* runs;  // (first page, page count) pairs of a scattered allocation, nullptr when contiguous
+            u32  numRuns;
+            u32  nextFree;
+            u8   generation;
+            bool used;
+        };
+
+        template <typename TOffset>
+        struct page_allocator_T<TOffset>::context_t
+        {
+            alloc_t* m_allocator;
+            offset_t m_size;
+            offset_t m_pageSize;
+            u32      m_pageShift;
+            u32      m_numPages;
+            u32      m_freePages;
+            u32      m_numWords;
+            u32      m_numSummaryWords;
+            u64*     m_words;    // Bit set: page is free
+            u64*     m_summary;  // Bit set: word has a free page
+
+            page_record_t* m_records;
+            u32            m_numRecords;
+            u32            m_maxRecords;
+            u32            m_maxAllocs;
+            u32            m_freeRecord;
+
+            // Free run histogram of the last report, rebuilt once the bitmap has changed
+            u32  m_runCounts[NUM_REPORT_BINS];
+            u32  m_longestRun;
+            bool m_runCountsValid;
+        };
+
+        template <typename TContext>
+        static void sMarkPages(TContext* ctx, u32 first, u32 count, bool free)
+        {
+            ctx->m_runCountsValid = false;
+            while (count > 0)
+            {
+                u32 const w    = first >> 6;
+                u32 const b    = first & 63;
+                u32 const n    = (64 - b) < count ? (64 - b) : count;
+                u64 const mask = n == 64 ? FULL_WORD : (((u64)1 << n) - 1) << b;
+                if (free)
+                    ctx->m_words[w] |= mask;
+                else
+                    ctx->m_words[w] &= ~mask;
+                if (ctx->m_words[w] != 0)
+                    ctx->m_summary[w >> 6] |= (u64)1 << (w & 63);
+                else
+                    ctx->m_summary[w >> 6] &= ~((u64)1 << (w & 63));
+                first += n;
+                count -= n;
+            }
+        }
+
+        // First word at or after 'w' with a free page, m_numWords when there is none
+        template <typename TContext>
+        static u32 sNextFreeWord(TContext const* ctx, u32 w)
+        {
+            while (w < ctx->m_numWords)
+            {
+                u32 const s    = w >> 6;
+                u64 const bits = ctx->m_summary[s] & (FULL_WORD << (w & 63));
+                if (bits != 0)
+                    return (s << 6) | sLowestBit(bits);
+                w = (s + 1) << 6;
+            }
+            return ctx->m_numWords;
+        }
+
+        // Number of consecutive fully free words starting at 'w', counting stops after 'maxWords'
+        template <typename TContext>
+        static u32 sCountFullWords(TContext const* ctx, u32 w, u32 maxWords)
+        {
+            u32 count = 0;
+            while (count < maxWords && w + count < ctx->m_numWords)
+            {
+                u32 const remaining = ctx->m_numWords - (w + count);
+                u32 const c         = remaining < 64 ? remaining : 64;
+                u64 const full      = sFullWordMask(ctx->m_words + w + count, c);
+                u32 const k         = sLowRun(full);
+                count += k < c ? k : c;
+                if (k < c)
+                    break;
+            }
+            return count;
+        }
+
+        // Lowest run of 'numPages' free pages that starts at a multiple of 'alignPages', NO_RECORD when none
+        template <typename TContext>
+        static u32 sFindRun(TContext const* ctx, u32 numPages, u32 alignPages)
+        {
+            u64 alignMask = 0;
+            if (alignPages < 64)
+            {
+                for (u32 i = 0; i < 64; i += alignPages)
+                    alignMask |= (u64)1 << i;
+            }
+
+            u64 run      = 0;  // Free pages carried over from the previous words
+            u64 runStart = 0;
+            u32 w        = sNextFreeWord(ctx, 0);
+            while (w < ctx->m_numWords)
+            {
+                u64 const word = ctx->m_words[w];
+                if (word == FULL_WORD)
+                {
+                    if (run == 0)
+                        runStart = (u64)w << 6;
+                    u32 const k = numPages > 64 ? sCountFullWords(ctx, w, (u32)(((u64)numPages + alignPages) / 64 + 1)) : 1;
+                    run += (u64)k << 6;
+                    u64 const start = (runStart + alignPages - 1) & ~(u64)(alignPages - 1);
+                    if (start + numPages <= runStart + run)
+                        return (u32)start;
+                    w += k;
+                    continue;
+                }
+
+                if (word != 0)
+                {
+                    // A run that ends in the low bits of this word
+                    u32 const low = sLowRun(word);
+                    if (run == 0)
+                        runStart = (u64)w << 6;
+                    u64 const start = (runStart + alignPages - 1) & ~(u64)(alignPages - 1);
+                    if (start + numPages <= runStart + run + low)
+                        return (u32)start;
+
+                    // A run inside this word
+                    if (numPages <= 64)
+                    {
+                        u64 const allowed = alignPages < 64 ? alignMask : ((((u64)w << 6) & (alignPages - 1)) == 0 ? 1 : 0);
+                        u32 const b       = sFindRunInWord(word, numPages, allowed);
+                        if (b < 64)
+                            return (w << 6) + b;
+                    }
+
+                    // A run that starts in the high bits of this word
+                    run      = sHighRun(word);
+                    runStart = ((u64)w << 6) + 64 - run;
+                }
+                else
+                {
+                    run = 0;
+                }
+                w = run > 0 ? w + 1 : sNextFreeWord(ctx, w + 1);
+            }
+            return NO_RECORD;
+        }
+
+        template <typename TContext>
+        static u32 sAcquireRecord(TContext* ctx)
+        {
+            u32 index = ctx->m_freeRecord;
+            if (index != NO_RECORD)
+            {
+                ctx->m_freeRecord = ctx->m_records[index].nextFree;
+                return index;
+            }
+            if (ctx->m_numRecords == ctx->m_maxAllocs)
+                return NO_RECORD;
+            if (ctx->m_numRecords == ctx->m_maxRecords)
+            {
+                u32 maxRecords = ctx->m_maxRecords == 0 ? 256 : ctx->m_maxRecords * 2;
+                if (maxRecords > ctx->m_maxAllocs)
+                    maxRecords = ctx->m_maxAllocs;
+                ctx->m_records    = g_reallocate_array(ctx->m_allocator, ctx->m_records, ctx->m_maxRecords, maxRecords);
+                ctx->m_maxRecords = maxRecords;
+            }
+            index                            = ctx->m_numRecords++;
+            ctx->m_records[index].generation = 0;
+            ctx->m_records[index].used       = false;
+            return index;
+        }
+
+        template <typename TContext>
+        static page_record_t const* sFindRecord(TContext const* ctx, handle_t handle)
+        {
+            u32 const index = handle & PAGE_HANDLE_INDEX_MASK;
+            if (handle == INVALID_HANDLE || index >= ctx->m_numRecords)
+                return nullptr;
+            page_record_t const* record = &ctx->m_records[index];
+            if (!record->used || record->generation != (u8)(handle >> PAGE_HANDLE_INDEX_BITS))
+                return nullptr;
+            return record;
+        }
+
+        template <typename TContext>
+        static handle_t sCommitRecord(TContext* ctx, u32 index, u32 firstPage, u32 numPages, u32* runs, u32 numRuns)
+        {
+            page_record_t& record = ctx->m_records[index];
+            record.firstPage      = firstPage;
+            record.numPages       = numPages;
+            record.runs           = runs;
+            record.numRuns        = numRuns;
+            record.used           = true;
+            return ((handle_t)record.generation << PAGE_HANDLE_INDEX_BITS) | index;
+        }
+
+        template <typename TOffset>
+        page_allocator_T<TOffset>::page_allocator_T()
+            : m_context(nullptr)
+        {
+        }
+
+        template <typename TOffset>
+        page_allocator_T<TOffset>::~page_allocator_T()
+        {
+        }
+
+        template <typename TOffset>
+        void page_allocator_T<TOffset>::init(alloc_t* allocator, offset_t size, u32 maxAllocs, offset_t pageSize)
+        {
+            ASSERT(!m_context);
+            ASSERT(pageSize > 0 && (pageSize & (pageSize - 1)) == 0);
+
+            m_context              = allocator->construct<context_t>();
+            m_context->m_allocator = allocator;
+            m_context->m_pageSize  = pageSize;
+            m_context->m_pageShift = sLowestBit((u64)pageSize);
+
+            u64 numPages = (u64)size >> m_context->m_pageShift;
+            if (numPages > 0xffffffc0ull)
+                numPages = 0xffffffc0ull;
+            m_context->m_size            = (offset_t)(numPages << m_context->m_pageShift);
+            m_context->m_numPages        = (u32)numPages;
+            m_context->m_freePages       = (u32)numPages;
+            m_context->m_numWords        = (u32)((numPages + 63) / 64);
+            m_context->m_numSummaryWords = (m_context->m_numWords + 63) / 64;
+            m_context->m_words           = g_allocate_array<u64>(allocator, m_context->m_numWords + 1);
+            m_context->m_summary         = g_allocate_array<u64>(allocator, m_context->m_numSummaryWords + 1);
+            for (u32 w = 0; w <= m_context->m_numWords; ++w)
+                m_context->m_words[w] = 0;
+            for (u32 s = 0; s <= m_context->m_numSummaryWords; ++s)
+                m_context->m_summary[s] = 0;
+            sMarkPages(m_context, 0, (u32)numPages, true);
+
+            m_context->m_records        = nullptr;
+            m_context->m_numRecords     = 0;
+            m_context->m_maxRecords     = 0;
+            m_context->m_maxAllocs      = maxAllocs < PAGE_HANDLE_INDEX_MASK ? maxAllocs : PAGE_HANDLE_INDEX_MASK;
+            m_context->m_freeRecord     = NO_RECORD;
+            m_context->m_runCountsValid = false;
+        }
+
+        template <typename TOffset>
+        void page_allocator_T<TOffset>::destroy()
+        {
+            ASSERT(m_context);
+            alloc_t* allocator = m_context->m_allocator;
+            for (u32 i = 0; i < m_context->m_numRecords; ++i)
+            {
+                if (m_context->m_records[i].used && m_context->m_records[i].runs != nullptr)
+                    g_deallocate_array(allocator, m_context->m_records[i].runs);
+            }
+            if (m_context->m_records != nullptr)
+                g_deallocate_array(allocator, m_context->m_records);
+            g_deallocate_array(allocator, m_context->m_words);
+            g_deallocate_array(allocator, m_context->m_summary);
+            allocator->destruct(m_context);
+            m_context = nullptr;
+        }
+
+        template <typename TOffset>
+        TOffset page_allocator_T<TOffset>::size() const
+        {
+            return m_context->m_size;
+        }
+
+        template <typename TOffset>
+        TOffset page_allocator_T<TOffset>::pageSize() const
+        {
+            return m_context->m_pageSize;
+        }
+
+        template <typename TOffset>
+        handle_t page_allocator_T<TOffset>::allocateHandle(offset_t size, offset_t alignment, u32 /*resource*/)
+        {
+            context_t* ctx = m_context;
+            if (size == 0 || size > ctx->m_size)
+                return INVALID_HANDLE;
+
+            u32 const numPages   = (u32)((size + ctx->m_pageSize - 1) >> ctx->m_pageShift);
+            u32 const alignPages = alignment > ctx->m_pageSize ? (u32)(alignment >> ctx->m_pageShift) : 1;
+            if (numPages > ctx->m_freePages)
+                return INVALID_HANDLE;
+
+            u32 const firstPage = sFindRun(ctx, numPages, alignPages);
+            if (firstPage == NO_RECORD)
+                return INVALID_HANDLE;
+            u32 const index = sAcquireRecord(ctx);
+            if (index == NO_RECORD)
+                return INVALID_HANDLE;
+
+            sMarkPages(ctx, firstPage, numPages, false);
+            ctx->m_freePages -= numPages;
+            return sCommitRecord(ctx, index, firstPage, numPages, nullptr, 0);
+        }
+
+        template <typename TOffset>
+        handle_t page_allocator_T<TOffset>::allocateScattered(offset_t size, u32 maxRuns)
+        {
+            context_t* ctx = m_context;
+            if (size == 0 || size > ctx->m_size || maxRuns == 0)
+                return INVALID_HANDLE;
+
+            u32 const numPages = (u32)((size + ctx->m_pageSize - 1) >> ctx->m_pageShift);
+            if (numPages > ctx->m_freePages)
+                return INVALID_HANDLE;
+
+            // Collect the lowest free runs without touching the bitmap, a request that needs too many runs fails
+            u32  maxPairs = 16;
+            u32* runs     = g_allocate_array<u32>(ctx->m_allocator, maxPairs * 2);
+            u32  numRuns  = 0;
+            u32  need     = numPages;
+            for (u32 w = sNextFreeWord(ctx, 0); need > 0 && w < ctx->m_numWords; w = sNextFreeWord(ctx, w + 1))
+            {
+                u64 word = ctx->m_words[w];
+                while (word != 0 && need > 0)
+                {
+                    u32 const b    = sLowestBit(word);
+                    u32 const len  = sLowRun(word >> b);
+                    u32 const take = len < need ? len : need;
+                    u32 const page = (w << 6) + b;
+                    word &= ~(take == 64 ? FULL_WORD : (((u64)1 << take) - 1) << b);
+                    need -= take;
+
+                    if (numRuns > 0 && runs[numRuns * 2 - 2] + runs[numRuns * 2 - 1] == page)
+                    {
+                        runs[numRuns * 2 - 1] += take;
+                        continue;
+                    }
+                    if (numRuns == maxRuns)
+                    {
+                        g_deallocate_array(ctx->m_allocator, runs);
+                        return INVALID_HANDLE;
+                    }
+                    if (numRuns == maxPairs)
+                    {
+                        runs     = g_reallocate_array(ctx->m_allocator, runs, maxPairs * 2, maxPairs * 4);
+                        maxPairs = maxPairs * 2;
+                    }
+                    runs[numRuns * 2 + 0] = page;
+                    runs[numRuns * 2 + 1] = take;
+                    numRuns++;
+                }
+            }
+
+            u32 const index = sAcquireRecord(ctx);
+            if (index == NO_RECORD)
+            {
+                g_deallocate_array(ctx->m_allocator, runs);
+                return INVALID_HANDLE;
+            }
+
+            for (u32 r = 0; r < numRuns; ++r)
+                sMarkPages(ctx, runs[r * 2], runs[r * 2 + 1], false);
+            ctx->m_freePages -= numPages;
+
+            u32 const firstPage = runs[0];
+            if (numRuns == 1)
+            {
+                g_deallocate_array(ctx->m_allocator, runs);
+                return sCommitRecord(ctx, index, firstPage, numPages, nullptr, 0);
+            }
+            return sCommitRecord(ctx, index, firstPage, numPages, runs, numRuns);
+        }
+
+        template <typename TOffset>
+        bool page_allocator_T<TOffset>::freeHandle(handle_t handle)
+        {
+            context_t* ctx = m_context;
+            if (sFindRecord(ctx, handle) == nullptr)
+                return false;
+
+            page_record_t& record = ctx->m_records[handle & PAGE_HANDLE_INDEX_MASK];
+            if (record.runs != nullptr)
+            {
+                for (u32 r = 0; r < record.numRuns; ++r)
+                    sMarkPages(ctx, record.runs[r * 2], record.runs[r * 2 + 1], true);
+                g_deallocate_array(ctx->m_allocator, record.runs);
+                record.runs = nullptr;
+            }
+            else
+            {
+                sMarkPages(ctx, record.firstPage, record.numPages, true);
+            }
+            ctx->m_freePages += record.numPages;
+
+            record.used       = false;
+            record.generation = (u8)(record.generation + 1);
+            record.nextFree   = ctx->m_freeRecord;
+            ctx->m_freeRecord = handle & PAGE_HANDLE_INDEX_MASK;
+            return true;
+        }
+
+        template <typename TOffset>
+        bool page_allocator_T<TOffset>::isValid(handle_t handle) const
+        {
+            return sFindRecord(m_context, handle) != nullptr;
+        }
+
+        template <typename TOffset>
+        TOffset page_allocator_T<TOffset>::getOffset(handle_t handle) const
+        {
+            page_record_t const* record = sFindRecord(m_context, handle);
+            return record != nullptr ? (offset_t)record->firstPage << m_context->m_pageShift : allocation_T<offset_t>::NO_SPACE;
+        }
+
+        template <typename TOffset>
+        TOffset page_allocator_T<TOffset>::getSize(handle_t handle) const
+        {
+            page_record_t const* record = sFindRecord(m_context, handle);
+            return record != nullptr ? (offset_t)record->numPages << m_context->m_pageShift : 0;
+        }
+
+        template <typename TOffset>
+        u32 page_allocator_T<TOffset>::getRuns(handle_t handle, page_run_t* outRuns, u32 maxRuns) const
+        {
+            page_record_t const* record = sFindRecord(m_context, handle);
+            if (record == nullptr)
+                return 0;
+
+            u32 const shift = m_context->m_pageShift;
+            if (record->runs == nullptr)
+            {
+                if (maxRuns > 0)
+                {
+                    outRuns[0].offset = (offset_t)record->firstPage << shift;
+                    outRuns[0].size   = (offset_t)record->numPages << shift;
+                }
+                return 1;
+            }
+            for (u32 r = 0; r < record->numRuns && r < maxRuns; ++r)
+            {
+                outRuns[r].offset = (offset_t)record->runs[r * 2] << shift;
+                outRuns[r].size   = (offset_t)record->runs[r * 2 + 1] << shift;
+            }
+            return record->numRuns;
+        }
+
+        // Histogram of the free runs by log2 of their page count, returns the longest run in pages
+        template <typename TContext>
+        static u32 sFreeRunHistogram(TContext const* ctx, u32* counts, u32 numBins)
+        {
+            for (u32 b = 0; b < numBins; ++b)
+                counts[b] = 0;
+
+            u32 longest = 0;
+            u32 run     = 0;
+            for (u32 w = 0; w <= ctx->m_numWords; ++w)
+            {
+                u64 const word = ctx->m_words[w];  // The extra word is always 0 and terminates the last run
+                if (word == FULL_WORD)
+                {
+                    run += 64;
+                    continue;
+                }
+
+                u32 bit = 0;
+                while (bit < 64)
+                {
+                    u32 const free = sLowRun(word >> bit);
+                    run += free;
+                    bit += free;
+                    if (bit >= 64)
+                        break;  // The run continues in the next word
+
+                    if (run > 0)
+                    {
+                        u32 const bin = sHighestBit(run);
+                        counts[bin < numBins ? bin : numBins - 1]++;
+                        longest = run > longest ? run : longest;
+                        run     = 0;
+                    }
+                    u64 const rest = word >> bit;
+                    if (rest == 0)
+                        break;
+                    bit += sLowestBit(rest);
+                }
+            }
+            return longest;
+        }
+
+        // A report walks every bin, the histogram is built once for all of them
+        template <typename TContext>
+        static void sUpdateRunCounts(TContext* ctx, u32 numBins)
+        {
+            if (!ctx->m_runCountsValid)
+            {
+                ctx->m_longestRun     = sFreeRunHistogram(ctx, ctx->m_runCounts, numBins);
+                ctx->m_runCountsValid = true;
+            }
+        }
+
+        template <typename TOffset>
+        void page_allocator_T<TOffset>::storageReport(storage_report_t& report) const
+        {
+            sUpdateRunCounts(m_context, NUM_REPORT_BINS);
+            report.totalFreeSpace    = (u64)m_context->m_freePages << m_context->m_pageShift;
+            report.largestFreeRegion = (u64)m_context->m_longestRun << m_context->m_pageShift;
+            report.numberOfBins      = NUM_REPORT_BINS;
+            report.numberOfUsedBins  = 0;
+            for (u32 b = 0; b < NUM_REPORT_BINS; ++b)
+                report.numberOfUsedBins += m_context->m_runCounts[b] != 0 ? 1 : 0;
+        }
+
+        template <typename TOffset>
+        void page_allocator_T<TOffset>::storageBinState(u32 binIndex, bin_report_t& binState) const
+        {
+            sUpdateRunCounts(m_context, NUM_REPORT_BINS);
+            binState.size  = binIndex < NUM_REPORT_BINS ? (u64)m_context->m_pageSize << binIndex : 0;
+            binState.count = binIndex < NUM_REPORT_BINS ? m_context->m_runCounts[binIndex] : 0;
+        }
+
+        template class page_allocator_T<u32>;
+        template class page_allocator_T<u64>;
+    }  // namespace nalloc
+}  // namespace ncore
@@ -0,0 +1,449 @@
+#include "ccore/c_target.h"
+#include "ccore/c_debug.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/c_vkresidency.h"
+
+namespace ncore
+{
+    namespace nvkmem
+    {
+        static constexpr u32 NO_ENTRY   = 0xffffffff;
+        static constexpr u32 SLOT_BITS  = 24;
+        static constexpr u32 SLOT_MASK  = (1u << SLOT_BITS) - 1;
+        static constexpr u32 MAX_SLOTS  = SLOT_MASK;  // SLOT_MASK itself would make a handle of INVALID_RESIDENT
+        static constexpr u32 FREE_STATE = 0xff;
+
+        // A resident is its slot index in the low bits and the slot generation in the high bits
+        struct resident_entry_t
+        {
+            residency_desc_t desc;
+            allocation_t     allocation;
+            u64              lastUsed;
+            u32              prev;  // Least recently used list of the priority, or the free list
+            u32              next;
+            u32              heap;  // Heap of the allocation
+            u8               state;
+            u8               generation;
+        };
+
+        struct lru_list_t
+        {
+            u32 head;  // Least recently used
+            u32 tail;
+        };
+
+        struct residency_manager_t::context_t
+        {
+            alloc_t*              m_allocator;
+            memory_manager_t*     m_manager;
+            residency_listener_t* m_listener;
+            residency_config_t    m_config;
+            u32                   m_heapTypes[MAX_MEMORY_HEAPS];  // Memory type bits of every heap
+
+            resident_entry_t* m_entries;
+            u32               m_numEntries;
+            u32               m_maxEntries;
+            u32               m_freeEntry;
+            lru_list_t        m_lists[NUM_RESIDENCY_PRIORITIES];
+
+            u32 m_totalEvictions;
+            u32 m_totalDemotions;
+        };
+
+        static inline resident_t sHandle(resident_entry_t const* entry, u32 slot) { return ((u32)entry->generation << SLOT_BITS) | slot; }
+
+        static resident_entry_t* sFindEntry(residency_manager_t::context_t const* ctx, resident_t resident)
+        {
+            u32 const slot = resident & SLOT_MASK;
+            if (resident == INVALID_RESIDENT || slot >= ctx->m_numEntries)
+                return nullptr;
+            resident_entry_t* entry = &ctx->m_entries[slot];
+            if (entry->state == FREE_STATE || entry->generation != (u8)(resident >> SLOT_BITS))
+                return nullptr;
+            return entry;
+        }
+
+        static void sUnlink(residency_manager_t::context_t* ctx, u32 slot)
+        {
+            resident_entry_t& entry = ctx->m_entries[slot];
+            lru_list_t&       list  = ctx->m_lists[entry.desc.priority];
+            if (entry.prev != NO_ENTRY)
+                ctx->m_entries[entry.prev].next = entry.next;
+            else
+                list.head = entry.next;
+            if (entry.next != NO_ENTRY)
+                ctx->m_entries[entry.next].prev = entry.prev;
+            else
+                list.tail = entry.prev;
+        }
+
+        // Lists stay ordered by the frame of last use, a resource is inserted behind the last one used before it
+        static void sLink(residency_manager_t::context_t* ctx, u32 slot)
+        {
+            resident_entry_t& entry = ctx->m_entries[slot];
+            lru_list_t&       list  = ctx->m_lists[entry.desc.priority];
+            u32               prev  = list.tail;
+            while (prev != NO_ENTRY && ctx->m_entries[prev].lastUsed > entry.lastUsed)
+                prev = ctx->m_entries[prev].prev;
+            entry.prev = prev;
+            entry.next = prev != NO_ENTRY ? ctx->m_entries[prev].next : list.head;
+            if (entry.prev != NO_ENTRY)
+                ctx->m_entries[entry.prev].next = slot;
+            else
+                list.head = slot;
+            if (entry.next != NO_ENTRY)
+                ctx->m_entries[entry.next].prev = slot;
+            else
+                list.tail = slot;
+        }
+
+        // What the heap holds that cannot be reused: other processes and the bytes handed out by the manager
+        static u64 sHeapPressure(residency_manager_t::context_t const* ctx, u32 heap)
+        {
+            heap_budget_t budget;
+            ctx->m_manager->getBudget(heap, budget);
+            u64 const freeInBlocks = budget.blockBytes - budget.allocationBytes;
+            return budget.usage > freeInBlocks ? budget.usage - freeInBlocks : 0;
+        }
+
+        static u64 sHeapLimit(residency_manager_t::context_t const* ctx, u32 heap, u32 percent)
+        {
+            heap_budget_t budget;
+            ctx->m_manager->getBudget(heap, budget);
+            return budget.budget / 100 * percent;
+        }
+
+        static bool sAllocate(residency_manager_t::context_t* ctx, residency_desc_t const& desc, u32 requiredFlags, u32 typeMask, allocation_t& outAllocation)
+        {
+            memory_requirements_t requirements = desc.requirements;
+            requirements.memoryTypeBits &= typeMask;
+            if (requirements.memoryTypeBits == 0)
+                return false;
+            return ctx->m_manager->allocate(requirements, requiredFlags, desc.preferredFlags, desc.usage, desc.resource, outAllocation);
+        }
+
+        // Moves a resource to fallback memory in another heap, unless that pushes the other heap beyond its limit
+        static bool sDemote(residency_manager_t::context_t* ctx, u32 slot)
+        {
+            resident_entry_t& entry = ctx->m_entries[slot];
+            allocation_t      fallback;
+            if (!sAllocate(ctx, entry.desc, ctx->m_config.fallbackFlags, ~ctx->m_heapTypes[entry.heap], fallback))
+                return false;
+            u32 const fallbackHeap = ctx->m_manager->getMemoryProperties().memoryTypes[fallback.memoryType].heapIndex;
+            if (sHeapPressure(ctx, fallbackHeap) > sHeapLimit(ctx, fallbackHeap, ctx->m_config.evictPercent))
+            {
+                ctx->m_manager->free(fallback);
+                return false;
+            }
+
+            ctx->m_listener->onMoved(sHandle(&entry, slot), entry.allocation, fallback, entry.desc.userData);
+            ctx->m_manager->free(entry.allocation);
+            entry.allocation = fallback;
+            entry.heap       = fallbackHeap;
+            entry.state      = RESIDENCY_STATE_DEMOTED;
+            ctx->m_totalDemotions++;
+            return true;
+        }
+
+        static void sEvict(residency_manager_t::context_t* ctx, u32 slot)
+        {
+            resident_entry_t& entry = ctx->m_entries[slot];
+            ctx->m_listener->onEvicted(sHandle(&entry, slot), entry.allocation, entry.desc.userData);
+            sUnlink(ctx, slot);
+            ctx->m_manager->free(entry.allocation);
+            entry.state = RESIDENCY_STATE_EVICTED;
+            ctx->m_totalEvictions++;
+        }
+
+        // Demotes or evicts the coldest resources of 'heap' until its pressure is at most 'target', lowest
+        // priority first. Resources used in the last framesInFlight frames and 'keep' are skipped.
+        static u32 sRelieve(residency_manager_t::context_t* ctx, u32 heap, u64 target, u64 frame, u32 keep)
+        {
+            u32 count = 0;
+            for (u32 p = 0; p < NUM_RESIDENCY_PRIORITIES; ++p)
+            {
+                u32 slot = ctx->m_lists[p].head;
+                while (slot != NO_ENTRY && sHeapPressure(ctx, heap) > target)
+                {
+                    resident_entry_t& entry = ctx->m_entries[slot];
+                    u32 const         next  = entry.next;
+                    if (entry.lastUsed + ctx->m_config.framesInFlight > frame)
+                        break;  // The rest of the list is more recent
+                    if (entry.heap == heap && slot != keep)
+                    {
+                        bool const demote = (entry.desc.flags & RESIDENCY_FLAG_DEMOTABLE) != 0 && entry.state == RESIDENCY_STATE_RESIDENT;
+                        if (demote && sDemote(ctx, slot))
+                        {
+                            count++;
+                        }
+                        else if ((entry.desc.flags & RESIDENCY_FLAG_EVICTABLE) != 0)
+                        {
+                            sEvict(ctx, slot);
+                            count++;
+                        }
+                    }
+                    slot = next;
+                }
+                if (sHeapPressure(ctx, heap) <= target)
+                    break;
+            }
+            return count;
+        }
+
+        // Allocates memory of the requested type for a resource, relieving the heap of the best memory type first
+        static bool sAllocateResident(residency_manager_t::context_t* ctx, residency_desc_t const& desc, u64 frame, u32 keep, allocation_t& outAllocation)
+        {
+            u8        types[MAX_MEMORY_TYPES];
+            u32 const numTypes = ctx->m_manager->findMemoryTypes(desc.requirements.memoryTypeBits, desc.requiredFlags, desc.preferredFlags, desc.usage, types);
+            if (numTypes == 0)
+                return false;
+
+            u32 const heap  = ctx->m_manager->getMemoryProperties().memoryTypes[types[0]].heapIndex;
+            u64 const limit = sHeapLimit(ctx, heap, ctx->m_config.evictPercent);
+            if (sHeapPressure(ctx, heap) + desc.requirements.size > limit)
+            {
+                u64 const target = sHeapLimit(ctx, heap, ctx->m_config.targetPercent);
+                sRelieve(ctx, heap, target > desc.requirements.size ? target - desc.requirements.size : 0, frame, keep);
+            }
+            if (sAllocate(ctx, desc, desc.requiredFlags, 0xffffffff, outAllocation))
+                return true;
+
+            // Out of device memory, give up everything in the heap that may go and try once more
+            if (sRelieve(ctx, heap, 0, frame, keep) == 0)
+                return false;
+            ctx->m_manager->trim();
+            return sAllocate(ctx, desc, desc.requiredFlags, 0xffffffff, outAllocation);
+        }
+
+        residency_manager_t::residency_manager_t()
+            : m_context(nullptr)
+        {
+        }
+
+        residency_manager_t::~residency_manager_t() {}
+
+        void residency_manager_t::init(alloc_t* allocator, memory_manager_t* manager, residency_listener_t* listener, residency_config_t const& config)
+        {
+            ASSERT(!m_context);
+            m_context                   = allocator->construct<context_t>();
+            m_context->m_allocator      = allocator;
+            m_context->m_manager        = manager;
+            m_context->m_listener       = listener;
+            m_context->m_config         = config;
+            m_context->m_entries        = nullptr;
+            m_context->m_numEntries     = 0;
+            m_context->m_maxEntries     = 0;
+            m_context->m_freeEntry      = NO_ENTRY;
+            m_context->m_totalEvictions = 0;
+            m_context->m_totalDemotions = 0;
+            for (u32 p = 0; p < NUM_RESIDENCY_PRIORITIES; ++p)
+                m_context->m_lists[p] = {NO_ENTRY, NO_ENTRY};
+
+            memory_properties_t const& properties = manager->getMemoryProperties();
+            for (u32 h = 0; h < MAX_MEMORY_HEAPS; ++h)
+                m_context->m_heapTypes[h] = 0;
+            for (u32 t = 0; t < properties.memoryTypeCount; ++t)
+                m_context->m_heapTypes[properties.memoryTypes[t].heapIndex] |= 1u << t;
+        }
+
+        void residency_manager_t::destroy()
+        {
+            ASSERT(m_context);
+            context_t* ctx = m_context;
+            for (u32 i = 0; i < ctx->m_numEntries; ++i)
+            {
+                u8 const state = ctx->m_entries[i].state;
+                if (state == RESIDENCY_STATE_RESIDENT || state == RESIDENCY_STATE_DEMOTED)
+                    ctx->m_manager->free(ctx->m_entries[i].allocation);
+            }
+            if (ctx->m_entries != nullptr)
+                g_deallocate_array(ctx->m_allocator, ctx->m_entries);
+            ctx->m_allocator->destruct(ctx);
+            m_context = nullptr;
+        }
+
+        resident_t residency_manager_t::add(residency_desc_t const& desc, u64 frame)
+        {
+            context_t* ctx = m_context;
+            ASSERT(desc.priority < NUM_RESIDENCY_PRIORITIES);
+
+            allocation_t allocation;
+            if (!sAllocateResident(ctx, desc, frame, NO_ENTRY, allocation))
+                return INVALID_RESIDENT;
+
+            u32 slot = ctx->m_freeEntry;
+            if (slot != NO_ENTRY)
+            {
+                ctx->m_freeEntry = ctx->m_entries[slot].next;
+            }
+            else if (ctx->m_numEntries == MAX_SLOTS)
+            {
+                ctx->m_manager->free(allocation);
+                return INVALID_RESIDENT;
+            }
+            else
+            {
+                if (ctx->m_numEntries == ctx->m_maxEntries)
+                {
+                    u32 const maxEntries = ctx->m_maxEntries == 0 ? 64 : (ctx->m_maxEntries < MAX_SLOTS / 2 ? ctx->m_maxEntries * 2 : MAX_SLOTS);
+                    ctx->m_entries       = g_reallocate_array(ctx->m_allocator, ctx->m_entries, ctx->m_maxEntries, maxEntries);
+                    ctx->m_maxEntries    = maxEntries;
+                }
+                slot                            = ctx->m_numEntries++;
+                ctx->m_entries[slot].generation = 0;
+            }
+
+            resident_entry_t& entry = ctx->m_entries[slot];
+            entry.desc              = desc;
+            entry.allocation        = allocation;
+            entry.lastUsed          = frame;
+            entry.heap              = ctx->m_manager->getMemoryProperties().memoryTypes[allocation.memoryType].heapIndex;
+            entry.state             = RESIDENCY_STATE_RESIDENT;
+            sLink(ctx, slot);
+            return sHandle(&entry, slot);
+        }
+
+        void residency_manager_t::remove(resident_t resident)
+        {
+            context_t*        ctx   = m_context;
+            resident_entry_t* entry = sFindEntry(ctx, resident);
+            ASSERT(entry != nullptr);
+            u32 const slot = resident & SLOT_MASK;
+            if (entry->state != RESIDENCY_STATE_EVICTED)
+            {
+                sUnlink(ctx, slot);
+                ctx->m_manager->free(entry->allocation);
+            }
+            entry->state = FREE_STATE;
+            entry->generation++;
+            entry->next      = ctx->m_freeEntry;
+            ctx->m_freeEntry = slot;
+        }
+
+        void residency_manager_t::use(resident_t resident, u64 frame)
+        {
+            context_t*        ctx   = m_context;
+            resident_entry_t* entry = sFindEntry(ctx, resident);
+            ASSERT(entry != nullptr);
+            if (frame > entry->lastUsed)
+                entry->lastUsed = frame;
+            if (entry->state == RESIDENCY_STATE_EVICTED)
+                return;
+            u32 const slot = resident & SLOT_MASK;
+            if (ctx->m_lists[entry->desc.priority].tail != slot)
+            {
+                sUnlink(ctx, slot);
+                sLink(ctx, slot);
+            }
+        }
+
+        void residency_manager_t::setPriority(resident_t resident, u32 priority)
+        {
+            context_t*        ctx   = m_context;
+            resident_entry_t* entry = sFindEntry(ctx, resident);
+            ASSERT(entry != nullptr && priority < NUM_RESIDENCY_PRIORITIES);
+            if (entry->state == RESIDENCY_STATE_EVICTED)
+            {
+                entry->desc.priority = priority;
+                return;
+            }
+            u32 const slot = resident & SLOT_MASK;
+            sUnlink(ctx, slot);
+            entry->desc.priority = priority;
+            sLink(ctx, slot);
+        }
+
+        bool residency_manager_t::restore(resident_t resident, u64 frame)
+        {
+            context_t*        ctx   = m_context;
+            resident_entry_t* entry = sFindEntry(ctx, resident);
+            ASSERT(entry != nullptr);
+            if (entry->state == RESIDENCY_STATE_RESIDENT)
+            {
+                use(resident, frame);
+                return true;
+            }
+
+            // Making room may move other resources but never this one, which keeps its place in its list
+            // until it has the new memory
+            u32 const    slot = resident & SLOT_MASK;
+            allocation_t allocation;
+            if (!sAllocateResident(ctx, entry->desc, frame, slot, allocation))
+                return false;
+
+            if (frame > entry->lastUsed)
+                entry->lastUsed = frame;
+            if (entry->state == RESIDENCY_STATE_DEMOTED)
+            {
+                ctx->m_listener->onMoved(resident, entry->allocation, allocation, entry->desc.userData);
+                ctx->m_manager->free(entry->allocation);
+                sUnlink(ctx, slot);
+            }
+            entry->allocation = allocation;
+            entry->heap       = ctx->m_manager->getMemoryProperties().memoryTypes[allocation.memoryType].heapIndex;
+            entry->state      = RESIDENCY_STATE_RESIDENT;
+            sLink(ctx, slot);
+            return true;
+        }
+
+        u32 residency_manager_t::getState(resident_t resident) const
+        {
+            resident_entry_t const* entry = sFindEntry(m_context, resident);
+            ASSERT(entry != nullptr);
+            return entry->state;
+        }
+
+        allocation_t const& residency_manager_t::getAllocation(resident_t resident) const
+        {
+            resident_entry_t const* entry = sFindEntry(m_context, resident);
+            ASSERT(entry != nullptr);
+            return entry->allocation;
+        }
+
+        u32 residency_manager_t::update(u64 frame)
+        {
+            context_t* ctx = m_context;
+            ctx->m_manager->updateBudget();
+
+            u32 count = 0;
+            for (u32 h = 0; h < ctx->m_manager->getMemoryProperties().memoryHeapCount; ++h)
+            {
+                if (sHeapPressure(ctx, h) > sHeapLimit(ctx, h, ctx->m_config.evictPercent))
+                    count += sRelieve(ctx, h, sHeapLimit(ctx, h, ctx->m_config.targetPercent), frame, NO_ENTRY);
+            }
+
+            // Hand the memory that became free back to the device, the driver only sees device memory
+            if (count > 0)
+                ctx->m_manager->trim();
+            return count;
+        }
+
+        void residency_manager_t::getStats(residency_stats_t& outStats) const
+        {
+            context_t const* ctx = m_context;
+            outStats             = residency_stats_t();
+            for (u32 i = 0; i < ctx->m_numEntries; ++i)
+            {
+                resident_entry_t const& entry = ctx->m_entries[i];
+                if (entry.state == RESIDENCY_STATE_RESIDENT)
+                {
+                    outStats.residentCount++;
+                    outStats.residentBytes += entry.allocation.size;
+                }
+                else if (entry.state == RESIDENCY_STATE_DEMOTED)
+                {
+                    outStats.demotedCount++;
+                    outStats.demotedBytes += entry.allocation.size;
+                }
+                else if (entry.state == RESIDENCY_STATE_EVICTED)
+                {
+                    outStats.evictedCount++;
+                }
+            }
+            outStats.totalEvictions = ctx->m_totalEvictions;
+            outStats.totalDemotions = ctx->m_totalDemotions;
+        }
+
+    }  // namespace nvkmem
+}  // namespace ncore
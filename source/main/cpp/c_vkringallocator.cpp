@@ -0,0 +1,242 @@
+#include "ccore/c_target.h"
+#include "ccore/c_debug.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/c_vkringallocator.h"
+#include "cvkmem/private/c_vkblockallocator.h"
+
+#include <atomic>
+#include <mutex>
+
+namespace ncore
+{
+    namespace nvkmem
+    {
+        static constexpr u64 UNSUBMITTED = 0xffffffffffffffffull;
+
+        // Ring positions are virtual and only ever increase, the physical offset is the position modulo the
+        // ring size. Everything in [tail, head) is in flight.
+        struct submit_mark_t
+        {
+            u64 value;
+            u64 head;  // Ring head at the time of the submit
+        };
+
+        struct fallback_t
+        {
+            allocation_t allocation;
+            u64          value;  // UNSUBMITTED until the next submit
+        };
+
+        struct ring_allocator_t::context_t
+        {
+            alignas(64) std::atomic<u64> m_head;
+            alignas(64) std::atomic<u64> m_tail;
+
+            alloc_t*          m_allocator;
+            memory_manager_t* m_manager;
+            ring_config_t     m_config;
+            allocation_t      m_memory;  // The ring
+            u64               m_size;
+
+            submit_mark_t m_submits[MAX_PENDING_SUBMITS];
+            u32           m_firstSubmit;
+            u32           m_numSubmits;
+
+            std::mutex  m_fallbackMutex;
+            fallback_t* m_fallbacks;
+            u32         m_numFallbacks;
+            u32         m_maxFallbacks;
+            u32         m_totalFallbacks;
+            u64         m_totalFallbackBytes;
+        };
+
+        static bool sAllocateFallback(ring_allocator_t::context_t* ctx, u64 size, u64 alignment, allocation_t& outAllocation)
+        {
+            memory_requirements_t requirements;
+            requirements.size           = size;
+            requirements.alignment      = alignment;
+            requirements.memoryTypeBits = ctx->m_config.memoryTypeBits;
+
+            std::lock_guard<std::mutex> lock(ctx->m_fallbackMutex);
+            if (!ctx->m_manager->allocate(requirements, ctx->m_config.requiredFlags, ctx->m_config.preferredFlags, ctx->m_config.usage, nalloc::RESOURCE_LINEAR, outAllocation))
+                return false;
+
+            if (ctx->m_numFallbacks == ctx->m_maxFallbacks)
+            {
+                u32 const maxFallbacks = ctx->m_maxFallbacks == 0 ? 16 : ctx->m_maxFallbacks * 2;
+                ctx->m_fallbacks       = g_reallocate_array(ctx->m_allocator, ctx->m_fallbacks, ctx->m_maxFallbacks, maxFallbacks);
+                ctx->m_maxFallbacks    = maxFallbacks;
+            }
+            ctx->m_fallbacks[ctx->m_numFallbacks].allocation = outAllocation;
+            ctx->m_fallbacks[ctx->m_numFallbacks].value      = UNSUBMITTED;
+            ctx->m_numFallbacks++;
+            ctx->m_totalFallbacks++;
+            ctx->m_totalFallbackBytes += size;
+            return true;
+        }
+
+        ring_allocator_t::ring_allocator_t()
+            : m_context(nullptr)
+        {
+        }
+
+        ring_allocator_t::~ring_allocator_t() {}
+
+        bool ring_allocator_t::init(alloc_t* allocator, memory_manager_t* manager, ring_config_t const& config)
+        {
+            ASSERT(!m_context);
+            ASSERT(config.maxAlignment > 0 && (config.maxAlignment & (config.maxAlignment - 1)) == 0);
+
+            // A ring size that is a multiple of the maximum alignment keeps aligned positions aligned after wrapping
+            memory_requirements_t requirements;
+            requirements.size           = config.size & ~(config.maxAlignment - 1);
+            requirements.alignment      = config.maxAlignment;
+            requirements.memoryTypeBits = config.memoryTypeBits;
+
+            allocation_t memory;
+            if (requirements.size == 0 || !manager->allocate(requirements, config.requiredFlags, config.preferredFlags, config.usage, nalloc::RESOURCE_LINEAR, memory))
+                return false;
+
+            m_context = allocator->construct<context_t>();
+            m_context->m_head.store(0);
+            m_context->m_tail.store(0);
+            m_context->m_allocator          = allocator;
+            m_context->m_manager            = manager;
+            m_context->m_config             = config;
+            m_context->m_memory             = memory;
+            m_context->m_size               = requirements.size;
+            m_context->m_firstSubmit        = 0;
+            m_context->m_numSubmits         = 0;
+            m_context->m_fallbacks          = nullptr;
+            m_context->m_numFallbacks       = 0;
+            m_context->m_maxFallbacks       = 0;
+            m_context->m_totalFallbacks     = 0;
+            m_context->m_totalFallbackBytes = 0;
+            return true;
+        }
+
+        void ring_allocator_t::destroy()
+        {
+            ASSERT(m_context);
+            alloc_t* allocator = m_context->m_allocator;
+            for (u32 i = 0; i < m_context->m_numFallbacks; ++i)
+                m_context->m_manager->free(m_context->m_fallbacks[i].allocation);
+            if (m_context->m_fallbacks != nullptr)
+                g_deallocate_array(allocator, m_context->m_fallbacks);
+            m_context->m_manager->free(m_context->m_memory);
+            allocator->destruct(m_context);
+            m_context = nullptr;
+        }
+
+        bool ring_allocator_t::allocate(u64 size, u64 alignment, allocation_t& outAllocation)
+        {
+            context_t* ctx = m_context;
+            if (alignment == 0)
+                alignment = 1;
+            ASSERT((alignment & (alignment - 1)) == 0);
+
+            // An empty allocation takes no ring space and needs no reclaim
+            if (size == 0)
+            {
+                outAllocation      = ctx->m_memory;
+                outAllocation.size = 0;
+                return true;
+            }
+            if (size > ctx->m_size || alignment > ctx->m_config.maxAlignment)
+                return sAllocateFallback(ctx, size, alignment, outAllocation);
+
+            u64 head = ctx->m_head.load(std::memory_order_relaxed);
+            u64 position;
+            while (true)
+            {
+                position         = (head + alignment - 1) & ~(alignment - 1);
+                u64 const lapEnd = (head / ctx->m_size + 1) * ctx->m_size;
+                if (position + size > lapEnd)
+                    position = lapEnd;  // Wrap, the end of the ring is padding
+
+                // Out of ring space, the tail only moves forward so a stale tail is conservative
+                if (position + size - ctx->m_tail.load(std::memory_order_acquire) > ctx->m_size)
+                    return sAllocateFallback(ctx, size, alignment, outAllocation);
+
+                if (ctx->m_head.compare_exchange_weak(head, position + size, std::memory_order_acq_rel, std::memory_order_relaxed))
+                    break;
+            }
+
+            outAllocation        = ctx->m_memory;
+            outAllocation.offset = ctx->m_memory.offset + (position % ctx->m_size);
+            outAllocation.size   = size;
+            return true;
+        }
+
+        void ring_allocator_t::submit(u64 timelineValue)
+        {
+            context_t* ctx = m_context;
+
+            submit_mark_t mark;
+            mark.value = timelineValue;
+            mark.head  = ctx->m_head.load(std::memory_order_acquire);
+            if (ctx->m_numSubmits == MAX_PENDING_SUBMITS)
+            {
+                // Merging into the most recent submit only delays the reclaim of the older one
+                ctx->m_submits[(ctx->m_firstSubmit + ctx->m_numSubmits - 1) % MAX_PENDING_SUBMITS] = mark;
+            }
+            else
+            {
+                ctx->m_submits[(ctx->m_firstSubmit + ctx->m_numSubmits) % MAX_PENDING_SUBMITS] = mark;
+                ctx->m_numSubmits++;
+            }
+
+            std::lock_guard<std::mutex> lock(ctx->m_fallbackMutex);
+            for (u32 i = 0; i < ctx->m_numFallbacks; ++i)
+            {
+                if (ctx->m_fallbacks[i].value == UNSUBMITTED)
+                    ctx->m_fallbacks[i].value = timelineValue;
+            }
+        }
+
+        void ring_allocator_t::reclaim(u64 completedValue)
+        {
+            context_t* ctx = m_context;
+
+            // Each completed submit releases its whole ring segment by moving the tail
+            while (ctx->m_numSubmits > 0 && ctx->m_submits[ctx->m_firstSubmit].value <= completedValue)
+            {
+                ctx->m_tail.store(ctx->m_submits[ctx->m_firstSubmit].head, std::memory_order_release);
+                ctx->m_firstSubmit = (ctx->m_firstSubmit + 1) % MAX_PENDING_SUBMITS;
+                ctx->m_numSubmits--;
+            }
+
+            std::lock_guard<std::mutex> lock(ctx->m_fallbackMutex);
+            u32                         i = 0;
+            while (i < ctx->m_numFallbacks)
+            {
+                fallback_t& fallback = ctx->m_fallbacks[i];
+                if (fallback.value != UNSUBMITTED && fallback.value <= completedValue)
+                {
+                    ctx->m_manager->free(fallback.allocation);
+                    fallback = ctx->m_fallbacks[--ctx->m_numFallbacks];
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+        }
+
+        void ring_allocator_t::getStats(ring_stats_t& outStats) const
+        {
+            context_t* ctx          = m_context;
+            outStats.bytesInFlight  = ctx->m_head.load(std::memory_order_acquire) - ctx->m_tail.load(std::memory_order_acquire);
+            outStats.pendingSubmits = ctx->m_numSubmits;
+
+            std::lock_guard<std::mutex> lock(ctx->m_fallbackMutex);
+            outStats.fallbackCount      = ctx->m_numFallbacks;
+            outStats.totalFallbacks     = ctx->m_totalFallbacks;
+            outStats.totalFallbackBytes = ctx->m_totalFallbackBytes;
+        }
+
+        allocation_t const& ring_allocator_t::getMemory() const { return m_context->m_memory; }
+
+    }  // namespace nvkmem
+}  // namespace ncore
@@ -0,0 +1,352 @@
+#include "ccore/c_target.h"
+#include "ccore/c_debug.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/private/c_vkshardedallocator.h"
+
+#include <atomic>
+#include <mutex>
+
+namespace ncore
+{
+    namespace nalloc
+    {
+        static constexpr u32 NUM_CACHED_RESOURCES = 3;  // RESOURCE_ANY, RESOURCE_LINEAR and RESOURCE_OPTIMAL
+
+        template <typename TConfig>
+        struct sharded_allocator_T<TConfig>::context_t
+        {
+            typedef sharded_allocator_T<TConfig>        allocator_t;
+            typedef typename allocator_t::offset_t      offset_t;
+            typedef typename allocator_t::allocation_t  allocation_t;
+            typedef block_allocator_T<TConfig>          shard_allocator_t;
+
+            // Padded to a cache line so that threads hammering neighbouring shards do not false-share the lock
+            struct alignas(64) shard_t
+            {
+                std::mutex        mutex;
+                shard_allocator_t allocator;
+                offset_t          base;
+                offset_t          size;
+            };
+
+            alloc_t*         m_allocator;
+            shard_t**        m_shards;
+            u32              m_numShards;
+            offset_t         m_shardSize;
+            offset_t         m_shardAlignment;  // Largest alignment that is honoured
+            std::atomic<u32> m_nextHome;
+        };
+
+        template <typename TConfig>
+        struct sharded_allocator_T<TConfig>::cache_t
+        {
+            struct magazine_t
+            {
+                u32          count;
+                allocation_t items[MAGAZINE_SIZE];
+            };
+
+            u32        home;  // Shard that is tried first
+            magazine_t magazines[NUM_SIZE_CLASSES][NUM_CACHED_RESOURCES];
+        };
+
+        // Returns the size class of a request, or NUM_SIZE_CLASSES when it is not served by the caches
+        template <typename TOffset>
+        static u32 sSizeClass(TOffset size, TOffset alignment, u32 resource, u32 minShift, u32 maxShift)
+        {
+            if (size > ((TOffset)1 << maxShift) || alignment > ((TOffset)1 << maxShift) || resource >= NUM_CACHED_RESOURCES)
+                return maxShift - minShift + 1;
+            u32 shift = minShift;
+            while (((TOffset)1 << shift) < size || ((TOffset)1 << shift) < alignment)
+                shift++;
+            return shift - minShift;
+        }
+
+        // Allocate up to 'count' ranges of the same size from one shard, the caller holds the shard lock
+        template <typename TContext>
+        static u32 sAllocateFromShard(TContext* ctx, u32 shardIndex, typename TContext::offset_t size, typename TContext::offset_t alignment, u32 resource, typename TContext::allocation_t* out, u32 count)
+        {
+            typename TContext::shard_t* shard = ctx->m_shards[shardIndex];
+
+            u32 n = 0;
+            while (n < count)
+            {
+                handle_t const handle = shard->allocator.allocateHandle(size, alignment, resource);
+                if (handle == INVALID_HANDLE)
+                    break;
+                out[n].offset   = shard->base + shard->allocator.getOffset(handle);
+                out[n].size     = size;
+                out[n].shard    = (u16)shardIndex;
+                out[n].resource = (u16)resource;
+                out[n].handle   = handle;
+                n++;
+            }
+            return n;
+        }
+
+        // Try the shards starting at 'home', shards that are busy are skipped on the first pass and waited on
+        // in the second pass. Returns the number of ranges allocated, 0 when all shards are out of space.
+        template <typename TContext>
+        static u32 sAllocateFromShards(TContext* ctx, u32 home, typename TContext::offset_t size, typename TContext::offset_t alignment, u32 resource, typename TContext::allocation_t* out, u32 count)
+        {
+            u64 busy = 0;
+            for (u32 i = 0; i < ctx->m_numShards; ++i)
+            {
+                u32 const s = (home + i) % ctx->m_numShards;
+                if (size > ctx->m_shards[s]->size)
+                    continue;
+                if (!ctx->m_shards[s]->mutex.try_lock())
+                {
+                    busy |= (u64)1 << s;
+                    continue;
+                }
+                u32 const n = sAllocateFromShard(ctx, s, size, alignment, resource, out, count);
+                ctx->m_shards[s]->mutex.unlock();
+                if (n > 0)
+                    return n;
+            }
+
+            for (u32 i = 0; i < ctx->m_numShards && busy != 0; ++i)
+            {
+                u32 const s = (home + i) % ctx->m_numShards;
+                if ((busy & ((u64)1 << s)) == 0)
+                    continue;
+                busy &= ~((u64)1 << s);
+                std::lock_guard<std::mutex> lock(ctx->m_shards[s]->mutex);
+                u32 const n = sAllocateFromShard(ctx, s, size, alignment, resource, out, count);
+                if (n > 0)
+                    return n;
+            }
+            return 0;
+        }
+
+        // Free a list of ranges, ranges of the same shard are freed under a single lock
+        template <typename TContext>
+        static void sReleaseToShards(TContext* ctx, typename TContext::allocation_t* items, u32 count)
+        {
+            while (count > 0)
+            {
+                u32 const                   s     = items[0].shard;
+                typename TContext::shard_t* shard = ctx->m_shards[s];
+
+                std::lock_guard<std::mutex> lock(shard->mutex);
+                u32                         i = 0;
+                while (i < count)
+                {
+                    if (items[i].shard == s)
+                    {
+                        shard->allocator.freeHandle(items[i].handle);
+                        items[i] = items[--count];
+                    }
+                    else
+                    {
+                        ++i;
+                    }
+                }
+            }
+        }
+
+        template <typename TConfig>
+        sharded_allocator_T<TConfig>::sharded_allocator_T()
+            : m_context(nullptr)
+        {
+        }
+
+        template <typename TConfig>
+        sharded_allocator_T<TConfig>::~sharded_allocator_T()
+        {
+        }
+
+        template <typename TConfig>
+        void sharded_allocator_T<TConfig>::init(alloc_t* allocator, offset_t size, u32 numShards, u32 maxAllocsPerShard, offset_t bufferImageGranularity)
+        {
+            ASSERT(!m_context);
+
+            if (numShards == 0)
+                numShards = 1;
+            if (numShards > MAX_SHARDS)
+                numShards = MAX_SHARDS;
+
+            offset_t const shardAlignment = ((offset_t)1 << MAX_CACHED_SHIFT) > bufferImageGranularity ? ((offset_t)1 << MAX_CACHED_SHIFT) : bufferImageGranularity;
+
+            // Shards start at a multiple of the shard alignment, the last shard also takes the tail of the range
+            offset_t shardSize = (size / numShards) & ~(shardAlignment - 1);
+            while (shardSize == 0 && numShards > 1)
+            {
+                numShards = numShards / 2;
+                shardSize = (size / numShards) & ~(shardAlignment - 1);
+            }
+            if (shardSize == 0)
+                shardSize = size;
+
+            m_context                   = allocator->construct<context_t>();
+            m_context->m_allocator      = allocator;
+            m_context->m_numShards      = numShards;
+            m_context->m_shardSize      = shardSize;
+            m_context->m_shardAlignment = shardAlignment;
+            m_context->m_nextHome.store(0);
+            m_context->m_shards = g_allocate_array<typename context_t::shard_t*>(allocator, numShards);
+            for (u32 i = 0; i < numShards; ++i)
+            {
+                typename context_t::shard_t* shard = allocator->construct<typename context_t::shard_t>();
+                shard->base                        = (offset_t)i * shardSize;
+                shard->size                        = (i + 1 < numShards) ? shardSize : (size - shard->base);
+                shard->allocator.init(allocator, shard->size, maxAllocsPerShard, bufferImageGranularity);
+                m_context->m_shards[i] = shard;
+            }
+        }
+
+        template <typename TConfig>
+        void sharded_allocator_T<TConfig>::destroy()
+        {
+            ASSERT(m_context);
+            alloc_t* allocator = m_context->m_allocator;
+            for (u32 i = 0; i < m_context->m_numShards; ++i)
+            {
+                m_context->m_shards[i]->allocator.destroy();
+                allocator->destruct(m_context->m_shards[i]);
+            }
+            g_deallocate_array(allocator, m_context->m_shards);
+            allocator->destruct(m_context);
+            m_context = nullptr;
+        }
+
+        template <typename TConfig>
+        typename sharded_allocator_T<TConfig>::cache_t* sharded_allocator_T<TConfig>::createCache()
+        {
+            cache_t* cache = m_context->m_allocator->template construct<cache_t>();
+            cache->home    = m_context->m_nextHome.fetch_add(1) % m_context->m_numShards;
+            for (u32 c = 0; c < NUM_SIZE_CLASSES; ++c)
+                for (u32 r = 0; r < NUM_CACHED_RESOURCES; ++r)
+                    cache->magazines[c][r].count = 0;
+            return cache;
+        }
+
+        template <typename TConfig>
+        void sharded_allocator_T<TConfig>::destroyCache(cache_t* cache)
+        {
+            flush(cache);
+            m_context->m_allocator->destruct(cache);
+        }
+
+        template <typename TConfig>
+        void sharded_allocator_T<TConfig>::flush(cache_t* cache)
+        {
+            for (u32 c = 0; c < NUM_SIZE_CLASSES; ++c)
+            {
+                for (u32 r = 0; r < NUM_CACHED_RESOURCES; ++r)
+                {
+                    typename cache_t::magazine_t& magazine = cache->magazines[c][r];
+                    sReleaseToShards(m_context, magazine.items, magazine.count);
+                    magazine.count = 0;
+                }
+            }
+        }
+
+        template <typename TConfig>
+        bool sharded_allocator_T<TConfig>::allocate(cache_t* cache, offset_t size, offset_t alignment, u32 resource, allocation_t& outAllocation)
+        {
+            ASSERT((alignment & (alignment - 1)) == 0);
+
+            // Shards are only aligned to the shard alignment, a larger alignment cannot be honoured
+            if (alignment > m_context->m_shardAlignment)
+                return false;
+
+            u32 const sizeClass = sSizeClass(size, alignment, resource, MIN_CACHED_SHIFT, MAX_CACHED_SHIFT);
+            if (cache == nullptr || sizeClass == NUM_SIZE_CLASSES)
+            {
+                u32 const home = cache != nullptr ? cache->home : 0;
+                if (sAllocateFromShards(m_context, home, size, alignment, resource, &outAllocation, 1) == 1)
+                    return true;
+
+                // Ranges held by our own cache may be blocking the request, hand them back and retry
+                if (cache == nullptr)
+                    return false;
+                flush(cache);
+                return sAllocateFromShards(m_context, home, size, alignment, resource, &outAllocation, 1) == 1;
+            }
+
+            typename cache_t::magazine_t& magazine = cache->magazines[sizeClass][resource];
+            if (magazine.count == 0)
+            {
+                // Refill half a magazine under a single lock
+                offset_t const classSize = (offset_t)1 << (sizeClass + MIN_CACHED_SHIFT);
+                magazine.count           = sAllocateFromShards(m_context, cache->home, classSize, classSize, resource, magazine.items, MAGAZINE_SIZE / 2);
+                if (magazine.count == 0)
+                {
+                    flush(cache);
+                    magazine.count = sAllocateFromShards(m_context, cache->home, classSize, classSize, resource, magazine.items, 1);
+                    if (magazine.count == 0)
+                        return false;
+                }
+            }
+
+            outAllocation = magazine.items[--magazine.count];
+            return true;
+        }
+
+        template <typename TConfig>
+        void sharded_allocator_T<TConfig>::free(cache_t* cache, allocation_t const& allocation)
+        {
+            // Only ranges that have exactly the shape of a size class can be cached
+            u32 const sizeClass = sSizeClass(allocation.size, (offset_t)1, allocation.resource, MIN_CACHED_SHIFT, MAX_CACHED_SHIFT);
+            bool      cachable  = cache != nullptr && sizeClass != NUM_SIZE_CLASSES;
+            cachable            = cachable && allocation.size == ((offset_t)1 << (sizeClass + MIN_CACHED_SHIFT)) && (allocation.offset & (allocation.size - 1)) == 0;
+            if (!cachable)
+            {
+                allocation_t item = allocation;
+                sReleaseToShards(m_context, &item, 1);
+                return;
+            }
+
+            typename cache_t::magazine_t& magazine = cache->magazines[sizeClass][allocation.resource];
+            if (magazine.count == MAGAZINE_SIZE)
+            {
+                // Rebalance: hand the older half of the magazine back so other threads can use it
+                sReleaseToShards(m_context, magazine.items, MAGAZINE_SIZE / 2);
+                for (u32 i = 0; i < MAGAZINE_SIZE / 2; ++i)
+                    magazine.items[i] = magazine.items[i + MAGAZINE_SIZE / 2];
+                magazine.count = MAGAZINE_SIZE / 2;
+            }
+            magazine.items[magazine.count++] = allocation;
+        }
+
+        template <typename TConfig>
+        typename sharded_allocator_T<TConfig>::offset_t sharded_allocator_T<TConfig>::shardSize() const
+        {
+            return m_context->m_shardSize;
+        }
+
+        template <typename TConfig>
+        u32 sharded_allocator_T<TConfig>::numShards() const
+        {
+            return m_context->m_numShards;
+        }
+
+        template <typename TConfig>
+        void sharded_allocator_T<TConfig>::storageReport(storage_report_t& report) const
+        {
+            report.totalFreeSpace    = 0;
+            report.largestFreeRegion = 0;
+            report.numberOfBins      = 0;
+            report.numberOfUsedBins  = 0;
+            for (u32 i = 0; i < m_context->m_numShards; ++i)
+            {
+                storage_report_t shardReport;
+                {
+                    std::lock_guard<std::mutex> lock(m_context->m_shards[i]->mutex);
+                    m_context->m_shards[i]->allocator.storageReport(shardReport);
+                }
+                report.totalFreeSpace += shardReport.totalFreeSpace;
+                if (shardReport.largestFreeRegion > report.largestFreeRegion)
+                    report.largestFreeRegion = shardReport.largestFreeRegion;
+                report.numberOfBins += shardReport.numberOfBins;
+                report.numberOfUsedBins += shardReport.numberOfUsedBins;
+            }
+        }
+
+        template class sharded_allocator_T<block_config_T<u32, 3, u32>>;
+        template class sharded_allocator_T<block_config_T<u32, 3, u64>>;
+    }  // namespace nalloc
+}  // namespace ncore
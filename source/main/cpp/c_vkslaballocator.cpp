@@ -0,0 +1,398 @@
+#include "ccore/c_target.h"
+#include "ccore/c_debug.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/private/c_vkslaballocator.h"
+
+namespace ncore
+{
+    namespace nalloc
+    {
+        static constexpr u32 NO_SLAB = 0xffffffff;
+
+        static inline u32 sLowestBit(u64 v)
+        {
+#ifdef _MSC_VER
+            unsigned long retVal;
+            _BitScanForward64(&retVal, v);
+            return retVal;
+#else
+            return __builtin_ctzll(v);
+#endif
+        }
+
+        // Slab header, followed in the same allocation by the free-slot bitmap (a set bit is a free slot).
+        // Bit w of 'summary' is set when bitmap word w has a free slot.
+        template <typename TOffset>
+        struct slab_T
+        {
+            TOffset  base;
+            handle_t parentHandle;
+            u32      sizeClass;
+            u32      numUsed;
+            u32      prev;  // Partial list of the size class
+            u32      next;
+            u64      summary;
+
+            u64* words() { return (u64*)(this + 1); }
+        };
+
+        template <typename TOffset>
+        struct size_class_T
+        {
+            TOffset size;
+            TOffset alignment;
+            u32     numSlots;
+            u32     numWords;
+            u32     partial;   // Head of the list of slabs with a free slot
+            u32     numEmpty;  // Empty slabs kept in the partial list
+        };
+
+        template <typename TConfig>
+        struct slab_allocator_T<TConfig>::context_t
+        {
+            typedef slab_allocator_T<TConfig> allocator_t;
+            typedef slab_T<offset_t>          slab_t;
+            typedef size_class_T<offset_t>    size_class_t;
+
+            alloc_t*     m_allocator;
+            parent_t*    m_parent;
+            u32          m_resource;
+            u32          m_numClasses;
+            size_class_t m_classes[MAX_SIZE_CLASSES];
+
+            slab_t** m_slabs;            // Indexed by the slab bits of a handle, released slabs leave a nullptr
+            u8*      m_slabGenerations;  // Generation per slab index, bumped each time the slab runs empty
+            u32*     m_freeSlabs;
+            u32      m_numSlabs;
+            u32      m_maxSlabs;
+            u32      m_numFreeSlabs;
+
+            slab_stats_t m_stats;
+        };
+
+        template <typename TContext>
+        static void sLinkPartial(TContext* ctx, u32 slabIndex)
+        {
+            typename TContext::slab_t*       slab = ctx->m_slabs[slabIndex];
+            typename TContext::size_class_t& sc   = ctx->m_classes[slab->sizeClass];
+            slab->prev                            = NO_SLAB;
+            slab->next                            = sc.partial;
+            if (sc.partial != NO_SLAB)
+                ctx->m_slabs[sc.partial]->prev = slabIndex;
+            sc.partial = slabIndex;
+        }
+
+        template <typename TContext>
+        static void sUnlinkPartial(TContext* ctx, u32 slabIndex)
+        {
+            typename TContext::slab_t*       slab = ctx->m_slabs[slabIndex];
+            typename TContext::size_class_t& sc   = ctx->m_classes[slab->sizeClass];
+            if (slab->prev != NO_SLAB)
+                ctx->m_slabs[slab->prev]->next = slab->next;
+            else
+                sc.partial = slab->next;
+            if (slab->next != NO_SLAB)
+                ctx->m_slabs[slab->next]->prev = slab->prev;
+        }
+
+        // Takes a slab from the parent, returns its index or NO_SLAB
+        template <typename TContext>
+        static u32 sCreateSlab(TContext* ctx, u32 sizeClass)
+        {
+            typedef typename TContext::slab_t slab_t;
+            typename TContext::size_class_t&  sc = ctx->m_classes[sizeClass];
+
+            if (ctx->m_numFreeSlabs == 0 && ctx->m_numSlabs == TContext::allocator_t::MAX_SLABS)
+                return NO_SLAB;
+
+            handle_t const parentHandle = ctx->m_parent->allocateHandle(sc.size * sc.numSlots, sc.alignment, ctx->m_resource);
+            if (parentHandle == INVALID_HANDLE)
+                return NO_SLAB;
+
+            u32 slabIndex;
+            if (ctx->m_numFreeSlabs > 0)
+            {
+                slabIndex = ctx->m_freeSlabs[--ctx->m_numFreeSlabs];
+            }
+            else
+            {
+                if (ctx->m_numSlabs == ctx->m_maxSlabs)
+                {
+                    u32 const maxSlabs     = ctx->m_maxSlabs == 0 ? 64 : ctx->m_maxSlabs * 2;
+                    ctx->m_slabs           = g_reallocate_array(ctx->m_allocator, ctx->m_slabs, ctx->m_maxSlabs, maxSlabs);
+                    ctx->m_slabGenerations = g_reallocate_array(ctx->m_allocator, ctx->m_slabGenerations, ctx->m_maxSlabs, maxSlabs);
+                    ctx->m_freeSlabs       = g_reallocate_array(ctx->m_allocator, ctx->m_freeSlabs, ctx->m_numFreeSlabs, maxSlabs);
+                    ctx->m_maxSlabs        = maxSlabs;
+                }
+                slabIndex                         = ctx->m_numSlabs++;
+                ctx->m_slabGenerations[slabIndex] = 0;
+            }
+
+            slab_t* slab       = (slab_t*)ctx->m_allocator->allocate(sizeof(slab_t) + sc.numWords * sizeof(u64), sizeof(u64));
+            slab->base         = ctx->m_parent->getOffset(parentHandle);
+            slab->parentHandle = parentHandle;
+            slab->sizeClass    = sizeClass;
+            slab->numUsed      = 0;
+            slab->summary      = 0;
+            u64* words         = slab->words();
+            for (u32 w = 0; w < sc.numWords; ++w)
+            {
+                u32 const slots = (w + 1) * 64 <= sc.numSlots ? 64 : sc.numSlots - w * 64;
+                words[w]        = slots == 64 ? ~(u64)0 : (((u64)1 << slots) - 1);
+                slab->summary |= (u64)1 << w;
+            }
+            ctx->m_slabs[slabIndex] = slab;
+            sLinkPartial(ctx, slabIndex);
+
+            ctx->m_stats.numSlabs++;
+            ctx->m_stats.slabBytes += sc.size * sc.numSlots;
+            return slabIndex;
+        }
+
+        template <typename TContext>
+        static void sReleaseSlab(TContext* ctx, u32 slabIndex)
+        {
+            typename TContext::slab_t*             slab = ctx->m_slabs[slabIndex];
+            typename TContext::size_class_t const& sc   = ctx->m_classes[slab->sizeClass];
+            sUnlinkPartial(ctx, slabIndex);
+            ctx->m_parent->freeHandle(slab->parentHandle);
+
+            ctx->m_stats.numSlabs--;
+            ctx->m_stats.slabBytes -= sc.size * sc.numSlots;
+            ctx->m_allocator->deallocate(slab);
+            ctx->m_slabs[slabIndex]                 = nullptr;
+            ctx->m_freeSlabs[ctx->m_numFreeSlabs++] = slabIndex;
+        }
+
+        template <typename TContext>
+        static inline handle_t sToHandle(TContext* ctx, u32 slabIndex, u32 slot)
+        {
+            typedef typename TContext::allocator_t allocator_t;
+            u32 const                              generation = ctx->m_slabGenerations[slabIndex];
+            return (generation << (allocator_t::SLAB_BITS + allocator_t::SLOT_BITS)) | (slabIndex << allocator_t::SLOT_BITS) | slot;
+        }
+
+        // Returns the slab of an allocated slot, or nullptr for a stale or invalid handle. A free slot is
+        // rejected by the bitmap, a handle from before the slab last ran empty by the generation.
+        template <typename TContext>
+        static typename TContext::slab_t* sFromHandle(TContext const* ctx, handle_t handle, u32& outSlabIndex, u32& outSlot)
+        {
+            typedef typename TContext::allocator_t allocator_t;
+            u32 const slabIndex = (handle >> allocator_t::SLOT_BITS) & ((1 << allocator_t::SLAB_BITS) - 1);
+            u32 const slot      = handle & (allocator_t::MAX_SLOTS_PER_SLAB - 1);
+            if (handle == INVALID_HANDLE || slabIndex >= ctx->m_numSlabs || ctx->m_slabs[slabIndex] == nullptr)
+                return nullptr;
+
+            typename TContext::slab_t*             slab = ctx->m_slabs[slabIndex];
+            typename TContext::size_class_t const& sc   = ctx->m_classes[slab->sizeClass];
+            if (slot >= sc.numSlots || (slab->words()[slot >> 6] & ((u64)1 << (slot & 63))) != 0)
+                return nullptr;
+            if (ctx->m_slabGenerations[slabIndex] != (u8)(handle >> (allocator_t::SLAB_BITS + allocator_t::SLOT_BITS)))
+                return nullptr;
+            outSlabIndex = slabIndex;
+            outSlot      = slot;
+            return slab;
+        }
+
+        template <typename TConfig>
+        slab_allocator_T<TConfig>::slab_allocator_T()
+            : m_context(nullptr)
+        {
+        }
+
+        template <typename TConfig>
+        slab_allocator_T<TConfig>::~slab_allocator_T()
+        {
+        }
+
+        template <typename TConfig>
+        void slab_allocator_T<TConfig>::init(alloc_t* allocator, parent_t* parent, offset_t const* classSizes, u32 numClasses, offset_t slabSize, u32 resource)
+        {
+            ASSERT(!m_context);
+            ASSERT(numClasses <= MAX_SIZE_CLASSES);
+
+            m_context               = allocator->construct<context_t>();
+            m_context->m_allocator  = allocator;
+            m_context->m_parent     = parent;
+            m_context->m_resource   = resource;
+            m_context->m_numClasses = numClasses < MAX_SIZE_CLASSES ? numClasses : MAX_SIZE_CLASSES;
+            for (u32 c = 0; c < m_context->m_numClasses; ++c)
+            {
+                typename context_t::size_class_t& sc = m_context->m_classes[c];
+                offset_t const                    n  = slabSize / classSizes[c];
+                sc.size                              = classSizes[c];
+                sc.alignment                         = classSizes[c] & (0 - classSizes[c]);
+                sc.numSlots                          = n < 1 ? 1 : (n > MAX_SLOTS_PER_SLAB ? MAX_SLOTS_PER_SLAB : (u32)n);
+                sc.numWords                          = (sc.numSlots + 63) / 64;
+                sc.partial                           = NO_SLAB;
+                sc.numEmpty                          = 0;
+            }
+            m_context->m_slabs           = nullptr;
+            m_context->m_slabGenerations = nullptr;
+            m_context->m_freeSlabs       = nullptr;
+            m_context->m_numSlabs        = 0;
+            m_context->m_maxSlabs        = 0;
+            m_context->m_numFreeSlabs    = 0;
+            m_context->m_stats           = slab_stats_t();
+        }
+
+        template <typename TConfig>
+        void slab_allocator_T<TConfig>::destroy()
+        {
+            ASSERT(m_context);
+            alloc_t* allocator = m_context->m_allocator;
+            for (u32 i = 0; i < m_context->m_numSlabs; ++i)
+            {
+                if (m_context->m_slabs[i] != nullptr)
+                {
+                    m_context->m_parent->freeHandle(m_context->m_slabs[i]->parentHandle);
+                    allocator->deallocate(m_context->m_slabs[i]);
+                }
+            }
+            if (m_context->m_slabs != nullptr)
+            {
+                g_deallocate_array(allocator, m_context->m_slabs);
+                g_deallocate_array(allocator, m_context->m_slabGenerations);
+                g_deallocate_array(allocator, m_context->m_freeSlabs);
+            }
+            allocator->destruct(m_context);
+            m_context = nullptr;
+        }
+
+        template <typename TConfig>
+        u32 slab_allocator_T<TConfig>::sizeClassOf(offset_t size) const
+        {
+            u32 c = 0;
+            while (c < m_context->m_numClasses && m_context->m_classes[c].size < size)
+                c++;
+            return c;
+        }
+
+        template <typename TConfig>
+        handle_t slab_allocator_T<TConfig>::allocate(offset_t size)
+        {
+            return allocateClass(sizeClassOf(size));
+        }
+
+        template <typename TConfig>
+        handle_t slab_allocator_T<TConfig>::allocateClass(u32 sizeClass)
+        {
+            context_t* ctx = m_context;
+            if (sizeClass >= ctx->m_numClasses)
+                return INVALID_HANDLE;
+
+            typename context_t::size_class_t& sc        = ctx->m_classes[sizeClass];
+            u32                               slabIndex = sc.partial;
+            bool                              created   = false;
+            if (slabIndex == NO_SLAB)
+            {
+                slabIndex = sCreateSlab(ctx, sizeClass);
+                if (slabIndex == NO_SLAB)
+                    return INVALID_HANDLE;
+                created = true;
+            }
+
+            typename context_t::slab_t* slab  = ctx->m_slabs[slabIndex];
+            u64*                        words = slab->words();
+            u32 const                   w     = sLowestBit(slab->summary);
+            u32 const                   slot  = (w << 6) | sLowestBit(words[w]);
+            words[w] &= words[w] - 1;
+            if (words[w] == 0)
+                slab->summary &= ~((u64)1 << w);
+
+            if (slab->numUsed++ == 0 && !created)
+                sc.numEmpty--;  // The empty slab kept for reuse is in use again
+            if (slab->summary == 0)
+                sUnlinkPartial(ctx, slabIndex);
+
+            ctx->m_stats.numUsedSlots++;
+            ctx->m_stats.usedBytes += sc.size;
+            return sToHandle(ctx, slabIndex, slot);
+        }
+
+        template <typename TConfig>
+        bool slab_allocator_T<TConfig>::free(handle_t handle)
+        {
+            context_t*                  ctx = m_context;
+            u32                         slabIndex, slot;
+            typename context_t::slab_t* slab = sFromHandle(ctx, handle, slabIndex, slot);
+            if (slab == nullptr)
+                return false;
+
+            typename context_t::size_class_t& sc   = ctx->m_classes[slab->sizeClass];
+            u64* const                        word = &slab->words()[slot >> 6];
+            u64 const                         bit  = (u64)1 << (slot & 63);
+
+            if (slab->summary == 0)
+                sLinkPartial(ctx, slabIndex);
+            *word |= bit;
+            slab->summary |= (u64)1 << (slot >> 6);
+            slab->numUsed--;
+            ctx->m_stats.numUsedSlots--;
+            ctx->m_stats.usedBytes -= sc.size;
+
+            if (slab->numUsed == 0)
+            {
+                // Every handle into the slab is stale from now on, whether it is kept or a new slab takes the index
+                ctx->m_slabGenerations[slabIndex] += 1;
+                if (sc.numEmpty == 0)
+                    sc.numEmpty = 1;
+                else
+                    sReleaseSlab(ctx, slabIndex);
+            }
+            return true;
+        }
+
+        template <typename TConfig>
+        typename slab_allocator_T<TConfig>::offset_t slab_allocator_T<TConfig>::getOffset(handle_t handle) const
+        {
+            u32                               slabIndex, slot;
+            typename context_t::slab_t const* slab = sFromHandle(m_context, handle, slabIndex, slot);
+            if (slab == nullptr)
+                return parent_t::allocation_t::NO_SPACE;
+            return slab->base + (offset_t)slot * m_context->m_classes[slab->sizeClass].size;
+        }
+
+        template <typename TConfig>
+        typename slab_allocator_T<TConfig>::offset_t slab_allocator_T<TConfig>::getSize(handle_t handle) const
+        {
+            u32                               slabIndex, slot;
+            typename context_t::slab_t const* slab = sFromHandle(m_context, handle, slabIndex, slot);
+            return slab != nullptr ? m_context->m_classes[slab->sizeClass].size : 0;
+        }
+
+        template <typename TConfig>
+        bool slab_allocator_T<TConfig>::isValid(handle_t handle) const
+        {
+            u32 slabIndex, slot;
+            return sFromHandle(m_context, handle, slabIndex, slot) != nullptr;
+        }
+
+        template <typename TConfig>
+        void slab_allocator_T<TConfig>::trim()
+        {
+            context_t* ctx = m_context;
+            for (u32 i = 0; i < ctx->m_numSlabs; ++i)
+            {
+                if (ctx->m_slabs[i] != nullptr && ctx->m_slabs[i]->numUsed == 0)
+                {
+                    ctx->m_classes[ctx->m_slabs[i]->sizeClass].numEmpty = 0;
+                    sReleaseSlab(ctx, i);
+                }
+            }
+        }
+
+        template <typename TConfig>
+        void slab_allocator_T<TConfig>::getStats(slab_stats_t& outStats) const
+        {
+            outStats               = m_context->m_stats;
+            outStats.numEmptySlabs = 0;
+            for (u32 c = 0; c < m_context->m_numClasses; ++c)
+                outStats.numEmptySlabs += m_context->m_classes[c].numEmpty;
+        }
+
+        template class slab_allocator_T<block_config_T<u32, 3, u32>>;
+        template class slab_allocator_T<block_config_T<u32, 3, u64>>;
+    }  // namespace nalloc
+}  // namespace ncore
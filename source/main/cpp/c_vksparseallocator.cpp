@@ -0,0 +1,472 @@
+#include "ccore/c_target.h"
+#include "ccore/c_debug.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/c_vksparseallocator.h"
+#include "cvkmem/private/c_vkblockallocator.h"
+#include "cvkmem/private/c_vkpageallocator.h"
+
+namespace ncore
+{
+    namespace nvkmem
+    {
+        static inline u32 sLowestBit(u64 v)
+        {
+#ifdef _MSC_VER
+            unsigned long retVal;
+            _BitScanForward64(&retVal, v);
+            return retVal;
+#else
+            return __builtin_ctzll(v);
+#endif
+        }
+
+        static constexpr u32 LEAF_SHIFT = 10;
+        static constexpr u32 LEAF_MASK  = sparse_allocator_t::LEAF_PAGES - 1;
+        static constexpr u32 LEAF_WORDS = sparse_allocator_t::LEAF_PAGES / 64;
+
+        // Page table entry, 'chunk' is the chunk slot + 1 so that a zeroed entry is an uncommitted page
+        struct page_entry_t
+        {
+            nalloc::handle_t page;  // Handle in the page allocator of the chunk
+            u32              chunk;
+        };
+
+        struct page_leaf_t
+        {
+            page_entry_t entries[sparse_allocator_t::LEAF_PAGES];
+            u64          dirty[LEAF_WORDS];  // Pages whose binding changed since the last flush
+            u32          numCommitted;
+        };
+
+        struct sparse_chunk_t
+        {
+            allocation_t             memory;
+            nalloc::page_allocator_t pages;
+            u32                      numPages;
+            u32                      numUsed;
+        };
+
+        struct sparse_allocator_t::context_t
+        {
+            alloc_t*          m_allocator;
+            memory_manager_t* m_manager;
+            sparse_config_t   m_config;
+            u32               m_pageShift;
+
+            nalloc::block_allocator_t m_virtual;  // In units of pages
+            u32                       m_numRanges;
+            u64                       m_reservedPages;
+
+            // Page table, a directory of leaves that are created on the first commit and released by the flush
+            // that finds them empty. Bit l of m_dirtyLeaves is set when leaf l has dirty pages.
+            page_leaf_t** m_leaves;
+            u64*          m_dirtyLeaves;
+            u32           m_numLeaves;
+            u32           m_dirtyPages;
+            u64           m_committedPages;
+
+            sparse_chunk_t** m_chunks;  // nullptr for a free slot
+            u32              m_numChunks;
+            u32              m_maxChunks;
+            u32              m_numEmptyChunks;
+            u32              m_currentChunk;  // Chunk that served the most recent page
+
+            sparse_bind_t* m_binds;
+            u32            m_maxBinds;
+        };
+
+        static page_leaf_t* sGetLeaf(sparse_allocator_t::context_t* ctx, u32 page)
+        {
+            page_leaf_t*& leaf = ctx->m_leaves[page >> LEAF_SHIFT];
+            if (leaf == nullptr)
+            {
+                leaf = ctx->m_allocator->construct<page_leaf_t>();
+                for (u32 i = 0; i < sparse_allocator_t::LEAF_PAGES; ++i)
+                    leaf->entries[i] = {nalloc::INVALID_HANDLE, 0};
+                for (u32 w = 0; w < LEAF_WORDS; ++w)
+                    leaf->dirty[w] = 0;
+                leaf->numCommitted = 0;
+            }
+            return leaf;
+        }
+
+        static void sMarkDirty(sparse_allocator_t::context_t* ctx, page_leaf_t* leaf, u32 page)
+        {
+            u32 const leafIndex = page >> LEAF_SHIFT;
+            u64&      word      = leaf->dirty[(page & LEAF_MASK) >> 6];
+            u64 const bit       = 1ull << (page & 63);
+            if ((word & bit) == 0)
+            {
+                word |= bit;
+                ctx->m_dirtyPages++;
+                ctx->m_dirtyLeaves[leafIndex >> 6] |= 1ull << (leafIndex & 63);
+            }
+        }
+
+        static u32 sCreateChunk(sparse_allocator_t::context_t* ctx)
+        {
+            memory_requirements_t requirements;
+            requirements.size           = ctx->m_config.chunkSize;
+            requirements.alignment      = ctx->m_config.pageSize;
+            requirements.memoryTypeBits = ctx->m_config.memoryTypeBits;
+
+            allocation_t memory;
+            if (!ctx->m_manager->allocate(requirements, ctx->m_config.requiredFlags, ctx->m_config.preferredFlags, ctx->m_config.usage, nalloc::RESOURCE_ANY, memory))
+                return ctx->m_numChunks;
+
+            u32 slot = 0;
+            while (slot < ctx->m_numChunks && ctx->m_chunks[slot] != nullptr)
+                ++slot;
+            if (slot == ctx->m_numChunks)
+            {
+                if (ctx->m_numChunks == ctx->m_maxChunks)
+                {
+                    u32 const maxChunks = ctx->m_maxChunks == 0 ? 8 : ctx->m_maxChunks * 2;
+                    ctx->m_chunks       = g_reallocate_array(ctx->m_allocator, ctx->m_chunks, ctx->m_maxChunks, maxChunks);
+                    ctx->m_maxChunks    = maxChunks;
+                }
+                ctx->m_numChunks++;
+            }
+
+            sparse_chunk_t* chunk = ctx->m_allocator->construct<sparse_chunk_t>();
+            chunk->memory         = memory;
+            chunk->numPages       = (u32)(ctx->m_config.chunkSize >> ctx->m_pageShift);
+            chunk->numUsed        = 0;
+            chunk->pages.init(ctx->m_allocator, (u32)ctx->m_config.chunkSize, chunk->numPages, (u32)ctx->m_config.pageSize);
+            ctx->m_chunks[slot] = chunk;
+            ctx->m_numEmptyChunks++;
+            return slot;
+        }
+
+        static void sReleaseChunk(sparse_allocator_t::context_t* ctx, u32 slot)
+        {
+            sparse_chunk_t* chunk = ctx->m_chunks[slot];
+            ctx->m_manager->free(chunk->memory);
+            chunk->pages.destroy();
+            ctx->m_allocator->destruct(chunk);
+            ctx->m_chunks[slot] = nullptr;
+            while (ctx->m_numChunks > 0 && ctx->m_chunks[ctx->m_numChunks - 1] == nullptr)
+                ctx->m_numChunks--;
+        }
+
+        // Takes a physical page from the current chunk, keeping consecutive commits contiguous in memory,
+        // then from any chunk with a free page, then from a new chunk
+        static bool sAllocatePage(sparse_allocator_t::context_t* ctx, page_entry_t& outEntry)
+        {
+            u32 slot = ctx->m_currentChunk;
+            if (slot >= ctx->m_numChunks || ctx->m_chunks[slot] == nullptr || ctx->m_chunks[slot]->numUsed == ctx->m_chunks[slot]->numPages)
+            {
+                slot = 0;
+                while (slot < ctx->m_numChunks && (ctx->m_chunks[slot] == nullptr || ctx->m_chunks[slot]->numUsed == ctx->m_chunks[slot]->numPages))
+                    ++slot;
+                if (slot == ctx->m_numChunks)
+                {
+                    slot = sCreateChunk(ctx);
+                    if (slot == ctx->m_numChunks)
+                        return false;
+                }
+                ctx->m_currentChunk = slot;
+            }
+
+            sparse_chunk_t* chunk = ctx->m_chunks[slot];
+            outEntry.page         = chunk->pages.allocateHandle((u32)ctx->m_config.pageSize);
+            outEntry.chunk        = slot + 1;
+            ASSERT(outEntry.page != nalloc::INVALID_HANDLE);
+            if (chunk->numUsed++ == 0)
+                ctx->m_numEmptyChunks--;
+            return true;
+        }
+
+        static void sFreePage(sparse_allocator_t::context_t* ctx, page_entry_t const& entry)
+        {
+            sparse_chunk_t* chunk = ctx->m_chunks[entry.chunk - 1];
+            chunk->pages.freeHandle(entry.page);
+            if (--chunk->numUsed == 0)
+                ctx->m_numEmptyChunks++;
+        }
+
+        static void sDecommit(sparse_allocator_t::context_t* ctx, u32 first, u32 end)
+        {
+            for (u32 page = first; page < end;)
+            {
+                u32 const    leafEnd = (page | LEAF_MASK) + 1;
+                page_leaf_t* leaf    = ctx->m_leaves[page >> LEAF_SHIFT];
+                if (leaf == nullptr || leaf->numCommitted == 0)
+                {
+                    page = leafEnd;
+                    continue;
+                }
+                u32 const last = end < leafEnd ? end : leafEnd;
+                for (; page < last; ++page)
+                {
+                    page_entry_t& entry = leaf->entries[page & LEAF_MASK];
+                    if (entry.chunk == 0)
+                        continue;
+                    sFreePage(ctx, entry);
+                    entry = {nalloc::INVALID_HANDLE, 0};
+                    leaf->numCommitted--;
+                    ctx->m_committedPages--;
+                    sMarkDirty(ctx, leaf, page);
+                }
+            }
+        }
+
+        // Page span [outFirst, outEnd) of the range, widened to whole pages
+        static void sRangePages(sparse_allocator_t::context_t const* ctx, virtual_range_t range, u64 offset, u64 size, u32& outFirst, u32& outEnd)
+        {
+            ASSERT(ctx->m_virtual.isValid(range));
+            u32 const base  = ctx->m_virtual.getOffset(range);
+            u32 const pages = ctx->m_virtual.getSize(range);
+            u64 const mask  = ctx->m_config.pageSize - 1;
+            u64 const first = offset >> ctx->m_pageShift;
+            u64 const end   = (offset + size + mask) >> ctx->m_pageShift;
+            ASSERT(end <= pages);
+            outFirst = base + (u32)(first < pages ? first : pages);
+            outEnd   = base + (u32)(end < pages ? end : pages);
+        }
+
+        static void sAppendBind(sparse_allocator_t::context_t* ctx, u32& numBinds, u64 resourceOffset, u64 size, device_memory_t memory, u64 memoryOffset)
+        {
+            if (numBinds > 0)
+            {
+                sparse_bind_t& last = ctx->m_binds[numBinds - 1];
+                if (last.resourceOffset + last.size == resourceOffset && last.memory == memory && (memory == NULL_MEMORY || last.memoryOffset + last.size == memoryOffset))
+                {
+                    last.size += size;
+                    return;
+                }
+            }
+            if (numBinds == ctx->m_maxBinds)
+            {
+                u32 const maxBinds = ctx->m_maxBinds == 0 ? 256 : ctx->m_maxBinds * 2;
+                ctx->m_binds       = g_reallocate_array(ctx->m_allocator, ctx->m_binds, ctx->m_maxBinds, maxBinds);
+                ctx->m_maxBinds    = maxBinds;
+            }
+            sparse_bind_t& bind = ctx->m_binds[numBinds++];
+            bind.resourceOffset = resourceOffset;
+            bind.size           = size;
+            bind.memory         = memory;
+            bind.memoryOffset   = memoryOffset;
+        }
+
+        sparse_allocator_t::sparse_allocator_t()
+            : m_context(nullptr)
+        {
+        }
+
+        sparse_allocator_t::~sparse_allocator_t() {}
+
+        void sparse_allocator_t::init(alloc_t* allocator, memory_manager_t* manager, sparse_config_t const& config)
+        {
+            ASSERT(!m_context);
+            ASSERT(config.pageSize > 0 && (config.pageSize & (config.pageSize - 1)) == 0);
+            ASSERT(config.chunkSize >= config.pageSize && config.chunkSize < 0x100000000ull);
+
+            u32 pageShift = 0;
+            while ((1ull << pageShift) < config.pageSize)
+                ++pageShift;
+            u64 numPages = config.virtualSize >> pageShift;
+            if (numPages > 0xffffffffull)
+                numPages = 0xffffffffull;
+
+            m_context               = allocator->construct<context_t>();
+            context_t* ctx          = m_context;
+            ctx->m_allocator        = allocator;
+            ctx->m_manager          = manager;
+            ctx->m_config           = config;
+            ctx->m_config.chunkSize = config.chunkSize & ~(config.pageSize - 1);
+            ctx->m_pageShift        = pageShift;
+            ctx->m_numRanges        = 0;
+            ctx->m_reservedPages    = 0;
+            ctx->m_numLeaves        = (u32)((numPages + LEAF_MASK) >> LEAF_SHIFT);
+            ctx->m_leaves           = g_allocate_array<page_leaf_t*>(allocator, ctx->m_numLeaves);
+            ctx->m_dirtyLeaves      = g_allocate_array<u64>(allocator, (ctx->m_numLeaves + 63) / 64);
+            ctx->m_dirtyPages       = 0;
+            ctx->m_committedPages   = 0;
+            ctx->m_chunks           = nullptr;
+            ctx->m_numChunks        = 0;
+            ctx->m_maxChunks        = 0;
+            ctx->m_numEmptyChunks   = 0;
+            ctx->m_currentChunk     = 0;
+            ctx->m_binds            = nullptr;
+            ctx->m_maxBinds         = 0;
+            for (u32 i = 0; i < ctx->m_numLeaves; ++i)
+                ctx->m_leaves[i] = nullptr;
+            for (u32 i = 0; i < (ctx->m_numLeaves + 63) / 64; ++i)
+                ctx->m_dirtyLeaves[i] = 0;
+            ctx->m_virtual.init(allocator, (u32)numPages, 0xffffffff, 1, nalloc::PLACEMENT_LOWEST_ADDRESS);
+        }
+
+        void sparse_allocator_t::destroy()
+        {
+            ASSERT(m_context);
+            context_t* ctx       = m_context;
+            alloc_t*   allocator = ctx->m_allocator;
+            for (u32 i = 0; i < ctx->m_numLeaves; ++i)
+            {
+                if (ctx->m_leaves[i] != nullptr)
+                    allocator->destruct(ctx->m_leaves[i]);
+            }
+            g_deallocate_array(allocator, ctx->m_leaves);
+            g_deallocate_array(allocator, ctx->m_dirtyLeaves);
+            for (u32 i = ctx->m_numChunks; i > 0; --i)
+            {
+                if (ctx->m_chunks[i - 1] != nullptr)
+                    sReleaseChunk(ctx, i - 1);
+            }
+            if (ctx->m_chunks != nullptr)
+                g_deallocate_array(allocator, ctx->m_chunks);
+            if (ctx->m_binds != nullptr)
+                g_deallocate_array(allocator, ctx->m_binds);
+            ctx->m_virtual.destroy();
+            allocator->destruct(ctx);
+            m_context = nullptr;
+        }
+
+        virtual_range_t sparse_allocator_t::reserve(u64 size, u64 alignment)
+        {
+            context_t* ctx   = m_context;
+            u64 const  pages = (size + ctx->m_config.pageSize - 1) >> ctx->m_pageShift;
+            u64 const  align = alignment > ctx->m_config.pageSize ? alignment >> ctx->m_pageShift : 1;
+            ASSERT((alignment & (alignment - 1)) == 0);
+            if (pages == 0 || pages > ctx->m_virtual.size() || align > ctx->m_virtual.size())
+                return INVALID_RANGE;
+
+            nalloc::handle_t const range = ctx->m_virtual.allocateHandle((u32)pages, (u32)align);
+            if (range == nalloc::INVALID_HANDLE)
+                return INVALID_RANGE;
+            ctx->m_numRanges++;
+            ctx->m_reservedPages += ctx->m_virtual.getSize(range);
+            return range;
+        }
+
+        void sparse_allocator_t::release(virtual_range_t range)
+        {
+            context_t* ctx = m_context;
+            ASSERT(ctx->m_virtual.isValid(range));
+            u32 const first = ctx->m_virtual.getOffset(range);
+            u32 const pages = ctx->m_virtual.getSize(range);
+            sDecommit(ctx, first, first + pages);
+            ctx->m_virtual.freeHandle(range);
+            ctx->m_numRanges--;
+            ctx->m_reservedPages -= pages;
+        }
+
+        u64 sparse_allocator_t::getOffset(virtual_range_t range) const { return (u64)m_context->m_virtual.getOffset(range) << m_context->m_pageShift; }
+        u64 sparse_allocator_t::getSize(virtual_range_t range) const { return (u64)m_context->m_virtual.getSize(range) << m_context->m_pageShift; }
+
+        bool sparse_allocator_t::commit(virtual_range_t range, u64 offset, u64 size)
+        {
+            context_t* ctx = m_context;
+            u32        first, end;
+            sRangePages(ctx, range, offset, size, first, end);
+            for (u32 page = first; page < end; ++page)
+            {
+                page_leaf_t*  leaf  = sGetLeaf(ctx, page);
+                page_entry_t& entry = leaf->entries[page & LEAF_MASK];
+                if (entry.chunk != 0)
+                    continue;
+                if (!sAllocatePage(ctx, entry))
+                    return false;
+                leaf->numCommitted++;
+                ctx->m_committedPages++;
+                sMarkDirty(ctx, leaf, page);
+            }
+            return true;
+        }
+
+        void sparse_allocator_t::decommit(virtual_range_t range, u64 offset, u64 size)
+        {
+            u32 first, end;
+            sRangePages(m_context, range, offset, size, first, end);
+            sDecommit(m_context, first, end);
+        }
+
+        bool sparse_allocator_t::isCommitted(virtual_range_t range, u64 offset) const
+        {
+            context_t const* ctx = m_context;
+            ASSERT(ctx->m_virtual.isValid(range));
+            ASSERT(offset < ((u64)ctx->m_virtual.getSize(range) << ctx->m_pageShift));
+            u32 const          page = ctx->m_virtual.getOffset(range) + (u32)(offset >> ctx->m_pageShift);
+            page_leaf_t const* leaf = ctx->m_leaves[page >> LEAF_SHIFT];
+            return leaf != nullptr && leaf->entries[page & LEAF_MASK].chunk != 0;
+        }
+
+        u32 sparse_allocator_t::flush(sparse_bind_batch_t& outBatch)
+        {
+            context_t* ctx      = m_context;
+            u32        numBinds = 0;
+
+            // Dirty leaves and pages are visited in address order, so the binds come out sorted and a bind
+            // only has to be compared with the one before it to merge
+            u32 const numWords = (ctx->m_numLeaves + 63) / 64;
+            for (u32 lw = 0; lw < numWords; ++lw)
+            {
+                while (ctx->m_dirtyLeaves[lw] != 0)
+                {
+                    u32 const    leafIndex = (lw << 6) + sLowestBit(ctx->m_dirtyLeaves[lw]);
+                    page_leaf_t* leaf      = ctx->m_leaves[leafIndex];
+                    ctx->m_dirtyLeaves[lw] &= ctx->m_dirtyLeaves[lw] - 1;
+                    for (u32 w = 0; w < LEAF_WORDS; ++w)
+                    {
+                        u64 bits = leaf->dirty[w];
+                        while (bits != 0)
+                        {
+                            u32 const           index = (w << 6) + sLowestBit(bits);
+                            u64 const           page  = ((u64)leafIndex << LEAF_SHIFT) + index;
+                            page_entry_t const& entry = leaf->entries[index];
+                            bits &= bits - 1;
+                            if (entry.chunk == 0)
+                            {
+                                sAppendBind(ctx, numBinds, page << ctx->m_pageShift, ctx->m_config.pageSize, NULL_MEMORY, 0);
+                            }
+                            else
+                            {
+                                sparse_chunk_t const* chunk = ctx->m_chunks[entry.chunk - 1];
+                                sAppendBind(ctx, numBinds, page << ctx->m_pageShift, ctx->m_config.pageSize, chunk->memory.memory, chunk->memory.offset + chunk->pages.getOffset(entry.page));
+                            }
+                        }
+                        leaf->dirty[w] = 0;
+                    }
+                    if (leaf->numCommitted == 0)
+                    {
+                        ctx->m_allocator->destruct(leaf);
+                        ctx->m_leaves[leafIndex] = nullptr;
+                    }
+                }
+            }
+            ctx->m_dirtyPages = 0;
+
+            // Excess empty chunks go only now, their pages may be referenced by the unbinds of this flush
+            for (u32 slot = ctx->m_numChunks; slot > 0 && ctx->m_numEmptyChunks > ctx->m_config.maxEmptyChunks; --slot)
+            {
+                sparse_chunk_t* chunk = ctx->m_chunks[slot - 1];
+                if (chunk != nullptr && chunk->numUsed == 0)
+                {
+                    sReleaseChunk(ctx, slot - 1);
+                    ctx->m_numEmptyChunks--;
+                }
+            }
+
+            outBatch.binds    = ctx->m_binds;
+            outBatch.numBinds = numBinds;
+            return numBinds;
+        }
+
+        void sparse_allocator_t::getStats(sparse_stats_t& outStats) const
+        {
+            context_t const* ctx = m_context;
+            outStats.rangeCount  = ctx->m_numRanges;
+            outStats.chunkCount  = 0;
+            for (u32 i = 0; i < ctx->m_numChunks; ++i)
+                outStats.chunkCount += ctx->m_chunks[i] != nullptr ? 1 : 0;
+            outStats.emptyChunkCount = ctx->m_numEmptyChunks;
+            outStats.dirtyPages      = ctx->m_dirtyPages;
+            outStats.reservedBytes   = ctx->m_reservedPages << ctx->m_pageShift;
+            outStats.committedBytes  = ctx->m_committedPages << ctx->m_pageShift;
+            outStats.chunkBytes      = (u64)outStats.chunkCount * ctx->m_config.chunkSize;
+        }
+
+    }  // namespace nvkmem
+}  // namespace ncore
@@ -0,0 +1,818 @@
+#include "ccore/c_target.h"
+#include "ccore/c_debug.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/private/c_vktrace.h"
+
+#include <atomic>
+#include <chrono>
+#include <string.h>
+
+namespace ncore
+{
+    namespace nalloc
+    {
+        // Stream: magic, version, then events. An event starts with a tag byte followed by LEB128 fields:
+        // time delta, thread (only when it changed), then the fields of the operation.
+        static constexpr u32 TRACE_MAGIC   = 0x43525441;  // 'ATRC'
+        static constexpr u32 TRACE_VERSION = 1;
+
+        static constexpr u8 TAG_OP_MASK        = 0x07;
+        static constexpr u8 TAG_THREAD         = 0x08;
+        static constexpr u8 TAG_RESOURCE_SHIFT = 4;
+        static constexpr u8 TAG_FAILED         = 0x40;
+
+        static constexpr u32 MAX_EVENT_BYTES = 1 + 10 * 6;
+
+        static inline u8* sWriteVarint(u8* out, u64 value)
+        {
+            while (value >= 0x80)
+            {
+                *out++ = (u8)(value | 0x80);
+                value >>= 7;
+            }
+            *out++ = (u8)value;
+            return out;
+        }
+
+        static inline u64 sNowNs() { return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+
+        // Threads are numbered in order of their first recorded event, over all recorders
+        static std::atomic<u32> sNextThread(0);
+        static u32              sThreadIndex()
+        {
+            static thread_local u32 tIndex = 0xffffffff;
+            if (tIndex == 0xffffffff)
+                tIndex = sNextThread.fetch_add(1, std::memory_order_relaxed);
+            return tIndex;
+        }
+
+        static inline u32 sLog2(u64 alignment)
+        {
+            u32 shift = 0;
+            while (shift < 63 && ((u64)1 << shift) < alignment)
+                shift++;
+            return shift;
+        }
+
+        // trace_recorder_t...
+        struct trace_recorder_t::context_t
+        {
+            alloc_t*      m_allocator;
+            trace_sink_t* m_sink;
+            u8*           m_buffer;
+            u32           m_bufferSize;
+            u32           m_used;
+            u64           m_epoch;
+            u64           m_lastTime;
+            u32           m_lastThread;
+            u64           m_events;
+            u64           m_flushedBytes;
+        };
+
+        trace_recorder_t::trace_recorder_t()
+            : m_context(nullptr)
+        {
+        }
+
+        trace_recorder_t::~trace_recorder_t() {}
+
+        void trace_recorder_t::init(alloc_t* allocator, trace_sink_t* sink, u32 bufferSize)
+        {
+            ASSERT(!m_context);
+            if (bufferSize < 4 * MAX_EVENT_BYTES)
+                bufferSize = 4 * MAX_EVENT_BYTES;
+
+            m_context                 = allocator->construct<context_t>();
+            m_context->m_allocator    = allocator;
+            m_context->m_sink         = sink;
+            m_context->m_buffer       = (u8*)allocator->allocate(bufferSize, 8);
+            m_context->m_bufferSize   = bufferSize;
+            m_context->m_epoch        = sNowNs();
+            m_context->m_lastTime     = 0;
+            m_context->m_lastThread   = 0xffffffff;
+            m_context->m_events       = 0;
+            m_context->m_flushedBytes = 0;
+
+            u8* out           = m_context->m_buffer;
+            out               = sWriteVarint(out, TRACE_MAGIC);
+            out               = sWriteVarint(out, TRACE_VERSION);
+            m_context->m_used = (u32)(out - m_context->m_buffer);
+        }
+
+        void trace_recorder_t::destroy()
+        {
+            ASSERT(m_context);
+            flush();
+            alloc_t* allocator = m_context->m_allocator;
+            allocator->deallocate(m_context->m_buffer);
+            allocator->destruct(m_context);
+            m_context = nullptr;
+        }
+
+        void trace_recorder_t::flush()
+        {
+            context_t* ctx = m_context;
+            if (ctx->m_used == 0)
+                return;
+            ctx->m_sink->write(ctx->m_buffer, ctx->m_used);
+            ctx->m_flushedBytes += ctx->m_used;
+            ctx->m_used = 0;
+        }
+
+        // Starts an event, returns where its operation fields go
+        static u8* sBeginEvent(trace_recorder_t* recorder, trace_recorder_t::context_t* ctx, u32 op, u32 resource, bool failed)
+        {
+            if (ctx->m_used + MAX_EVENT_BYTES > ctx->m_bufferSize)
+                recorder->flush();
+
+            u64 time = sNowNs() - ctx->m_epoch;
+            if (time < ctx->m_lastTime)
+                time = ctx->m_lastTime;
+            u32 const thread = sThreadIndex();
+
+            u8* out = ctx->m_buffer + ctx->m_used;
+            *out++  = (u8)(op | (thread != ctx->m_lastThread ? TAG_THREAD : 0) | ((resource & 3) << TAG_RESOURCE_SHIFT) | (failed ? TAG_FAILED : 0));
+            out     = sWriteVarint(out, time - ctx->m_lastTime);
+            if (thread != ctx->m_lastThread)
+                out = sWriteVarint(out, thread);
+
+            ctx->m_lastTime   = time;
+            ctx->m_lastThread = thread;
+            ctx->m_events++;
+            return out;
+        }
+
+        static inline void sEndEvent(trace_recorder_t::context_t* ctx, u8* out) { ctx->m_used = (u32)(out - ctx->m_buffer); }
+
+        void trace_recorder_t::recordBegin(u64 size, u64 granularity, u32 placement)
+        {
+            u8* out = sBeginEvent(this, m_context, TRACE_BEGIN, 0, false);
+            out     = sWriteVarint(out, size);
+            out     = sWriteVarint(out, granularity);
+            out     = sWriteVarint(out, placement);
+            sEndEvent(m_context, out);
+        }
+
+        void trace_recorder_t::recordAllocate(u64 size, u64 alignment, u32 resource, handle_t handle, u64 offset)
+        {
+            bool const failed = handle == INVALID_HANDLE;
+            u8*        out    = sBeginEvent(this, m_context, TRACE_ALLOCATE, resource, failed);
+            out               = sWriteVarint(out, size);
+            *out++            = (u8)sLog2(alignment);
+            if (!failed)
+            {
+                out = sWriteVarint(out, handle);
+                out = sWriteVarint(out, offset);
+            }
+            sEndEvent(m_context, out);
+        }
+
+        void trace_recorder_t::recordFree(handle_t handle)
+        {
+            u8* out = sBeginEvent(this, m_context, TRACE_FREE, 0, false);
+            out     = sWriteVarint(out, handle);
+            sEndEvent(m_context, out);
+        }
+
+        void trace_recorder_t::recordBatch(u32 count)
+        {
+            u8* out = sBeginEvent(this, m_context, TRACE_BATCH, 0, false);
+            out     = sWriteVarint(out, count);
+            sEndEvent(m_context, out);
+        }
+
+        void trace_recorder_t::recordReallocate(handle_t handle, u64 newSize, bool success)
+        {
+            u8* out = sBeginEvent(this, m_context, TRACE_REALLOCATE, 0, !success);
+            out     = sWriteVarint(out, handle);
+            out     = sWriteVarint(out, newSize);
+            sEndEvent(m_context, out);
+        }
+
+        void trace_recorder_t::recordGrow(u64 newSize, bool success)
+        {
+            u8* out = sBeginEvent(this, m_context, TRACE_GROW, 0, !success);
+            out     = sWriteVarint(out, newSize);
+            sEndEvent(m_context, out);
+        }
+
+        void trace_recorder_t::recordShrink(u64 newSize)
+        {
+            u8* out = sBeginEvent(this, m_context, TRACE_SHRINK, 0, false);
+            out     = sWriteVarint(out, newSize);
+            sEndEvent(m_context, out);
+        }
+
+        u64 trace_recorder_t::eventCount() const { return m_context->m_events; }
+        u64 trace_recorder_t::bytesWritten() const { return m_context->m_flushedBytes + m_context->m_used; }
+
+        // trace_memory_sink_t...
+        trace_memory_sink_t::trace_memory_sink_t(alloc_t* allocator)
+            : m_allocator(allocator)
+            , m_data(nullptr)
+            , m_size(0)
+            , m_capacity(0)
+        {
+        }
+
+        trace_memory_sink_t::~trace_memory_sink_t()
+        {
+            if (m_data != nullptr)
+                g_deallocate_array(m_allocator, m_data);
+        }
+
+        void trace_memory_sink_t::v_write(void const* data, u32 size)
+        {
+            if (m_size + size > m_capacity)
+            {
+                u32 capacity = m_capacity < 65536 ? 65536 : m_capacity;
+                while (capacity < m_size + size)
+                    capacity *= 2;
+                m_data     = g_reallocate_array(m_allocator, m_data, m_capacity / 8, capacity / 8);
+                m_capacity = capacity;
+            }
+            memcpy((u8*)m_data + m_size, data, size);
+            m_size += size;
+        }
+
+        // trace_reader_t...
+        trace_reader_t::trace_reader_t()
+            : m_data(nullptr)
+            , m_size(0)
+            , m_position(0)
+            , m_time(0)
+            , m_thread(0)
+            , m_corrupt(false)
+        {
+        }
+
+        static bool sReadVarint(u8 const* data, u64 size, u64& position, u64& outValue)
+        {
+            u64 value = 0;
+            for (u32 shift = 0; shift < 64 && position < size; shift += 7)
+            {
+                u8 const byte = data[position++];
+                value |= (u64)(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0)
+                {
+                    outValue = value;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool trace_reader_t::init(void const* data, u64 size)
+        {
+            m_data     = (u8 const*)data;
+            m_size     = size;
+            m_position = 0;
+            m_time     = 0;
+            m_thread   = 0;
+            m_corrupt  = false;
+
+            u64 magic, version;
+            if (!sReadVarint(m_data, m_size, m_position, magic) || !sReadVarint(m_data, m_size, m_position, version))
+                return false;
+            return magic == TRACE_MAGIC && version == TRACE_VERSION;
+        }
+
+        bool trace_reader_t::next(trace_event_t& outEvent)
+        {
+            if (m_position >= m_size || m_corrupt)
+                return false;
+
+            u8 const tag   = m_data[m_position++];
+            u64      delta = 0, value = 0;
+            bool     ok    = sReadVarint(m_data, m_size, m_position, delta);
+            if (ok && (tag & TAG_THREAD) != 0)
+                ok = sReadVarint(m_data, m_size, m_position, value);
+            if (!ok)
+            {
+                m_corrupt = true;
+                return false;
+            }
+
+            if ((tag & TAG_THREAD) != 0)
+                m_thread = (u32)value;
+            m_time += delta;
+            outEvent.op        = tag & TAG_OP_MASK;
+            outEvent.resource  = (tag >> TAG_RESOURCE_SHIFT) & 3;
+            outEvent.thread    = m_thread;
+            outEvent.handle    = INVALID_HANDLE;
+            outEvent.time      = m_time;
+            outEvent.size      = 0;
+            outEvent.alignment = 1;
+            outEvent.offset    = 0;
+            outEvent.success   = (tag & TAG_FAILED) == 0;
+
+            switch (outEvent.op)
+            {
+                case TRACE_BEGIN:
+                    ok                = ok && sReadVarint(m_data, m_size, m_position, outEvent.size);
+                    ok                = ok && sReadVarint(m_data, m_size, m_position, outEvent.alignment);
+                    ok                = ok && sReadVarint(m_data, m_size, m_position, value);
+                    outEvent.resource = (u32)value;
+                    break;
+                case TRACE_ALLOCATE:
+                    ok = ok && sReadVarint(m_data, m_size, m_position, outEvent.size);
+                    ok = ok && m_position < m_size && m_data[m_position] < 64;
+                    if (ok)
+                        outEvent.alignment = (u64)1 << m_data[m_position++];
+                    if (outEvent.success)
+                    {
+                        ok              = ok && sReadVarint(m_data, m_size, m_position, value);
+                        outEvent.handle = (handle_t)value;
+                        ok              = ok && sReadVarint(m_data, m_size, m_position, outEvent.offset);
+                    }
+                    break;
+                case TRACE_FREE:
+                    ok              = ok && sReadVarint(m_data, m_size, m_position, value);
+                    outEvent.handle = (handle_t)value;
+                    break;
+                case TRACE_REALLOCATE:
+                    ok              = ok && sReadVarint(m_data, m_size, m_position, value);
+                    outEvent.handle = (handle_t)value;
+                    ok              = ok && sReadVarint(m_data, m_size, m_position, outEvent.size);
+                    break;
+                case TRACE_GROW:
+                case TRACE_SHRINK:
+                case TRACE_BATCH: ok = ok && sReadVarint(m_data, m_size, m_position, outEvent.size); break;
+                default: ok = false; break;
+            }
+
+            m_corrupt = !ok;
+            return ok;
+        }
+
+        // block_trace_engine_T...
+        template <typename TConfig>
+        block_trace_engine_T<TConfig>::block_trace_engine_T(alloc_t* allocator, u32 placement, u32 maxAllocs)
+            : m_allocator(allocator)
+            , m_placement(placement)
+            , m_maxAllocs(maxAllocs)
+            , m_initialized(false)
+            , m_sizes(nullptr)
+            , m_maxSizes(0)
+        {
+        }
+
+        template <typename TConfig>
+        block_trace_engine_T<TConfig>::~block_trace_engine_T()
+        {
+            if (m_initialized)
+                m_engine.destroy();
+            if (m_sizes != nullptr)
+                g_deallocate_array(m_allocator, m_sizes);
+        }
+
+        template <typename TConfig>
+        void block_trace_engine_T<TConfig>::v_begin(u64 size, u64 granularity, u32 placement)
+        {
+            typedef typename TConfig::offset_t offset_t;
+            if (m_initialized)
+                m_engine.destroy();
+            m_engine.init(m_allocator, (offset_t)size, m_maxAllocs, (offset_t)granularity, m_placement != PLACEMENT_KEEP ? m_placement : placement);
+            m_initialized = true;
+        }
+
+        template <typename TConfig>
+        handle_t block_trace_engine_T<TConfig>::v_allocate(u64 size, u64 alignment, u32 resource, u64& outOffset)
+        {
+            typedef typename TConfig::offset_t offset_t;
+            handle_t const handle = m_engine.allocateHandle((offset_t)size, (offset_t)alignment, resource);
+            outOffset             = handle != INVALID_HANDLE ? (u64)m_engine.getOffset(handle) : 0;
+            return handle;
+        }
+
+        template <typename TConfig>
+        bool block_trace_engine_T<TConfig>::v_free(handle_t handle)
+        {
+            return m_engine.freeHandle(handle);
+        }
+
+        template <typename TConfig>
+        bool block_trace_engine_T<TConfig>::v_reallocate(handle_t handle, u64 newSize)
+        {
+            return m_engine.reallocate(handle, (typename TConfig::offset_t)newSize);
+        }
+
+        template <typename TConfig>
+        bool block_trace_engine_T<TConfig>::v_grow(u64 newSize)
+        {
+            return m_engine.grow((typename TConfig::offset_t)newSize);
+        }
+
+        template <typename TConfig>
+        u64 block_trace_engine_T<TConfig>::v_shrinkToFit()
+        {
+            return m_engine.shrinkToFit();
+        }
+
+        template <typename TConfig>
+        u32 block_trace_engine_T<TConfig>::v_allocateMany(u64 const* sizes, u32 count, u32 resource, handle_t* outHandles, u64* outOffsets)
+        {
+            typedef typename TConfig::offset_t offset_t;
+            if (count > m_maxSizes)
+            {
+                if (m_sizes != nullptr)
+                    g_deallocate_array(m_allocator, m_sizes);
+                m_maxSizes = count;
+                m_sizes    = g_allocate_array<offset_t>(m_allocator, m_maxSizes);
+            }
+            for (u32 i = 0; i < count; ++i)
+                m_sizes[i] = (offset_t)sizes[i];
+            u32 const numAllocated = m_engine.allocateMany(m_sizes, count, outHandles, (offset_t)1, resource);
+            for (u32 i = 0; i < count; ++i)
+                outOffsets[i] = outHandles[i] != INVALID_HANDLE ? (u64)m_engine.getOffset(outHandles[i]) : 0;
+            return numAllocated;
+        }
+
+        template <typename TConfig>
+        u32 block_trace_engine_T<TConfig>::v_freeMany(handle_t const* handles, u32 count)
+        {
+            return m_engine.freeMany(handles, count);
+        }
+
+        template <typename TConfig>
+        void block_trace_engine_T<TConfig>::v_storageReport(storage_report_t& report) const
+        {
+            m_engine.storageReport(report);
+        }
+
+        template class block_trace_engine_T<block_config_T<u16, 3, u32>>;
+        template class block_trace_engine_T<block_config_T<u32, 3, u32>>;
+        template class block_trace_engine_T<block_config_T<u32, 3, u64>>;
+
+        // trace_replayer_t...
+
+        // Open addressing map from trace handles to engine handles, deletion shifts entries back so that
+        // no tombstones build up over a long trace
+        struct handle_entry_t
+        {
+            handle_t key;
+            handle_t value;
+        };
+
+        struct trace_replayer_t::context_t
+        {
+            alloc_t*        m_allocator;
+            handle_entry_t* m_map;
+            u32             m_mapCapacity;  // A power of 2
+            u32             m_mapCount;
+
+            trace_sample_t* m_samples;
+            u32             m_numSamples;
+            u32             m_maxSamples;
+
+            // Events of a batch and the arguments and results of the engine call that replays it
+            trace_event_t* m_batch;
+            u64*           m_batchSizes;
+            handle_t*      m_batchHandles;
+            u64*           m_batchOffsets;
+            u32            m_maxBatch;
+
+            trace_report_t m_report;
+        };
+
+        static inline u32 sSlotOf(handle_t key, u32 capacity) { return (key * 0x9e3779b1u) & (capacity - 1); }
+
+        static void sMapInsert(trace_replayer_t::context_t* ctx, handle_t key, handle_t value);
+
+        static void sMapGrow(trace_replayer_t::context_t* ctx)
+        {
+            handle_entry_t* const old         = ctx->m_map;
+            u32 const             oldCapacity = ctx->m_mapCapacity;
+            ctx->m_mapCapacity                = oldCapacity == 0 ? 1024 : oldCapacity * 2;
+            ctx->m_map                        = g_allocate_array<handle_entry_t>(ctx->m_allocator, ctx->m_mapCapacity);
+            ctx->m_mapCount                   = 0;
+            for (u32 i = 0; i < ctx->m_mapCapacity; ++i)
+                ctx->m_map[i].key = INVALID_HANDLE;
+            for (u32 i = 0; i < oldCapacity; ++i)
+            {
+                if (old[i].key != INVALID_HANDLE)
+                    sMapInsert(ctx, old[i].key, old[i].value);
+            }
+            if (old != nullptr)
+                g_deallocate_array(ctx->m_allocator, old);
+        }
+
+        static void sMapInsert(trace_replayer_t::context_t* ctx, handle_t key, handle_t value)
+        {
+            if ((ctx->m_mapCount + 1) * 4 > ctx->m_mapCapacity * 3)
+                sMapGrow(ctx);
+            u32 const mask = ctx->m_mapCapacity - 1;
+            u32       slot = sSlotOf(key, ctx->m_mapCapacity);
+            while (ctx->m_map[slot].key != INVALID_HANDLE && ctx->m_map[slot].key != key)
+                slot = (slot + 1) & mask;
+            if (ctx->m_map[slot].key == INVALID_HANDLE)
+                ctx->m_mapCount++;
+            ctx->m_map[slot].key   = key;
+            ctx->m_map[slot].value = value;
+        }
+
+        static u32 sMapFind(trace_replayer_t::context_t const* ctx, handle_t key)
+        {
+            if (ctx->m_mapCapacity == 0)
+                return 0xffffffff;
+            u32 const mask = ctx->m_mapCapacity - 1;
+            for (u32 slot = sSlotOf(key, ctx->m_mapCapacity);; slot = (slot + 1) & mask)
+            {
+                if (ctx->m_map[slot].key == key)
+                    return slot;
+                if (ctx->m_map[slot].key == INVALID_HANDLE)
+                    return 0xffffffff;
+            }
+        }
+
+        static void sMapErase(trace_replayer_t::context_t* ctx, u32 slot)
+        {
+            u32 const mask = ctx->m_mapCapacity - 1;
+            u32       hole = slot;
+            for (u32 next = (slot + 1) & mask; ctx->m_map[next].key != INVALID_HANDLE; next = (next + 1) & mask)
+            {
+                // An entry moves into the hole when the hole lies on its probe path
+                u32 const home = sSlotOf(ctx->m_map[next].key, ctx->m_mapCapacity);
+                if (((next - home) & mask) >= ((next - hole) & mask))
+                {
+                    ctx->m_map[hole] = ctx->m_map[next];
+                    hole             = next;
+                }
+            }
+            ctx->m_map[hole].key = INVALID_HANDLE;
+            ctx->m_mapCount--;
+        }
+
+        static void sTime(trace_op_stats_t& stats, u64 ns, bool success)
+        {
+            stats.count++;
+            stats.failures += success ? 0 : 1;
+            stats.totalNs += ns;
+            if (ns > stats.maxNs)
+                stats.maxNs = ns;
+        }
+
+        static void sSample(trace_replayer_t::context_t* ctx, trace_engine_t* engine, u64 heapSize, u64 event, u64 time)
+        {
+            storage_report_t report;
+            engine->storageReport(report);
+            if (ctx->m_numSamples == ctx->m_maxSamples)
+            {
+                u32 const maxSamples = ctx->m_maxSamples == 0 ? 256 : ctx->m_maxSamples * 2;
+                ctx->m_samples       = g_reallocate_array(ctx->m_allocator, ctx->m_samples, ctx->m_maxSamples, maxSamples);
+                ctx->m_maxSamples    = maxSamples;
+            }
+            trace_sample_t& sample   = ctx->m_samples[ctx->m_numSamples++];
+            sample.event             = event;
+            sample.time              = time;
+            sample.usedBytes         = heapSize - report.totalFreeSpace;
+            sample.freeBytes         = report.totalFreeSpace;
+            sample.largestFreeRegion = report.largestFreeRegion;
+            sample.liveAllocations   = ctx->m_mapCount;
+        }
+
+        // Replays the 'numEvents' events that follow a batch event with one allocateMany or freeMany
+        static bool sReplayBatch(trace_replayer_t::context_t* ctx, trace_reader_t& reader, trace_engine_t* engine, u64 numEvents)
+        {
+            // An event is at least a tag and a time delta, a count the rest of the trace cannot hold is corrupt
+            if (numEvents > reader.remaining() / 2 || numEvents > 0xffffffff)
+                return false;
+            u32 const count = (u32)numEvents;
+            if (count > ctx->m_maxBatch)
+            {
+                if (ctx->m_batch != nullptr)
+                {
+                    g_deallocate_array(ctx->m_allocator, ctx->m_batch);
+                    g_deallocate_array(ctx->m_allocator, ctx->m_batchSizes);
+                    g_deallocate_array(ctx->m_allocator, ctx->m_batchHandles);
+                    g_deallocate_array(ctx->m_allocator, ctx->m_batchOffsets);
+                }
+                ctx->m_maxBatch     = count;
+                ctx->m_batch        = g_allocate_array<trace_event_t>(ctx->m_allocator, count);
+                ctx->m_batchSizes   = g_allocate_array<u64>(ctx->m_allocator, count);
+                ctx->m_batchHandles = g_allocate_array<handle_t>(ctx->m_allocator, count);
+                ctx->m_batchOffsets = g_allocate_array<u64>(ctx->m_allocator, count);
+            }
+            for (u32 i = 0; i < count; ++i)
+            {
+                if (!reader.next(ctx->m_batch[i]) || (ctx->m_batch[i].op != TRACE_ALLOCATE && ctx->m_batch[i].op != TRACE_FREE) || ctx->m_batch[i].op != ctx->m_batch[0].op)
+                    return false;
+            }
+
+            trace_report_t& report = ctx->m_report;
+            if (count == 0)
+                return true;
+            if (ctx->m_batch[0].op == TRACE_ALLOCATE)
+            {
+                for (u32 i = 0; i < count; ++i)
+                    ctx->m_batchSizes[i] = ctx->m_batch[i].size;
+                u64 const start = sNowNs();
+                engine->allocateMany(ctx->m_batchSizes, count, ctx->m_batch[0].resource, ctx->m_batchHandles, ctx->m_batchOffsets);
+                u64 const ns = sNowNs() - start;
+                for (u32 i = 0; i < count; ++i)
+                {
+                    trace_event_t const& event  = ctx->m_batch[i];
+                    handle_t const       handle = ctx->m_batchHandles[i];
+                    sTime(report.allocate, i == 0 ? ns : 0, handle != INVALID_HANDLE);
+                    if ((handle != INVALID_HANDLE) != event.success || (event.success && ctx->m_batchOffsets[i] != event.offset))
+                        report.divergences++;
+                    if (handle != INVALID_HANDLE && event.success)
+                        sMapInsert(ctx, event.handle, handle);
+                    else if (handle != INVALID_HANDLE)
+                        engine->free(handle);
+                }
+            }
+            else
+            {
+                u32 numHandles = 0;
+                for (u32 i = 0; i < count; ++i)
+                {
+                    u32 const slot = sMapFind(ctx, ctx->m_batch[i].handle);
+                    if (slot == 0xffffffff)
+                    {
+                        report.unknownHandles++;
+                        continue;
+                    }
+                    ctx->m_batchHandles[numHandles++] = ctx->m_map[slot].value;
+                    sMapErase(ctx, slot);
+                }
+                u64 const start    = sNowNs();
+                u32 const numFreed = engine->freeMany(ctx->m_batchHandles, numHandles);
+                u64 const ns       = sNowNs() - start;
+                for (u32 i = 0; i < numHandles; ++i)
+                    sTime(report.free, i == 0 ? ns : 0, i < numFreed);
+            }
+            return true;
+        }
+
+        trace_replayer_t::trace_replayer_t()
+            : m_context(nullptr)
+        {
+        }
+
+        trace_replayer_t::~trace_replayer_t() {}
+
+        void trace_replayer_t::init(alloc_t* allocator)
+        {
+            ASSERT(!m_context);
+            m_context                 = allocator->construct<context_t>();
+            m_context->m_allocator    = allocator;
+            m_context->m_map          = nullptr;
+            m_context->m_mapCapacity  = 0;
+            m_context->m_mapCount     = 0;
+            m_context->m_samples      = nullptr;
+            m_context->m_numSamples   = 0;
+            m_context->m_maxSamples   = 0;
+            m_context->m_batch        = nullptr;
+            m_context->m_batchSizes   = nullptr;
+            m_context->m_batchHandles = nullptr;
+            m_context->m_batchOffsets = nullptr;
+            m_context->m_maxBatch     = 0;
+        }
+
+        void trace_replayer_t::destroy()
+        {
+            ASSERT(m_context);
+            alloc_t* allocator = m_context->m_allocator;
+            if (m_context->m_map != nullptr)
+                g_deallocate_array(allocator, m_context->m_map);
+            if (m_context->m_samples != nullptr)
+                g_deallocate_array(allocator, m_context->m_samples);
+            if (m_context->m_batch != nullptr)
+            {
+                g_deallocate_array(allocator, m_context->m_batch);
+                g_deallocate_array(allocator, m_context->m_batchSizes);
+                g_deallocate_array(allocator, m_context->m_batchHandles);
+                g_deallocate_array(allocator, m_context->m_batchOffsets);
+            }
+            allocator->destruct(m_context);
+            m_context = nullptr;
+        }
+
+        bool trace_replayer_t::replay(void const* trace, u64 traceSize, trace_engine_t* engine, u32 sampleInterval)
+        {
+            context_t* ctx    = m_context;
+            ctx->m_report     = trace_report_t();
+            ctx->m_numSamples = 0;
+            for (u32 i = 0; i < ctx->m_mapCapacity; ++i)
+                ctx->m_map[i].key = INVALID_HANDLE;
+            ctx->m_mapCount = 0;
+
+            trace_reader_t reader;
+            if (!reader.init(trace, traceSize))
+                return false;
+
+            trace_report_t& report    = ctx->m_report;
+            u64             heapSize  = 0;
+            u64             firstTime = 0;
+            u64             lastTime  = 0;
+            bool            corrupt   = false;
+            trace_event_t   event;
+            while (reader.next(event))
+            {
+                // The engine is initialized by the begin event, nothing can be replayed before it
+                if (report.events == 0 && event.op != TRACE_BEGIN)
+                {
+                    corrupt = true;
+                    break;
+                }
+
+                if (report.events == 0)
+                    firstTime = event.time;
+                lastTime     = event.time;
+                u32 consumed = 1;
+
+                switch (event.op)
+                {
+                    case TRACE_BEGIN:
+                        engine->begin(event.size, event.alignment, event.resource);
+                        heapSize = event.size;
+                        for (u32 i = 0; i < ctx->m_mapCapacity; ++i)
+                            ctx->m_map[i].key = INVALID_HANDLE;
+                        ctx->m_mapCount = 0;
+                        break;
+                    case TRACE_ALLOCATE:
+                    {
+                        u64            offset = 0;
+                        u64 const      start  = sNowNs();
+                        handle_t const handle = engine->allocate(event.size, event.alignment, event.resource, offset);
+                        sTime(report.allocate, sNowNs() - start, handle != INVALID_HANDLE);
+                        if ((handle != INVALID_HANDLE) != event.success || (event.success && offset != event.offset))
+                            report.divergences++;
+                        if (handle != INVALID_HANDLE && event.success)
+                            sMapInsert(ctx, event.handle, handle);
+                        else if (handle != INVALID_HANDLE)
+                            engine->free(handle);  // The trace has no handle to free it with later
+                        break;
+                    }
+                    case TRACE_FREE:
+                    case TRACE_REALLOCATE:
+                    {
+                        u32 const slot = sMapFind(ctx, event.handle);
+                        if (slot == 0xffffffff)
+                        {
+                            report.unknownHandles++;
+                            break;
+                        }
+                        u64 const start = sNowNs();
+                        if (event.op == TRACE_FREE)
+                        {
+                            bool const freed = engine->free(ctx->m_map[slot].value);
+                            sTime(report.free, sNowNs() - start, freed);
+                            sMapErase(ctx, slot);
+                        }
+                        else
+                        {
+                            bool const resized = engine->reallocate(ctx->m_map[slot].value, event.size);
+                            sTime(report.reallocate, sNowNs() - start, resized);
+                            if (resized != event.success)
+                                report.divergences++;
+                        }
+                        break;
+                    }
+                    case TRACE_GROW:
+                        if (engine->grow(event.size))
+                            heapSize = event.size;
+                        break;
+                    case TRACE_SHRINK: heapSize = engine->shrinkToFit(); break;
+                    case TRACE_BATCH:
+                        corrupt = !sReplayBatch(ctx, reader, engine, event.size);
+                        if (!corrupt && event.size > 0)
+                        {
+                            lastTime = ctx->m_batch[event.size - 1].time;
+                            consumed += (u32)event.size;
+                        }
+                        break;
+                }
+                if (corrupt)
+                    break;
+
+                u64 const before = report.events;
+                report.events += consumed;
+                if (sampleInterval > 0 && heapSize > 0 && (before / sampleInterval) != (report.events / sampleInterval))
+                    sSample(ctx, engine, heapSize, report.events - 1, lastTime);
+            }
+
+            if (heapSize > 0 && report.events > 0 && (ctx->m_numSamples == 0 || ctx->m_samples[ctx->m_numSamples - 1].event != report.events - 1))
+                sSample(ctx, engine, heapSize, report.events - 1, lastTime);
+            for (u32 i = 0; i < ctx->m_numSamples; ++i)
+            {
+                if (ctx->m_samples[i].usedBytes > report.peakUsedBytes)
+                    report.peakUsedBytes = ctx->m_samples[i].usedBytes;
+            }
+
+            report.duration = lastTime - firstTime;
+            return !corrupt && !reader.corrupt();
+        }
+
+        void trace_replayer_t::getReport(trace_report_t& outReport) const { outReport = m_context->m_report; }
+
+        u32 trace_replayer_t::getSamples(trace_sample_t const*& outSamples) const
+        {
+            outSamples = m_context->m_samples;
+            return m_context->m_numSamples;
+        }
+
+    }  // namespace nalloc
+}  // namespace ncore
@@ -0,0 +1,321 @@
+#include "ccore/c_target.h"
+#include "ccore/c_debug.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/c_vkupload.h"
+
+#include <string.h>
+
+namespace ncore
+{
+    namespace nvkmem
+    {
+        struct upload_record_t
+        {
+            device_memory_t srcMemory;
+            device_memory_t dstMemory;
+            u64             srcOffset;
+            u64             dstOffset;
+            u64             size;
+        };
+
+        // Host mapping of a staging allocation that did not come from the ring memory
+        struct staging_map_t
+        {
+            allocation_t allocation;
+            u8*          base;  // Host address of offset 0 of the memory
+        };
+
+        struct upload_stage_t::context_t
+        {
+            alloc_t*          m_allocator;
+            memory_manager_t* m_manager;
+            ring_allocator_t  m_ring;
+            device_memory_t   m_ringMemory;
+            u8*               m_ringBase;  // Host address of offset 0 of the ring memory
+
+            staging_map_t* m_maps;  // Fallback allocations of the batch being filled
+            u32            m_numMaps;
+            u32            m_maxMaps;
+
+            upload_record_t* m_records;
+            u32              m_numRecords;
+            u32              m_maxRecords;
+
+            upload_copy_t* m_copies;
+            u32            m_numCopies;
+            u32            m_maxCopies;
+            copy_region_t* m_regions;  // Merged records, at most one per record
+            u32            m_maxRegions;
+
+            u64 m_totalUploads;
+            u64 m_totalBytes;
+            u32 m_totalBatches;
+            u64 m_totalRegions;
+            u32 m_totalCopies;
+        };
+
+        template <typename T> static void sGrow(alloc_t* allocator, T*& array, u32 count, u32& capacity, u32 minimum)
+        {
+            if (count < capacity)
+                return;
+            u32 const newCapacity = capacity == 0 ? minimum : capacity * 2;
+            array                 = g_reallocate_array(allocator, array, capacity, newCapacity);
+            capacity              = newCapacity;
+        }
+
+        upload_stage_t::upload_stage_t()
+            : m_context(nullptr)
+        {
+        }
+
+        upload_stage_t::~upload_stage_t() {}
+
+        bool upload_stage_t::init(alloc_t* allocator, memory_manager_t* manager, ring_config_t const& staging)
+        {
+            ASSERT(!m_context);
+            m_context = allocator->construct<context_t>();
+            if (!m_context->m_ring.init(allocator, manager, staging))
+            {
+                allocator->destruct(m_context);
+                m_context = nullptr;
+                return false;
+            }
+
+            allocation_t const& memory = m_context->m_ring.getMemory();
+            u8* const           host   = (u8*)manager->map(memory);
+            if (host == nullptr)
+            {
+                m_context->m_ring.destroy();
+                allocator->destruct(m_context);
+                m_context = nullptr;
+                return false;
+            }
+
+            m_context->m_allocator    = allocator;
+            m_context->m_manager      = manager;
+            m_context->m_ringMemory   = memory.memory;
+            m_context->m_ringBase     = host - memory.offset;
+            m_context->m_maps         = nullptr;
+            m_context->m_numMaps      = 0;
+            m_context->m_maxMaps      = 0;
+            m_context->m_records      = nullptr;
+            m_context->m_numRecords   = 0;
+            m_context->m_maxRecords   = 0;
+            m_context->m_copies       = nullptr;
+            m_context->m_numCopies    = 0;
+            m_context->m_maxCopies    = 0;
+            m_context->m_regions      = nullptr;
+            m_context->m_maxRegions   = 0;
+            m_context->m_totalUploads = 0;
+            m_context->m_totalBytes   = 0;
+            m_context->m_totalBatches = 0;
+            m_context->m_totalRegions = 0;
+            m_context->m_totalCopies  = 0;
+            return true;
+        }
+
+        void upload_stage_t::destroy()
+        {
+            ASSERT(m_context);
+            context_t* ctx       = m_context;
+            alloc_t*   allocator = ctx->m_allocator;
+            for (u32 i = 0; i < ctx->m_numMaps; ++i)
+                ctx->m_manager->unmap(ctx->m_maps[i].allocation);
+            ctx->m_manager->unmap(ctx->m_ring.getMemory());
+            ctx->m_ring.destroy();
+            if (ctx->m_maps != nullptr)
+                g_deallocate_array(allocator, ctx->m_maps);
+            if (ctx->m_records != nullptr)
+                g_deallocate_array(allocator, ctx->m_records);
+            if (ctx->m_copies != nullptr)
+                g_deallocate_array(allocator, ctx->m_copies);
+            if (ctx->m_regions != nullptr)
+                g_deallocate_array(allocator, ctx->m_regions);
+            allocator->destruct(ctx);
+            m_context = nullptr;
+        }
+
+        // Host address of a staging allocation, a fallback allocation of the ring is mapped on first use
+        static u8* sHostAddress(upload_stage_t::context_t* ctx, allocation_t const& staging)
+        {
+            if (staging.memory == ctx->m_ringMemory)
+                return ctx->m_ringBase + staging.offset;
+            for (u32 i = 0; i < ctx->m_numMaps; ++i)
+            {
+                if (ctx->m_maps[i].allocation.memory == staging.memory)
+                    return ctx->m_maps[i].base + staging.offset;
+            }
+
+            u8* const host = (u8*)ctx->m_manager->map(staging);
+            if (host == nullptr)
+                return nullptr;
+            sGrow(ctx->m_allocator, ctx->m_maps, ctx->m_numMaps, ctx->m_maxMaps, 8);
+            ctx->m_maps[ctx->m_numMaps].allocation = staging;
+            ctx->m_maps[ctx->m_numMaps].base       = host - staging.offset;
+            ctx->m_numMaps++;
+            return host;
+        }
+
+        void* upload_stage_t::reserve(allocation_t const& destination, u64 dstOffset, u64 size, u64 alignment)
+        {
+            context_t* ctx = m_context;
+            ASSERT(size > 0 && dstOffset + size <= destination.size);
+            ASSERT(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+            allocation_t staging;
+            if (!ctx->m_ring.allocate(size, alignment, staging))
+                return nullptr;
+            u8* const host = sHostAddress(ctx, staging);
+            if (host == nullptr)
+                return nullptr;
+
+            // Only recorded here, the device flush happens in submit() after the caller wrote the data.
+            // Consecutive staging allocations merge into one range in the manager.
+            ctx->m_manager->flush(staging);
+
+            sGrow(ctx->m_allocator, ctx->m_records, ctx->m_numRecords, ctx->m_maxRecords, 256);
+            upload_record_t& record = ctx->m_records[ctx->m_numRecords++];
+            record.srcMemory        = staging.memory;
+            record.dstMemory        = destination.memory;
+            record.srcOffset        = staging.offset;
+            record.dstOffset        = destination.offset + dstOffset;
+            record.size             = size;
+
+            ctx->m_totalUploads++;
+            ctx->m_totalBytes += size;
+            return host;
+        }
+
+        bool upload_stage_t::upload(allocation_t const& destination, u64 dstOffset, void const* data, u64 size, u64 alignment)
+        {
+            void* const host = reserve(destination, dstOffset, size, alignment);
+            if (host == nullptr)
+                return false;
+            memcpy(host, data, (size_t)size);
+            return true;
+        }
+
+        // Order of the copies and of the regions within a copy
+        static inline bool sRecordLess(upload_record_t const& a, upload_record_t const& b)
+        {
+            if (a.dstMemory != b.dstMemory)
+                return a.dstMemory < b.dstMemory;
+            if (a.srcMemory != b.srcMemory)
+                return a.srcMemory < b.srcMemory;
+            return a.dstOffset < b.dstOffset;
+        }
+
+        static void sSiftDown(upload_record_t* records, u32 root, u32 count)
+        {
+            while (true)
+            {
+                u32 child = root * 2 + 1;
+                if (child >= count)
+                    return;
+                if (child + 1 < count && sRecordLess(records[child], records[child + 1]))
+                    child++;
+                if (!sRecordLess(records[root], records[child]))
+                    return;
+                upload_record_t const swap = records[root];
+                records[root]              = records[child];
+                records[child]             = swap;
+                root                       = child;
+            }
+        }
+
+        static void sSortRecords(upload_record_t* records, u32 count)
+        {
+            for (u32 i = count / 2; i > 0; --i)
+                sSiftDown(records, i - 1, count);
+            for (u32 end = count; end > 1; --end)
+            {
+                upload_record_t const swap = records[0];
+                records[0]                 = records[end - 1];
+                records[end - 1]           = swap;
+                sSiftDown(records, 0, end - 1);
+            }
+        }
+
+        void upload_stage_t::submit(u64 timelineValue, upload_batch_t& outBatch)
+        {
+            context_t* ctx   = m_context;
+            u32 const  count = ctx->m_numRecords;
+
+            sSortRecords(ctx->m_records, count);
+            if (count > ctx->m_maxRegions)
+            {
+                if (ctx->m_regions != nullptr)
+                    g_deallocate_array(ctx->m_allocator, ctx->m_regions);
+                ctx->m_maxRegions = count < 256 ? 256 : count;
+                ctx->m_regions    = g_allocate_array<copy_region_t>(ctx->m_allocator, ctx->m_maxRegions);
+            }
+
+            // A record continues the previous region when it follows it in both staging and destination memory
+            u32 numRegions   = 0;
+            ctx->m_numCopies = 0;
+            for (u32 i = 0; i < count; ++i)
+            {
+                upload_record_t const& record = ctx->m_records[i];
+                upload_copy_t*         copy   = ctx->m_numCopies > 0 ? &ctx->m_copies[ctx->m_numCopies - 1] : nullptr;
+                if (copy == nullptr || copy->srcMemory != record.srcMemory || copy->dstMemory != record.dstMemory)
+                {
+                    sGrow(ctx->m_allocator, ctx->m_copies, ctx->m_numCopies, ctx->m_maxCopies, 16);
+                    copy              = &ctx->m_copies[ctx->m_numCopies++];
+                    copy->srcMemory   = record.srcMemory;
+                    copy->dstMemory   = record.dstMemory;
+                    copy->firstRegion = numRegions;
+                    copy->numRegions  = 0;
+                }
+                else
+                {
+                    copy_region_t& last = ctx->m_regions[numRegions - 1];
+                    if (last.srcOffset + last.size == record.srcOffset && last.dstOffset + last.size == record.dstOffset)
+                    {
+                        last.size += record.size;
+                        continue;
+                    }
+                }
+                copy_region_t& region = ctx->m_regions[numRegions++];
+                region.srcOffset      = record.srcOffset;
+                region.dstOffset      = record.dstOffset;
+                region.size           = record.size;
+                copy->numRegions++;
+            }
+
+            // The staging writes become visible to the device, then the fallback mappings of the batch are released
+            ctx->m_manager->flushMappedRanges();
+            for (u32 i = 0; i < ctx->m_numMaps; ++i)
+                ctx->m_manager->unmap(ctx->m_maps[i].allocation);
+            ctx->m_numMaps = 0;
+            ctx->m_ring.submit(timelineValue);
+
+            outBatch.copies     = ctx->m_copies;
+            outBatch.numCopies  = ctx->m_numCopies;
+            outBatch.regions    = ctx->m_regions;
+            outBatch.numRegions = numRegions;
+
+            ctx->m_numRecords = 0;
+            ctx->m_totalBatches++;
+            ctx->m_totalRegions += numRegions;
+            ctx->m_totalCopies += ctx->m_numCopies;
+        }
+
+        void upload_stage_t::reclaim(u64 completedValue) { m_context->m_ring.reclaim(completedValue); }
+
+        void upload_stage_t::getStats(upload_stats_t& outStats) const
+        {
+            context_t const* ctx = m_context;
+            ring_stats_t     ring;
+            ctx->m_ring.getStats(ring);
+            outStats.bytesInFlight = ring.bytesInFlight;
+            outStats.pendingCount  = ctx->m_numRecords;
+            outStats.totalUploads  = ctx->m_totalUploads;
+            outStats.totalBytes    = ctx->m_totalBytes;
+            outStats.totalBatches  = ctx->m_totalBatches;
+            outStats.totalRegions  = ctx->m_totalRegions;
+            outStats.totalCopies   = ctx->m_totalCopies;
+        }
+
+    }  // namespace nvkmem
+}  // namespace ncore
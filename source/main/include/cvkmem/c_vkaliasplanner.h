@@ -0,0 +1,83 @@
+#ifndef __CVKMEM_ALIAS_PLANNER_H_
+#define __CVKMEM_ALIAS_PLANNER_H_
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "cvkmem/c_vkmem.h"
+
+namespace ncore
+{
+    namespace nvkmem
+    {
+        // A transient resource of a frame, alive from the start of pass 'firstPass' to the end of pass 'lastPass'
+        struct transient_resource_t
+        {
+            u64 size;
+            u64 alignment;  // A power of 2
+            u32 firstPass;
+            u32 lastPass;
+            u32 resource;  // nalloc::RESOURCE_ANY/LINEAR/OPTIMAL
+        };
+
+        // Resource 'after' takes over (part of) the memory of resource 'before' and needs an aliasing
+        // barrier at the start of pass 'pass'
+        struct alias_barrier_t
+        {
+            u32 before;
+            u32 after;
+            u32 pass;
+        };
+
+        struct alias_stats_t
+        {
+            u64 heapSize         = 0;  // Bytes needed by the current plan
+            u64 unaliasedSize    = 0;  // Sum of the sizes, what the resources take without aliasing
+            u32 numBarriers      = 0;
+            u32 numPlaced        = 0;  // Resources placed by the most recent plan()
+            u32 fullPlans        = 0;
+            u32 incrementalPlans = 0;
+            u32 cachedPlans      = 0;  // Calls that found the input unchanged
+        };
+
+        // Packs the transient resources of a frame into one heap, resources whose lifetimes do not overlap may
+        // share memory. Resources are placed largest first at the lowest offset that does not collide with a
+        // placed resource that is alive at the same time. Linear and optimal resources that are alive at the
+        // same time are kept bufferImageGranularity apart.
+        // The plan is cached, the index of a resource in the input is its identity between calls. An unchanged
+        // input returns the cached plan, when only a few resources changed the others keep their offsets and
+        // only the changed ones are placed again. A full plan is made when more than a quarter changed or the
+        // incremental heap grows more than a quarter beyond the last full plan.
+        // Not thread-safe.
+        class alias_planner_t
+        {
+        public:
+            alias_planner_t();
+            ~alias_planner_t();
+
+            void init(alloc_t* allocator, u64 bufferImageGranularity = 1);
+            void destroy();
+
+            // Returns the heap size of the plan
+            u64  plan(transient_resource_t const* resources, u32 count);
+            void invalidate();  // The next plan() is a full plan
+
+            u64 heapSize() const;
+            u64 getOffset(u32 index) const;
+
+            // Barriers ordered by pass, valid until the next plan(). Returns the number of barriers.
+            u32 getBarriers(alias_barrier_t const*& outBarriers) const;
+
+            void getStats(alias_stats_t& outStats) const;
+
+            struct context_t;
+
+        private:
+            context_t* m_context;
+        };
+
+    }  // namespace nvkmem
+}  // namespace ncore
+
+#endif  // __CVKMEM_ALIAS_PLANNER_H_
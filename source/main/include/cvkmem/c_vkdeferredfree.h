@@ -0,0 +1,49 @@
+#ifndef __CVKMEM_DEFERRED_FREE_H_
+#define __CVKMEM_DEFERRED_FREE_H_
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "cvkmem/c_vkmem.h"
+
+namespace ncore
+{
+    namespace nvkmem
+    {
+        // Frees allocations once the GPU is done with them. A dropped allocation is enqueued with the timeline
+        // value after which the GPU no longer uses it, release() frees everything up to a completed value in a
+        // single batch through memory_manager_t::freeMany.
+        // Every thread enqueues into its own queue_t, the lock of a queue is only contended while release()
+        // collects it. release() may run on any one thread at a time and is the only caller of the manager.
+        class deferred_free_t
+        {
+        public:
+            struct queue_t;
+
+            deferred_free_t();
+            ~deferred_free_t();
+
+            void init(alloc_t* allocator, memory_manager_t* manager);
+            void destroy();  // Frees everything that is still pending, the GPU must be idle
+
+            queue_t* createQueue();
+            void     destroyQueue(queue_t* queue);  // Pending frees of the queue stay pending
+
+            void enqueue(queue_t* queue, allocation_t const& allocation, u64 completionValue);
+
+            // Frees every pending allocation with a completion value <= 'completedValue', returns the number freed.
+            // An allocation enqueued twice is freed once and counted once.
+            u32 release(u64 completedValue);
+            u32 pendingCount() const;  // Frees collected by release() that are still waiting for the GPU
+
+            struct context_t;
+
+        private:
+            context_t* m_context;
+        };
+
+    }  // namespace nvkmem
+}  // namespace ncore
+
+#endif  // __CVKMEM_DEFERRED_FREE_H_
@@ -0,0 +1,74 @@
+#ifndef __CVKMEM_FAKE_DEVICE_H_
+#define __CVKMEM_FAKE_DEVICE_H_
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "cvkmem/c_vkmem.h"
+
+namespace ncore
+{
+    namespace nvkmem
+    {
+        // In-process device without a GPU, for tests and tools. Device memory is bookkeeping only, every heap
+        // refuses allocations beyond its size and allocations can be made to fail on demand.
+        class fake_device_t : public device_t
+        {
+        public:
+            fake_device_t();
+            ~fake_device_t();
+
+            // The default layout is a discrete GPU: a device local heap, a host heap and a small
+            // device local and host visible heap (resizable BAR). The last memory type is host cached but not
+            // host coherent, for the flush and invalidate path.
+            void init(alloc_t* allocator);
+            void init(alloc_t* allocator, memory_properties_t const& properties, u64 bufferImageGranularity);
+            void destroy();
+
+            void setFailAllocations(bool fail);  // Every allocateMemory fails while set
+            u32  liveAllocations() const;
+            u64  heapUsage(u32 heapIndex) const;
+            u64  memorySize(device_memory_t memory) const;  // 0 for an unknown memory object
+            u32  memoryType(device_memory_t memory) const;
+
+            // Mapping bookkeeping, host memory backs a memory object from its first map until it is freed.
+            // A range error is a flush or invalidate of unmapped memory or of a range that is not atom aligned.
+            u32 mapCalls() const;
+            u32 flushCalls() const;
+            u32 invalidateCalls() const;
+            u32 rangeErrors() const;
+            u64 flushedBytes() const;  // Sum of the sizes of all flushed ranges
+            u64 invalidatedBytes() const;
+
+            // Simulated VK_EXT_memory_budget, the budget of a heap defaults to its size and the reported usage is
+            // the memory allocated from the heap plus the usage of other processes
+            void setHeapBudget(u32 heapIndex, u64 budget);
+            void setExternalUsage(u32 heapIndex, u64 usage);
+
+            // Stand-in for a GPU timeline semaphore, the value only moves forward
+            void signal(u64 value);
+            u64  completedValue() const;
+
+            struct context_t;
+
+        protected:
+            virtual void            v_getMemoryProperties(memory_properties_t& outProperties) const;
+            virtual u64             v_getBufferImageGranularity() const;
+            virtual device_memory_t v_allocateMemory(u32 memoryTypeIndex, u64 size);
+            virtual void            v_freeMemory(device_memory_t memory);
+            virtual void            v_getMemoryBudget(memory_budget_t& outBudget) const;
+            virtual u64             v_getNonCoherentAtomSize() const;
+            virtual void*           v_mapMemory(device_memory_t memory);
+            virtual void            v_unmapMemory(device_memory_t memory);
+            virtual void            v_flushMemoryRanges(mapped_range_t const* ranges, u32 count);
+            virtual void            v_invalidateMemoryRanges(mapped_range_t const* ranges, u32 count);
+
+        private:
+            context_t* m_context;
+        };
+
+    }  // namespace nvkmem
+}  // namespace ncore
+
+#endif  // __CVKMEM_FAKE_DEVICE_H_
@@ -9,7 +9,224 @@
 
 namespace ncore
 {
+    namespace nvkmem
+    {
+        // Opaque device memory object (VkDeviceMemory on a Vulkan device)
+        typedef u64                      device_memory_t;
+        static constexpr device_memory_t NULL_MEMORY = 0;
 
+        static constexpr u32 MAX_MEMORY_TYPES = 32;
+        static constexpr u32 MAX_MEMORY_HEAPS = 16;
+
+        // Memory property flags, same values as VkMemoryPropertyFlagBits
+        static constexpr u32 MEMORY_PROPERTY_DEVICE_LOCAL     = 0x01;
+        static constexpr u32 MEMORY_PROPERTY_HOST_VISIBLE     = 0x02;
+        static constexpr u32 MEMORY_PROPERTY_HOST_COHERENT    = 0x04;
+        static constexpr u32 MEMORY_PROPERTY_HOST_CACHED      = 0x08;
+        static constexpr u32 MEMORY_PROPERTY_LAZILY_ALLOCATED = 0x10;
+
+        // Memory usage hints, they add required, preferred and avoided property flags to a request
+        static constexpr u32 MEMORY_USAGE_UNKNOWN    = 0;  // Only the flags of the request
+        static constexpr u32 MEMORY_USAGE_GPU_ONLY   = 1;  // Prefers device local, avoids host visible
+        static constexpr u32 MEMORY_USAGE_CPU_ONLY   = 2;  // Requires host visible and coherent, avoids device local
+        static constexpr u32 MEMORY_USAGE_CPU_TO_GPU = 3;  // Uploads, requires host visible and prefers device local
+        static constexpr u32 MEMORY_USAGE_GPU_TO_CPU = 4;  // Readback, requires host visible and prefers host cached
+        static constexpr u32 MEMORY_USAGE_GPU_LAZY   = 5;  // Transient attachments, requires lazily allocated
+        static constexpr u32 NUM_MEMORY_USAGES       = 6;
+
+        // Memory heap flags, same values as VkMemoryHeapFlagBits
+        static constexpr u32 MEMORY_HEAP_DEVICE_LOCAL = 0x01;
+
+        struct memory_type_t
+        {
+            u32 propertyFlags;
+            u32 heapIndex;
+        };
+
+        struct memory_heap_t
+        {
+            u64 size;
+            u32 flags;
+        };
+
+        // Mirrors VkPhysicalDeviceMemoryProperties
+        struct memory_properties_t
+        {
+            u32           memoryTypeCount;
+            memory_type_t memoryTypes[MAX_MEMORY_TYPES];
+            u32           memoryHeapCount;
+            memory_heap_t memoryHeaps[MAX_MEMORY_HEAPS];
+        };
+
+        // Mirrors VkMemoryRequirements
+        struct memory_requirements_t
+        {
+            u64 size;
+            u64 alignment;
+            u32 memoryTypeBits;
+        };
+
+        // Mirrors VkPhysicalDeviceMemoryBudgetPropertiesEXT
+        struct memory_budget_t
+        {
+            u64 heapBudget[MAX_MEMORY_HEAPS];
+            u64 heapUsage[MAX_MEMORY_HEAPS];
+        };
+
+        // Mirrors VkMappedMemoryRange
+        struct mapped_range_t
+        {
+            device_memory_t memory;
+            u64             offset;
+            u64             size;
+        };
+
+        static constexpr u64 WHOLE_SIZE = 0xffffffffffffffffull;
+
+        // The device the memory manager allocates from. A Vulkan backend forwards to vkAllocateMemory and
+        // vkFreeMemory, see c_vkfakedevice.h for an in-process device that needs no GPU.
+        class device_t
+        {
+        public:
+            void            getMemoryProperties(memory_properties_t& outProperties) const { v_getMemoryProperties(outProperties); }
+            u64             getBufferImageGranularity() const { return v_getBufferImageGranularity(); }
+            device_memory_t allocateMemory(u32 memoryTypeIndex, u64 size) { return v_allocateMemory(memoryTypeIndex, size); }  // NULL_MEMORY on failure
+            void            freeMemory(device_memory_t memory) { v_freeMemory(memory); }
+
+            // Usage and budget of every heap of the whole process (VK_EXT_memory_budget). A device without the
+            // extension reports 80% of the heap size as budget and a usage of 0.
+            void getMemoryBudget(memory_budget_t& outBudget) const { v_getMemoryBudget(outBudget); }
+
+            // Host access to host visible memory, a memory object is mapped as a whole. Ranges of non-coherent
+            // memory are multiples of getNonCoherentAtomSize or end at the end of the memory object.
+            u64   getNonCoherentAtomSize() const { return v_getNonCoherentAtomSize(); }
+            void* mapMemory(device_memory_t memory) { return v_mapMemory(memory); }  // nullptr on failure
+            void  unmapMemory(device_memory_t memory) { v_unmapMemory(memory); }
+            void  flushMemoryRanges(mapped_range_t const* ranges, u32 count) { v_flushMemoryRanges(ranges, count); }
+            void  invalidateMemoryRanges(mapped_range_t const* ranges, u32 count) { v_invalidateMemoryRanges(ranges, count); }
+
+        protected:
+            virtual ~device_t() {}
+
+            virtual void            v_getMemoryProperties(memory_properties_t& outProperties) const   = 0;
+            virtual u64             v_getBufferImageGranularity() const                               = 0;
+            virtual device_memory_t v_allocateMemory(u32 memoryTypeIndex, u64 size)                   = 0;
+            virtual void            v_freeMemory(device_memory_t memory)                              = 0;
+            virtual u64             v_getNonCoherentAtomSize() const                                  = 0;
+            virtual void*           v_mapMemory(device_memory_t memory)                               = 0;
+            virtual void            v_unmapMemory(device_memory_t memory)                             = 0;
+            virtual void            v_flushMemoryRanges(mapped_range_t const* ranges, u32 count)      = 0;
+            virtual void            v_invalidateMemoryRanges(mapped_range_t const* ranges, u32 count) = 0;
+            virtual void            v_getMemoryBudget(memory_budget_t& outBudget) const;
+        };
+
+        struct memory_config_t
+        {
+            u64 preferredBlockSize    = 256 * 1024 * 1024;  // Size of a new block, at most 2 GB
+            u64 dedicatedThreshold    = 64 * 1024 * 1024;   // Requests of at least this size get their own device memory
+            u32 maxEmptyBlocksPerType = 1;                  // Empty blocks kept per memory type before blocks are released
+            u32 maxAllocsPerBlock     = 0xffffffff;
+            u32 pageEngineHeaps       = 0;      // Bit per memory heap, blocks of these heaps use the bitmap page allocator
+            u64 pageSize              = 65536;  // Page size of the page allocator, a power of 2, rounded up to bufferImageGranularity
+        };
+
+        struct memory_stats_t
+        {
+            u32 blockCount          = 0;
+            u32 emptyBlockCount     = 0;
+            u32 dedicatedCount      = 0;
+            u32 allocationCount     = 0;  // Including dedicated allocations
+            u64 blockBytes          = 0;
+            u64 dedicatedBytes      = 0;
+            u64 allocatedBytes      = 0;  // Bytes handed out from blocks
+            u32 deviceAllocateCalls = 0;
+            u32 deviceFreeCalls     = 0;
+        };
+
+        // Accounting of one memory heap, see memory_manager_t::updateBudget
+        struct heap_budget_t
+        {
+            u64 blockBytes      = 0;  // Device memory of the manager in the heap, blocks and dedicated allocations
+            u64 allocationBytes = 0;  // Bytes handed out from that memory
+            u64 usage           = 0;  // Usage of the whole process, as reported by the device and adjusted since
+            u64 budget          = 0;  // What the process may use before the driver starts paging
+        };
+
+        static constexpr u32 DEDICATED_BLOCK = 0xffffffff;
+
+        struct allocation_t
+        {
+            device_memory_t memory;
+            u64             offset;      // Offset in 'memory'
+            u64             size;
+            u32             memoryType;  // Memory type index
+            u32             block;       // Block slot of the memory type, DEDICATED_BLOCK for a dedicated allocation
+            u32             handle;      // Handle in the block allocator of the block
+        };
+
+        // Sub-allocates device memory. Every memory type has a list of device memory blocks, each managed by
+        // its own block allocator. Blocks are created on demand and empty blocks beyond maxEmptyBlocksPerType
+        // are returned to the device, large requests bypass the blocks with a dedicated allocation.
+        // Not thread-safe.
+        class memory_manager_t
+        {
+        public:
+            memory_manager_t();
+            ~memory_manager_t();
+
+            void init(alloc_t* allocator, device_t* device, memory_config_t const& config = memory_config_t());
+            void destroy();  // Releases all blocks, outstanding allocations become invalid
+
+            // Tries the memory types in requirements.memoryTypeBits in the order of findMemoryTypes, moving on
+            // to the next type when the device is out of memory. 'usage' is one of MEMORY_USAGE_*, 'resource'
+            // is one of nalloc::RESOURCE_ANY/LINEAR/OPTIMAL. Returns false when out of memory.
+            bool allocate(memory_requirements_t const& requirements, u32 requiredFlags, u32 preferredFlags, u32 usage, u32 resource, allocation_t& outAllocation);
+            void free(allocation_t const& allocation);
+
+            // Frees a batch, allocations of the same block are handed to its block allocator together so that
+            // neighbours in memory are merged before they reach the free bins. Allocations that were already
+            // freed, also earlier in the same batch, are skipped. Returns the number actually freed.
+            u32 freeMany(allocation_t const* allocations, u32 count);
+
+            void trim();  // Releases all empty blocks
+
+            // Ranks the memory types in 'memoryTypeBits' that have all required flags, fewest missing preferred
+            // flags and fewest avoided flags first. The ranking is a table lookup built at init, requests with
+            // flags beyond MEMORY_PROPERTY_LAZILY_ALLOCATED are ranked on the fly.
+            // Writes up to MAX_MEMORY_TYPES type indices to 'outTypes' and returns the number written.
+            u32 findMemoryTypes(u32 memoryTypeBits, u32 requiredFlags, u32 preferredFlags, u32 usage, u8* outTypes) const;
+
+            void getStats(memory_stats_t& outStats) const;
+
+            // The device is asked for usage and budget at init and by updateBudget, once a frame is enough.
+            // In between the usage follows the device memory the manager allocates and frees.
+            void updateBudget();
+            void getBudget(u32 heapIndex, heap_budget_t& outBudget) const;
+
+            // Host access. The block of an allocation is mapped once and reference counted, map() returns the
+            // block mapping plus the offset of the allocation. Blocks whose count drops to 0 are unmapped by the
+            // next flushMappedRanges, so map/unmap pairs within a frame cost no device calls.
+            void* map(allocation_t const& allocation);  // nullptr when the memory is not host visible
+            void  unmap(allocation_t const& allocation);
+
+            // Record a range of an allocation that the host wrote (flush) or is about to read (invalidate), only
+            // for memory types that are not host coherent. Ranges are relative to the allocation.
+            void flush(allocation_t const& allocation, u64 offset = 0, u64 size = WHOLE_SIZE);
+            void invalidate(allocation_t const& allocation, u64 offset = 0, u64 size = WHOLE_SIZE);
+
+            // Once a frame: the recorded ranges are rounded to nonCoherentAtomSize, merged and handed to the device
+            // in one flush call and one invalidate call per device memory. Returns the number of device calls.
+            u32 flushMappedRanges();
+
+            memory_properties_t const& getMemoryProperties() const;
+
+            struct context_t;
+
+        private:
+            context_t* m_context;
+        };
+
+    }  // namespace nvkmem
 };  // namespace ncore
 
 #endif
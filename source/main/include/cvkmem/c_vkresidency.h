@@ -0,0 +1,122 @@
+#ifndef __CVKMEM_RESIDENCY_H_
+#define __CVKMEM_RESIDENCY_H_
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "cvkmem/c_vkmem.h"
+
+namespace ncore
+{
+    namespace nvkmem
+    {
+        typedef u32                 resident_t;
+        static constexpr resident_t INVALID_RESIDENT = 0xffffffff;
+
+        // Eviction order, the lowest priority goes first and least recently used first within a priority
+        static constexpr u32 RESIDENCY_PRIORITY_LOW    = 0;
+        static constexpr u32 RESIDENCY_PRIORITY_NORMAL = 1;
+        static constexpr u32 RESIDENCY_PRIORITY_HIGH   = 2;
+        static constexpr u32 NUM_RESIDENCY_PRIORITIES  = 3;
+
+        static constexpr u32 RESIDENCY_FLAG_EVICTABLE = 0x1;  // May lose its memory, the owner streams it back in
+        static constexpr u32 RESIDENCY_FLAG_DEMOTABLE = 0x2;  // May move to the fallback memory of another heap
+
+        static constexpr u32 RESIDENCY_STATE_RESIDENT = 0;  // In memory of the type it asked for
+        static constexpr u32 RESIDENCY_STATE_DEMOTED  = 1;  // In fallback memory
+        static constexpr u32 RESIDENCY_STATE_EVICTED  = 2;  // Without memory
+
+        struct residency_desc_t
+        {
+            memory_requirements_t requirements;
+            u32                   requiredFlags  = 0;
+            u32                   preferredFlags = 0;
+            u32                   usage          = MEMORY_USAGE_GPU_ONLY;
+            u32                   resource       = 0;  // nalloc::RESOURCE_*
+            u32                   priority       = RESIDENCY_PRIORITY_NORMAL;
+            u32                   flags          = RESIDENCY_FLAG_EVICTABLE;
+            void*                 userData       = nullptr;
+        };
+
+        struct residency_config_t
+        {
+            u32 framesInFlight = 2;                             // Resources used in the most recent frames are left alone
+            u32 evictPercent   = 95;                            // A heap is relieved once its usage passes this percentage of its budget
+            u32 targetPercent  = 90;                            // and until its usage is below this percentage
+            u32 fallbackFlags  = MEMORY_PROPERTY_HOST_VISIBLE;  // Required flags of the memory that resources are demoted to
+        };
+
+        struct residency_stats_t
+        {
+            u32 residentCount  = 0;
+            u32 demotedCount   = 0;
+            u32 evictedCount   = 0;
+            u32 totalEvictions = 0;
+            u32 totalDemotions = 0;
+            u64 residentBytes  = 0;
+            u64 demotedBytes   = 0;
+        };
+
+        // Told about every resource that loses or moves its memory, before the old memory is freed. The owner
+        // rebinds the resource, copies its content for a move and stops using the old memory.
+        class residency_listener_t
+        {
+        public:
+            void onEvicted(resident_t resident, allocation_t const& allocation, void* userData) { v_onEvicted(resident, allocation, userData); }
+            void onMoved(resident_t resident, allocation_t const& from, allocation_t const& to, void* userData) { v_onMoved(resident, from, to, userData); }
+
+        protected:
+            virtual ~residency_listener_t() {}
+
+            virtual void v_onEvicted(resident_t resident, allocation_t const& allocation, void* userData)               = 0;
+            virtual void v_onMoved(resident_t resident, allocation_t const& from, allocation_t const& to, void* userData) = 0;
+        };
+
+        // Keeps the usage of every memory heap within its budget. Each resource owns an allocation of the memory
+        // manager and sits in a least recently used list of its priority. When the usage of a heap nears its
+        // budget the coldest resources of that heap are demoted to fallback memory of another heap or evicted,
+        // resources used in the last framesInFlight frames are left alone.
+        // Usage counts the memory of other processes and what the manager has handed out, free space in blocks is
+        // not counted since it is reused before new device memory is allocated.
+        // Not thread-safe.
+        class residency_manager_t
+        {
+        public:
+            residency_manager_t();
+            ~residency_manager_t();
+
+            void init(alloc_t* allocator, memory_manager_t* manager, residency_listener_t* listener, residency_config_t const& config = residency_config_t());
+            void destroy();  // Frees the memory of all resources
+
+            // Makes room in the heap first when the resource would push it beyond its budget.
+            // Returns INVALID_RESIDENT when out of memory.
+            resident_t add(residency_desc_t const& desc, u64 frame);
+            void       remove(resident_t resident);
+
+            void use(resident_t resident, u64 frame);  // Marks the resource as used in 'frame'
+            void setPriority(resident_t resident, u32 priority);
+
+            // Brings an evicted or demoted resource back into memory of the type it asked for. For a demoted
+            // resource the listener is told about the move. Returns false when out of memory.
+            bool restore(resident_t resident, u64 frame);
+
+            u32                 getState(resident_t resident) const;
+            allocation_t const& getAllocation(resident_t resident) const;  // Undefined for an evicted resource
+
+            // Once a frame: refreshes the budget of the manager and relieves every heap beyond evictPercent.
+            // Returns the number of resources evicted or demoted.
+            u32 update(u64 frame);
+
+            void getStats(residency_stats_t& outStats) const;
+
+            struct context_t;
+
+        private:
+            context_t* m_context;
+        };
+
+    }  // namespace nvkmem
+}  // namespace ncore
+
+#endif  // __CVKMEM_RESIDENCY_H_
@@ -0,0 +1,73 @@
+#ifndef __CVKMEM_RING_ALLOCATOR_H_
+#define __CVKMEM_RING_ALLOCATOR_H_
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "cvkmem/c_vkmem.h"
+
+namespace ncore
+{
+    namespace nvkmem
+    {
+        struct ring_config_t
+        {
+            u64 size           = 64 * 1024 * 1024;  // Size of the ring, allocated from the memory manager at init
+            u64 maxAlignment   = 256;               // Largest alignment served from the ring, larger requests fall back
+            u32 memoryTypeBits = 0xffffffff;
+            u32 requiredFlags  = MEMORY_PROPERTY_HOST_VISIBLE;
+            u32 preferredFlags = 0;
+            u32 usage          = MEMORY_USAGE_CPU_TO_GPU;
+        };
+
+        struct ring_stats_t
+        {
+            u64 bytesInFlight      = 0;  // Ring bytes not yet reclaimed, including wrap padding
+            u32 pendingSubmits     = 0;
+            u32 fallbackCount      = 0;  // Live fallback allocations
+            u32 totalFallbacks     = 0;
+            u64 totalFallbackBytes = 0;
+        };
+
+        // Linear sub-allocator for transient memory (uploads, constants, per-draw scratch) that lives for one
+        // to a few frames. Allocation is a single compare-and-swap on the ring head and allocations are never
+        // freed individually. submit() tags everything allocated since the previous submit with a timeline
+        // value, reclaim() hands back the ring segment of every submit up to a completed value at once.
+        // An allocation that does not fit before the end of the ring continues at the start of the ring, when
+        // the ring is full it falls back to the memory manager and is freed by the reclaim of its submit.
+        // allocate() may be called from any thread, submit() and reclaim() from one thread at a time. Fallbacks
+        // call the memory manager under a lock of the ring, nothing else may use the manager concurrently.
+        class ring_allocator_t
+        {
+        public:
+            static constexpr u32 MAX_PENDING_SUBMITS = 64;  // Beyond this submits are merged into the most recent one
+
+            ring_allocator_t();
+            ~ring_allocator_t();
+
+            // Returns false when the ring memory could not be allocated
+            bool init(alloc_t* allocator, memory_manager_t* manager, ring_config_t const& config = ring_config_t());
+            void destroy();  // Frees all fallback allocations, the GPU must be done with all of them
+
+            // 'alignment' must be a power of 2, returns false only when the fallback is out of memory as well.
+            // A size of 0 returns an empty allocation at the start of the ring.
+            bool allocate(u64 size, u64 alignment, allocation_t& outAllocation);
+
+            // Tag all allocations made since the previous submit with a monotonically increasing timeline value
+            void submit(u64 timelineValue);
+            void reclaim(u64 completedValue);
+
+            void                getStats(ring_stats_t& outStats) const;
+            allocation_t const& getMemory() const;  // The ring, to map it once for all of its allocations
+
+            struct context_t;
+
+        private:
+            context_t* m_context;
+        };
+
+    }  // namespace nvkmem
+}  // namespace ncore
+
+#endif  // __CVKMEM_RING_ALLOCATOR_H_
@@ -0,0 +1,104 @@
+#ifndef __CVKMEM_SPARSE_ALLOCATOR_H_
+#define __CVKMEM_SPARSE_ALLOCATOR_H_
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "cvkmem/c_vkmem.h"
+
+namespace ncore
+{
+    namespace nvkmem
+    {
+        struct sparse_config_t
+        {
+            u64 virtualSize    = 64ull * 1024 * 1024 * 1024;  // Address space to reserve ranges from, at most 2^32 pages
+            u64 pageSize       = 65536;                       // Sparse block size of the resources, a power of 2
+            u64 chunkSize      = 64 * 1024 * 1024;            // Physical pages are drawn from chunks of this size
+            u32 maxEmptyChunks = 1;                           // Empty chunks kept before chunks go back to the manager
+            u32 memoryTypeBits = 0xffffffff;
+            u32 requiredFlags  = 0;
+            u32 preferredFlags = 0;
+            u32 usage          = MEMORY_USAGE_GPU_ONLY;
+        };
+
+        struct sparse_stats_t
+        {
+            u32 rangeCount      = 0;
+            u32 chunkCount      = 0;
+            u32 emptyChunkCount = 0;
+            u32 dirtyPages      = 0;  // Pages whose binding changed since the last flush
+            u64 reservedBytes   = 0;
+            u64 committedBytes  = 0;
+            u64 chunkBytes      = 0;
+        };
+
+        // Mirrors VkSparseMemoryBind, a 'memory' of NULL_MEMORY unbinds the range
+        struct sparse_bind_t
+        {
+            u64             resourceOffset;  // Offset in the virtual address space
+            u64             size;
+            device_memory_t memory;
+            u64             memoryOffset;
+        };
+
+        // All binds of one flush, ordered by resourceOffset and without overlap, ready for a single
+        // vkQueueBindSparse submission. Valid until the next flush.
+        struct sparse_bind_batch_t
+        {
+            sparse_bind_t const* binds;
+            u32                  numBinds;
+        };
+
+        typedef u32                      virtual_range_t;
+        static constexpr virtual_range_t INVALID_RANGE = 0xffffffff;
+
+        // Virtual memory for sparse resources (virtual textures, terrain, huge buffers). Ranges of a virtual
+        // address space are reserved up front and physical pages are committed to them on demand. The virtual
+        // address space is a block allocator in units of pages, a two-level page table maps every virtual page
+        // to a page of a physical chunk, and the chunks are allocated from the memory manager and cut into pages
+        // by a page allocator. Commit and decommit only update the page table, flush() turns every page that
+        // changed since the previous flush into binds, merging neighbours that are contiguous in memory as well.
+        // Decommitted pages are reused right away, the GPU must be done with them before decommit() is called.
+        // Not thread-safe.
+        class sparse_allocator_t
+        {
+        public:
+            static constexpr u32 LEAF_PAGES = 1024;  // Virtual pages per page table leaf
+
+            sparse_allocator_t();
+            ~sparse_allocator_t();
+
+            void init(alloc_t* allocator, memory_manager_t* manager, sparse_config_t const& config = sparse_config_t());
+            void destroy();  // Returns all chunks to the manager, binds that were not flushed are dropped
+
+            // Sizes are rounded up to whole pages and 'alignment' (a power of 2) to at least a page.
+            // Returns INVALID_RANGE when the address space is exhausted.
+            virtual_range_t reserve(u64 size, u64 alignment = 0);
+            void            release(virtual_range_t range);          // Decommits all pages of the range
+            u64             getOffset(virtual_range_t range) const;  // Offset of the range in the virtual address space
+            u64             getSize(virtual_range_t range) const;
+
+            // 'offset' and 'size' are relative to the range and widened to whole pages, committed pages are skipped.
+            // Returns false when out of device memory, pages committed up to that point stay committed.
+            bool commit(virtual_range_t range, u64 offset, u64 size);
+            void decommit(virtual_range_t range, u64 offset, u64 size);
+            bool isCommitted(virtual_range_t range, u64 offset) const;
+
+            // Describes the binds of all pages committed or decommitted since the previous flush and returns
+            // their number. Empty chunks beyond maxEmptyChunks are returned to the manager afterwards.
+            u32 flush(sparse_bind_batch_t& outBatch);
+
+            void getStats(sparse_stats_t& outStats) const;
+
+            struct context_t;
+
+        private:
+            context_t* m_context;
+        };
+
+    }  // namespace nvkmem
+}  // namespace ncore
+
+#endif  // __CVKMEM_SPARSE_ALLOCATOR_H_
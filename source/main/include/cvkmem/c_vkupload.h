@@ -0,0 +1,92 @@
+#ifndef __CVKMEM_UPLOAD_H_
+#define __CVKMEM_UPLOAD_H_
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "cvkmem/c_vkmem.h"
+#include "cvkmem/c_vkringallocator.h"
+
+namespace ncore
+{
+    namespace nvkmem
+    {
+        // Offsets are in device memory, a backend translates them to the offsets of the buffers bound to it
+        struct copy_region_t
+        {
+            u64 srcOffset;
+            u64 dstOffset;
+            u64 size;
+        };
+
+        // One copy command, regions [firstRegion, firstRegion + numRegions) of the batch
+        struct upload_copy_t
+        {
+            device_memory_t srcMemory;
+            device_memory_t dstMemory;
+            u32             firstRegion;
+            u32             numRegions;
+        };
+
+        // Copies ordered by destination memory, regions ordered by destination offset
+        struct upload_batch_t
+        {
+            upload_copy_t const* copies;
+            u32                  numCopies;
+            copy_region_t const* regions;
+            u32                  numRegions;
+        };
+
+        struct upload_stats_t
+        {
+            u64 bytesInFlight = 0;  // Staging bytes not yet reclaimed, including the batch being filled
+            u32 pendingCount  = 0;  // Uploads of the batch being filled
+            u64 totalUploads  = 0;
+            u64 totalBytes    = 0;
+            u32 totalBatches  = 0;
+            u64 totalRegions  = 0;  // After merging, what the copy commands carry
+            u32 totalCopies   = 0;
+        };
+
+        // Packs CPU to GPU uploads into a staging ring. reserve() places an upload at the next offset of the
+        // ring that satisfies its alignment, so the uploads of a batch sit back to back in the staging memory
+        // which is mapped once for the lifetime of the stage. submit() sorts the uploads by destination, merges
+        // uploads that are contiguous in both staging and destination memory into one region and emits one
+        // copy per (staging, destination) memory pair.
+        // The staging memory of a batch stays in flight until reclaim() is given its timeline value, meanwhile
+        // the next batch is filled from the rest of the ring. Destination ranges of one batch must not overlap.
+        // Not thread-safe, submit() flushes the mapped ranges of the memory manager.
+        class upload_stage_t
+        {
+        public:
+            upload_stage_t();
+            ~upload_stage_t();
+
+            // False when the staging ring could not be allocated or is not host visible
+            bool init(alloc_t* allocator, memory_manager_t* manager, ring_config_t const& staging = ring_config_t());
+            void destroy();  // The GPU must be done with all submitted batches
+
+            // Returns where to write 'size' bytes for 'destination' at 'dstOffset', staging offsets are aligned to
+            // 'alignment' (a power of 2, the texel block size or optimalBufferCopyOffsetAlignment for images).
+            // nullptr when out of staging memory.
+            void* reserve(allocation_t const& destination, u64 dstOffset, u64 size, u64 alignment = 4);
+            bool  upload(allocation_t const& destination, u64 dstOffset, void const* data, u64 size, u64 alignment = 4);
+
+            // Closes the batch and tags its staging memory with 'timelineValue', 'outBatch' is valid until the
+            // next submit(). Record the copies into a command buffer that signals 'timelineValue'.
+            void submit(u64 timelineValue, upload_batch_t& outBatch);
+            void reclaim(u64 completedValue);
+
+            void getStats(upload_stats_t& outStats) const;
+
+            struct context_t;
+
+        private:
+            context_t* m_context;
+        };
+
+    }  // namespace nvkmem
+}  // namespace ncore
+
+#endif  // __CVKMEM_UPLOAD_H_
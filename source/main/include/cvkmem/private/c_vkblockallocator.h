@@ -7,56 +7,197 @@
 
 namespace ncore
 {
+    class alloc_t;
+
     namespace nalloc
     {
-        static constexpr u32 NUM_TOP_BINS  = 32;
-        static constexpr u32 BINS_PER_LEAF = 8;
-        static constexpr u32 NUM_LEAF_BINS = NUM_TOP_BINS * BINS_PER_LEAF;
+        class trace_recorder_t;
+
+        // Resource tags, used to keep linear resources (buffers, linear images) and optimally
+        // tiled images from sharing a bufferImageGranularity page.
+        static constexpr u32 RESOURCE_ANY     = 0;  // No granularity constraint
+        static constexpr u32 RESOURCE_LINEAR  = 1;  // Buffers and linear tiled images
+        static constexpr u32 RESOURCE_OPTIMAL = 2;  // Optimal tiled images
+
+        // Placement policies, which free node of the selected bin an allocation is taken from.
+        // The ordered policies keep every bin sorted with a search tree per bin, a node enters or leaves its
+        // bin in O(log n) of the bin size at the cost of three more indices per node.
+        static constexpr u32 PLACEMENT_FAST           = 0;  // Most recently freed node of the bin (LIFO)
+        static constexpr u32 PLACEMENT_LOWEST_ADDRESS = 1;  // Lowest offset in the bin, packs the heap towards its start
+        static constexpr u32 PLACEMENT_BEST_FIT       = 2;  // Smallest node that fits, also searches the bin below
+
+        // Compact 32-bit allocation handle: node index in the low bits, generation in the high bits.
+        // The generation changes every time an allocation is freed, so a stale handle is rejected.
+        typedef u32               handle_t;
+        static constexpr handle_t INVALID_HANDLE = 0xffffffff;
 
-        struct allocation_t
+        template <typename TOffset>
+        struct allocation_T
         {
-            static constexpr u32 NO_SPACE = 0xffffffff;
+            static constexpr TOffset NO_SPACE = (TOffset)~(TOffset)0;
 
-            const u32 offset;
-            const u32 size;
+            const TOffset offset;
+            const TOffset size;
+        };
+
+        // A planned defragmentation move, copy 'size' bytes from srcOffset to dstOffset
+        template <typename TOffset>
+        struct defrag_move_T
+        {
+            handle_t handle;  // The allocation that moves, it keeps its handle
+            handle_t target;  // Reserved destination, internal to the allocator
+            TOffset  srcOffset;
+            TOffset  dstOffset;
+            TOffset  size;
         };
 
         struct storage_report_t
         {
-            u32 totalFreeSpace    = 0;
-            u32 largestFreeRegion = 0;
+            u64 totalFreeSpace    = 0;
+            u64 largestFreeRegion = 0;
             u32 numberOfBins      = 0;
             u32 numberOfUsedBins  = 0;
         };
 
         struct bin_report_t
         {
-            u32 size  = 0;
+            u64 size  = 0;
             u32 count = 0;
         };
 
-        class block_allocator_t
+        // Compile time configuration of a block allocator:
+        // - TIndex: node index type, u16 halves the node metadata but limits the pool to 32766 nodes, every
+        //   allocation and every free range takes a node
+        // - TMantissaBits: bins per power of 2 (1 << TMantissaBits), more bits give a tighter fragmentation bound
+        // - TOffset: u32 manages up to 4 GB, u64 manages heaps far beyond that
+        template <typename TIndex, u32 TMantissaBits, typename TOffset>
+        struct block_config_T
+        {
+            typedef TIndex  index_t;
+            typedef TOffset offset_t;
+
+            static constexpr u32 MANTISSA_BITS = TMantissaBits;
+            static constexpr u32 BINS_PER_LEAF = 1 << TMantissaBits;
+
+            // Handle bits used for the node index, the remaining bits hold the generation
+            static constexpr u32 HANDLE_INDEX_BITS = sizeof(TIndex) == 2 ? 16 : 24;
+
+            // One top bin per exponent, exponents run from 0 (denorms) up to the highest offset bit
+            static constexpr u32 NUM_TOP_BINS  = sizeof(TOffset) * 8 - TMantissaBits + 1;
+            static constexpr u32 NUM_LEAF_BINS = NUM_TOP_BINS * BINS_PER_LEAF;
+        };
+
+        // Offset allocator, explicitly instantiated (see c_vkblockallocator.cpp) for u16 and u32 indices,
+        // 3 and 4 mantissa bits and u32 and u64 offsets (u16 indices only with u32 offsets).
+        template <typename TConfig>
+        class block_allocator_T
         {
         public:
-            block_allocator_t();
-            block_allocator_t(block_allocator_t&& other);
-            ~block_allocator_t();
+            typedef TConfig                    config_t;
+            typedef typename TConfig::offset_t offset_t;
+            typedef typename TConfig::index_t  index_t;
+            typedef allocation_T<offset_t>     allocation_t;
+            typedef defrag_move_T<offset_t>    defrag_move_t;
 
-            // TODO Pass alloc_t* instead of having the block allocator use new/delete
-            void init(u32 size, u32 maxAllocs = 128 * 1024);
+            static constexpr u32 MANTISSA_BITS = TConfig::MANTISSA_BITS;
+            static constexpr u32 NUM_TOP_BINS  = TConfig::NUM_TOP_BINS;
+            static constexpr u32 BINS_PER_LEAF = TConfig::BINS_PER_LEAF;
+            static constexpr u32 NUM_LEAF_BINS = TConfig::NUM_LEAF_BINS;
+
+            block_allocator_T();
+            block_allocator_T(block_allocator_T&& other);
+            ~block_allocator_T();
+
+            // All metadata is allocated from 'allocator'. Node storage starts small and grows in chunks up to
+            // 'maxAllocs' nodes (clamped to what a handle can address), existing allocations stay valid.
+            // bufferImageGranularity must be a power of 2, a value of 1 disables linear/optimal separation
+            void init(alloc_t* allocator, offset_t size, u32 maxAllocs = 0xffffffff, offset_t bufferImageGranularity = 1, u32 placement = PLACEMENT_FAST);
             void destroy();
 
-            allocation_t* allocate(u32 size);
-            void          free(allocation_t* allocation);
-            void          storageReport(storage_report_t& report) const;
-            void          storageBinState(u32 binIndex, bin_report_t& binState) const;
+            // Resize the managed range, existing allocations are untouched.
+            // grow appends [size, newSize) as free space, merged with a free range at the end of the heap.
+            // shrinkToFit drops the free range at the end of the heap and returns the new size.
+            bool     grow(offset_t newSize);
+            offset_t shrinkToFit();
+            offset_t size() const;
+
+            // Alignment must be a power of 2, the leading padding is returned to the free bins.
+            // Allocations tagged RESOURCE_LINEAR and RESOURCE_OPTIMAL never share a bufferImageGranularity page.
+            // Returns INVALID_HANDLE when out of space.
+            handle_t allocateHandle(offset_t size, offset_t alignment = 1, u32 resource = RESOURCE_ANY);
+            bool     freeHandle(handle_t handle);  // Returns false for a stale or invalid handle
+            bool     isValid(handle_t handle) const;
+            offset_t getOffset(handle_t handle) const;
+            offset_t getSize(handle_t handle) const;
+
+            // Grow or shrink an allocation without moving it, by taking space from or giving space back to
+            // the free range that follows it. Returns false (and changes nothing) when that range is too small.
+            bool reallocate(handle_t handle, offset_t newSize);
+
+            // Batched variants, cheaper per item than the same number of single calls.
+            // allocateMany packs consecutive requests into a single free node where possible, the node is
+            // picked by the placement policy for the size of the upcoming requests. Failed entries receive
+            // INVALID_HANDLE and the number of successful allocations is returned.
+            // freeMany merges allocations that are adjacent in memory into a single free node, stale handles
+            // and duplicates are skipped. Returns the number of freed allocations, their total size goes to
+            // 'outFreedBytes'.
+            u32 allocateMany(offset_t const* sizes, u32 count, handle_t* outHandles, offset_t alignment = 1, u32 resource = RESOURCE_ANY);
+            u32 freeMany(handle_t const* handles, u32 count, offset_t* outFreedBytes = nullptr);
+
+            // allocation_t compatibility layer, the returned pointer stays valid until the allocation is freed
+            allocation_t*       allocate(offset_t size);
+            allocation_t*       allocate(offset_t size, offset_t alignment, u32 resource = RESOURCE_ANY);
+            void                free(allocation_t* allocation);
+            bool                reallocate(allocation_t* allocation, offset_t newSize);
+            handle_t            getHandle(allocation_t const* allocation) const;
+            allocation_t const* getAllocation(handle_t handle) const;
+
+            // Defragmentation, moves allocations into free space at lower offsets in budget-limited steps.
+            // defragPlan visits at most 'maxVisits' nodes and reserves the destination of at most 'maxMoves'
+            // moves of at most 'maxBytes' in total. After the copies have completed call defragCommit, or call
+            // defragCancel to drop the moves, either before the next defragPlan. A moved allocation keeps the
+            // alignment of its old offset, up to 'maxAlignment'. An allocation that is freed or reallocated before
+            // defragCommit is not moved. Returns false when a pass over the heap is done.
+            bool defragPlan(defrag_move_t* outMoves, u32 maxMoves, u32& outNumMoves, offset_t maxBytes, u32 maxVisits = 256, offset_t maxAlignment = 65536);
+            void defragCommit(defrag_move_t const* moves, u32 count);
+            void defragCancel(defrag_move_t const* moves, u32 count);
+
+            // Snapshot of the complete state (nodes, bins and freelist) as a versioned binary image, valid for a
+            // build with the same configuration and byte order. Restoring keeps every handle and offset valid,
+            // allocation_t pointers of the compatibility layer have to be fetched again with getAllocation.
+            // save returns the number of bytes written, or 0 when 'bufferSize' is smaller than saveSize().
+            // restore copies the node storage out of the image, restoreInPlace uses the image itself as node
+            // storage (e.g. a private file mapping) which must be writable, 8 byte aligned and outlive the allocator.
+            // Both take the place of init and return false for an image that does not match.
+            u32  saveSize() const;
+            u32  save(void* buffer, u32 bufferSize) const;
+            bool restore(alloc_t* allocator, void const* image, u32 imageSize);
+            bool restoreInPlace(alloc_t* allocator, void* image, u32 imageSize);
+
+            // Records every allocation, free, reallocation, grow and shrinkToFit into 'recorder' (see c_vktrace.h),
+            // nullptr stops recording. Attach it right after init so that a replay starts from the same heap.
+            // A trace has no events for moves or snapshots: setTrace returns false for an allocator that was
+            // restored or that has planned moves, and defragPlan plans no moves while recording.
+            bool setTrace(trace_recorder_t* recorder);
+
+            void storageReport(storage_report_t& report) const;
+            void storageBinState(u32 binIndex, bin_report_t& binState) const;
 
-            struct node_t;
             struct context_t;
 
         private:
             context_t* m_context;
         };
+
+        typedef block_config_T<u32, 3, u32> block_config_t;    // Default
+        typedef block_config_T<u16, 3, u32> block_config16_t;  // Small heaps (descriptors, constants), compact nodes
+        typedef block_config_T<u32, 3, u64> block_config64_t;  // Heaps beyond 4 GB
+
+        typedef block_allocator_T<block_config_t>   block_allocator_t;
+        typedef block_allocator_T<block_config16_t> block_allocator16_t;
+        typedef block_allocator_T<block_config64_t> block_allocator64_t;
+        typedef allocation_T<u32>                   allocation_t;
+        typedef allocation_T<u64>                   allocation64_t;
     }  // namespace nalloc
 }  // namespace ncore
 
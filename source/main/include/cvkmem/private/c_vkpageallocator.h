@@ -0,0 +1,77 @@
+#ifndef __CVKMEM_PAGE_ALLOCATOR_H_
+#define __CVKMEM_PAGE_ALLOCATOR_H_
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "cvkmem/private/c_vkblockallocator.h"
+
+namespace ncore
+{
+    class alloc_t;
+
+    namespace nalloc
+    {
+        // A run of pages of a scattered allocation, in bytes
+        template <typename TOffset>
+        struct page_run_T
+        {
+            TOffset offset;
+            TOffset size;
+        };
+
+        // Allocator for page granular heaps (sparse binding, 64 KB pages), an alternative engine to
+        // block_allocator_T with the same handle and report surface. Occupancy is a bitmap with one bit per
+        // page and a summary bitmap with one bit per 64 pages. Only the skip over fully free words, for runs
+        // longer than 64 pages, uses SSE2/AVX2 where available, runs inside a word and the report histogram
+        // are scalar bit scans. Sizes are rounded up to whole pages and the lowest fitting run is used.
+        // The page size must be a multiple of bufferImageGranularity, the resource tag is accepted for
+        // compatibility and has no effect.
+        template <typename TOffset>
+        class page_allocator_T
+        {
+        public:
+            typedef TOffset             offset_t;
+            typedef page_run_T<TOffset> page_run_t;
+
+            static constexpr u32 NUM_REPORT_BINS = 32;  // storageBinState bin b counts free runs of [2^b, 2^(b+1)) pages
+
+            page_allocator_T();
+            ~page_allocator_T();
+
+            // 'pageSize' must be a power of 2, a partial page at the end of 'size' is not used
+            void init(alloc_t* allocator, offset_t size, u32 maxAllocs = 0xffffffff, offset_t pageSize = 65536);
+            void destroy();
+
+            offset_t size() const;
+            offset_t pageSize() const;
+
+            // Contiguous allocation, 'alignment' must be a power of 2. Returns INVALID_HANDLE when out of space.
+            handle_t allocateHandle(offset_t size, offset_t alignment = 1, u32 resource = RESOURCE_ANY);
+
+            // Non-contiguous allocation of at most 'maxRuns' runs, lowest free pages first
+            handle_t allocateScattered(offset_t size, u32 maxRuns = 0xffffffff);
+
+            bool     freeHandle(handle_t handle);  // Returns false for a stale or invalid handle
+            bool     isValid(handle_t handle) const;
+            offset_t getOffset(handle_t handle) const;                                  // Offset of the first run
+            offset_t getSize(handle_t handle) const;                                    // Size of all runs together
+            u32      getRuns(handle_t handle, page_run_t* outRuns, u32 maxRuns) const;  // Returns the number of runs
+
+            // Both share a histogram of the free runs that is rebuilt once after the bitmap has changed
+            void storageReport(storage_report_t& report) const;
+            void storageBinState(u32 binIndex, bin_report_t& binState) const;
+
+            struct context_t;
+
+        private:
+            context_t* m_context;
+        };
+
+        typedef page_allocator_T<u32> page_allocator_t;
+        typedef page_allocator_T<u64> page_allocator64_t;
+    }  // namespace nalloc
+}  // namespace ncore
+
+#endif  // __CVKMEM_PAGE_ALLOCATOR_H_
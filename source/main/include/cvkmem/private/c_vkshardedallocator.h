@@ -0,0 +1,82 @@
+#ifndef __CVKMEM_SHARDED_ALLOCATOR_H_
+#define __CVKMEM_SHARDED_ALLOCATOR_H_
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "cvkmem/private/c_vkblockallocator.h"
+
+namespace ncore
+{
+    class alloc_t;
+
+    namespace nalloc
+    {
+        // Thread-safe front-end over block_allocator_T.
+        // The managed range is split into equally sized shards, each a block allocator behind its own lock.
+        // Every thread owns a cache_t that keeps recently freed small ranges in per size-class magazines,
+        // most small allocations and frees are served from the cache without taking any lock.
+        // An allocation never spans shards, so the largest allocation is limited to the shard size.
+        template <typename TConfig>
+        class sharded_allocator_T
+        {
+        public:
+            typedef TConfig                    config_t;
+            typedef typename TConfig::offset_t offset_t;
+
+            // Small requests are rounded up to a power of 2 size class and are naturally aligned,
+            // that way any cached range of a class can serve any request of that class.
+            static constexpr u32 MIN_CACHED_SHIFT = 6;   // 64 B
+            static constexpr u32 MAX_CACHED_SHIFT = 16;  // 64 KB
+            static constexpr u32 NUM_SIZE_CLASSES = MAX_CACHED_SHIFT - MIN_CACHED_SHIFT + 1;
+            static constexpr u32 MAGAZINE_SIZE    = 16;  // Cached ranges per size class and resource type
+            static constexpr u32 MAX_SHARDS       = 64;
+
+            struct allocation_t
+            {
+                offset_t offset;  // Offset in the full managed range
+                offset_t size;    // Reserved size, small requests are rounded up to their size class
+                u16      shard;
+                u16      resource;
+                handle_t handle;  // Handle in the block allocator of the shard
+            };
+
+            // Per-thread cache, it must only be used by the thread that owns it
+            struct cache_t;
+
+            sharded_allocator_T();
+            ~sharded_allocator_T();
+
+            // 'numShards' is typically the number of threads that allocate concurrently (at most MAX_SHARDS).
+            // Shards are aligned to at least 64 KB and bufferImageGranularity, alignments up to that are honoured.
+            void init(alloc_t* allocator, offset_t size, u32 numShards, u32 maxAllocsPerShard = 0xffffffff, offset_t bufferImageGranularity = 1);
+            void destroy();  // All caches must have been destroyed
+
+            cache_t* createCache();
+            void     destroyCache(cache_t* cache);  // Hands all cached ranges back to their shards
+            void     flush(cache_t* cache);         // Hands all cached ranges back to their shards
+
+            // 'cache' may be nullptr, in which case every call goes to a shard. Returns false when out of space,
+            // or when 'alignment' is larger than the shard alignment (64 KB or bufferImageGranularity).
+            bool allocate(cache_t* cache, offset_t size, offset_t alignment, u32 resource, allocation_t& outAllocation);
+            void free(cache_t* cache, allocation_t const& allocation);
+
+            offset_t shardSize() const;
+            u32      numShards() const;
+
+            // Locks each shard in turn, ranges held in caches are reported as used
+            void storageReport(storage_report_t& report) const;
+
+            struct context_t;
+
+        private:
+            context_t* m_context;
+        };
+
+        typedef sharded_allocator_T<block_config_t>   sharded_allocator_t;
+        typedef sharded_allocator_T<block_config64_t> sharded_allocator64_t;
+    }  // namespace nalloc
+}  // namespace ncore
+
+#endif  // __CVKMEM_SHARDED_ALLOCATOR_H_
@@ -0,0 +1,81 @@
+#ifndef __CVKMEM_SLAB_ALLOCATOR_H_
+#define __CVKMEM_SLAB_ALLOCATOR_H_
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "cvkmem/private/c_vkblockallocator.h"
+
+namespace ncore
+{
+    class alloc_t;
+
+    namespace nalloc
+    {
+        struct slab_stats_t
+        {
+            u32 numSlabs      = 0;
+            u32 numEmptySlabs = 0;
+            u32 numUsedSlots  = 0;
+            u64 slabBytes     = 0;  // Taken from the parent allocator
+            u64 usedBytes     = 0;  // Handed out in slots
+        };
+
+        // Fixed size-class pools on top of a block allocator, for many small uniform allocations
+        // (uniform blocks, meshlet chunks, texture tiles). Every slab is a single allocation of the parent
+        // that is cut into equally sized slots, a slot is found and released in O(1) through a two-level
+        // bitmap of the slab, so a slot costs one bit instead of a parent node. A slab that becomes empty
+        // goes back to the parent, except for one empty slab per size class that is kept for reuse.
+        // Slots are aligned to the largest power of 2 that divides their size class.
+        // A freed slot is rejected by the bitmap until it is handed out again. A handle also carries the
+        // generation of its slab, which is bumped each time the slab runs empty, so a handle into an emptied
+        // or recycled slab is rejected by free, getOffset and getSize until the generation wraps around.
+        template <typename TConfig>
+        class slab_allocator_T
+        {
+        public:
+            typedef TConfig                    config_t;
+            typedef typename TConfig::offset_t offset_t;
+            typedef block_allocator_T<TConfig> parent_t;
+
+            static constexpr u32 MAX_SIZE_CLASSES   = 16;
+            static constexpr u32 SLOT_BITS          = 12;  // Low bits of a slab handle
+            static constexpr u32 SLAB_BITS          = 12;  // Followed by the slab index
+            static constexpr u32 GENERATION_BITS    = 8;   // and the generation of the slab in the high bits
+            static constexpr u32 MAX_SLOTS_PER_SLAB = 1 << SLOT_BITS;
+            static constexpr u32 MAX_SLABS          = (1 << SLAB_BITS) - 1;  // No valid handle equals INVALID_HANDLE
+
+            slab_allocator_T();
+            ~slab_allocator_T();
+
+            // 'classSizes' must be ascending. A slab holds slabSize / classSize slots, at least 1 and at most
+            // MAX_SLOTS_PER_SLAB. All slabs are allocated from 'parent' with the 'resource' tag.
+            void init(alloc_t* allocator, parent_t* parent, offset_t const* classSizes, u32 numClasses, offset_t slabSize = 1024 * 1024, u32 resource = RESOURCE_ANY);
+            void destroy();  // Returns all slabs to the parent, outstanding handles become invalid
+
+            // allocate picks the smallest size class that fits, INVALID_HANDLE when no class fits or
+            // the parent is out of space
+            handle_t allocate(offset_t size);
+            handle_t allocateClass(u32 sizeClass);
+            bool     free(handle_t handle);             // Returns false for a slot that is not allocated or a stale handle
+            offset_t getOffset(handle_t handle) const;  // NO_SPACE for a stale handle
+            offset_t getSize(handle_t handle) const;    // Size of the size class, 0 for a stale handle
+            bool     isValid(handle_t handle) const;
+
+            u32  sizeClassOf(offset_t size) const;  // numClasses when no class fits
+            void trim();                            // Returns the empty slabs kept for reuse to the parent
+            void getStats(slab_stats_t& outStats) const;
+
+            struct context_t;
+
+        private:
+            context_t* m_context;
+        };
+
+        typedef slab_allocator_T<block_config_t>   slab_allocator_t;
+        typedef slab_allocator_T<block_config64_t> slab_allocator64_t;
+    }  // namespace nalloc
+}  // namespace ncore
+
+#endif  // __CVKMEM_SLAB_ALLOCATOR_H_
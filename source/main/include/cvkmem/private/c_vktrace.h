@@ -0,0 +1,244 @@
+#ifndef __CVKMEM_TRACE_H_
+#define __CVKMEM_TRACE_H_
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "cvkmem/private/c_vkblockallocator.h"
+
+namespace ncore
+{
+    class alloc_t;
+
+    namespace nalloc
+    {
+        static constexpr u32 TRACE_BEGIN      = 0;  // size: heap size, alignment: bufferImageGranularity, resource: placement
+        static constexpr u32 TRACE_ALLOCATE   = 1;  // size, alignment, resource, handle and offset (when successful)
+        static constexpr u32 TRACE_FREE       = 2;  // handle
+        static constexpr u32 TRACE_REALLOCATE = 3;  // handle and size (the new size)
+        static constexpr u32 TRACE_GROW       = 4;  // size: the new heap size
+        static constexpr u32 TRACE_SHRINK     = 5;  // size: the heap size after shrinkToFit
+        static constexpr u32 TRACE_BATCH      = 6;  // size: the number of allocate or free events that follow and form one allocateMany or freeMany
+
+        struct trace_event_t
+        {
+            u32      op;
+            u32      resource;
+            u32      thread;  // Small index handed out per thread in order of the first event of the thread
+            handle_t handle;
+            u64      time;  // Nanoseconds since the recorder was initialized
+            u64      size;
+            u64      alignment;
+            u64      offset;
+            bool     success;
+        };
+
+        // Receives the encoded trace in pieces of at most the buffer size of the recorder
+        class trace_sink_t
+        {
+        public:
+            void write(void const* data, u32 size) { v_write(data, size); }
+
+        protected:
+            virtual ~trace_sink_t() {}
+            virtual void v_write(void const* data, u32 size) = 0;
+        };
+
+        // Keeps the whole trace in one growing buffer, 8 byte aligned so that it can be handed to trace_reader_t
+        class trace_memory_sink_t : public trace_sink_t
+        {
+        public:
+            trace_memory_sink_t(alloc_t* allocator);
+            virtual ~trace_memory_sink_t();
+
+            u8 const* data() const { return (u8 const*)m_data; }
+            u32       size() const { return m_size; }
+
+        protected:
+            virtual void v_write(void const* data, u32 size);
+
+        private:
+            alloc_t* m_allocator;
+            u64*     m_data;
+            u32      m_size;
+            u32      m_capacity;
+        };
+
+        // Records the operations of a block allocator (see block_allocator_T::setTrace) as a stream of
+        // variable length events, most events take 4 to 12 bytes. Events are encoded into a buffer that is
+        // handed to the sink when it is full, at flush() and at destroy().
+        // Calls must be serialized the same way as the calls of the allocator it records.
+        class trace_recorder_t
+        {
+        public:
+            trace_recorder_t();
+            ~trace_recorder_t();
+
+            void init(alloc_t* allocator, trace_sink_t* sink, u32 bufferSize = 64 * 1024);
+            void destroy();  // Flushes
+            void flush();
+
+            void recordBegin(u64 size, u64 granularity, u32 placement);
+            void recordAllocate(u64 size, u64 alignment, u32 resource, handle_t handle, u64 offset);  // INVALID_HANDLE for a failed allocation
+            void recordFree(handle_t handle);
+            void recordBatch(u32 count);
+            void recordReallocate(handle_t handle, u64 newSize, bool success);
+            void recordGrow(u64 newSize, bool success);
+            void recordShrink(u64 newSize);
+
+            u64 eventCount() const;
+            u64 bytesWritten() const;  // Including what is still buffered
+
+            struct context_t;
+
+        private:
+            context_t* m_context;
+        };
+
+        // Decodes a complete trace held in memory (e.g. a mapped file)
+        class trace_reader_t
+        {
+        public:
+            trace_reader_t();
+
+            bool init(void const* data, u64 size);  // False when the data does not start with a trace header
+            bool next(trace_event_t& outEvent);     // False at the end of the trace or at a truncated event
+            bool corrupt() const { return m_corrupt; }
+            u64  remaining() const { return m_size - m_position; }
+
+        private:
+            u8 const* m_data;
+            u64       m_size;
+            u64       m_position;
+            u64       m_time;
+            u32       m_thread;
+            bool      m_corrupt;
+        };
+
+        // The allocator a trace is replayed into, handles are those of the engine
+        class trace_engine_t
+        {
+        public:
+            void     begin(u64 size, u64 granularity, u32 placement) { v_begin(size, granularity, placement); }
+            handle_t allocate(u64 size, u64 alignment, u32 resource, u64& outOffset) { return v_allocate(size, alignment, resource, outOffset); }
+            bool     free(handle_t handle) { return v_free(handle); }
+            bool     reallocate(handle_t handle, u64 newSize) { return v_reallocate(handle, newSize); }
+            bool     grow(u64 newSize) { return v_grow(newSize); }
+            u64      shrinkToFit() { return v_shrinkToFit(); }
+            u32      allocateMany(u64 const* sizes, u32 count, u32 resource, handle_t* outHandles, u64* outOffsets) { return v_allocateMany(sizes, count, resource, outHandles, outOffsets); }
+            u32      freeMany(handle_t const* handles, u32 count) { return v_freeMany(handles, count); }
+            void     storageReport(storage_report_t& report) const { v_storageReport(report); }
+
+        protected:
+            virtual ~trace_engine_t() {}
+
+            virtual void     v_begin(u64 size, u64 granularity, u32 placement)                                                = 0;
+            virtual handle_t v_allocate(u64 size, u64 alignment, u32 resource, u64& outOffset)                                = 0;
+            virtual bool     v_free(handle_t handle)                                                                          = 0;
+            virtual bool     v_reallocate(handle_t handle, u64 newSize)                                                       = 0;
+            virtual bool     v_grow(u64 newSize)                                                                              = 0;
+            virtual u64      v_shrinkToFit()                                                                                  = 0;
+            virtual u32      v_allocateMany(u64 const* sizes, u32 count, u32 resource, handle_t* outHandles, u64* outOffsets) = 0;
+            virtual u32      v_freeMany(handle_t const* handles, u32 count)                                                   = 0;
+            virtual void     v_storageReport(storage_report_t& report) const                                                  = 0;
+        };
+
+        // Replays into a block allocator of configuration TConfig, the heap size and granularity come from the
+        // trace. A placement policy other than PLACEMENT_KEEP overrides the placement of the trace, so that
+        // policies can be compared on the same workload.
+        template <typename TConfig>
+        class block_trace_engine_T : public trace_engine_t
+        {
+        public:
+            static constexpr u32 PLACEMENT_KEEP = 0xffffffff;
+
+            block_trace_engine_T(alloc_t* allocator, u32 placement = PLACEMENT_KEEP, u32 maxAllocs = 0xffffffff);
+            virtual ~block_trace_engine_T();
+
+        protected:
+            virtual void     v_begin(u64 size, u64 granularity, u32 placement);
+            virtual handle_t v_allocate(u64 size, u64 alignment, u32 resource, u64& outOffset);
+            virtual bool     v_free(handle_t handle);
+            virtual bool     v_reallocate(handle_t handle, u64 newSize);
+            virtual bool     v_grow(u64 newSize);
+            virtual u64      v_shrinkToFit();
+            virtual u32      v_allocateMany(u64 const* sizes, u32 count, u32 resource, handle_t* outHandles, u64* outOffsets);
+            virtual u32      v_freeMany(handle_t const* handles, u32 count);
+            virtual void     v_storageReport(storage_report_t& report) const;
+
+        private:
+            alloc_t*                    m_allocator;
+            u32                         m_placement;
+            u32                         m_maxAllocs;
+            bool                        m_initialized;
+            block_allocator_T<TConfig>  m_engine;
+            typename TConfig::offset_t* m_sizes;  // allocateMany argument
+            u32                         m_maxSizes;
+        };
+
+        struct trace_op_stats_t
+        {
+            u64 count    = 0;
+            u64 failures = 0;
+            u64 totalNs  = 0;
+            u64 maxNs    = 0;
+        };
+
+        struct trace_report_t
+        {
+            trace_op_stats_t allocate;
+            trace_op_stats_t free;
+            trace_op_stats_t reallocate;
+            u64              events         = 0;
+            u64              unknownHandles = 0;  // Frees and reallocations of handles the replay never handed out
+            u64              divergences    = 0;  // Allocations and reallocations whose outcome or offset differs from the trace
+            u64              peakUsedBytes  = 0;  // Highest usedBytes of the samples
+            u64              duration       = 0;  // Nanoseconds between the first and the last event of the trace
+        };
+
+        // Fragmentation over time, 1 - largestFreeRegion / freeBytes
+        struct trace_sample_t
+        {
+            u64 event;  // Index of the event after which the sample was taken
+            u64 time;   // Trace time of that event
+            u64 usedBytes;
+            u64 freeBytes;
+            u64 largestFreeRegion;
+            u32 liveAllocations;
+        };
+
+        // Feeds a trace into an engine in recorded order and times every operation. Handles of the trace are
+        // mapped to the handles of the engine, an engine with the configuration and placement of the recorded
+        // allocator reproduces its offsets exactly and reports no divergences.
+        // Defragmentation moves and restored snapshots are not part of a trace (see block_allocator_T::setTrace).
+        class trace_replayer_t
+        {
+        public:
+            trace_replayer_t();
+            ~trace_replayer_t();
+
+            void init(alloc_t* allocator);
+            void destroy();
+
+            // Takes a fragmentation sample every 'sampleInterval' events and after the last one.
+            // Returns false when the trace is corrupt or does not start with a begin event, the report covers the
+            // events replayed before that.
+            bool replay(void const* trace, u64 traceSize, trace_engine_t* engine, u32 sampleInterval = 1024);
+
+            void getReport(trace_report_t& outReport) const;
+            u32  getSamples(trace_sample_t const*& outSamples) const;  // Valid until the next replay()
+
+            struct context_t;
+
+        private:
+            context_t* m_context;
+        };
+
+        typedef block_trace_engine_T<block_config_t>   block_trace_engine_t;
+        typedef block_trace_engine_T<block_config16_t> block_trace_engine16_t;
+        typedef block_trace_engine_T<block_config64_t> block_trace_engine64_t;
+    }  // namespace nalloc
+}  // namespace ncore
+
+#endif  // __CVKMEM_TRACE_H_
@@ -0,0 +1,265 @@
+#include "ccore/c_target.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/c_vkaliasplanner.h"
+#include "cvkmem/private/c_vkblockallocator.h"
+
+#include "cunittest/cunittest.h"
+#include "csuperalloc/test_allocator.h"
+
+using namespace ncore;
+using namespace ncore::nvkmem;
+
+UNITTEST_SUITE_BEGIN(alias_planner)
+{
+    UNITTEST_FIXTURE(main)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        static transient_resource_t sResource(u64 size, u32 firstPass, u32 lastPass, u32 resource = nalloc::RESOURCE_ANY, u64 alignment = 256)
+        {
+            transient_resource_t r;
+            r.size      = size;
+            r.alignment = alignment;
+            r.firstPass = firstPass;
+            r.lastPass  = lastPass;
+            r.resource  = resource;
+            return r;
+        }
+
+        static bool sHasBarrier(alias_planner_t const& planner, u32 before, u32 after, u32 pass)
+        {
+            alias_barrier_t const* barriers;
+            u32 const              count = planner.getBarriers(barriers);
+            for (u32 i = 0; i < count; ++i)
+            {
+                if (barriers[i].before == before && barriers[i].after == after && barriers[i].pass == pass)
+                    return true;
+            }
+            return false;
+        }
+
+        UNITTEST_TEST(overlapping_lifetimes)
+        {
+            alias_planner_t planner;
+            planner.init(Allocator);
+
+            // Everything is alive at pass 1, nothing is shared
+            transient_resource_t const resources[] = {sResource(1024, 0, 1), sResource(4096, 1, 2), sResource(512, 1, 1)};
+            CHECK_EQUAL(1024 + 4096 + 512, planner.plan(resources, 3));
+            CHECK_EQUAL(0, planner.getOffset(1));
+            CHECK_EQUAL(4096, planner.getOffset(0));
+            CHECK_EQUAL(4096 + 1024, planner.getOffset(2));
+
+            alias_barrier_t const* barriers;
+            CHECK_EQUAL(0, planner.getBarriers(barriers));
+
+            planner.destroy();
+        }
+
+        UNITTEST_TEST(sequential_lifetimes)
+        {
+            alias_planner_t planner;
+            planner.init(Allocator);
+
+            transient_resource_t const resources[] = {sResource(2048, 0, 1), sResource(2048, 2, 3)};
+            CHECK_EQUAL(2048, planner.plan(resources, 2));
+            CHECK_EQUAL(0, planner.getOffset(0));
+            CHECK_EQUAL(0, planner.getOffset(1));
+
+            alias_barrier_t const* barriers;
+            CHECK_EQUAL(1, planner.getBarriers(barriers));
+            CHECK_TRUE(sHasBarrier(planner, 0, 1, 2));
+
+            alias_stats_t stats;
+            planner.getStats(stats);
+            CHECK_EQUAL(2048, stats.heapSize);
+            CHECK_EQUAL(4096, stats.unaliasedSize);
+            CHECK_EQUAL(1, stats.numBarriers);
+
+            planner.destroy();
+        }
+
+        UNITTEST_TEST(covered_barriers)
+        {
+            alias_planner_t planner;
+            planner.init(Allocator);
+
+            // B takes over part of A, C takes over all of A and B. A needs no barrier before C where B covered
+            // their common memory, it does where B did not.
+            transient_resource_t const resources[] = {sResource(2048, 0, 0), sResource(1024, 1, 1), sResource(2048, 2, 2), sResource(1024, 3, 3)};
+            CHECK_EQUAL(2048, planner.plan(resources, 4));
+
+            alias_barrier_t const* barriers;
+            u32 const              count = planner.getBarriers(barriers);
+            CHECK_TRUE(sHasBarrier(planner, 0, 1, 1));
+            CHECK_TRUE(sHasBarrier(planner, 0, 2, 2));
+            CHECK_TRUE(sHasBarrier(planner, 1, 2, 2));
+            CHECK_TRUE(sHasBarrier(planner, 2, 3, 3));
+            CHECK_FALSE(sHasBarrier(planner, 0, 3, 3));
+            CHECK_FALSE(sHasBarrier(planner, 1, 3, 3));
+            CHECK_EQUAL(4, count);
+
+            // Ordered by pass
+            u32 unordered = 0;
+            for (u32 i = 1; i < count; ++i)
+                unordered += barriers[i - 1].pass > barriers[i].pass ? 1 : 0;
+            CHECK_EQUAL(0, unordered);
+
+            planner.destroy();
+        }
+
+        UNITTEST_TEST(granularity)
+        {
+            alias_planner_t planner;
+            planner.init(Allocator, 1024);
+
+            // A buffer and an image alive at the same time do not share a granularity page
+            transient_resource_t const resources[] = {sResource(100, 0, 1, nalloc::RESOURCE_LINEAR), sResource(100, 0, 1, nalloc::RESOURCE_OPTIMAL), sResource(100, 0, 1, nalloc::RESOURCE_LINEAR)};
+            planner.plan(resources, 3);
+            CHECK_EQUAL(0, planner.getOffset(0));
+            CHECK_EQUAL(1024, planner.getOffset(1));
+            CHECK_EQUAL(256, planner.getOffset(2));
+
+            // At different times they do
+            transient_resource_t const sequential[] = {sResource(100, 0, 0, nalloc::RESOURCE_LINEAR), sResource(100, 1, 1, nalloc::RESOURCE_OPTIMAL)};
+            planner.invalidate();
+            CHECK_EQUAL(100, planner.plan(sequential, 2));
+            CHECK_EQUAL(0, planner.getOffset(1));
+
+            planner.destroy();
+        }
+
+        UNITTEST_TEST(cached_and_incremental)
+        {
+            alias_planner_t planner;
+            planner.init(Allocator);
+
+            transient_resource_t resources[8];
+            for (u32 i = 0; i < 8; ++i)
+                resources[i] = sResource(1024 * (i + 1), i, i + 1);
+            u64 const heapSize = planner.plan(resources, 8);
+            u64       offsets[8];
+            for (u32 i = 0; i < 8; ++i)
+                offsets[i] = planner.getOffset(i);
+
+            alias_stats_t stats;
+            CHECK_EQUAL(heapSize, planner.plan(resources, 8));
+            planner.getStats(stats);
+            CHECK_EQUAL(1, stats.fullPlans);
+            CHECK_EQUAL(1, stats.cachedPlans);
+            CHECK_EQUAL(0, stats.numPlaced);
+
+            // One changed resource is placed again, the others stay
+            resources[3].size = 512;
+            planner.plan(resources, 8);
+            planner.getStats(stats);
+            CHECK_EQUAL(1, stats.incrementalPlans);
+            CHECK_EQUAL(1, stats.numPlaced);
+            u32 moved = 0;
+            for (u32 i = 0; i < 8; ++i)
+                moved += (i != 3 && planner.getOffset(i) != offsets[i]) ? 1 : 0;
+            CHECK_EQUAL(0, moved);
+
+            // More than a quarter changed
+            for (u32 i = 0; i < 3; ++i)
+                resources[i].lastPass = 7;
+            planner.plan(resources, 8);
+            planner.getStats(stats);
+            CHECK_EQUAL(2, stats.fullPlans);
+            CHECK_EQUAL(8, stats.numPlaced);
+
+            planner.destroy();
+        }
+
+        static u32 sRandom(u32& state)
+        {
+            state = state * 1664525u + 1013904223u;
+            return state >> 8;
+        }
+
+        // Resources alive at the same time never share memory, and every piece of memory a resource takes over
+        // has a barrier against its previous owner
+        UNITTEST_TEST(random_plans)
+        {
+            alias_planner_t planner;
+            planner.init(Allocator, 1024);
+
+            u32 const            count = 48;
+            transient_resource_t resources[count];
+            u32                  state    = 777;
+            u32                  overlaps = 0;
+            u32                  missing  = 0;
+            u32                  wrong    = 0;
+            for (u32 round = 0; round < 20; ++round)
+            {
+                for (u32 i = 0; i < count; ++i)
+                {
+                    if (round > 0 && (sRandom(state) % 8) != 0)
+                        continue;
+                    u32 const first = sRandom(state) % 16;
+                    resources[i]    = sResource(256 * (1 + sRandom(state) % 16), first, first + sRandom(state) % 4, sRandom(state) % 3, 256u << (sRandom(state) % 3));
+                }
+                planner.plan(resources, count);
+
+                for (u32 a = 0; a < count; ++a)
+                {
+                    u64 const aBegin = planner.getOffset(a);
+                    u64 const aEnd   = aBegin + resources[a].size;
+                    wrong += (aBegin % resources[a].alignment) != 0 ? 1 : 0;
+                    for (u32 b = a + 1; b < count; ++b)
+                    {
+                        bool const alive  = resources[a].firstPass <= resources[b].lastPass && resources[b].firstPass <= resources[a].lastPass;
+                        u64 const  bBegin = planner.getOffset(b);
+                        overlaps += (alive && aBegin < bBegin + resources[b].size && bBegin < aEnd) ? 1 : 0;
+
+                        // A buffer and an image do not share a 1 KB page
+                        bool const mixed = resources[a].resource != nalloc::RESOURCE_ANY && resources[b].resource != nalloc::RESOURCE_ANY && resources[a].resource != resources[b].resource;
+                        overlaps += (alive && mixed && aBegin / 1024 <= (bBegin + resources[b].size - 1) / 1024 && bBegin / 1024 <= (aEnd - 1) / 1024) ? 1 : 0;
+                    }
+                }
+
+                // The memory of a resource in 256 byte steps, the previous owner is the overlapping resource that
+                // ended last before it starts
+                for (u32 b = 0; b < count; ++b)
+                {
+                    for (u64 at = planner.getOffset(b); at < planner.getOffset(b) + resources[b].size; at += 256)
+                    {
+                        u32 owner = count;
+                        for (u32 a = 0; a < count; ++a)
+                        {
+                            if (resources[a].lastPass >= resources[b].firstPass || at < planner.getOffset(a) || at >= planner.getOffset(a) + resources[a].size)
+                                continue;
+                            if (owner == count || resources[a].lastPass > resources[owner].lastPass)
+                                owner = a;
+                        }
+                        if (owner != count && !sHasBarrier(planner, owner, b, resources[b].firstPass))
+                            missing++;
+                    }
+                }
+
+                alias_barrier_t const* barriers;
+                u32 const              numBarriers = planner.getBarriers(barriers);
+                for (u32 i = 0; i < numBarriers; ++i)
+                {
+                    transient_resource_t const& before = resources[barriers[i].before];
+                    transient_resource_t const& after  = resources[barriers[i].after];
+                    u64 const                   begin  = planner.getOffset(barriers[i].before);
+                    u64 const                   other  = planner.getOffset(barriers[i].after);
+                    bool const                  shared = begin < other + after.size && other < begin + before.size;
+                    wrong += (!shared || before.lastPass >= after.firstPass || barriers[i].pass != after.firstPass) ? 1 : 0;
+                    wrong += (i > 0 && barriers[i - 1].pass > barriers[i].pass) ? 1 : 0;
+                }
+            }
+            CHECK_EQUAL(0, overlaps);
+            CHECK_EQUAL(0, missing);
+            CHECK_EQUAL(0, wrong);
+
+            planner.destroy();
+        }
+    }
+}
+UNITTEST_SUITE_END
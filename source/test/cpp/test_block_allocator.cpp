@@ -0,0 +1,1404 @@
+#include "ccore/c_target.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/private/c_vkblockallocator.h"
+
+#include "cunittest/cunittest.h"
+#include "csuperalloc/test_allocator.h"
+
+#include <string.h>
+
+using namespace ncore;
+using namespace ncore::nalloc;
+
+UNITTEST_SUITE_BEGIN(block_allocator)
+{
+    UNITTEST_FIXTURE(aligned)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(alignment)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 1024 * 1024);
+
+            handle_t const a = block.allocateHandle(100);
+            CHECK_EQUAL(0, block.getOffset(a));
+
+            u32 const alignments[] = {16, 256, 4096, 65536};
+            for (u32 i = 0; i < 4; ++i)
+            {
+                handle_t const h = block.allocateHandle(100, alignments[i]);
+                CHECK_NOT_EQUAL(INVALID_HANDLE, h);
+                CHECK_EQUAL(0, block.getOffset(h) & (alignments[i] - 1));
+                CHECK_EQUAL(100, block.getSize(h));
+            }
+
+            // The leading padding went back to the bins, a small request fits in front of the 256 aligned one
+            handle_t const b = block.allocateHandle(40);
+            CHECK_TRUE(block.getOffset(b) < 256);
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(padding_is_reused)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 65536);
+
+            handle_t const a = block.allocateHandle(1);
+            handle_t const b = block.allocateHandle(1000, 4096);
+            CHECK_EQUAL(4096, block.getOffset(b));
+
+            storage_report_t report;
+            block.storageReport(report);
+            CHECK_EQUAL(65536 - 1 - 1000, report.totalFreeSpace);
+
+            // Freeing both merges the padding back into one range that spans the heap
+            CHECK_TRUE(block.freeHandle(b));
+            CHECK_TRUE(block.freeHandle(a));
+            block.storageReport(report);
+            CHECK_EQUAL(65536, report.totalFreeSpace);
+            CHECK_EQUAL(65536, report.largestFreeRegion);
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(granularity_separation)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 1024 * 1024, 0xffffffff, 1024);
+
+            // A linear and an optimal resource never share a 1 KB page
+            handle_t const linear  = block.allocateHandle(100, 1, RESOURCE_LINEAR);
+            handle_t const optimal = block.allocateHandle(100, 1, RESOURCE_OPTIMAL);
+            CHECK_EQUAL(0, block.getOffset(linear));
+            CHECK_EQUAL(1024, block.getOffset(optimal));
+
+            // Resources of the same type share the page
+            handle_t const optimal2 = block.allocateHandle(100, 1, RESOURCE_OPTIMAL);
+            CHECK_EQUAL(1124, block.getOffset(optimal2));
+
+            // The free space in front of the optimal page is only usable by linear resources
+            handle_t const linear2 = block.allocateHandle(100, 1, RESOURCE_LINEAR);
+            CHECK_EQUAL(100, block.getOffset(linear2));
+
+            // A linear resource after the optimal ones starts on the next page
+            block.freeHandle(linear2);
+            handle_t const big = block.allocateHandle(2000, 1, RESOURCE_LINEAR);
+            CHECK_EQUAL(2048, block.getOffset(big));
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(out_of_space)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 4096);
+
+            CHECK_EQUAL(INVALID_HANDLE, block.allocateHandle(4097));
+            handle_t const a = block.allocateHandle(1);
+            CHECK_EQUAL(INVALID_HANDLE, block.allocateHandle(4000, 8192));
+            handle_t const b = block.allocateHandle(4095 - 1024);
+            handle_t const c = block.allocateHandle(1024);
+            CHECK_NOT_EQUAL(INVALID_HANDLE, b);
+            CHECK_NOT_EQUAL(INVALID_HANDLE, c);
+            CHECK_EQUAL(INVALID_HANDLE, block.allocateHandle(1));
+            CHECK_TRUE(block.freeHandle(a));
+            CHECK_NOT_EQUAL(INVALID_HANDLE, block.allocateHandle(1));
+
+            block.destroy();
+        }
+    }
+
+    UNITTEST_FIXTURE(config64)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(beyond_4gb)
+        {
+            u64 const GB = 1024ull * 1024 * 1024;
+
+            block_allocator64_t block;
+            block.init(Allocator, 16 * GB);
+
+            handle_t const a = block.allocateHandle(5 * GB);
+            handle_t const b = block.allocateHandle(5 * GB);
+            handle_t const c = block.allocateHandle(64, 4 * GB);
+            CHECK_NOT_EQUAL(INVALID_HANDLE, a);
+            CHECK_NOT_EQUAL(INVALID_HANDLE, b);
+            CHECK_NOT_EQUAL(INVALID_HANDLE, c);
+            CHECK_EQUAL(0, block.getOffset(a));
+            CHECK_EQUAL(5 * GB, block.getOffset(b));
+            CHECK_EQUAL(5 * GB, block.getSize(b));
+            CHECK_EQUAL(12 * GB, block.getOffset(c));
+
+            storage_report_t report;
+            block.storageReport(report);
+            CHECK_EQUAL(16 * GB - 10 * GB - 64, report.totalFreeSpace);
+
+            block.freeHandle(a);
+            block.freeHandle(b);
+            block.freeHandle(c);
+            block.storageReport(report);
+            CHECK_EQUAL(16 * GB, report.totalFreeSpace);
+            CHECK_EQUAL(16 * GB, report.largestFreeRegion);
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(whole_range)
+        {
+            // Bins reach up to the highest offset bit
+            u64 const size = 1ull << 40;
+
+            block_allocator64_t block;
+            block.init(Allocator, size);
+            handle_t const a = block.allocateHandle(size);
+            CHECK_NOT_EQUAL(INVALID_HANDLE, a);
+            CHECK_EQUAL(size, block.getSize(a));
+            CHECK_EQUAL(INVALID_HANDLE, block.allocateHandle(1));
+            block.destroy();
+        }
+    }
+
+    UNITTEST_FIXTURE(config16)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(node_limit)
+        {
+            // 32766 nodes, one of them holds the free remainder
+            u32 const maxAllocs = 32766;
+
+            block_allocator16_t block;
+            block.init(Allocator, 65536);
+
+            handle_t* handles = g_allocate_array<handle_t>(Allocator, maxAllocs);
+            u32       count   = 0;
+            while (count < maxAllocs)
+            {
+                handles[count] = block.allocateHandle(1);
+                if (handles[count] == INVALID_HANDLE)
+                    break;
+                CHECK_EQUAL(count, block.getOffset(handles[count]));
+                count++;
+            }
+            CHECK_EQUAL(maxAllocs - 1, count);
+
+            // An allocation needs a spare node for the remainder, a lone free range does not give one back
+            CHECK_TRUE(block.freeHandle(handles[100]));
+            CHECK_EQUAL(INVALID_HANDLE, block.allocateHandle(1));
+
+            // Two adjacent free ranges merge into one node, which frees a node
+            CHECK_TRUE(block.freeHandle(handles[101]));
+            handles[100] = block.allocateHandle(1);
+            CHECK_EQUAL(100, block.getOffset(handles[100]));
+            CHECK_EQUAL(INVALID_HANDLE, block.allocateHandle(1));
+
+            // The handle of 101 is stale and skipped
+            CHECK_EQUAL(count - 1, block.freeMany(handles, count));
+            storage_report_t report;
+            block.storageReport(report);
+            CHECK_EQUAL(65536, report.largestFreeRegion);
+
+            g_deallocate_array(Allocator, handles);
+            block.destroy();
+        }
+
+        UNITTEST_TEST(max_allocs)
+        {
+            block_allocator16_t block;
+            block.init(Allocator, 65536, 4);
+
+            handle_t const a = block.allocateHandle(16);
+            handle_t const b = block.allocateHandle(16);
+            handle_t const c = block.allocateHandle(16);
+            CHECK_NOT_EQUAL(INVALID_HANDLE, c);
+            CHECK_EQUAL(INVALID_HANDLE, block.allocateHandle(16));
+            CHECK_TRUE(block.freeHandle(b));
+            CHECK_EQUAL(INVALID_HANDLE, block.allocateHandle(16));
+            CHECK_TRUE(block.freeHandle(c));
+            handle_t const d = block.allocateHandle(16);
+            CHECK_EQUAL(16, block.getOffset(d));
+            block.freeHandle(a);
+            block.destroy();
+        }
+    }
+
+    UNITTEST_FIXTURE(node_pool)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(grows_in_chunks)
+        {
+            // The pool starts with 256 nodes, 5000 allocations need several chunks
+            u32 const count = 5000;
+
+            block_allocator_t block;
+            block.init(Allocator, 1024 * 1024);
+
+            allocation_t** allocations = g_allocate_array<allocation_t*>(Allocator, count);
+            for (u32 i = 0; i < count; ++i)
+            {
+                allocations[i] = block.allocate(64);
+                CHECK_NOT_NULL(allocations[i]);
+            }
+
+            // Pointers handed out before the pool grew still point at their own range
+            for (u32 i = 0; i < count; ++i)
+            {
+                CHECK_EQUAL(i * 64, allocations[i]->offset);
+                CHECK_EQUAL(64, allocations[i]->size);
+            }
+
+            for (u32 i = 0; i < count; i += 2)
+                block.free(allocations[i]);
+            for (u32 i = 1; i < count; i += 2)
+                block.free(allocations[i]);
+
+            storage_report_t report;
+            block.storageReport(report);
+            CHECK_EQUAL(1024 * 1024, report.largestFreeRegion);
+
+            g_deallocate_array(Allocator, allocations);
+            block.destroy();
+        }
+
+        UNITTEST_TEST(handle_and_pointer)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 65536);
+
+            allocation_t*  a = block.allocate(100);
+            handle_t const h = block.getHandle(a);
+            CHECK_NOT_EQUAL(INVALID_HANDLE, h);
+            CHECK_TRUE(block.getAllocation(h) == a);
+            CHECK_EQUAL(a->offset, block.getOffset(h));
+
+            block.free(a);
+            CHECK_EQUAL(INVALID_HANDLE, block.getHandle(a));
+            CHECK_NULL(block.getAllocation(h));
+
+            block.destroy();
+        }
+    }
+
+    UNITTEST_FIXTURE(handles)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(stale_handles)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 65536);
+
+            handle_t const a = block.allocateHandle(100);
+            CHECK_TRUE(block.isValid(a));
+            CHECK_TRUE(block.freeHandle(a));
+
+            // The node is reused with a new generation, the old handle stays invalid
+            handle_t const b = block.allocateHandle(100);
+            CHECK_EQUAL(a & 0xffffff, b & 0xffffff);
+            CHECK_NOT_EQUAL(a, b);
+
+            CHECK_FALSE(block.isValid(a));
+            CHECK_FALSE(block.freeHandle(a));
+            CHECK_EQUAL(allocation_t::NO_SPACE, block.getOffset(a));
+            CHECK_EQUAL(0, block.getSize(a));
+            CHECK_FALSE(block.reallocate(a, 200));
+
+            // The stale free did not touch the new owner
+            CHECK_TRUE(block.isValid(b));
+            CHECK_EQUAL(100, block.getSize(b));
+            CHECK_TRUE(block.freeHandle(b));
+            CHECK_FALSE(block.freeHandle(b));
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(invalid_handles)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 65536);
+
+            CHECK_FALSE(block.isValid(INVALID_HANDLE));
+            CHECK_FALSE(block.freeHandle(INVALID_HANDLE));
+            CHECK_FALSE(block.isValid(0x00fffff0));  // Beyond the node pool
+            CHECK_FALSE(block.isValid(0));           // The free range node
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(u16_handles)
+        {
+            block_allocator16_t block;
+            block.init(Allocator, 65536);
+
+            handle_t const a = block.allocateHandle(100);
+            block.freeHandle(a);
+            handle_t const b = block.allocateHandle(100);
+            CHECK_EQUAL(a & 0xffff, b & 0xffff);
+            CHECK_NOT_EQUAL(a, b);
+            CHECK_FALSE(block.freeHandle(a));
+            CHECK_TRUE(block.freeHandle(b));
+
+            block.destroy();
+        }
+    }
+
+    UNITTEST_FIXTURE(batch)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(allocate_many_is_contiguous)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 1024 * 1024);
+
+            u32 const sizes[] = {100, 200, 300, 400, 500};
+            handle_t  handles[5];
+            CHECK_EQUAL(5, block.allocateMany(sizes, 5, handles));
+
+            u32 offset = 0;
+            for (u32 i = 0; i < 5; ++i)
+            {
+                CHECK_EQUAL(offset, block.getOffset(handles[i]));
+                CHECK_EQUAL(sizes[i], block.getSize(handles[i]));
+                offset += sizes[i];
+            }
+
+            // Adjacent allocations merge into one free node
+            CHECK_EQUAL(5, block.freeMany(handles, 5));
+            storage_report_t report;
+            block.storageReport(report);
+            CHECK_EQUAL(1024 * 1024, report.largestFreeRegion);
+            CHECK_EQUAL(1, report.numberOfUsedBins);
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(partial_failure)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 4096);
+
+            u32 const sizes[] = {1000, 8192, 1000, 1000};
+            handle_t  handles[4];
+            CHECK_EQUAL(3, block.allocateMany(sizes, 4, handles));
+            CHECK_EQUAL(INVALID_HANDLE, handles[1]);
+            CHECK_TRUE(block.isValid(handles[0]));
+            CHECK_TRUE(block.isValid(handles[3]));
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(free_many_skips_stale_and_duplicates)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 65536);
+
+            u32 const sizes[] = {64, 64, 64, 64};
+            handle_t  handles[4];
+            block.allocateMany(sizes, 4, handles);
+            handle_t const keep = block.allocateHandle(64);
+
+            CHECK_TRUE(block.freeHandle(handles[1]));
+            handle_t const batch[] = {handles[0], handles[1], handles[2], handles[2], handles[3], INVALID_HANDLE};
+            CHECK_EQUAL(3, block.freeMany(batch, 6));
+
+            CHECK_TRUE(block.isValid(keep));
+            CHECK_EQUAL(256, block.getOffset(keep));
+            storage_report_t report;
+            block.storageReport(report);
+            CHECK_EQUAL(65536 - 64, report.totalFreeSpace);
+
+            block.freeHandle(keep);
+            block.storageReport(report);
+            CHECK_EQUAL(65536, report.largestFreeRegion);
+            block.destroy();
+        }
+
+        UNITTEST_TEST(aligned_batch)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 65536, 0xffffffff, 1024);
+
+            u32 const sizes[] = {100, 100, 100};
+            handle_t  handles[3];
+            CHECK_EQUAL(3, block.allocateMany(sizes, 3, handles, 256, RESOURCE_OPTIMAL));
+            for (u32 i = 0; i < 3; ++i)
+                CHECK_EQUAL(0, block.getOffset(handles[i]) & 255);
+            CHECK_EQUAL(3, block.freeMany(handles, 3));
+
+            block.destroy();
+        }
+    }
+
+    UNITTEST_FIXTURE(placement)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        static u32 sRandom(u32& state)
+        {
+            state = state * 1664525u + 1013904223u;
+            return state >> 8;
+        }
+
+        UNITTEST_TEST(lowest_address)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 640, 0xffffffff, 1, PLACEMENT_LOWEST_ADDRESS);
+
+            handle_t handles[10];
+            for (u32 i = 0; i < 10; ++i)
+                handles[i] = block.allocateHandle(64);
+
+            // Fast placement would hand out the most recently freed node first
+            u32 const order[] = {1, 5, 3, 7};
+            for (u32 i = 0; i < 4; ++i)
+                block.freeHandle(handles[order[i]]);
+            for (u32 i = 0; i < 4; ++i)
+                CHECK_EQUAL(64 + i * 128, block.getOffset(block.allocateHandle(64)));
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(lowest_address_many_holes)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 1024 * 64, 0xffffffff, 1, PLACEMENT_LOWEST_ADDRESS);
+
+            handle_t* handles = g_allocate_array<handle_t>(Allocator, 1024);
+            for (u32 i = 0; i < 1024; ++i)
+                handles[i] = block.allocateHandle(64);
+
+            // Free every other block in a shuffled order, the holes all land in one bin
+            u32* order = g_allocate_array<u32>(Allocator, 512);
+            for (u32 i = 0; i < 512; ++i)
+                order[i] = i * 2 + 1;
+            u32 state = 1;
+            for (u32 i = 511; i > 0; --i)
+            {
+                u32 const j = sRandom(state) % (i + 1);
+                u32 const t = order[i];
+                order[i]    = order[j];
+                order[j]    = t;
+            }
+            for (u32 i = 0; i < 512; ++i)
+                block.freeHandle(handles[order[i]]);
+
+            for (u32 i = 0; i < 512; ++i)
+            {
+                handles[i * 2 + 1] = block.allocateHandle(64);
+                CHECK_EQUAL((i * 2 + 1) * 64, block.getOffset(handles[i * 2 + 1]));
+            }
+
+            for (u32 i = 0; i < 1024; ++i)
+                block.freeHandle(handles[order[i / 2] - (i & 1)]);
+            storage_report_t report;
+            block.storageReport(report);
+            CHECK_EQUAL(1024 * 64, report.largestFreeRegion);
+
+            g_deallocate_array(Allocator, order);
+            g_deallocate_array(Allocator, handles);
+            block.destroy();
+        }
+
+        UNITTEST_TEST(best_fit)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 4096, 0xffffffff, 1, PLACEMENT_BEST_FIT);
+
+            // Holes of 100, 70 and 66 bytes in between used blocks, the heap is otherwise full
+            u32 const sizes[] = {100, 8, 70, 8, 66, 8};
+            handle_t  handles[7];
+            for (u32 i = 0; i < 6; ++i)
+                handles[i] = block.allocateHandle(sizes[i]);
+            handles[6] = block.allocateHandle(4096 - 260);
+            block.freeHandle(handles[0]);
+            block.freeHandle(handles[2]);
+            block.freeHandle(handles[4]);
+
+            // 66 and 70 share the bin below the one 65 rounds up to, fast placement would take the 100 byte hole
+            handle_t const a = block.allocateHandle(65);
+            CHECK_EQUAL(186, block.getOffset(a));
+            handle_t const b = block.allocateHandle(65);
+            CHECK_EQUAL(108, block.getOffset(b));
+            handle_t const c = block.allocateHandle(65);
+            CHECK_EQUAL(0, block.getOffset(c));
+            CHECK_EQUAL(INVALID_HANDLE, block.allocateHandle(65));
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(best_fit_matches_reference)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 1024 * 1024, 0xffffffff, 1, PLACEMENT_BEST_FIT);
+
+            // Carve the heap into blocks of random sizes and free every other one, the holes never touch
+            u32 const count   = 2000;
+            u32*      offsets = g_allocate_array<u32>(Allocator, count);
+            u32*      sizes   = g_allocate_array<u32>(Allocator, count);
+            handle_t* handles = g_allocate_array<handle_t>(Allocator, count);
+            u32       state   = 7;
+            u32       end     = 0;
+            for (u32 i = 0; i < count; ++i)
+            {
+                sizes[i]   = 1 + sRandom(state) % 300;
+                handles[i] = block.allocateHandle(sizes[i]);
+                offsets[i] = block.getOffset(handles[i]);
+                CHECK_EQUAL(end, offsets[i]);
+                end += sizes[i];
+            }
+            block.allocateHandle(1024 * 1024 - end);
+            for (u32 i = 0; i < count; i += 2)
+                block.freeHandle(handles[i]);
+
+            // The holes are the reference, an allocation takes the smallest hole that fits and the lowest
+            // offset among holes of the same size
+            for (;;)
+            {
+                u32 const size = 1 + sRandom(state) % 300;
+                u32       best = count;
+                for (u32 i = 0; i < count; i += 2)
+                {
+                    if (sizes[i] >= size && (best == count || sizes[i] < sizes[best] || (sizes[i] == sizes[best] && offsets[i] < offsets[best])))
+                        best = i;
+                }
+
+                handle_t const h = block.allocateHandle(size);
+                if (best == count)
+                {
+                    CHECK_EQUAL(INVALID_HANDLE, h);
+                    break;
+                }
+                CHECK_EQUAL(offsets[best], block.getOffset(h));
+                offsets[best] += size;
+                sizes[best] -= size;
+            }
+
+            g_deallocate_array(Allocator, handles);
+            g_deallocate_array(Allocator, sizes);
+            g_deallocate_array(Allocator, offsets);
+            block.destroy();
+        }
+
+        UNITTEST_TEST(batch_honours_placement)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 640, 0xffffffff, 1, PLACEMENT_LOWEST_ADDRESS);
+
+            handle_t handles[10];
+            for (u32 i = 0; i < 10; ++i)
+                handles[i] = block.allocateHandle(64);
+            u32 const order[] = {1, 5, 3, 7};
+            for (u32 i = 0; i < 4; ++i)
+                block.freeHandle(handles[order[i]]);
+
+            u32 const sizes[] = {64, 64, 64, 64};
+            handle_t  batch[4];
+            CHECK_EQUAL(4, block.allocateMany(sizes, 4, batch));
+            for (u32 i = 0; i < 4; ++i)
+                CHECK_EQUAL(64 + i * 128, block.getOffset(batch[i]));
+            block.destroy();
+
+            block.init(Allocator, 4096, 0xffffffff, 1, PLACEMENT_BEST_FIT);
+            u32 const holes[] = {100, 8, 70, 8, 66, 8};
+            for (u32 i = 0; i < 6; ++i)
+                handles[i] = block.allocateHandle(holes[i]);
+            handles[6] = block.allocateHandle(4096 - 260);
+            block.freeHandle(handles[0]);
+            block.freeHandle(handles[2]);
+            block.freeHandle(handles[4]);
+
+            u32 const size = 65;
+            CHECK_EQUAL(1, block.allocateMany(&size, 1, batch));
+            CHECK_EQUAL(186, block.getOffset(batch[0]));
+            block.destroy();
+        }
+    }
+
+    UNITTEST_FIXTURE(defrag)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        typedef block_allocator_t::defrag_move_t defrag_move_t;
+
+        // A hole at the start of the heap followed by two allocations of 128 bytes, the size of a bin
+        static void sSetup(block_allocator_t& block, handle_t& b, handle_t& c)
+        {
+            handle_t const a = block.allocateHandle(128);
+            b                = block.allocateHandle(128);
+            c                = block.allocateHandle(128);
+            block.freeHandle(a);
+        }
+
+        UNITTEST_TEST(plan_commit)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 4096);
+            handle_t b, c;
+            sSetup(block, b, c);
+
+            defrag_move_t moves[8];
+            u32           numMoves = 0;
+            block.defragPlan(moves, 8, numMoves, 4096);
+            CHECK_EQUAL(1, numMoves);
+            CHECK_EQUAL(b, moves[0].handle);
+            CHECK_EQUAL(128, moves[0].srcOffset);
+            CHECK_EQUAL(0, moves[0].dstOffset);
+            CHECK_EQUAL(128, moves[0].size);
+
+            // The destination is reserved until the commit
+            storage_report_t report;
+            block.storageReport(report);
+            CHECK_EQUAL(4096 - 384, report.totalFreeSpace);
+
+            block.defragCommit(moves, numMoves);
+            CHECK_EQUAL(0, block.getOffset(b));
+            CHECK_EQUAL(128, block.getSize(b));
+
+            // Finish the pass, 'c' keeps the 256 alignment of its offset unless the alignment is capped
+            while (block.defragPlan(moves, 8, numMoves, 4096, 256, 128) || numMoves > 0)
+                block.defragCommit(moves, numMoves);
+            CHECK_EQUAL(0, block.getOffset(b));
+            CHECK_EQUAL(128, block.getOffset(c));
+            block.storageReport(report);
+            CHECK_EQUAL(4096 - 256, report.largestFreeRegion);
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(plan_cancel)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 4096);
+            handle_t b, c;
+            sSetup(block, b, c);
+
+            defrag_move_t moves[8];
+            u32           numMoves = 0;
+            block.defragPlan(moves, 8, numMoves, 4096);
+            CHECK_EQUAL(1, numMoves);
+            block.defragCancel(moves, numMoves);
+
+            CHECK_EQUAL(128, block.getOffset(b));
+            CHECK_EQUAL(256, block.getOffset(c));
+            storage_report_t report;
+            block.storageReport(report);
+            CHECK_EQUAL(4096 - 256, report.totalFreeSpace);
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(budget)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 4096);
+            handle_t b, c;
+            sSetup(block, b, c);
+
+            // A move larger than the byte budget is not planned
+            defrag_move_t moves[8];
+            u32           numMoves = 0;
+            block.defragPlan(moves, 8, numMoves, 64);
+            CHECK_EQUAL(0, numMoves);
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(free_during_move)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 4096);
+            handle_t b, c;
+            sSetup(block, b, c);
+
+            defrag_move_t moves[8];
+            u32           numMoves = 0;
+            block.defragPlan(moves, 8, numMoves, 4096);
+            CHECK_EQUAL(1, numMoves);
+            CHECK_TRUE(block.freeHandle(b));
+            block.defragCommit(moves, numMoves);
+
+            CHECK_EQUAL(256, block.getOffset(c));
+            storage_report_t report;
+            block.storageReport(report);
+            CHECK_EQUAL(4096 - 128, report.totalFreeSpace);
+
+            CHECK_TRUE(block.freeHandle(c));
+            block.storageReport(report);
+            CHECK_EQUAL(4096, report.largestFreeRegion);
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(resize_during_move)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 4096);
+            handle_t b, c;
+            sSetup(block, b, c);
+            block.freeHandle(c);
+
+            defrag_move_t moves[8];
+            u32           numMoves = 0;
+            block.defragPlan(moves, 8, numMoves, 4096);
+            CHECK_EQUAL(1, numMoves);
+
+            // The copy covered 128 bytes, the grown allocation stays where it is
+            CHECK_TRUE(block.reallocate(b, 192));
+            block.defragCommit(moves, numMoves);
+            CHECK_EQUAL(128, block.getOffset(b));
+            CHECK_EQUAL(192, block.getSize(b));
+
+            storage_report_t report;
+            block.storageReport(report);
+            CHECK_EQUAL(4096 - 192, report.totalFreeSpace);
+
+            CHECK_TRUE(block.freeHandle(b));
+            block.storageReport(report);
+            CHECK_EQUAL(4096, report.largestFreeRegion);
+
+            block.destroy();
+        }
+    }
+
+    UNITTEST_FIXTURE(reallocate)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(grow_in_place)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 4096);
+
+            handle_t const a = block.allocateHandle(256);
+            CHECK_TRUE(block.reallocate(a, 1024));
+            CHECK_EQUAL(0, block.getOffset(a));
+            CHECK_EQUAL(1024, block.getSize(a));
+
+            // The free tail shrank, the next allocation follows the grown one
+            handle_t const b = block.allocateHandle(256);
+            CHECK_EQUAL(1024, block.getOffset(b));
+
+            // Growing into all of the free neighbor removes it
+            CHECK_TRUE(block.reallocate(b, 4096 - 1024));
+            storage_report_t report;
+            block.storageReport(report);
+            CHECK_EQUAL(0, report.totalFreeSpace);
+            CHECK_EQUAL(0, report.numberOfUsedBins);
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(grow_fails_without_room)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 4096);
+
+            handle_t const a = block.allocateHandle(256);
+            handle_t const b = block.allocateHandle(256);
+
+            // The next neighbor is used
+            CHECK_FALSE(block.reallocate(a, 257));
+            CHECK_EQUAL(256, block.getSize(a));
+
+            // The free neighbor is too small
+            CHECK_FALSE(block.reallocate(b, 4096));
+            CHECK_EQUAL(256, block.getSize(b));
+            storage_report_t report;
+            block.storageReport(report);
+            CHECK_EQUAL(4096 - 512, report.totalFreeSpace);
+
+            // A stale handle is rejected
+            block.freeHandle(a);
+            CHECK_FALSE(block.reallocate(a, 128));
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(shrink_in_place)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 4096);
+
+            handle_t const a = block.allocateHandle(1024);
+            handle_t const b = block.allocateHandle(1024);
+
+            // The used neighbor stays where it is, the space given back becomes a new free node
+            CHECK_TRUE(block.reallocate(a, 512));
+            CHECK_EQUAL(512, block.getSize(a));
+            CHECK_EQUAL(1024, block.getOffset(b));
+            handle_t const c = block.allocateHandle(512);
+            CHECK_EQUAL(512, block.getOffset(c));
+
+            // The space given back merges with the free neighbor
+            CHECK_TRUE(block.reallocate(b, 256));
+            storage_report_t report;
+            block.storageReport(report);
+            CHECK_EQUAL(4096 - 1024 - 256, report.totalFreeSpace);
+            CHECK_EQUAL(4096 - 1024 - 256, report.largestFreeRegion);
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(granularity)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 8192, 0xffffffff, 1024);
+
+            // Growing a linear resource into the page of an optimal one is refused
+            handle_t const linear  = block.allocateHandle(512, 1, RESOURCE_LINEAR);
+            handle_t const hole    = block.allocateHandle(1024);
+            handle_t const optimal = block.allocateHandle(512, 512, RESOURCE_OPTIMAL);
+            CHECK_EQUAL(1536, block.getOffset(optimal));
+            block.freeHandle(hole);
+
+            CHECK_TRUE(block.reallocate(linear, 1024));
+            CHECK_FALSE(block.reallocate(linear, 1536));
+            CHECK_EQUAL(1024, block.getSize(linear));
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(ordered_placement)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 4096, 0xffffffff, 1, PLACEMENT_BEST_FIT);
+
+            handle_t const a = block.allocateHandle(512);
+            handle_t const b = block.allocateHandle(512);
+            CHECK_TRUE(block.reallocate(a, 256));
+            CHECK_TRUE(block.reallocate(b, 1024));
+
+            // The 256 byte hole is the best fit
+            handle_t const c = block.allocateHandle(200);
+            CHECK_EQUAL(256, block.getOffset(c));
+
+            block.freeHandle(a);
+            block.freeHandle(b);
+            block.freeHandle(c);
+            storage_report_t report;
+            block.storageReport(report);
+            CHECK_EQUAL(4096, report.largestFreeRegion);
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(allocation_pointer)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 4096);
+
+            allocation_t* a = block.allocate(256);
+            CHECK_TRUE(block.reallocate(a, 512));
+            CHECK_EQUAL(512, a->size);
+            CHECK_TRUE(block.reallocate(a, 128));
+            CHECK_EQUAL(128, a->size);
+            block.free(a);
+
+            block.destroy();
+        }
+    }
+
+    UNITTEST_FIXTURE(resize_heap)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(grow_merges_free_tail)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 4096);
+
+            handle_t const a = block.allocateHandle(1024);
+            CHECK_TRUE(block.grow(8192));
+            CHECK_EQUAL(8192, block.size());
+
+            storage_report_t report;
+            block.storageReport(report);
+            CHECK_EQUAL(8192 - 1024, report.totalFreeSpace);
+            CHECK_EQUAL(8192 - 1024, report.largestFreeRegion);
+
+            // The new space is one range with the old tail
+            handle_t const b = block.allocateHandle(8192 - 1024);
+            CHECK_EQUAL(1024, block.getOffset(b));
+
+            block.freeHandle(a);
+            block.freeHandle(b);
+            block.storageReport(report);
+            CHECK_EQUAL(8192, report.largestFreeRegion);
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(grow_after_used_tail)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 4096);
+
+            handle_t const a = block.allocateHandle(4096);
+            CHECK_EQUAL(INVALID_HANDLE, block.allocateHandle(1));
+            CHECK_TRUE(block.grow(8192));
+
+            handle_t const b = block.allocateHandle(4096);
+            CHECK_EQUAL(4096, block.getOffset(b));
+
+            // Freeing both merges across the old end of the heap
+            block.freeHandle(a);
+            block.freeHandle(b);
+            storage_report_t report;
+            block.storageReport(report);
+            CHECK_EQUAL(8192, report.largestFreeRegion);
+
+            // The size only grows
+            CHECK_FALSE(block.grow(4096));
+            CHECK_TRUE(block.grow(8192));
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(shrink_to_fit)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 8192);
+
+            handle_t const a = block.allocateHandle(1024);
+            handle_t const b = block.allocateHandle(1024);
+            CHECK_EQUAL(2048, block.shrinkToFit());
+            CHECK_EQUAL(2048, block.size());
+            CHECK_EQUAL(INVALID_HANDLE, block.allocateHandle(1));
+
+            // Only the free tail is dropped, a hole before a used allocation stays
+            block.freeHandle(a);
+            CHECK_EQUAL(2048, block.shrinkToFit());
+            block.freeHandle(b);
+            CHECK_EQUAL(0, block.shrinkToFit());
+
+            storage_report_t report;
+            block.storageReport(report);
+            CHECK_EQUAL(0, report.totalFreeSpace);
+
+            // An empty heap grows from zero
+            CHECK_TRUE(block.grow(4096));
+            handle_t const c = block.allocateHandle(4096);
+            CHECK_EQUAL(0, block.getOffset(c));
+
+            block.destroy();
+        }
+
+        UNITTEST_TEST(ordered_placement)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 4096, 0xffffffff, 1, PLACEMENT_LOWEST_ADDRESS);
+
+            handle_t const a = block.allocateHandle(1024);
+            handle_t const b = block.allocateHandle(1024);
+            block.freeHandle(a);
+            CHECK_TRUE(block.grow(16384));
+            CHECK_EQUAL(2048, block.shrinkToFit());
+            CHECK_TRUE(block.grow(4096));
+
+            // The hole at the start comes before the grown tail
+            handle_t const c = block.allocateHandle(512);
+            CHECK_EQUAL(0, block.getOffset(c));
+            handle_t const d = block.allocateHandle(2048);
+            CHECK_EQUAL(2048, block.getOffset(d));
+
+            block.freeHandle(b);
+            block.freeHandle(c);
+            block.freeHandle(d);
+            storage_report_t report;
+            block.storageReport(report);
+            CHECK_EQUAL(4096, report.largestFreeRegion);
+
+            block.destroy();
+        }
+
+        static u32 sRandom(u32& state)
+        {
+            state = state * 1664525u + 1013904223u;
+            return state >> 8;
+        }
+
+        // The end of the heap is tracked through every split and merge, shrinkToFit always lands right after
+        // the last allocation
+        UNITTEST_TEST(tail_after_churn)
+        {
+            u32 const heapSize = 256 * 1024;
+            u32 const maxLive  = 256;
+
+            for (u32 placement = PLACEMENT_FAST; placement <= PLACEMENT_BEST_FIT; ++placement)
+            {
+                block_allocator_t block;
+                block.init(Allocator, heapSize, 0xffffffff, 1, placement);
+
+                handle_t live[maxLive];
+                handle_t batch[16];
+                u32      sizes[16];
+                u32      numLive = 0;
+                u32      state   = 11 + placement;
+                u32      errors  = 0;
+                for (u32 step = 0; step < 4000; ++step)
+                {
+                    u32 const r = sRandom(state);
+                    switch (r % 8)
+                    {
+                        case 0:
+                        {
+                            u32 const count = 1 + (r >> 4) % 8;
+                            for (u32 i = 0; i < count; ++i)
+                                sizes[i] = 1 + sRandom(state) % 2000;
+                            block.allocateMany(sizes, count, batch);
+                            for (u32 i = 0; i < count && numLive < maxLive; ++i)
+                            {
+                                if (batch[i] != INVALID_HANDLE)
+                                    live[numLive++] = batch[i];
+                            }
+                            break;
+                        }
+                        case 1:
+                        {
+                            u32 count = 0;
+                            while (count < 8 && numLive > 0)
+                            {
+                                u32 const index = sRandom(state) % numLive;
+                                batch[count++]  = live[index];
+                                live[index]     = live[--numLive];
+                            }
+                            block.freeMany(batch, count);
+                            break;
+                        }
+                        case 2:
+                            if (numLive > 0)
+                                block.reallocate(live[(r >> 4) % numLive], 1 + sRandom(state) % 4000);
+                            break;
+                        case 3:
+                        {
+                            block_allocator_t::defrag_move_t moves[4];
+                            u32                              numMoves;
+                            block.defragPlan(moves, 4, numMoves, heapSize);
+                            block.defragCommit(moves, numMoves);
+                            break;
+                        }
+                        default:
+                            if (numLive == maxLive || ((r >> 4) % 3 == 0 && numLive > 0))
+                            {
+                                u32 const index = (r >> 6) % numLive;
+                                block.freeHandle(live[index]);
+                                live[index] = live[--numLive];
+                            }
+                            else
+                            {
+                                handle_t const h = block.allocateHandle(1 + (r >> 4) % 3000, 1u << ((r >> 16) % 8));
+                                if (h != INVALID_HANDLE)
+                                    live[numLive++] = h;
+                            }
+                            break;
+                    }
+
+                    if (step % 50 == 0)
+                    {
+                        u32 end = 0;
+                        for (u32 i = 0; i < numLive; ++i)
+                        {
+                            u32 const e = block.getOffset(live[i]) + block.getSize(live[i]);
+                            end         = e > end ? e : end;
+                        }
+                        errors += block.shrinkToFit() != end ? 1 : 0;
+                        errors += block.grow(heapSize) ? 0 : 1;
+                    }
+                }
+                CHECK_EQUAL(0, errors);
+                block.destroy();
+            }
+        }
+    }
+
+    UNITTEST_FIXTURE(snapshot)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        static u32 const MAX_LIVE = 600;
+
+        static u32 sRandom(u32& state)
+        {
+            state = state * 1664525u + 1013904223u;
+            return state >> 8;
+        }
+
+        // Random allocations and frees, 'live' holds the handles of the allocations. The sequence only depends
+        // on 'state' and on what the allocator returns, two allocators in the same state stay in the same state.
+        template <typename T>
+        static void sChurn(T& block, handle_t* live, u32& numLive, u32& state, u32 steps)
+        {
+            for (u32 i = 0; i < steps; ++i)
+            {
+                u32 const r = sRandom(state);
+                if (numLive > 0 && (numLive == MAX_LIVE || (r & 3) == 0))
+                {
+                    u32 const index = (r >> 2) % numLive;
+                    block.freeHandle(live[index]);
+                    live[index] = live[--numLive];
+                }
+                else
+                {
+                    handle_t const h = block.allocateHandle(1 + (r >> 2) % 2000, (typename T::offset_t)1 << ((r >> 16) % 6));
+                    if (h != INVALID_HANDLE)
+                        live[numLive++] = h;
+                }
+            }
+        }
+
+        // Number of differences in the allocations and in the bins
+        template <typename T>
+        static u32 sDifferences(T const& a, T const& b, handle_t const* live, u32 numLive)
+        {
+            u32 differences = 0;
+            for (u32 i = 0; i < numLive; ++i)
+            {
+                if (!b.isValid(live[i]) || a.getOffset(live[i]) != b.getOffset(live[i]) || a.getSize(live[i]) != b.getSize(live[i]))
+                    differences++;
+            }
+
+            storage_report_t reportA, reportB;
+            a.storageReport(reportA);
+            b.storageReport(reportB);
+            if (reportA.totalFreeSpace != reportB.totalFreeSpace || reportA.largestFreeRegion != reportB.largestFreeRegion || reportA.numberOfUsedBins != reportB.numberOfUsedBins)
+                differences++;
+            for (u32 bin = 0; bin < T::NUM_LEAF_BINS; ++bin)
+            {
+                bin_report_t binA, binB;
+                a.storageBinState(bin, binA);
+                b.storageBinState(bin, binB);
+                if (binA.count != binB.count || binA.size != binB.size)
+                    differences++;
+            }
+            return differences;
+        }
+
+        // Saves a heap with a few node chunks, restores it by copy and in place, then the same sequence of
+        // allocations and frees on all three has to give the same handles and offsets
+        template <typename T>
+        static void sRoundTrip(alloc_t* allocator, typename T::offset_t size, u32 placement, u32& outDifferences, u32& outImageDifferences)
+        {
+            T block;
+            block.init(allocator, size, 0xffffffff, 1, placement);
+            handle_t* live  = g_allocate_array<handle_t>(allocator, MAX_LIVE * 3);
+            u32       count = 0;
+            u32       state = 11;
+            sChurn(block, live, count, state, 3000);
+
+            u32 const imageSize = block.saveSize();
+            u64*      image     = g_allocate_array<u64>(allocator, imageSize / 8 + 1);
+            u64*      inPlace   = g_allocate_array<u64>(allocator, imageSize / 8 + 1);
+            CHECK_EQUAL(0, block.save(image, imageSize - 1));
+            CHECK_EQUAL(imageSize, block.save(image, imageSize));
+            memcpy(inPlace, image, imageSize);
+
+            T copy, borrowed;
+            CHECK_TRUE(copy.restore(allocator, image, imageSize));
+            CHECK_TRUE(borrowed.restoreInPlace(allocator, inPlace, imageSize));
+            outDifferences = sDifferences(block, copy, live, count) + sDifferences(block, borrowed, live, count);
+
+            // Saving the restored state gives the same image
+            u64* again = g_allocate_array<u64>(allocator, imageSize / 8 + 1);
+            CHECK_EQUAL(imageSize, copy.saveSize());
+            copy.save(again, imageSize);
+            outImageDifferences = memcmp(image, again, imageSize) != 0 ? 1 : 0;
+
+            // The three allocators continue in lockstep, also after growing more node chunks
+            handle_t* liveCopy     = live + MAX_LIVE;
+            handle_t* liveBorrowed = live + MAX_LIVE * 2;
+            memcpy(liveCopy, live, count * sizeof(handle_t));
+            memcpy(liveBorrowed, live, count * sizeof(handle_t));
+            u32 countCopy = count, countBorrowed = count;
+            u32 stateCopy = state, stateBorrowed = state;
+            sChurn(block, live, count, state, 3000);
+            sChurn(copy, liveCopy, countCopy, stateCopy, 3000);
+            sChurn(borrowed, liveBorrowed, countBorrowed, stateBorrowed, 3000);
+            if (count != countCopy || count != countBorrowed || memcmp(live, liveCopy, count * sizeof(handle_t)) != 0 || memcmp(live, liveBorrowed, count * sizeof(handle_t)) != 0)
+                outDifferences++;
+            outDifferences += sDifferences(block, copy, live, count) + sDifferences(block, borrowed, live, count);
+
+            // The image outlives the allocator that borrows it
+            borrowed.destroy();
+            copy.destroy();
+            block.destroy();
+            g_deallocate_array(allocator, again);
+            g_deallocate_array(allocator, inPlace);
+            g_deallocate_array(allocator, image);
+            g_deallocate_array(allocator, live);
+        }
+
+        UNITTEST_TEST(round_trip)
+        {
+            u32 differences, imageDifferences;
+            sRoundTrip<block_allocator_t>(Allocator, 1024 * 1024, PLACEMENT_FAST, differences, imageDifferences);
+            CHECK_EQUAL(0, differences);
+            CHECK_EQUAL(0, imageDifferences);
+        }
+
+        UNITTEST_TEST(config16)
+        {
+            u32 differences, imageDifferences;
+            sRoundTrip<block_allocator16_t>(Allocator, 1024 * 1024, PLACEMENT_FAST, differences, imageDifferences);
+            CHECK_EQUAL(0, differences);
+            CHECK_EQUAL(0, imageDifferences);
+        }
+
+        UNITTEST_TEST(config64)
+        {
+            u32 differences, imageDifferences;
+            sRoundTrip<block_allocator64_t>(Allocator, (u64)8 << 30, PLACEMENT_FAST, differences, imageDifferences);
+            CHECK_EQUAL(0, differences);
+            CHECK_EQUAL(0, imageDifferences);
+        }
+
+        // The search trees of the ordered policies are part of the image
+        UNITTEST_TEST(ordered_placement)
+        {
+            u32 differences, imageDifferences;
+            sRoundTrip<block_allocator_t>(Allocator, 1024 * 1024, PLACEMENT_LOWEST_ADDRESS, differences, imageDifferences);
+            CHECK_EQUAL(0, differences);
+            CHECK_EQUAL(0, imageDifferences);
+            sRoundTrip<block_allocator_t>(Allocator, 1024 * 1024, PLACEMENT_BEST_FIT, differences, imageDifferences);
+            CHECK_EQUAL(0, differences);
+            CHECK_EQUAL(0, imageDifferences);
+            sRoundTrip<block_allocator64_t>(Allocator, (u64)8 << 30, PLACEMENT_BEST_FIT, differences, imageDifferences);
+            CHECK_EQUAL(0, differences);
+            CHECK_EQUAL(0, imageDifferences);
+        }
+
+        UNITTEST_TEST(stale_handles_stay_stale)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 65536);
+            handle_t const a = block.allocateHandle(100);
+            handle_t const b = block.allocateHandle(100);
+            block.freeHandle(a);
+
+            u32 const imageSize = block.saveSize();
+            u64*      image     = g_allocate_array<u64>(Allocator, imageSize / 8);
+            block.save(image, imageSize);
+            block.destroy();
+
+            block_allocator_t copy;
+            CHECK_TRUE(copy.restore(Allocator, image, imageSize));
+            CHECK_FALSE(copy.isValid(a));
+            CHECK_FALSE(copy.freeHandle(a));
+            CHECK_EQUAL(100, copy.getOffset(b));
+            CHECK_TRUE(copy.freeHandle(b));
+
+            copy.destroy();
+            g_deallocate_array(Allocator, image);
+        }
+
+        // A heap shrunk to nothing has no nodes in the neighbor chain
+        UNITTEST_TEST(empty_heap)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 65536);
+            CHECK_EQUAL(0, block.shrinkToFit());
+            u32 const imageSize = block.saveSize();
+            u64*      image     = g_allocate_array<u64>(Allocator, imageSize / 8);
+            block.save(image, imageSize);
+            block.destroy();
+
+            block_allocator_t copy;
+            CHECK_TRUE(copy.restore(Allocator, image, imageSize));
+            CHECK_TRUE(copy.grow(4096));
+            CHECK_NOT_EQUAL(INVALID_HANDLE, copy.allocateHandle(4096));
+            copy.destroy();
+            g_deallocate_array(Allocator, image);
+        }
+
+        UNITTEST_TEST(rejects_other_images)
+        {
+            block_allocator_t block;
+            block.init(Allocator, 65536);
+            block.allocateHandle(100);
+            u32 const imageSize = block.saveSize();
+            u64*      image     = g_allocate_array<u64>(Allocator, imageSize / 8 + 1);
+            block.save(image, imageSize);
+            block.destroy();
+
+            // Another configuration, a truncated image, an unaligned image
+            block_allocator16_t other;
+            CHECK_FALSE(other.restore(Allocator, image, imageSize));
+            block_allocator_t copy;
+            CHECK_FALSE(copy.restore(Allocator, image, imageSize - 8));
+            CHECK_FALSE(copy.restore(Allocator, (u8*)image + 4, imageSize));
+
+            // A corrupt header
+            u32* words = (u32*)image;
+            words[1] += 1;
+            CHECK_FALSE(copy.restore(Allocator, image, imageSize));
+            words[1] -= 1;
+            words[0] ^= 1;
+            CHECK_FALSE(copy.restoreInPlace(Allocator, image, imageSize));
+            words[0] ^= 1;
+
+            // Header fields that index the node storage: maxAllocs, placement, freeNodeCount and freeNodeHead
+            u32 const fields[] = {12, 13, 18, 19};
+            for (u32 i = 0; i < 4; ++i)
+            {
+                u32 const word   = words[fields[i]];
+                words[fields[i]] = 0x40000000;
+                CHECK_FALSE(copy.restore(Allocator, image, imageSize));
+                CHECK_FALSE(copy.restoreInPlace(Allocator, image, imageSize));
+                words[fields[i]] = word;
+            }
+
+            // The first empty bin after the header, pointing outside the nodes or at a node
+            u32 bin = 22;
+            while (words[bin] != 0x7fffffff)
+                bin++;
+            words[bin] = 0x7ffffffe;
+            CHECK_FALSE(copy.restore(Allocator, image, imageSize));
+            words[bin] = 0;
+            CHECK_FALSE(copy.restore(Allocator, image, imageSize));
+            words[bin] = 0x7fffffff;
+
+            CHECK_TRUE(copy.restore(Allocator, image, imageSize));
+            copy.destroy();
+            g_deallocate_array(Allocator, image);
+        }
+    }
+}
+UNITTEST_SUITE_END
@@ -0,0 +1,240 @@
+#include "ccore/c_target.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/c_vkmem.h"
+#include "cvkmem/c_vkfakedevice.h"
+#include "cvkmem/c_vkdeferredfree.h"
+#include "cvkmem/private/c_vkblockallocator.h"
+
+#include "cunittest/cunittest.h"
+#include "csuperalloc/test_allocator.h"
+#include "cvkmem/test_fake_device.h"
+
+#include <mutex>
+#include <thread>
+
+using namespace ncore;
+using namespace ncore::nvkmem;
+
+UNITTEST_SUITE_BEGIN(deferred_free)
+{
+    UNITTEST_FIXTURE(main)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FAKE_DEVICE;
+
+        static allocation_t sAllocate(u64 size)
+        {
+            memory_requirements_t requirements;
+            requirements.size           = size;
+            requirements.alignment      = 256;
+            requirements.memoryTypeBits = 0xffffffff;
+            allocation_t allocation;
+            s_manager.allocate(requirements, 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_ANY, allocation);
+            return allocation;
+        }
+
+        static u32 sAllocationCount()
+        {
+            memory_stats_t stats;
+            s_manager.getStats(stats);
+            return stats.allocationCount;
+        }
+
+        UNITTEST_TEST(release_by_value)
+        {
+            deferred_free_t deferred;
+            deferred.init(Allocator, &s_manager);
+            deferred_free_t::queue_t* queue = deferred.createQueue();
+
+            for (u32 i = 0; i < 6; ++i)
+                deferred.enqueue(queue, sAllocate(1024), 1 + (i % 3));
+            CHECK_EQUAL(6, sAllocationCount());
+
+            // Nothing is freed before the GPU passes the completion value
+            CHECK_EQUAL(0, deferred.release(0));
+            CHECK_EQUAL(6, deferred.pendingCount());
+            CHECK_EQUAL(2, deferred.release(1));
+            CHECK_EQUAL(4, deferred.pendingCount());
+            CHECK_EQUAL(4, sAllocationCount());
+            CHECK_EQUAL(4, deferred.release(3));
+            CHECK_EQUAL(0, deferred.pendingCount());
+            CHECK_EQUAL(0, sAllocationCount());
+            CHECK_EQUAL(0, deferred.release(3));
+
+            deferred.destroyQueue(queue);
+            deferred.destroy();
+        }
+
+        UNITTEST_TEST(dedicated_and_blocks)
+        {
+            deferred_free_t deferred;
+            deferred.init(Allocator, &s_manager);
+            deferred_free_t::queue_t* queue = deferred.createQueue();
+
+            // A batch mixes dedicated allocations and allocations of several blocks
+            deferred.enqueue(queue, sAllocate(600 * 1024), 1);
+            for (u32 i = 0; i < 6; ++i)
+                deferred.enqueue(queue, sAllocate(256 * 1024), 1);
+
+            memory_stats_t stats;
+            s_manager.getStats(stats);
+            CHECK_EQUAL(1, stats.dedicatedCount);
+            CHECK_EQUAL(2, stats.blockCount);
+
+            CHECK_EQUAL(7, deferred.release(1));
+            s_manager.getStats(stats);
+            CHECK_EQUAL(0, stats.allocationCount);
+            CHECK_EQUAL(0, stats.dedicatedCount);
+            CHECK_EQUAL(0, stats.allocatedBytes);
+
+            deferred.destroyQueue(queue);
+            deferred.destroy();
+            s_manager.trim();
+        }
+
+        UNITTEST_TEST(enqueued_twice)
+        {
+            deferred_free_t deferred;
+            deferred.init(Allocator, &s_manager);
+            deferred_free_t::queue_t* queue = deferred.createQueue();
+
+            // A dedicated and a block allocation dropped twice, the second free of each is skipped
+            allocation_t const dedicated = sAllocate(600 * 1024);
+            allocation_t const block     = sAllocate(1024);
+            deferred.enqueue(queue, dedicated, 1);
+            deferred.enqueue(queue, block, 1);
+            deferred.enqueue(queue, dedicated, 1);
+            deferred.enqueue(queue, block, 2);
+            deferred.enqueue(queue, dedicated, 2);
+            u32 const liveObjects = s_device.liveAllocations();
+            CHECK_EQUAL(2, deferred.release(1));
+            CHECK_EQUAL(0, deferred.release(2));
+            CHECK_EQUAL(liveObjects - 1, s_device.liveAllocations());
+
+            memory_stats_t stats;
+            s_manager.getStats(stats);
+            CHECK_EQUAL(0, stats.allocationCount);
+            CHECK_EQUAL(0, stats.dedicatedCount);
+            CHECK_EQUAL(0, stats.dedicatedBytes);
+            CHECK_EQUAL(0, stats.allocatedBytes);
+
+            deferred.destroyQueue(queue);
+            deferred.destroy();
+            s_manager.trim();
+        }
+
+        UNITTEST_TEST(destroyed_queue)
+        {
+            deferred_free_t deferred;
+            deferred.init(Allocator, &s_manager);
+
+            // Pending frees of a destroyed queue stay pending until their value completes
+            deferred_free_t::queue_t* queue = deferred.createQueue();
+            deferred.enqueue(queue, sAllocate(1024), 5);
+            deferred.destroyQueue(queue);
+            CHECK_EQUAL(0, deferred.release(4));
+            CHECK_EQUAL(1, sAllocationCount());
+            CHECK_EQUAL(1, deferred.release(5));
+            CHECK_EQUAL(0, sAllocationCount());
+
+            // destroy frees what is left
+            queue = deferred.createQueue();
+            deferred.enqueue(queue, sAllocate(1024), 100);
+            deferred.destroyQueue(queue);
+            deferred.destroy();
+            CHECK_EQUAL(0, sAllocationCount());
+        }
+
+        // The test allocator is not thread safe, enqueue allocates on the worker threads
+        class locked_alloc_t : public alloc_t
+        {
+        public:
+            locked_alloc_t(alloc_t* allocator)
+                : m_allocator(allocator)
+            {
+            }
+
+        protected:
+            virtual void* v_allocate(u32 size, u32 alignment)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                return m_allocator->allocate(size, alignment);
+            }
+            virtual void v_deallocate(void* mem)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_allocator->deallocate(mem);
+            }
+
+            alloc_t*   m_allocator;
+            std::mutex m_mutex;
+        };
+
+        struct worker_t
+        {
+            deferred_free_t*          deferred;
+            deferred_free_t::queue_t* queue;
+            allocation_t const*       allocations;
+            u32                       count;
+        };
+
+        static void sWorker(worker_t* worker)
+        {
+            for (u32 i = 0; i < worker->count; ++i)
+                worker->deferred->enqueue(worker->queue, worker->allocations[i], 1 + i);
+        }
+
+        UNITTEST_TEST(threads)
+        {
+            locked_alloc_t   allocator(Allocator);
+            fake_device_t    device;
+            memory_manager_t manager;
+            device.init(&allocator);
+            manager.init(&allocator, &device, memory_config_t());
+            deferred_free_t deferred;
+            deferred.init(&allocator, &manager);
+
+            // The manager is not thread safe, the allocations are made up front and only enqueue runs on the threads
+            u32 const             numThreads  = 4;
+            u32 const             count       = 64;
+            allocation_t*         allocations = g_allocate_array<allocation_t>(Allocator, numThreads * count);
+            memory_requirements_t requirements;
+            requirements.size           = 256;
+            requirements.alignment      = 256;
+            requirements.memoryTypeBits = 0xffffffff;
+            for (u32 i = 0; i < numThreads * count; ++i)
+                manager.allocate(requirements, 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_ANY, allocations[i]);
+
+            worker_t    workers[numThreads];
+            std::thread threads[numThreads];
+            for (u32 t = 0; t < numThreads; ++t)
+            {
+                workers[t] = {&deferred, deferred.createQueue(), allocations + t * count, count};
+                threads[t] = std::thread(sWorker, &workers[t]);
+            }
+
+            // release runs while the threads enqueue
+            u32 released = 0;
+            for (u32 value = 0; value <= count; value += 8)
+                released += deferred.release(value);
+            for (u32 t = 0; t < numThreads; ++t)
+                threads[t].join();
+            released += deferred.release(count);
+
+            memory_stats_t stats;
+            manager.getStats(stats);
+            CHECK_EQUAL(numThreads * count, released);
+            CHECK_EQUAL(0, stats.allocationCount);
+
+            for (u32 t = 0; t < numThreads; ++t)
+                deferred.destroyQueue(workers[t].queue);
+            g_deallocate_array(Allocator, allocations);
+            deferred.destroy();
+            manager.destroy();
+            device.destroy();
+        }
+    }
+}
+UNITTEST_SUITE_END
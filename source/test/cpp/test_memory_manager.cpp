@@ -0,0 +1,598 @@
+#include "ccore/c_target.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/c_vkmem.h"
+#include "cvkmem/c_vkfakedevice.h"
+#include "cvkmem/private/c_vkblockallocator.h"
+
+#include "cunittest/cunittest.h"
+#include "csuperalloc/test_allocator.h"
+
+using namespace ncore;
+using namespace ncore::nvkmem;
+
+UNITTEST_SUITE_BEGIN(memory_manager)
+{
+    UNITTEST_FIXTURE(fake_device)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(allocate_and_free)
+        {
+            fake_device_t device;
+            device.init(Allocator);
+
+            device_memory_t const a = device.allocateMemory(0, 1024);
+            CHECK_NOT_EQUAL(NULL_MEMORY, a);
+            CHECK_EQUAL(1024, device.memorySize(a));
+            CHECK_EQUAL(0, device.memoryType(a));
+            CHECK_EQUAL(1024, device.heapUsage(0));
+            CHECK_EQUAL(1, device.liveAllocations());
+
+            // A freed memory object is unknown, also after its slot is reused
+            device.freeMemory(a);
+            device_memory_t const b = device.allocateMemory(0, 2048);
+            CHECK_NOT_EQUAL(a, b);
+            CHECK_EQUAL(0, device.memorySize(a));
+            CHECK_EQUAL(MAX_MEMORY_TYPES, device.memoryType(a));
+            CHECK_EQUAL(2048, device.heapUsage(0));
+            device.freeMemory(b);
+
+            // Heap 2 is 256 MB
+            CHECK_EQUAL(NULL_MEMORY, device.allocateMemory(3, (u64)257 << 20));
+            CHECK_EQUAL(NULL_MEMORY, device.allocateMemory(0, 0));
+            CHECK_EQUAL(NULL_MEMORY, device.allocateMemory(MAX_MEMORY_TYPES, 1024));
+
+            device.setFailAllocations(true);
+            CHECK_EQUAL(NULL_MEMORY, device.allocateMemory(0, 1024));
+            CHECK_EQUAL(0, device.liveAllocations());
+
+            device.destroy();
+        }
+
+        UNITTEST_TEST(budget)
+        {
+            fake_device_t device;
+            device.init(Allocator);
+
+            device_memory_t const a = device.allocateMemory(0, 4096);
+            device.setExternalUsage(0, 1000);
+            device.setHeapBudget(0, 65536);
+
+            memory_budget_t budget;
+            device.getMemoryBudget(budget);
+            CHECK_EQUAL(65536, budget.heapBudget[0]);
+            CHECK_EQUAL(4096 + 1000, budget.heapUsage[0]);
+            CHECK_EQUAL((u64)16 << 30, budget.heapBudget[1]);
+
+            device.freeMemory(a);
+            device.destroy();
+        }
+    }
+
+    UNITTEST_FIXTURE(blocks)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        static memory_config_t sConfig()
+        {
+            memory_config_t config;
+            config.preferredBlockSize = 1024 * 1024;
+            config.dedicatedThreshold = 512 * 1024;
+            return config;
+        }
+
+        static memory_requirements_t sRequirements(u64 size, u64 alignment = 256, u32 memoryTypeBits = 0xffffffff)
+        {
+            memory_requirements_t requirements;
+            requirements.size           = size;
+            requirements.alignment      = alignment;
+            requirements.memoryTypeBits = memoryTypeBits;
+            return requirements;
+        }
+
+        UNITTEST_TEST(blocks_on_demand)
+        {
+            fake_device_t device;
+            device.init(Allocator);
+            memory_manager_t manager;
+            manager.init(Allocator, &device, sConfig());
+
+            // Four allocations fill a block, the fifth creates the next block
+            allocation_t allocations[8];
+            for (u32 i = 0; i < 8; ++i)
+            {
+                CHECK_TRUE(manager.allocate(sRequirements(256 * 1024), 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_ANY, allocations[i]));
+                CHECK_EQUAL(0, allocations[i].memoryType);
+                CHECK_EQUAL(i / 4, allocations[i].block);
+                CHECK_EQUAL((i % 4) * 256 * 1024, allocations[i].offset);
+            }
+            CHECK_EQUAL(allocations[0].memory, allocations[3].memory);
+            CHECK_NOT_EQUAL(allocations[0].memory, allocations[4].memory);
+
+            memory_stats_t stats;
+            manager.getStats(stats);
+            CHECK_EQUAL(2, stats.blockCount);
+            CHECK_EQUAL(8, stats.allocationCount);
+            CHECK_EQUAL(2 * 1024 * 1024, stats.blockBytes);
+            CHECK_EQUAL(2 * 1024 * 1024, stats.allocatedBytes);
+            CHECK_EQUAL(2, stats.deviceAllocateCalls);
+            CHECK_EQUAL(2, device.liveAllocations());
+
+            // A freed range is reused before a new block is created
+            manager.free(allocations[1]);
+            CHECK_TRUE(manager.allocate(sRequirements(256 * 1024), 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_ANY, allocations[1]));
+            CHECK_EQUAL(allocations[0].memory, allocations[1].memory);
+            CHECK_EQUAL(2, device.liveAllocations());
+
+            manager.destroy();
+            CHECK_EQUAL(0, device.liveAllocations());
+            device.destroy();
+        }
+
+        UNITTEST_TEST(empty_block_hysteresis)
+        {
+            fake_device_t device;
+            device.init(Allocator);
+            memory_manager_t manager;
+            manager.init(Allocator, &device, sConfig());
+
+            allocation_t allocations[8];
+            for (u32 i = 0; i < 8; ++i)
+                manager.allocate(sRequirements(256 * 1024), 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_ANY, allocations[i]);
+
+            // The first block to become empty is kept, the second is released
+            for (u32 i = 0; i < 8; ++i)
+                manager.free(allocations[i]);
+            memory_stats_t stats;
+            manager.getStats(stats);
+            CHECK_EQUAL(1, stats.blockCount);
+            CHECK_EQUAL(1, stats.emptyBlockCount);
+            CHECK_EQUAL(0, stats.allocationCount);
+            CHECK_EQUAL(1, device.liveAllocations());
+
+            // The empty block is used again without a device call
+            manager.allocate(sRequirements(256 * 1024), 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_ANY, allocations[0]);
+            manager.getStats(stats);
+            CHECK_EQUAL(0, stats.emptyBlockCount);
+            CHECK_EQUAL(2, stats.deviceAllocateCalls);
+            manager.free(allocations[0]);
+
+            manager.trim();
+            manager.getStats(stats);
+            CHECK_EQUAL(0, stats.blockCount);
+            CHECK_EQUAL(0, stats.emptyBlockCount);
+            CHECK_EQUAL(0, device.liveAllocations());
+
+            manager.destroy();
+            device.destroy();
+        }
+
+        UNITTEST_TEST(dedicated)
+        {
+            fake_device_t device;
+            device.init(Allocator);
+            memory_manager_t manager;
+            manager.init(Allocator, &device, sConfig());
+
+            allocation_t allocation;
+            CHECK_TRUE(manager.allocate(sRequirements(600 * 1024), 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_ANY, allocation));
+            CHECK_EQUAL(DEDICATED_BLOCK, allocation.block);
+            CHECK_EQUAL(0, allocation.offset);
+            CHECK_EQUAL(600 * 1024, device.memorySize(allocation.memory));
+
+            memory_stats_t stats;
+            manager.getStats(stats);
+            CHECK_EQUAL(0, stats.blockCount);
+            CHECK_EQUAL(1, stats.dedicatedCount);
+            CHECK_EQUAL(600 * 1024, stats.dedicatedBytes);
+
+            manager.free(allocation);
+            manager.getStats(stats);
+            CHECK_EQUAL(0, stats.dedicatedCount);
+            CHECK_EQUAL(0, device.liveAllocations());
+
+            manager.destroy();
+            device.destroy();
+        }
+
+        UNITTEST_TEST(type_fallback)
+        {
+            // Two device local types, the first one on a heap of 1 MB
+            memory_properties_t properties;
+            properties.memoryTypeCount = 2;
+            properties.memoryTypes[0]  = {MEMORY_PROPERTY_DEVICE_LOCAL, 0};
+            properties.memoryTypes[1]  = {MEMORY_PROPERTY_DEVICE_LOCAL, 1};
+            properties.memoryHeapCount = 2;
+            properties.memoryHeaps[0]  = {1024 * 1024, MEMORY_HEAP_DEVICE_LOCAL};
+            properties.memoryHeaps[1]  = {64 * 1024 * 1024, MEMORY_HEAP_DEVICE_LOCAL};
+
+            fake_device_t device;
+            device.init(Allocator, properties, 1);
+            memory_manager_t manager;
+            manager.init(Allocator, &device, sConfig());
+
+            allocation_t a, b;
+            CHECK_TRUE(manager.allocate(sRequirements(1024 * 1024), 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_ANY, a));
+            CHECK_EQUAL(0, a.memoryType);
+            CHECK_TRUE(manager.allocate(sRequirements(1024), 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_ANY, b));
+            CHECK_EQUAL(1, b.memoryType);
+
+            // Only the full type is allowed
+            allocation_t c;
+            CHECK_FALSE(manager.allocate(sRequirements(1024, 256, 1), 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_ANY, c));
+
+            // No type has the required flags
+            CHECK_FALSE(manager.allocate(sRequirements(1024), MEMORY_PROPERTY_HOST_VISIBLE, 0, MEMORY_USAGE_UNKNOWN, nalloc::RESOURCE_ANY, c));
+
+            manager.free(a);
+            manager.free(b);
+            manager.destroy();
+            device.destroy();
+        }
+
+        UNITTEST_TEST(smaller_blocks_when_tight)
+        {
+            memory_properties_t properties;
+            properties.memoryTypeCount = 1;
+            properties.memoryTypes[0]  = {MEMORY_PROPERTY_DEVICE_LOCAL, 0};
+            properties.memoryHeapCount = 1;
+            properties.memoryHeaps[0]  = {1536 * 1024, MEMORY_HEAP_DEVICE_LOCAL};
+
+            fake_device_t device;
+            device.init(Allocator, properties, 1);
+            memory_config_t config    = sConfig();
+            config.dedicatedThreshold = 4 * 1024 * 1024;
+            memory_manager_t manager;
+            manager.init(Allocator, &device, config);
+
+            // The second block does not fit at the preferred size, it is halved
+            allocation_t a, b;
+            CHECK_TRUE(manager.allocate(sRequirements(1024 * 1024, 1), 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_ANY, a));
+            CHECK_TRUE(manager.allocate(sRequirements(256 * 1024), 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_ANY, b));
+            CHECK_EQUAL(512 * 1024, device.memorySize(b.memory));
+
+            memory_stats_t stats;
+            manager.getStats(stats);
+            CHECK_EQUAL(1536 * 1024, stats.blockBytes);
+            CHECK_EQUAL(3, stats.deviceAllocateCalls);
+
+            manager.free(a);
+            manager.free(b);
+            manager.destroy();
+            device.destroy();
+        }
+
+        UNITTEST_TEST(out_of_memory)
+        {
+            fake_device_t device;
+            device.init(Allocator);
+            memory_manager_t manager;
+            manager.init(Allocator, &device, sConfig());
+
+            device.setFailAllocations(true);
+            allocation_t allocation;
+            CHECK_FALSE(manager.allocate(sRequirements(1024), 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_ANY, allocation));
+            CHECK_FALSE(manager.allocate(sRequirements(600 * 1024), 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_ANY, allocation));
+            CHECK_FALSE(manager.allocate(sRequirements(0), 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_ANY, allocation));
+
+            memory_stats_t stats;
+            manager.getStats(stats);
+            CHECK_EQUAL(0, stats.allocationCount);
+            CHECK_EQUAL(0, stats.blockCount);
+
+            device.setFailAllocations(false);
+            CHECK_TRUE(manager.allocate(sRequirements(1024), 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_ANY, allocation));
+            manager.free(allocation);
+
+            manager.destroy();
+            device.destroy();
+        }
+
+        UNITTEST_TEST(granularity)
+        {
+            fake_device_t device;
+            device.init(Allocator);
+            memory_manager_t manager;
+            manager.init(Allocator, &device, sConfig());
+
+            // The default fake device has a bufferImageGranularity of 1 KB
+            allocation_t buffer, image;
+            CHECK_TRUE(manager.allocate(sRequirements(100, 16), 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_LINEAR, buffer));
+            CHECK_TRUE(manager.allocate(sRequirements(100, 16), 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_OPTIMAL, image));
+            CHECK_EQUAL(buffer.memory, image.memory);
+            CHECK_EQUAL(1024, image.offset);
+
+            manager.free(buffer);
+            manager.free(image);
+            manager.destroy();
+            device.destroy();
+        }
+
+        UNITTEST_TEST(page_size_granularity)
+        {
+            fake_device_t device;
+            device.init(Allocator);
+            memory_config_t config = sConfig();
+            config.pageEngineHeaps = 1 << 0;
+            config.pageSize        = 256;
+            memory_manager_t manager;
+            manager.init(Allocator, &device, config);
+
+            // The page size is rounded up to the 1 KB granularity, a page never holds both a buffer and an image
+            allocation_t buffer, image;
+            CHECK_TRUE(manager.allocate(sRequirements(100, 16), 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_LINEAR, buffer));
+            CHECK_TRUE(manager.allocate(sRequirements(100, 16), 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_OPTIMAL, image));
+            CHECK_EQUAL(buffer.memory, image.memory);
+            CHECK_EQUAL(0, buffer.offset);
+            CHECK_EQUAL(1024, image.offset);
+
+            manager.free(buffer);
+            manager.free(image);
+            manager.destroy();
+            device.destroy();
+        }
+
+        UNITTEST_TEST(free_many_duplicates)
+        {
+            fake_device_t device;
+            device.init(Allocator);
+            memory_manager_t manager;
+            manager.init(Allocator, &device, sConfig());
+
+            allocation_t allocations[4];
+            for (u32 i = 0; i < 4; ++i)
+                manager.allocate(sRequirements(64 * 1024), 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_ANY, allocations[i]);
+
+            // A handle that is in the batch twice, or that was freed before, counts once
+            manager.free(allocations[3]);
+            allocation_t const batch[] = {allocations[0], allocations[1], allocations[0], allocations[3], allocations[1]};
+            manager.freeMany(batch, 5);
+
+            memory_stats_t stats;
+            manager.getStats(stats);
+            CHECK_EQUAL(1, stats.allocationCount);
+            CHECK_EQUAL(64 * 1024, stats.allocatedBytes);
+
+            heap_budget_t budget;
+            manager.getBudget(0, budget);
+            CHECK_EQUAL(64 * 1024, budget.allocationBytes);
+            CHECK_TRUE(budget.allocationBytes <= budget.blockBytes);
+
+            manager.free(allocations[2]);
+            manager.getStats(stats);
+            CHECK_EQUAL(0, stats.allocationCount);
+            CHECK_EQUAL(0, stats.allocatedBytes);
+
+            manager.destroy();
+            device.destroy();
+        }
+
+        // Type 4 of the default layout is host cached and not coherent
+        UNITTEST_TEST(flush_and_invalidate)
+        {
+            fake_device_t device;
+            device.init(Allocator);
+            memory_manager_t manager;
+            manager.init(Allocator, &device, sConfig());
+
+            allocation_t a, b;
+            manager.allocate(sRequirements(1000, 256, 1 << 4), 0, 0, MEMORY_USAGE_GPU_TO_CPU, nalloc::RESOURCE_ANY, a);
+            manager.allocate(sRequirements(1000, 256, 1 << 4), 0, 0, MEMORY_USAGE_GPU_TO_CPU, nalloc::RESOURCE_ANY, b);
+            CHECK_EQUAL(4, a.memoryType);
+            CHECK_EQUAL(a.memory, b.memory);
+            CHECK_NOT_EQUAL(nullptr, manager.map(a));
+            CHECK_NOT_EQUAL(nullptr, manager.map(b));
+            CHECK_EQUAL(1, device.mapCalls());
+            u64 const atom = device.getNonCoherentAtomSize();
+
+            // The range is rounded out to whole atoms
+            manager.flush(a, 10, 100);
+            CHECK_EQUAL(1, manager.flushMappedRanges());
+            CHECK_EQUAL(1, device.flushCalls());
+            CHECK_EQUAL(2 * atom, device.flushedBytes());
+
+            // Ranges of one memory object, recorded out of order, go to the device in one call
+            manager.flush(b);
+            manager.flush(a);
+            manager.invalidate(b, 0, 1);
+            CHECK_EQUAL(2, manager.flushMappedRanges());
+            CHECK_EQUAL(2, device.flushCalls());
+            CHECK_EQUAL(1, device.invalidateCalls());
+            CHECK_EQUAL(atom, device.invalidatedBytes());
+            CHECK_EQUAL(0, device.rangeErrors());
+
+            // Unmapping waits for the ranges recorded before it
+            manager.invalidate(a);
+            manager.unmap(a);
+            manager.unmap(b);
+            CHECK_EQUAL(1, manager.flushMappedRanges());
+            CHECK_EQUAL(2, device.invalidateCalls());
+            CHECK_EQUAL(0, device.rangeErrors());
+
+            // Nothing is recorded for coherent memory
+            allocation_t c;
+            manager.allocate(sRequirements(1000, 256, 1 << 1), 0, 0, MEMORY_USAGE_CPU_TO_GPU, nalloc::RESOURCE_ANY, c);
+            manager.map(c);
+            manager.flush(c);
+            manager.invalidate(c);
+            manager.unmap(c);
+            CHECK_EQUAL(0, manager.flushMappedRanges());
+            CHECK_EQUAL(2, device.flushCalls());
+            CHECK_EQUAL(2, device.invalidateCalls());
+
+            manager.free(a);
+            manager.free(b);
+            manager.free(c);
+            manager.destroy();
+            device.destroy();
+        }
+    }
+
+    UNITTEST_FIXTURE(type_selection)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        static bool sSameTypes(u8 const* types, u32 count, u8 const* expected, u32 expectedCount)
+        {
+            if (count != expectedCount)
+                return false;
+            for (u32 i = 0; i < count; ++i)
+            {
+                if (types[i] != expected[i])
+                    return false;
+            }
+            return true;
+        }
+
+        UNITTEST_TEST(usages)
+        {
+            fake_device_t device;
+            device.init(Allocator);
+            memory_manager_t manager;
+            manager.init(Allocator, &device);
+
+            // Types of the default layout: 0 device local, 1 host coherent, 2 host cached, 3 device local and host
+            // visible, 4 host cached and not coherent
+            u8        types[MAX_MEMORY_TYPES];
+            u8 const  gpuOnly[] = {0, 3, 1, 2, 4};
+            u32 const n0        = manager.findMemoryTypes(0xffffffff, 0, 0, MEMORY_USAGE_GPU_ONLY, types);
+            CHECK_TRUE(sSameTypes(types, n0, gpuOnly, 5));
+
+            u8 const  cpuOnly[] = {1, 2, 3};
+            u32 const n1        = manager.findMemoryTypes(0xffffffff, 0, 0, MEMORY_USAGE_CPU_ONLY, types);
+            CHECK_TRUE(sSameTypes(types, n1, cpuOnly, 3));
+
+            u8 const  upload[] = {3, 1, 2, 4};
+            u32 const n2       = manager.findMemoryTypes(0xffffffff, 0, 0, MEMORY_USAGE_CPU_TO_GPU, types);
+            CHECK_TRUE(sSameTypes(types, n2, upload, 4));
+
+            u8 const  readback[] = {2, 4, 1, 3};
+            u32 const n3         = manager.findMemoryTypes(0xffffffff, 0, 0, MEMORY_USAGE_GPU_TO_CPU, types);
+            CHECK_TRUE(sSameTypes(types, n3, readback, 4));
+
+            CHECK_EQUAL(0, manager.findMemoryTypes(0xffffffff, 0, 0, MEMORY_USAGE_GPU_LAZY, types));
+
+            // memoryTypeBits filters the ranking
+            u8 const  filtered[] = {1, 2};
+            u32 const n4         = manager.findMemoryTypes(0x6, 0, 0, MEMORY_USAGE_CPU_TO_GPU, types);
+            CHECK_TRUE(sSameTypes(types, n4, filtered, 2));
+
+            manager.destroy();
+            device.destroy();
+        }
+
+        UNITTEST_TEST(flags_beyond_the_table)
+        {
+            fake_device_t device;
+            device.init(Allocator);
+            memory_manager_t manager;
+            manager.init(Allocator, &device);
+
+            // No type has the flag, so requiring it leaves nothing and preferring it changes nothing
+            u32 const protectedFlag = 0x20;
+            u8        types[MAX_MEMORY_TYPES];
+            CHECK_EQUAL(0, manager.findMemoryTypes(0xffffffff, protectedFlag, 0, MEMORY_USAGE_UNKNOWN, types));
+
+            u8        reference[MAX_MEMORY_TYPES];
+            u32 const count = manager.findMemoryTypes(0xffffffff, 0, MEMORY_PROPERTY_HOST_CACHED, MEMORY_USAGE_UNKNOWN, reference);
+            u32 const n     = manager.findMemoryTypes(0xffffffff, 0, MEMORY_PROPERTY_HOST_CACHED | protectedFlag, MEMORY_USAGE_UNKNOWN, types);
+            CHECK_TRUE(sSameTypes(types, n, reference, count));
+
+            manager.destroy();
+            device.destroy();
+        }
+
+        // Every key of the table against a scan of the memory types
+        UNITTEST_TEST(table_matches_scan)
+        {
+            memory_properties_t properties;
+            properties.memoryTypeCount = 6;
+            properties.memoryTypes[0]  = {MEMORY_PROPERTY_DEVICE_LOCAL, 0};
+            properties.memoryTypes[1]  = {MEMORY_PROPERTY_DEVICE_LOCAL | MEMORY_PROPERTY_LAZILY_ALLOCATED, 0};
+            properties.memoryTypes[2]  = {MEMORY_PROPERTY_HOST_VISIBLE | MEMORY_PROPERTY_HOST_COHERENT, 1};
+            properties.memoryTypes[3]  = {MEMORY_PROPERTY_HOST_VISIBLE | MEMORY_PROPERTY_HOST_CACHED, 1};
+            properties.memoryTypes[4]  = {MEMORY_PROPERTY_HOST_VISIBLE | MEMORY_PROPERTY_HOST_COHERENT | MEMORY_PROPERTY_HOST_CACHED, 1};
+            properties.memoryTypes[5]  = {MEMORY_PROPERTY_DEVICE_LOCAL | MEMORY_PROPERTY_HOST_VISIBLE | MEMORY_PROPERTY_HOST_COHERENT, 0};
+            properties.memoryHeapCount = 2;
+            properties.memoryHeaps[0]  = {(u64)8 << 30, MEMORY_HEAP_DEVICE_LOCAL};
+            properties.memoryHeaps[1]  = {(u64)16 << 30, 0};
+
+            fake_device_t device;
+            device.init(Allocator, properties, 1);
+            memory_manager_t manager;
+            manager.init(Allocator, &device);
+
+            u32 mismatches = 0;
+            for (u32 usage = 0; usage < NUM_MEMORY_USAGES; ++usage)
+            {
+                for (u32 required = 0; required < 32; ++required)
+                {
+                    for (u32 preferred = 0; preferred < 32; ++preferred)
+                    {
+                        u32 req = required, pref = preferred, avoid = 0;
+                        switch (usage)
+                        {
+                            case MEMORY_USAGE_GPU_ONLY:
+                                pref |= MEMORY_PROPERTY_DEVICE_LOCAL;
+                                avoid |= MEMORY_PROPERTY_HOST_VISIBLE;
+                                break;
+                            case MEMORY_USAGE_CPU_ONLY:
+                                req |= MEMORY_PROPERTY_HOST_VISIBLE | MEMORY_PROPERTY_HOST_COHERENT;
+                                avoid |= MEMORY_PROPERTY_DEVICE_LOCAL;
+                                break;
+                            case MEMORY_USAGE_CPU_TO_GPU:
+                                req |= MEMORY_PROPERTY_HOST_VISIBLE;
+                                pref |= MEMORY_PROPERTY_DEVICE_LOCAL;
+                                break;
+                            case MEMORY_USAGE_GPU_TO_CPU:
+                                req |= MEMORY_PROPERTY_HOST_VISIBLE;
+                                pref |= MEMORY_PROPERTY_HOST_CACHED;
+                                break;
+                            case MEMORY_USAGE_GPU_LAZY: req |= MEMORY_PROPERTY_LAZILY_ALLOCATED; break;
+                        }
+                        if (((req | pref) & MEMORY_PROPERTY_LAZILY_ALLOCATED) == 0)
+                            avoid |= MEMORY_PROPERTY_LAZILY_ALLOCATED;
+                        avoid &= ~pref;
+
+                        // Stable selection on cost
+                        u8  expected[MAX_MEMORY_TYPES];
+                        u32 count = 0;
+                        for (u32 cost = 0; cost <= 10; ++cost)
+                        {
+                            for (u32 t = 0; t < properties.memoryTypeCount; ++t)
+                            {
+                                u32 const flags = properties.memoryTypes[t].propertyFlags;
+                                if ((flags & req) != req)
+                                    continue;
+                                u32 c = 0;
+                                for (u32 bit = 1; bit < 0x100; bit <<= 1)
+                                    c += (((pref & ~flags) | (avoid & flags)) & bit) != 0 ? 1 : 0;
+                                if (c == cost)
+                                    expected[count++] = (u8)t;
+                            }
+                        }
+
+                        u8        types[MAX_MEMORY_TYPES];
+                        u32 const n = manager.findMemoryTypes(0xffffffff, required, preferred, usage, types);
+                        mismatches += sSameTypes(types, n, expected, count) ? 0 : 1;
+                    }
+                }
+            }
+            CHECK_EQUAL(0, mismatches);
+
+            manager.destroy();
+            device.destroy();
+        }
+    }
+}
+UNITTEST_SUITE_END
@@ -0,0 +1,277 @@
+#include "ccore/c_target.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/private/c_vkpageallocator.h"
+
+#include "cunittest/cunittest.h"
+#include "csuperalloc/test_allocator.h"
+
+using namespace ncore;
+using namespace ncore::nalloc;
+
+UNITTEST_SUITE_BEGIN(page_allocator)
+{
+    UNITTEST_FIXTURE(main)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(contiguous)
+        {
+            page_allocator_t pages;
+            pages.init(Allocator, 64 * 65536 + 1000);
+            CHECK_EQUAL(64 * 65536, pages.size());
+
+            // Sizes round up to whole pages, the lowest fitting run is used
+            handle_t const a = pages.allocateHandle(1);
+            handle_t const b = pages.allocateHandle(65537);
+            CHECK_EQUAL(0, pages.getOffset(a));
+            CHECK_EQUAL(65536, pages.getSize(a));
+            CHECK_EQUAL(65536, pages.getOffset(b));
+            CHECK_EQUAL(2 * 65536, pages.getSize(b));
+
+            // Alignment beyond the page size
+            handle_t const c = pages.allocateHandle(65536, 8 * 65536);
+            CHECK_EQUAL(8 * 65536, pages.getOffset(c));
+            handle_t const d = pages.allocateHandle(65536);
+            CHECK_EQUAL(3 * 65536, pages.getOffset(d));
+
+            CHECK_EQUAL(INVALID_HANDLE, pages.allocateHandle(0));
+            CHECK_EQUAL(INVALID_HANDLE, pages.allocateHandle(60 * 65536));
+
+            // A stale handle is rejected
+            CHECK_TRUE(pages.freeHandle(a));
+            CHECK_FALSE(pages.freeHandle(a));
+            CHECK_FALSE(pages.isValid(a));
+            CHECK_EQUAL(0, pages.getSize(a));
+            handle_t const e = pages.allocateHandle(1);
+            CHECK_NOT_EQUAL(a, e);
+            CHECK_EQUAL(0, pages.getOffset(e));
+
+            pages.destroy();
+        }
+
+        UNITTEST_TEST(scattered)
+        {
+            page_allocator_t pages;
+            pages.init(Allocator, 256 * 4096, 0xffffffff, 4096);
+
+            // Holes at pages 1, 3-4 and 100-199
+            handle_t h[4];
+            h[0] = pages.allocateHandle(1 * 4096);
+            h[1] = pages.allocateHandle(1 * 4096);
+            h[2] = pages.allocateHandle(1 * 4096);
+            h[3] = pages.allocateHandle(2 * 4096);
+            pages.allocateHandle(95 * 4096);
+            handle_t const hole = pages.allocateHandle(100 * 4096);
+            pages.allocateHandle(56 * 4096);
+            pages.freeHandle(h[1]);
+            pages.freeHandle(h[3]);
+            pages.freeHandle(hole);
+
+            CHECK_EQUAL(INVALID_HANDLE, pages.allocateScattered(10 * 4096, 2));
+            handle_t const s = pages.allocateScattered(10 * 4096, 3);
+            CHECK_NOT_EQUAL(INVALID_HANDLE, s);
+            CHECK_EQUAL(10 * 4096, pages.getSize(s));
+            CHECK_EQUAL(4096, pages.getOffset(s));
+
+            page_allocator_t::page_run_t runs[4];
+            CHECK_EQUAL(3, pages.getRuns(s, runs, 4));
+            CHECK_EQUAL(1 * 4096, runs[0].offset);
+            CHECK_EQUAL(1 * 4096, runs[0].size);
+            CHECK_EQUAL(3 * 4096, runs[1].offset);
+            CHECK_EQUAL(2 * 4096, runs[1].size);
+            CHECK_EQUAL(100 * 4096, runs[2].offset);
+            CHECK_EQUAL(7 * 4096, runs[2].size);
+
+            // Freeing the runs gives the pages back
+            CHECK_TRUE(pages.freeHandle(s));
+            handle_t const t = pages.allocateHandle(100 * 4096);
+            CHECK_EQUAL(100 * 4096, pages.getOffset(t));
+
+            pages.destroy();
+        }
+
+        UNITTEST_TEST(report)
+        {
+            page_allocator_t pages;
+            pages.init(Allocator, 1024 * 4096, 0xffffffff, 4096);
+
+            storage_report_t report;
+            pages.storageReport(report);
+            CHECK_EQUAL(1024 * 4096, report.totalFreeSpace);
+            CHECK_EQUAL(1024 * 4096, report.largestFreeRegion);
+            CHECK_EQUAL(1, report.numberOfUsedBins);
+
+            // Free runs of 1, 3 and 899 pages
+            handle_t const a = pages.allocateHandle(1 * 4096);
+            handle_t const b = pages.allocateHandle(1 * 4096);
+            handle_t const c = pages.allocateHandle(3 * 4096);
+            pages.allocateHandle(120 * 4096);
+            pages.freeHandle(a);
+            pages.freeHandle(c);
+
+            bin_report_t bin;
+            pages.storageBinState(0, bin);
+            CHECK_EQUAL(4096, bin.size);
+            CHECK_EQUAL(1, bin.count);
+            pages.storageBinState(1, bin);
+            CHECK_EQUAL(1, bin.count);
+            pages.storageBinState(9, bin);
+            CHECK_EQUAL(1, bin.count);
+            pages.storageReport(report);
+            CHECK_EQUAL(899 * 4096, report.largestFreeRegion);
+            CHECK_EQUAL(3, report.numberOfUsedBins);
+
+            // The histogram follows the bitmap, the first two runs merge into one of 5 pages
+            pages.freeHandle(b);
+            pages.storageBinState(2, bin);
+            CHECK_EQUAL(1, bin.count);
+            pages.storageBinState(0, bin);
+            CHECK_EQUAL(0, bin.count);
+
+            pages.destroy();
+        }
+
+        // Scalar reference, a byte per page and first fit from page 0
+        struct reference_t
+        {
+            static constexpr u32 NUM_PAGES = 3000;
+            u8                   used[NUM_PAGES];
+
+            u32 findRun(u32 numPages, u32 alignPages) const
+            {
+                for (u32 first = 0; first + numPages <= NUM_PAGES; first += alignPages)
+                {
+                    u32 n = 0;
+                    while (n < numPages && used[first + n] == 0)
+                        n++;
+                    if (n == numPages)
+                        return first;
+                }
+                return NUM_PAGES;
+            }
+
+            void mark(u32 first, u32 count, u8 value)
+            {
+                for (u32 i = 0; i < count; ++i)
+                    used[first + i] = value;
+            }
+
+            void histogram(u32* counts, u32 numBins, u32& outLongest) const
+            {
+                for (u32 b = 0; b < numBins; ++b)
+                    counts[b] = 0;
+                outLongest = 0;
+                u32 run    = 0;
+                for (u32 p = 0; p <= NUM_PAGES; ++p)
+                {
+                    if (p < NUM_PAGES && used[p] == 0)
+                    {
+                        run++;
+                        continue;
+                    }
+                    if (run > 0)
+                    {
+                        u32 bin = 0;
+                        while ((run >> (bin + 1)) != 0)
+                            bin++;
+                        counts[bin]++;
+                        outLongest = run > outLongest ? run : outLongest;
+                    }
+                    run = 0;
+                }
+            }
+        };
+
+        static u32 sRandom(u32& state)
+        {
+            state = state * 1664525u + 1013904223u;
+            return state >> 8;
+        }
+
+        // The word scans, SIMD where the target has it, match the scalar reference on a long random sequence
+        UNITTEST_TEST(matches_scalar_reference)
+        {
+            page_allocator_t pages;
+            pages.init(Allocator, reference_t::NUM_PAGES * 4096, 0xffffffff, 4096);
+            reference_t* reference = Allocator->construct<reference_t>();
+            reference->mark(0, reference_t::NUM_PAGES, 0);
+
+            u32 const maxLive = 256;
+            handle_t  live[maxLive];
+            u32       livePages[maxLive];
+            u32       numLive    = 0;
+            u32       mismatches = 0;
+            u32       state      = 12345;
+            for (u32 i = 0; i < 20000; ++i)
+            {
+                if (numLive == maxLive || (numLive > 0 && (sRandom(state) & 3) == 0))
+                {
+                    u32 const k = sRandom(state) % numLive;
+                    reference->mark(pages.getOffset(live[k]) / 4096, livePages[k], 0);
+                    pages.freeHandle(live[k]);
+                    live[k]      = live[--numLive];
+                    livePages[k] = livePages[numLive];
+                    continue;
+                }
+
+                // Mostly short runs, some spanning several bitmap words
+                u32 const r          = sRandom(state);
+                u32 const numPages   = (r & 7) == 0 ? 1 + (r >> 3) % 300 : 1 + (r >> 3) % 40;
+                u32 const alignPages = 1u << ((r >> 16) % 8);
+                u32 const expected   = reference->findRun(numPages, alignPages);
+
+                handle_t const handle = pages.allocateHandle(numPages * 4096, alignPages * 4096);
+                if (handle == INVALID_HANDLE)
+                {
+                    mismatches += expected != reference_t::NUM_PAGES ? 1 : 0;
+                    continue;
+                }
+                u32 const first = pages.getOffset(handle) / 4096;
+                mismatches += first != expected ? 1 : 0;
+                reference->mark(first, numPages, 1);
+                live[numLive]      = handle;
+                livePages[numLive] = numPages;
+                numLive++;
+
+                if ((i % 500) == 0)
+                {
+                    u32 counts[page_allocator_t::NUM_REPORT_BINS];
+                    u32 longest;
+                    reference->histogram(counts, page_allocator_t::NUM_REPORT_BINS, longest);
+                    for (u32 b = 0; b < page_allocator_t::NUM_REPORT_BINS; ++b)
+                    {
+                        bin_report_t bin;
+                        pages.storageBinState(b, bin);
+                        mismatches += bin.count != counts[b] ? 1 : 0;
+                    }
+                    storage_report_t report;
+                    pages.storageReport(report);
+                    mismatches += report.largestFreeRegion != (u64)longest * 4096 ? 1 : 0;
+                }
+            }
+            CHECK_EQUAL(0, mismatches);
+
+            Allocator->destruct(reference);
+            pages.destroy();
+        }
+
+        UNITTEST_TEST(config64)
+        {
+            page_allocator64_t pages;
+            pages.init(Allocator, (u64)16 << 30, 0xffffffff, (u64)1 << 20);
+
+            handle_t const a = pages.allocateHandle((u64)6 << 30);
+            handle_t const b = pages.allocateHandle((u64)1 << 20, (u64)8 << 30);
+            CHECK_EQUAL(0, pages.getOffset(a));
+            CHECK_EQUAL((u64)8 << 30, pages.getOffset(b));
+            CHECK_EQUAL((u64)6 << 30, pages.getSize(a));
+
+            pages.destroy();
+        }
+    }
+}
+UNITTEST_SUITE_END
@@ -0,0 +1,314 @@
+#include "ccore/c_target.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/c_vkmem.h"
+#include "cvkmem/c_vkfakedevice.h"
+#include "cvkmem/c_vkresidency.h"
+
+#include "cunittest/cunittest.h"
+#include "csuperalloc/test_allocator.h"
+
+using namespace ncore;
+using namespace ncore::nvkmem;
+
+UNITTEST_SUITE_BEGIN(residency)
+{
+    UNITTEST_FIXTURE(main)
+    {
+        UNITTEST_ALLOCATOR;
+
+        static u64 const SIZE = 256 * 1024;
+        static u64 const MB   = 1024 * 1024;
+
+        // Remembers what the residency manager told it
+        class listener_t : public residency_listener_t
+        {
+        public:
+            listener_t()
+                : numEvicted(0)
+                , numMoved(0)
+                , lastEvicted(INVALID_RESIDENT)
+                , lastMoved(INVALID_RESIDENT)
+            {
+            }
+
+            u32          numEvicted;
+            u32          numMoved;
+            resident_t   lastEvicted;
+            resident_t   lastMoved;
+            allocation_t movedFrom;
+            allocation_t movedTo;
+
+        protected:
+            virtual void v_onEvicted(resident_t resident, allocation_t const&, void*)
+            {
+                numEvicted++;
+                lastEvicted = resident;
+            }
+            virtual void v_onMoved(resident_t resident, allocation_t const& from, allocation_t const& to, void*)
+            {
+                numMoved++;
+                lastMoved = resident;
+                movedFrom = from;
+                movedTo   = to;
+            }
+        };
+
+        static fake_device_t    s_device;
+        static memory_manager_t s_manager;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        // Heap 0 gets a budget of 'budget' bytes, blocks are 1 MB
+        static void sInit(alloc_t* allocator, u64 budget)
+        {
+            memory_config_t config;
+            config.preferredBlockSize    = MB;
+            config.dedicatedThreshold    = 512 * 1024;
+            config.maxEmptyBlocksPerType = 0;
+            s_device.init(allocator);
+            s_device.setHeapBudget(0, budget);
+            s_manager.init(allocator, &s_device, config);
+        }
+
+        static void sDestroy()
+        {
+            s_manager.destroy();
+            s_device.destroy();
+        }
+
+        static residency_desc_t sDesc(u32 priority = RESIDENCY_PRIORITY_NORMAL, u32 flags = RESIDENCY_FLAG_EVICTABLE)
+        {
+            residency_desc_t desc;
+            desc.requirements.size           = SIZE;
+            desc.requirements.alignment      = 256;
+            desc.requirements.memoryTypeBits = 0xffffffff;
+            desc.priority                    = priority;
+            desc.flags                       = flags;
+            return desc;
+        }
+
+        UNITTEST_TEST(evicts_least_recently_used)
+        {
+            sInit(Allocator, 8 * MB);
+            listener_t          listener;
+            residency_manager_t residency;
+            residency.init(Allocator, &s_manager, &listener);
+
+            resident_t residents[8];
+            for (u32 i = 0; i < 8; ++i)
+                residents[i] = residency.add(sDesc(), i);
+            CHECK_EQUAL(0, residency.update(10));
+
+            // 2 MB used of a 2 MB budget, a single eviction brings heap 0 below 90%
+            s_device.setHeapBudget(0, 2 * MB);
+            residency.use(residents[0], 10);
+            CHECK_EQUAL(1, residency.update(10));
+            CHECK_EQUAL(1, listener.numEvicted);
+            CHECK_EQUAL(residents[1], listener.lastEvicted);
+            CHECK_EQUAL(RESIDENCY_STATE_EVICTED, residency.getState(residents[1]));
+            CHECK_EQUAL(RESIDENCY_STATE_RESIDENT, residency.getState(residents[0]));
+
+            residency_stats_t stats;
+            residency.getStats(stats);
+            CHECK_EQUAL(7, stats.residentCount);
+            CHECK_EQUAL(1, stats.evictedCount);
+            CHECK_EQUAL(7 * SIZE, stats.residentBytes);
+
+            // Within budget again
+            CHECK_EQUAL(0, residency.update(11));
+
+            residency.destroy();
+            sDestroy();
+        }
+
+        UNITTEST_TEST(lowest_priority_first)
+        {
+            sInit(Allocator, 8 * MB);
+            listener_t          listener;
+            residency_manager_t residency;
+            residency.init(Allocator, &s_manager, &listener);
+
+            resident_t residents[8];
+            for (u32 i = 0; i < 8; ++i)
+                residents[i] = residency.add(sDesc(i == 6 ? RESIDENCY_PRIORITY_LOW : RESIDENCY_PRIORITY_HIGH), i);
+
+            // The low priority resource goes first although it was used more recently
+            s_device.setHeapBudget(0, 2 * MB);
+            CHECK_EQUAL(1, residency.update(20));
+            CHECK_EQUAL(residents[6], listener.lastEvicted);
+
+            // setPriority moves a resource between the lists
+            residency.setPriority(residents[2], RESIDENCY_PRIORITY_LOW);
+            s_device.setHeapBudget(0, 7 * SIZE);
+            CHECK_EQUAL(1, residency.update(20));
+            CHECK_EQUAL(residents[2], listener.lastEvicted);
+
+            residency.destroy();
+            sDestroy();
+        }
+
+        UNITTEST_TEST(frames_in_flight)
+        {
+            sInit(Allocator, 8 * MB);
+            listener_t          listener;
+            residency_manager_t residency;
+            residency.init(Allocator, &s_manager, &listener);
+
+            for (u32 i = 0; i < 4; ++i)
+                residency.add(sDesc(), 5);
+
+            // Everything was used in the last two frames, the heap stays beyond its budget
+            s_device.setHeapBudget(0, 512 * 1024);
+            CHECK_EQUAL(0, residency.update(6));
+            CHECK_EQUAL(0, listener.numEvicted);
+
+            // Resources that are not evictable stay as well
+            residency_desc_t pinned = sDesc(RESIDENCY_PRIORITY_LOW, 0);
+            s_device.setHeapBudget(0, 8 * MB);
+            residency.update(6);
+            resident_t const keep = residency.add(pinned, 0);
+            s_device.setHeapBudget(0, 512 * 1024);
+            CHECK_EQUAL(4, residency.update(100));
+            CHECK_EQUAL(RESIDENCY_STATE_RESIDENT, residency.getState(keep));
+
+            residency.destroy();
+            sDestroy();
+        }
+
+        UNITTEST_TEST(external_usage)
+        {
+            sInit(Allocator, 4 * MB);
+            listener_t          listener;
+            residency_manager_t residency;
+            residency.init(Allocator, &s_manager, &listener);
+
+            for (u32 i = 0; i < 8; ++i)
+                residency.add(sDesc(), 0);
+
+            // Another process takes 3 MB of the heap, which leaves room for two resources below 90%
+            s_device.setExternalUsage(0, 3 * MB);
+            CHECK_EQUAL(6, residency.update(10));
+            heap_budget_t budget;
+            s_manager.getBudget(0, budget);
+            CHECK_EQUAL(2 * SIZE, budget.allocationBytes);
+
+            // The freed blocks went back to the device
+            CHECK_EQUAL(MB, budget.blockBytes);
+            CHECK_EQUAL(1, s_device.liveAllocations());
+
+            residency.destroy();
+            sDestroy();
+        }
+
+        UNITTEST_TEST(add_makes_room)
+        {
+            sInit(Allocator, 8 * MB);
+            listener_t          listener;
+            residency_manager_t residency;
+            residency.init(Allocator, &s_manager, &listener);
+
+            resident_t residents[8];
+            for (u32 i = 0; i < 8; ++i)
+                residents[i] = residency.add(sDesc(), i);
+
+            // The new resource would push heap 0 beyond 95% of its budget, the coldest ones make room first
+            s_device.setHeapBudget(0, 2 * MB);
+            s_manager.updateBudget();
+            resident_t const added = residency.add(sDesc(), 20);
+            CHECK_NOT_EQUAL(INVALID_RESIDENT, added);
+            CHECK_EQUAL(2, listener.numEvicted);
+            CHECK_EQUAL(RESIDENCY_STATE_EVICTED, residency.getState(residents[0]));
+            CHECK_EQUAL(RESIDENCY_STATE_EVICTED, residency.getState(residents[1]));
+
+            // Restoring the evicted resource evicts the next coldest
+            CHECK_TRUE(residency.restore(residents[0], 21));
+            CHECK_EQUAL(RESIDENCY_STATE_RESIDENT, residency.getState(residents[0]));
+            CHECK_EQUAL(RESIDENCY_STATE_EVICTED, residency.getState(residents[2]));
+
+            residency.remove(residents[1]);
+            residency_stats_t stats;
+            residency.getStats(stats);
+            CHECK_EQUAL(7, stats.residentCount);
+            CHECK_EQUAL(1, stats.evictedCount);
+            CHECK_EQUAL(3, stats.totalEvictions);
+
+            residency.destroy();
+            sDestroy();
+        }
+
+        UNITTEST_TEST(demote_and_restore)
+        {
+            sInit(Allocator, 8 * MB);
+            listener_t          listener;
+            residency_manager_t residency;
+            residency.init(Allocator, &s_manager, &listener);
+
+            resident_t residents[8];
+            for (u32 i = 0; i < 8; ++i)
+                residents[i] = residency.add(sDesc(RESIDENCY_PRIORITY_NORMAL, RESIDENCY_FLAG_EVICTABLE | RESIDENCY_FLAG_DEMOTABLE), i);
+
+            // The coldest resource moves to host visible memory of another heap instead of losing its memory
+            s_device.setHeapBudget(0, 2 * MB);
+            CHECK_EQUAL(1, residency.update(10));
+            CHECK_EQUAL(0, listener.numEvicted);
+            CHECK_EQUAL(1, listener.numMoved);
+            CHECK_EQUAL(residents[0], listener.lastMoved);
+            CHECK_EQUAL(RESIDENCY_STATE_DEMOTED, residency.getState(residents[0]));
+            allocation_t const demoted = residency.getAllocation(residents[0]);
+            CHECK_NOT_EQUAL(0, s_manager.getMemoryProperties().memoryTypes[demoted.memoryType].heapIndex);
+            CHECK_TRUE((s_manager.getMemoryProperties().memoryTypes[demoted.memoryType].propertyFlags & MEMORY_PROPERTY_HOST_VISIBLE) != 0);
+            CHECK_EQUAL(0, listener.movedFrom.memoryType);
+
+            residency_stats_t stats;
+            residency.getStats(stats);
+            CHECK_EQUAL(1, stats.demotedCount);
+            CHECK_EQUAL(SIZE, stats.demotedBytes);
+            CHECK_EQUAL(1, stats.totalDemotions);
+
+            // Back once there is room
+            s_device.setHeapBudget(0, 8 * MB);
+            residency.update(11);
+            CHECK_TRUE(residency.restore(residents[0], 12));
+            CHECK_EQUAL(2, listener.numMoved);
+            CHECK_EQUAL(demoted.memory, listener.movedFrom.memory);
+            CHECK_EQUAL(0, residency.getAllocation(residents[0]).memoryType);
+            CHECK_EQUAL(RESIDENCY_STATE_RESIDENT, residency.getState(residents[0]));
+
+            residency.destroy();
+            sDestroy();
+        }
+
+        UNITTEST_TEST(out_of_device_memory)
+        {
+            sInit(Allocator, 8 * MB);
+            listener_t          listener;
+            residency_manager_t residency;
+            residency.init(Allocator, &s_manager, &listener);
+
+            // Four dedicated allocations fill the 256 MB of heap 2, the budget is not what limits them
+            residency_desc_t desc            = sDesc();
+            desc.requirements.size           = 64 * MB;
+            desc.requirements.memoryTypeBits = 1 << 3;
+            s_device.setHeapBudget(2, (u64)1 << 40);
+            s_manager.updateBudget();
+            for (u32 i = 0; i < 4; ++i)
+                CHECK_NOT_EQUAL(INVALID_RESIDENT, residency.add(desc, 0));
+
+            // The device is out of memory, the add gives up what may go and retries
+            CHECK_NOT_EQUAL(INVALID_RESIDENT, residency.add(desc, 10));
+            CHECK_EQUAL(4, listener.numEvicted);
+
+            // Full again with resources of the current frame, nothing may go
+            for (u32 i = 0; i < 3; ++i)
+                CHECK_NOT_EQUAL(INVALID_RESIDENT, residency.add(desc, 10));
+            CHECK_EQUAL(INVALID_RESIDENT, residency.add(desc, 10));
+            CHECK_EQUAL(4, listener.numEvicted);
+
+            residency.destroy();
+            sDestroy();
+        }
+    }
+}
+UNITTEST_SUITE_END
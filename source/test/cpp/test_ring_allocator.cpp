@@ -0,0 +1,249 @@
+#include "ccore/c_target.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/c_vkmem.h"
+#include "cvkmem/c_vkfakedevice.h"
+#include "cvkmem/c_vkringallocator.h"
+
+#include "cunittest/cunittest.h"
+#include "csuperalloc/test_allocator.h"
+#include "cvkmem/test_fake_device.h"
+
+#include <algorithm>
+#include <thread>
+
+using namespace ncore;
+using namespace ncore::nvkmem;
+
+UNITTEST_SUITE_BEGIN(ring_allocator)
+{
+    UNITTEST_FIXTURE(main)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FAKE_DEVICE;
+
+        static ring_config_t sConfig()
+        {
+            ring_config_t config;
+            config.size         = 65536;
+            config.maxAlignment = 256;
+            return config;
+        }
+
+        // Offset of an allocation in the ring
+        static u64 sRingOffset(ring_allocator_t const& ring, allocation_t const& allocation) { return allocation.offset - ring.getMemory().offset; }
+
+        // Fallbacks may come from the same device memory block as the ring, but never from its range
+        static bool sInRing(ring_allocator_t const& ring, allocation_t const& allocation)
+        {
+            allocation_t const& memory = ring.getMemory();
+            return allocation.memory == memory.memory && allocation.offset >= memory.offset && allocation.offset + allocation.size <= memory.offset + memory.size;
+        }
+
+        UNITTEST_TEST(linear)
+        {
+            ring_allocator_t ring;
+            CHECK_TRUE(ring.init(Allocator, &s_manager, sConfig()));
+
+            allocation_t a, b, c;
+            CHECK_TRUE(ring.allocate(100, 1, a));
+            CHECK_TRUE(ring.allocate(100, 256, b));
+            CHECK_TRUE(ring.allocate(1, 1, c));
+            CHECK_EQUAL(0, sRingOffset(ring, a));
+            CHECK_EQUAL(256, sRingOffset(ring, b));
+            CHECK_EQUAL(356, sRingOffset(ring, c));
+            CHECK_TRUE(sInRing(ring, b));
+            CHECK_EQUAL(100, b.size);
+
+            ring_stats_t stats;
+            ring.getStats(stats);
+            CHECK_EQUAL(357, stats.bytesInFlight);
+            CHECK_EQUAL(0, stats.fallbackCount);
+
+            ring.destroy();
+        }
+
+        UNITTEST_TEST(empty_allocation)
+        {
+            ring_allocator_t ring;
+            ring.init(Allocator, &s_manager, sConfig());
+
+            allocation_t a;
+            CHECK_TRUE(ring.allocate(0, 16, a));
+            CHECK_EQUAL(0, a.size);
+            CHECK_TRUE(sInRing(ring, a));
+
+            ring_stats_t stats;
+            ring.getStats(stats);
+            CHECK_EQUAL(0, stats.bytesInFlight);
+            CHECK_EQUAL(0, stats.totalFallbacks);
+
+            ring.destroy();
+        }
+
+        UNITTEST_TEST(wrap_and_reclaim)
+        {
+            ring_allocator_t ring;
+            ring.init(Allocator, &s_manager, sConfig());
+
+            allocation_t a, b, c;
+            ring.allocate(40000, 1, a);
+            ring.submit(1);
+            ring.allocate(20000, 1, b);
+            ring.submit(2);
+            CHECK_EQUAL(40000, sRingOffset(ring, b));
+
+            // The first submit is done, the next allocation does not fit before the end and wraps to the start
+            ring.reclaim(1);
+            CHECK_TRUE(ring.allocate(10000, 1, c));
+            CHECK_EQUAL(0, sRingOffset(ring, c));
+            CHECK_TRUE(sInRing(ring, c));
+
+            // The padding at the end of the ring is in flight until the submit of the wrapped allocation is done
+            ring_stats_t stats;
+            ring.getStats(stats);
+            CHECK_EQUAL(65536 + 10000 - 40000, stats.bytesInFlight);
+            CHECK_EQUAL(1, stats.pendingSubmits);
+
+            ring.submit(3);
+            ring.reclaim(3);
+            ring.getStats(stats);
+            CHECK_EQUAL(0, stats.bytesInFlight);
+            CHECK_EQUAL(0, stats.pendingSubmits);
+            CHECK_EQUAL(0, stats.totalFallbacks);
+
+            ring.destroy();
+        }
+
+        UNITTEST_TEST(fallback)
+        {
+            ring_allocator_t ring;
+            ring.init(Allocator, &s_manager, sConfig());
+
+            // The ring is full until the submit is reclaimed
+            allocation_t a, b;
+            ring.allocate(60000, 1, a);
+            ring.submit(1);
+            CHECK_TRUE(ring.allocate(10000, 1, b));
+            CHECK_FALSE(sInRing(ring, b));
+            CHECK_EQUAL(10000, b.size);
+
+            // Larger than the ring, or aligned beyond maxAlignment
+            allocation_t c, d;
+            CHECK_TRUE(ring.allocate(100000, 1, c));
+            CHECK_TRUE(ring.allocate(16, 4096, d));
+            CHECK_EQUAL(0, d.offset & 4095);
+
+            ring_stats_t stats;
+            ring.getStats(stats);
+            CHECK_EQUAL(3, stats.fallbackCount);
+            CHECK_EQUAL(3, stats.totalFallbacks);
+            CHECK_EQUAL(10000 + 100000 + 16, stats.totalFallbackBytes);
+
+            // Fallbacks belong to the next submit, reclaiming the earlier one keeps them
+            ring.reclaim(1);
+            ring.getStats(stats);
+            CHECK_EQUAL(3, stats.fallbackCount);
+
+            ring.submit(2);
+            ring.reclaim(2);
+            ring.getStats(stats);
+            CHECK_EQUAL(0, stats.fallbackCount);
+            CHECK_EQUAL(0, stats.bytesInFlight);
+
+            // The ring has room again
+            allocation_t e;
+            ring.allocate(10000, 1, e);
+            CHECK_TRUE(sInRing(ring, e));
+
+            ring.destroy();
+
+            memory_stats_t memoryStats;
+            s_manager.getStats(memoryStats);
+            CHECK_EQUAL(0, memoryStats.allocationCount);
+        }
+
+        UNITTEST_TEST(merged_submits)
+        {
+            ring_allocator_t ring;
+            ring.init(Allocator, &s_manager, sConfig());
+
+            // Submits beyond MAX_PENDING_SUBMITS are merged into the most recent one
+            allocation_t a;
+            for (u32 i = 1; i <= ring_allocator_t::MAX_PENDING_SUBMITS + 6; ++i)
+            {
+                ring.allocate(100, 1, a);
+                ring.submit(i);
+            }
+            ring_stats_t stats;
+            ring.getStats(stats);
+            CHECK_EQUAL(ring_allocator_t::MAX_PENDING_SUBMITS, stats.pendingSubmits);
+
+            ring.reclaim(ring_allocator_t::MAX_PENDING_SUBMITS);
+            ring.getStats(stats);
+            CHECK_EQUAL(1, stats.pendingSubmits);
+            CHECK_NOT_EQUAL(0, stats.bytesInFlight);
+
+            ring.reclaim(ring_allocator_t::MAX_PENDING_SUBMITS + 6);
+            ring.getStats(stats);
+            CHECK_EQUAL(0, stats.pendingSubmits);
+            CHECK_EQUAL(0, stats.bytesInFlight);
+
+            ring.destroy();
+        }
+
+        struct worker_t
+        {
+            ring_allocator_t* ring;
+            u64*              offsets;
+            u32               count;
+            u32               failures;
+        };
+
+        static void sWorker(worker_t* worker)
+        {
+            for (u32 i = 0; i < worker->count; ++i)
+            {
+                allocation_t allocation;
+                if (!worker->ring->allocate(16, 16, allocation) || !sInRing(*worker->ring, allocation))
+                    worker->failures++;
+                worker->offsets[i] = allocation.offset;
+            }
+        }
+
+        UNITTEST_TEST(threads)
+        {
+            ring_allocator_t ring;
+            ring.init(Allocator, &s_manager, sConfig());
+
+            u32 const numThreads = 4;
+            u32 const count      = 1000;
+            u64*      offsets    = g_allocate_array<u64>(Allocator, numThreads * count);
+            worker_t  workers[numThreads];
+            for (u32 t = 0; t < numThreads; ++t)
+                workers[t] = {&ring, offsets + t * count, count, 0};
+
+            std::thread threads[numThreads];
+            for (u32 t = 0; t < numThreads; ++t)
+                threads[t] = std::thread(sWorker, &workers[t]);
+            for (u32 t = 0; t < numThreads; ++t)
+                threads[t].join();
+
+            // Every thread got its own 16 bytes
+            u32 failures = 0;
+            for (u32 t = 0; t < numThreads; ++t)
+                failures += workers[t].failures;
+            CHECK_EQUAL(0, failures);
+            std::sort(offsets, offsets + numThreads * count);
+            u32 overlaps = 0;
+            for (u32 i = 1; i < numThreads * count; ++i)
+                overlaps += (offsets[i] - offsets[i - 1] < 16) ? 1 : 0;
+            CHECK_EQUAL(0, overlaps);
+
+            g_deallocate_array(Allocator, offsets);
+            ring.destroy();
+        }
+    }
+}
+UNITTEST_SUITE_END
@@ -0,0 +1,200 @@
+#include "ccore/c_target.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/private/c_vkshardedallocator.h"
+
+#include "cunittest/cunittest.h"
+#include "csuperalloc/test_allocator.h"
+
+#include <algorithm>
+#include <thread>
+
+using namespace ncore;
+using namespace ncore::nalloc;
+
+UNITTEST_SUITE_BEGIN(sharded_allocator)
+{
+    UNITTEST_FIXTURE(main)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        typedef sharded_allocator_t::allocation_t sharded_allocation_t;
+
+        UNITTEST_TEST(shards)
+        {
+            sharded_allocator_t sharded;
+            sharded.init(Allocator, 16 * 1024 * 1024, 4);
+            CHECK_EQUAL(4, sharded.numShards());
+            CHECK_EQUAL(4 * 1024 * 1024, sharded.shardSize());
+
+            // Without a cache every request goes to a shard, offsets are in the full range
+            sharded_allocation_t a;
+            CHECK_TRUE(sharded.allocate(nullptr, 1000, 256, RESOURCE_ANY, a));
+            CHECK_EQUAL(1000, a.size);
+            CHECK_EQUAL(0, a.offset & 255);
+            CHECK_TRUE(a.offset >= (u32)a.shard * sharded.shardSize());
+            CHECK_TRUE(a.offset + a.size <= (u32)(a.shard + 1) * sharded.shardSize());
+
+            // An allocation never spans shards
+            sharded_allocation_t b;
+            CHECK_FALSE(sharded.allocate(nullptr, 5 * 1024 * 1024, 1, RESOURCE_ANY, b));
+            CHECK_TRUE(sharded.allocate(nullptr, 4 * 1024 * 1024, 1, RESOURCE_ANY, b));
+
+            // Alignments up to the shard alignment hold for the offset in the full range
+            sharded_allocation_t c;
+            CHECK_FALSE(sharded.allocate(nullptr, 1000, 128 * 1024, RESOURCE_ANY, c));
+            CHECK_TRUE(sharded.allocate(nullptr, 1000, 64 * 1024, RESOURCE_ANY, c));
+            CHECK_EQUAL(0, c.offset & (64 * 1024 - 1));
+
+            sharded.free(nullptr, a);
+            sharded.free(nullptr, b);
+            sharded.free(nullptr, c);
+
+            storage_report_t report;
+            sharded.storageReport(report);
+            CHECK_EQUAL(16 * 1024 * 1024, report.totalFreeSpace);
+            sharded.destroy();
+        }
+
+        UNITTEST_TEST(cache)
+        {
+            sharded_allocator_t sharded;
+            sharded.init(Allocator, 16 * 1024 * 1024, 2);
+            sharded_allocator_t::cache_t* cache = sharded.createCache();
+
+            // Small requests are rounded up to their power of 2 class and naturally aligned
+            sharded_allocation_t a;
+            CHECK_TRUE(sharded.allocate(cache, 100, 1, RESOURCE_ANY, a));
+            CHECK_EQUAL(128, a.size);
+            CHECK_EQUAL(0, a.offset & 127);
+
+            // A freed range is cached and handed out again
+            sharded.free(cache, a);
+            sharded_allocation_t b;
+            CHECK_TRUE(sharded.allocate(cache, 120, 1, RESOURCE_ANY, b));
+            CHECK_EQUAL(a.offset, b.offset);
+
+            // Requests beyond the largest class are not rounded
+            sharded_allocation_t c;
+            CHECK_TRUE(sharded.allocate(cache, 100000, 1, RESOURCE_ANY, c));
+            CHECK_EQUAL(100000, c.size);
+
+            // Cached ranges count as used until the cache is flushed
+            sharded.free(cache, b);
+            sharded.free(cache, c);
+            storage_report_t report;
+            sharded.storageReport(report);
+            CHECK_TRUE(report.totalFreeSpace < 16 * 1024 * 1024);
+            sharded.flush(cache);
+            sharded.storageReport(report);
+            CHECK_EQUAL(16 * 1024 * 1024, report.totalFreeSpace);
+
+            sharded.destroyCache(cache);
+            sharded.destroy();
+        }
+
+        UNITTEST_TEST(flush_on_out_of_space)
+        {
+            // One shard of 1 MB, fill the magazines of a cache and then ask for the whole shard
+            sharded_allocator_t sharded;
+            sharded.init(Allocator, 1024 * 1024, 1);
+            sharded_allocator_t::cache_t* cache = sharded.createCache();
+
+            sharded_allocation_t items[8];
+            for (u32 i = 0; i < 8; ++i)
+                CHECK_TRUE(sharded.allocate(cache, 4096, 1, RESOURCE_ANY, items[i]));
+            for (u32 i = 0; i < 8; ++i)
+                sharded.free(cache, items[i]);
+
+            sharded_allocation_t all;
+            CHECK_TRUE(sharded.allocate(cache, 1024 * 1024, 1, RESOURCE_ANY, all));
+            sharded.free(cache, all);
+
+            sharded.destroyCache(cache);
+            sharded.destroy();
+        }
+
+        // The caches are created and destroyed on the main thread, the test allocator is not thread-safe
+        struct worker_t
+        {
+            sharded_allocator_t*          sharded;
+            sharded_allocator_t::cache_t* cache;
+            sharded_allocation_t*         live;
+            u32                           numLive;
+            u32                           rounds;
+            u32                           seed;
+            u32                           failures;
+        };
+
+        static void sWorker(worker_t* worker)
+        {
+            sharded_allocator_t::cache_t* cache = worker->cache;
+            u32                           state = worker->seed;
+            bool                          valid[64];
+            for (u32 i = 0; i < worker->numLive; ++i)
+                valid[i] = false;
+            for (u32 r = 0; r < worker->rounds; ++r)
+            {
+                state          = state * 1664525u + 1013904223u;
+                u32 const i    = (state >> 8) % worker->numLive;
+                u32 const size = 64u << ((state >> 20) % 12);
+                if (valid[i])
+                    worker->sharded->free(cache, worker->live[i]);
+                valid[i] = worker->sharded->allocate(cache, size, 1, RESOURCE_ANY, worker->live[i]);
+                worker->failures += valid[i] ? 0 : 1;
+            }
+            // Keep the live set for the overlap check, hand everything else back
+            worker->sharded->flush(cache);
+            for (u32 i = 0; i < worker->numLive; ++i)
+            {
+                if (!valid[i])
+                    worker->live[i].size = 0;
+            }
+        }
+
+        UNITTEST_TEST(threads)
+        {
+            u32 const numThreads = 4;
+            u32 const numLive    = 64;
+
+            sharded_allocator_t sharded;
+            sharded.init(Allocator, 64 * 1024 * 1024, numThreads);
+
+            sharded_allocation_t live[numThreads * numLive];
+            worker_t             workers[numThreads];
+            std::thread          threads[numThreads];
+            for (u32 t = 0; t < numThreads; ++t)
+            {
+                workers[t] = {&sharded, sharded.createCache(), live + t * numLive, numLive, 20000, t + 1, 0};
+                threads[t] = std::thread(sWorker, &workers[t]);
+            }
+            for (u32 t = 0; t < numThreads; ++t)
+            {
+                threads[t].join();
+                sharded.destroyCache(workers[t].cache);
+                CHECK_EQUAL(0, workers[t].failures);
+            }
+
+            // No two live allocations of any thread overlap
+            std::sort(live, live + numThreads * numLive, [](sharded_allocation_t const& a, sharded_allocation_t const& b) { return a.offset < b.offset; });
+            u32 end = 0;
+            for (u32 i = 0; i < numThreads * numLive; ++i)
+            {
+                if (live[i].size == 0)
+                    continue;
+                CHECK_TRUE(live[i].offset >= end);
+                end = live[i].offset + live[i].size;
+                sharded.free(nullptr, live[i]);
+            }
+
+            storage_report_t report;
+            sharded.storageReport(report);
+            CHECK_EQUAL(64 * 1024 * 1024, report.totalFreeSpace);
+            sharded.destroy();
+        }
+    }
+}
+UNITTEST_SUITE_END
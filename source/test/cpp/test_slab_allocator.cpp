@@ -0,0 +1,241 @@
+#include "ccore/c_target.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/private/c_vkblockallocator.h"
+#include "cvkmem/private/c_vkslaballocator.h"
+
+#include "cunittest/cunittest.h"
+#include "csuperalloc/test_allocator.h"
+
+using namespace ncore;
+using namespace ncore::nalloc;
+
+UNITTEST_SUITE_BEGIN(slab_allocator)
+{
+    UNITTEST_FIXTURE(main)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(size_classes)
+        {
+            block_allocator_t parent;
+            parent.init(Allocator, 1024 * 1024);
+            slab_allocator_t slab;
+            u32 const        classSizes[] = {64, 96, 256};
+            slab.init(Allocator, &parent, classSizes, 3, 4096);
+
+            CHECK_EQUAL(0, slab.sizeClassOf(1));
+            CHECK_EQUAL(1, slab.sizeClassOf(65));
+            CHECK_EQUAL(2, slab.sizeClassOf(256));
+            CHECK_EQUAL(3, slab.sizeClassOf(257));
+            CHECK_EQUAL(INVALID_HANDLE, slab.allocate(257));
+
+            // Slots follow each other in a slab and are aligned to the power of 2 that divides the class
+            handle_t const a = slab.allocate(50);
+            handle_t const b = slab.allocate(64);
+            CHECK_EQUAL(64, slab.getSize(a));
+            CHECK_EQUAL(slab.getOffset(a) + 64, slab.getOffset(b));
+            handle_t const c = slab.allocate(90);
+            CHECK_EQUAL(96, slab.getSize(c));
+            CHECK_EQUAL(0, slab.getOffset(c) & 31);
+
+            slab_stats_t stats;
+            slab.getStats(stats);
+            CHECK_EQUAL(2, stats.numSlabs);
+            CHECK_EQUAL(3, stats.numUsedSlots);
+            CHECK_EQUAL(64 + 64 + 96, stats.usedBytes);
+            CHECK_EQUAL(64 * 64 + 42 * 96, stats.slabBytes);
+
+            slab.destroy();
+            parent.destroy();
+        }
+
+        UNITTEST_TEST(slabs_come_and_go)
+        {
+            block_allocator_t parent;
+            parent.init(Allocator, 1024 * 1024);
+            slab_allocator_t slab;
+            u32 const        classSizes[] = {256};
+            slab.init(Allocator, &parent, classSizes, 1, 1024);
+
+            // Four slots per slab
+            handle_t handles[12];
+            for (u32 i = 0; i < 12; ++i)
+                handles[i] = slab.allocateClass(0);
+            slab_stats_t stats;
+            slab.getStats(stats);
+            CHECK_EQUAL(3, stats.numSlabs);
+
+            // The first slab that becomes empty is kept, the second goes back to the parent
+            for (u32 i = 0; i < 8; ++i)
+                CHECK_TRUE(slab.free(handles[i]));
+            slab.getStats(stats);
+            CHECK_EQUAL(2, stats.numSlabs);
+            CHECK_EQUAL(1, stats.numEmptySlabs);
+
+            // The kept slab is reused before a new one is taken
+            handles[0] = slab.allocateClass(0);
+            slab.getStats(stats);
+            CHECK_EQUAL(2, stats.numSlabs);
+            CHECK_EQUAL(0, stats.numEmptySlabs);
+            CHECK_TRUE(slab.free(handles[0]));
+
+            slab.trim();
+            slab.getStats(stats);
+            CHECK_EQUAL(1, stats.numSlabs);
+            CHECK_EQUAL(0, stats.numEmptySlabs);
+            storage_report_t report;
+            parent.storageReport(report);
+            CHECK_EQUAL(1024 * 1024 - 1024, report.totalFreeSpace);
+
+            slab.destroy();
+            parent.destroy();
+        }
+
+        UNITTEST_TEST(full_slab)
+        {
+            block_allocator_t parent;
+            parent.init(Allocator, 1024 * 1024);
+            slab_allocator_t slab;
+            u32 const        classSizes[] = {16};
+            slab.init(Allocator, &parent, classSizes, 1, 16 * 130);
+
+            // 130 slots span three bitmap words, every slot is handed out once
+            u32 offsets[130];
+            for (u32 i = 0; i < 130; ++i)
+                offsets[i] = slab.getOffset(slab.allocateClass(0));
+            u32 distinct = 0;
+            for (u32 i = 0; i < 130; ++i)
+                distinct += (offsets[i] - offsets[0]) / 16 == i ? 1 : 0;
+            CHECK_EQUAL(130, distinct);
+
+            slab_stats_t stats;
+            slab.getStats(stats);
+            CHECK_EQUAL(1, stats.numSlabs);
+            slab.allocateClass(0);
+            slab.getStats(stats);
+            CHECK_EQUAL(2, stats.numSlabs);
+
+            slab.destroy();
+            parent.destroy();
+        }
+
+        UNITTEST_TEST(stale_handles)
+        {
+            block_allocator_t parent;
+            parent.init(Allocator, 1024 * 1024);
+            slab_allocator_t slab;
+            u32 const        classSizes[] = {64};
+            slab.init(Allocator, &parent, classSizes, 1, 256);
+
+            // A freed slot is rejected until it is handed out again
+            handle_t const a = slab.allocateClass(0);
+            handle_t const b = slab.allocateClass(0);
+            CHECK_TRUE(slab.free(a));
+            CHECK_FALSE(slab.isValid(a));
+            CHECK_FALSE(slab.free(a));
+            CHECK_EQUAL(slab_allocator_t::parent_t::allocation_t::NO_SPACE, slab.getOffset(a));
+            CHECK_EQUAL(0, slab.getSize(a));
+            CHECK_FALSE(slab.free(INVALID_HANDLE));
+
+            // The slab runs empty and is kept for reuse, its slots get new handles
+            CHECK_TRUE(slab.free(b));
+            CHECK_FALSE(slab.free(b));
+            handle_t const c = slab.allocateClass(0);
+            handle_t const d = slab.allocateClass(0);
+            CHECK_TRUE(c != a && c != b && d != a && d != b);
+            CHECK_TRUE(slab.isValid(c));
+            CHECK_FALSE(slab.isValid(a));
+            CHECK_FALSE(slab.isValid(b));
+            CHECK_FALSE(slab.free(b));
+            CHECK_EQUAL(64, slab.getSize(c));
+
+            slab_stats_t stats;
+            slab.getStats(stats);
+            CHECK_EQUAL(2, stats.numUsedSlots);
+            CHECK_EQUAL(1, stats.numSlabs);
+
+            slab.destroy();
+            parent.destroy();
+        }
+
+        UNITTEST_TEST(stale_handles_of_a_released_slab)
+        {
+            block_allocator_t parent;
+            parent.init(Allocator, 1024 * 1024);
+            slab_allocator_t slab;
+            u32 const        classSizes[] = {64};
+            slab.init(Allocator, &parent, classSizes, 1, 128);
+
+            // The second slab goes back to the parent, a new slab at the same index does not take its handles
+            handle_t handles[4];
+            for (u32 i = 0; i < 4; ++i)
+                handles[i] = slab.allocateClass(0);
+            for (u32 i = 0; i < 4; ++i)
+                slab.free(handles[i]);
+            slab_stats_t stats;
+            slab.getStats(stats);
+            CHECK_EQUAL(1, stats.numSlabs);
+
+            handle_t fresh[4];
+            for (u32 i = 0; i < 4; ++i)
+                fresh[i] = slab.allocateClass(0);
+            u32 stale = 0;
+            for (u32 i = 0; i < 4; ++i)
+            {
+                stale += slab.isValid(handles[i]) ? 0 : 1;
+                for (u32 j = 0; j < 4; ++j)
+                    stale += handles[i] == fresh[j] ? 0 : 1;
+            }
+            CHECK_EQUAL(4 + 16, stale);
+            for (u32 i = 0; i < 4; ++i)
+                CHECK_FALSE(slab.free(handles[i]));
+            slab.getStats(stats);
+            CHECK_EQUAL(4, stats.numUsedSlots);
+
+            slab.destroy();
+            parent.destroy();
+        }
+
+        UNITTEST_TEST(parent_out_of_space)
+        {
+            block_allocator_t parent;
+            parent.init(Allocator, 4096);
+            slab_allocator_t slab;
+            u32 const        classSizes[] = {1024};
+            slab.init(Allocator, &parent, classSizes, 1, 2048);
+
+            handle_t handles[4];
+            for (u32 i = 0; i < 4; ++i)
+                handles[i] = slab.allocateClass(0);
+            CHECK_EQUAL(INVALID_HANDLE, slab.allocateClass(0));
+            CHECK_TRUE(slab.free(handles[3]));
+            CHECK_NOT_EQUAL(INVALID_HANDLE, slab.allocateClass(0));
+
+            slab.destroy();
+            parent.destroy();
+        }
+
+        UNITTEST_TEST(config64)
+        {
+            block_allocator64_t parent;
+            parent.init(Allocator, (u64)8 << 30);
+            slab_allocator64_t slab;
+            u64 const          classSizes[] = {(u64)1 << 20};
+            slab.init(Allocator, &parent, classSizes, 1, (u64)1 << 30);
+
+            // A slab beyond 4 GB
+            parent.allocateHandle((u64)5 << 30);
+            handle_t const a = slab.allocateClass(0);
+            CHECK_EQUAL((u64)5 << 30, slab.getOffset(a));
+            CHECK_EQUAL((u64)1 << 20, slab.getSize(a));
+
+            slab.destroy();
+            parent.destroy();
+        }
+    }
+}
+UNITTEST_SUITE_END
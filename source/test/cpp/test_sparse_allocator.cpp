@@ -0,0 +1,255 @@
+#include "ccore/c_target.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/c_vkmem.h"
+#include "cvkmem/c_vkfakedevice.h"
+#include "cvkmem/c_vksparseallocator.h"
+
+#include "cunittest/cunittest.h"
+#include "csuperalloc/test_allocator.h"
+#include "cvkmem/test_fake_device.h"
+
+using namespace ncore;
+using namespace ncore::nvkmem;
+
+UNITTEST_SUITE_BEGIN(sparse_allocator)
+{
+    UNITTEST_FIXTURE(main)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FAKE_DEVICE;
+
+        static u64 const PAGE = 65536;
+
+        // Four pages per chunk
+        static sparse_config_t sConfig()
+        {
+            sparse_config_t config;
+            config.virtualSize    = 64 * 1024 * 1024;
+            config.pageSize       = PAGE;
+            config.chunkSize      = 4 * PAGE;
+            config.maxEmptyChunks = 1;
+            return config;
+        }
+
+        // Binds are ordered by resource offset, do not overlap and are whole pages
+        static bool sWellFormed(sparse_bind_batch_t const& batch)
+        {
+            for (u32 i = 0; i < batch.numBinds; ++i)
+            {
+                sparse_bind_t const& bind = batch.binds[i];
+                if (bind.size == 0 || (bind.size % PAGE) != 0 || (bind.resourceOffset % PAGE) != 0)
+                    return false;
+                if (i > 0 && batch.binds[i - 1].resourceOffset + batch.binds[i - 1].size > bind.resourceOffset)
+                    return false;
+            }
+            return true;
+        }
+
+        UNITTEST_TEST(reserve_and_release)
+        {
+            sparse_allocator_t sparse;
+            sparse.init(Allocator, &s_manager, sConfig());
+
+            virtual_range_t const a = sparse.reserve(1);
+            virtual_range_t const b = sparse.reserve(3 * PAGE, 4 * PAGE);
+            CHECK_EQUAL(0, sparse.getOffset(a));
+            CHECK_EQUAL(PAGE, sparse.getSize(a));
+            CHECK_EQUAL(4 * PAGE, sparse.getOffset(b));
+            CHECK_EQUAL(3 * PAGE, sparse.getSize(b));
+            CHECK_EQUAL(INVALID_RANGE, sparse.reserve(0));
+            CHECK_EQUAL(INVALID_RANGE, sparse.reserve(128 * 1024 * 1024));
+
+            sparse_stats_t stats;
+            sparse.getStats(stats);
+            CHECK_EQUAL(2, stats.rangeCount);
+            CHECK_EQUAL(4 * PAGE, stats.reservedBytes);
+            CHECK_EQUAL(0, stats.chunkCount);
+
+            // Reserving does not bind anything
+            sparse_bind_batch_t batch;
+            CHECK_EQUAL(0, sparse.flush(batch));
+
+            sparse.release(a);
+            sparse.release(b);
+            sparse.getStats(stats);
+            CHECK_EQUAL(0, stats.rangeCount);
+            CHECK_EQUAL(0, stats.reservedBytes);
+
+            sparse.destroy();
+        }
+
+        UNITTEST_TEST(commit_merges_binds)
+        {
+            sparse_allocator_t sparse;
+            sparse.init(Allocator, &s_manager, sConfig());
+
+            // Consecutive pages of one chunk are contiguous in memory and come out as a single bind
+            virtual_range_t const range = sparse.reserve(16 * PAGE);
+            CHECK_TRUE(sparse.commit(range, 100, 3 * PAGE));
+            CHECK_TRUE(sparse.isCommitted(range, 0));
+            CHECK_TRUE(sparse.isCommitted(range, 3 * PAGE));
+            CHECK_FALSE(sparse.isCommitted(range, 4 * PAGE));
+
+            sparse_stats_t stats;
+            sparse.getStats(stats);
+            CHECK_EQUAL(4, stats.dirtyPages);
+            CHECK_EQUAL(4 * PAGE, stats.committedBytes);
+            CHECK_EQUAL(1, stats.chunkCount);
+
+            sparse_bind_batch_t batch;
+            CHECK_EQUAL(1, sparse.flush(batch));
+            CHECK_TRUE(sWellFormed(batch));
+            CHECK_EQUAL(0, batch.binds[0].resourceOffset);
+            CHECK_EQUAL(4 * PAGE, batch.binds[0].size);
+            CHECK_NOT_EQUAL(NULL_MEMORY, batch.binds[0].memory);
+            CHECK_EQUAL(0, batch.binds[0].memoryOffset % PAGE);
+            device_memory_t const memory       = batch.binds[0].memory;
+            u64 const             memoryOffset = batch.binds[0].memoryOffset;
+
+            // Nothing changed since
+            CHECK_EQUAL(0, sparse.flush(batch));
+            CHECK_TRUE(sparse.commit(range, 0, 4 * PAGE));
+            CHECK_EQUAL(0, sparse.flush(batch));
+
+            // An unbind for the decommitted page, the page is reused by the next commit
+            sparse.decommit(range, 2 * PAGE, 1);
+            CHECK_FALSE(sparse.isCommitted(range, 2 * PAGE));
+            CHECK_EQUAL(1, sparse.flush(batch));
+            CHECK_EQUAL(2 * PAGE, batch.binds[0].resourceOffset);
+            CHECK_EQUAL(PAGE, batch.binds[0].size);
+            CHECK_EQUAL(NULL_MEMORY, batch.binds[0].memory);
+
+            CHECK_TRUE(sparse.commit(range, 8 * PAGE, PAGE));
+            CHECK_EQUAL(1, sparse.flush(batch));
+            CHECK_EQUAL(8 * PAGE, batch.binds[0].resourceOffset);
+            CHECK_EQUAL(memory, batch.binds[0].memory);
+            CHECK_EQUAL(memoryOffset + 2 * PAGE, batch.binds[0].memoryOffset);
+
+            sparse.release(range);
+            sparse.destroy();
+        }
+
+        UNITTEST_TEST(scattered_binds)
+        {
+            sparse_allocator_t sparse;
+            sparse.init(Allocator, &s_manager, sConfig());
+
+            // Interleaved commits of two ranges, neighbours in a range are not neighbours in memory
+            virtual_range_t const a = sparse.reserve(4 * PAGE);
+            virtual_range_t const b = sparse.reserve(4 * PAGE);
+            for (u32 i = 0; i < 4; ++i)
+            {
+                sparse.commit(a, i * PAGE, PAGE);
+                sparse.commit(b, i * PAGE, PAGE);
+            }
+
+            sparse_stats_t stats;
+            sparse.getStats(stats);
+            CHECK_EQUAL(2, stats.chunkCount);
+
+            sparse_bind_batch_t batch;
+            CHECK_EQUAL(8, sparse.flush(batch));
+            CHECK_TRUE(sWellFormed(batch));
+            u32 bound = 0;
+            for (u32 i = 0; i < batch.numBinds; ++i)
+                bound += batch.binds[i].memory != NULL_MEMORY ? 1 : 0;
+            CHECK_EQUAL(8, bound);
+
+            // A neighbour that is contiguous in memory again merges, decommitting all of b unbinds it in one go
+            sparse.decommit(b, 0, 4 * PAGE);
+            CHECK_EQUAL(1, sparse.flush(batch));
+            CHECK_EQUAL(4 * PAGE, batch.binds[0].resourceOffset);
+            CHECK_EQUAL(4 * PAGE, batch.binds[0].size);
+            CHECK_EQUAL(NULL_MEMORY, batch.binds[0].memory);
+
+            sparse.release(a);
+            sparse.release(b);
+            sparse.destroy();
+        }
+
+        UNITTEST_TEST(commit_then_decommit)
+        {
+            sparse_allocator_t sparse;
+            sparse.init(Allocator, &s_manager, sConfig());
+
+            // A page committed and decommitted between two flushes ends up unbound
+            virtual_range_t const range = sparse.reserve(2 * PAGE);
+            sparse.commit(range, 0, 2 * PAGE);
+            sparse.decommit(range, 0, 2 * PAGE);
+
+            sparse_bind_batch_t batch;
+            CHECK_EQUAL(1, sparse.flush(batch));
+            CHECK_EQUAL(0, batch.binds[0].resourceOffset);
+            CHECK_EQUAL(2 * PAGE, batch.binds[0].size);
+            CHECK_EQUAL(NULL_MEMORY, batch.binds[0].memory);
+
+            sparse.release(range);
+            sparse.destroy();
+        }
+
+        UNITTEST_TEST(chunks_go_back)
+        {
+            sparse_allocator_t sparse;
+            sparse.init(Allocator, &s_manager, sConfig());
+
+            virtual_range_t const range = sparse.reserve(16 * PAGE);
+            sparse.commit(range, 0, 12 * PAGE);
+            sparse_bind_batch_t batch;
+            sparse.flush(batch);
+
+            memory_stats_t memoryStats;
+            s_manager.getStats(memoryStats);
+            CHECK_EQUAL(3, memoryStats.allocationCount);
+
+            // The chunks stay until the flush that unbinds their pages, one empty chunk is kept
+            sparse.release(range);
+            sparse_stats_t stats;
+            sparse.getStats(stats);
+            CHECK_EQUAL(3, stats.chunkCount);
+            CHECK_EQUAL(3, stats.emptyChunkCount);
+            CHECK_EQUAL(12, stats.dirtyPages);
+
+            CHECK_EQUAL(1, sparse.flush(batch));
+            CHECK_EQUAL(12 * PAGE, batch.binds[0].size);
+            sparse.getStats(stats);
+            CHECK_EQUAL(1, stats.chunkCount);
+            CHECK_EQUAL(1, stats.emptyChunkCount);
+            CHECK_EQUAL(0, stats.committedBytes);
+            s_manager.getStats(memoryStats);
+            CHECK_EQUAL(1, memoryStats.allocationCount);
+
+            sparse.destroy();
+            s_manager.getStats(memoryStats);
+            CHECK_EQUAL(0, memoryStats.allocationCount);
+        }
+
+        UNITTEST_TEST(out_of_memory)
+        {
+            sparse_allocator_t sparse;
+            sparse.init(Allocator, &s_manager, sConfig());
+
+            // The empty block the manager keeps would serve the chunks without a device call
+            s_manager.trim();
+            virtual_range_t const range = sparse.reserve(8 * PAGE);
+            s_device.setFailAllocations(true);
+            CHECK_FALSE(sparse.commit(range, 0, 8 * PAGE));
+            s_device.setFailAllocations(false);
+
+            sparse_stats_t stats;
+            sparse.getStats(stats);
+            CHECK_EQUAL(0, stats.committedBytes);
+
+            CHECK_TRUE(sparse.commit(range, 0, 8 * PAGE));
+            sparse.getStats(stats);
+            CHECK_EQUAL(8 * PAGE, stats.committedBytes);
+
+            sparse.release(range);
+            sparse_bind_batch_t batch;
+            sparse.flush(batch);
+            sparse.destroy();
+        }
+    }
+}
+UNITTEST_SUITE_END
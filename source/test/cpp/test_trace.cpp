@@ -0,0 +1,395 @@
+#include "ccore/c_target.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/private/c_vkblockallocator.h"
+#include "cvkmem/private/c_vktrace.h"
+
+#include "cunittest/cunittest.h"
+#include "csuperalloc/test_allocator.h"
+
+#include <string.h>
+
+using namespace ncore;
+using namespace ncore::nalloc;
+
+UNITTEST_SUITE_BEGIN(trace)
+{
+    UNITTEST_FIXTURE(main)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        static u32 const MAX_LIVE = 400;
+
+        static u32 sRandom(u32& state)
+        {
+            state = state * 1664525u + 1013904223u;
+            return state >> 8;
+        }
+
+        // Every kind of event: single and batched allocations and frees (with stale handles and duplicates in
+        // the batches), failed allocations, reallocations, grow and shrinkToFit
+        template <typename T>
+        static void sWorkload(alloc_t* allocator, T& block, u32 steps)
+        {
+            typedef typename T::offset_t offset_t;
+
+            handle_t* live     = g_allocate_array<handle_t>(allocator, MAX_LIVE);
+            handle_t* batch    = g_allocate_array<handle_t>(allocator, 64);
+            offset_t* sizes    = g_allocate_array<offset_t>(allocator, 64);
+            u32       numLive  = 0;
+            u32       state    = 5;
+            offset_t  heapSize = block.size();
+            for (u32 step = 0; step < steps; ++step)
+            {
+                u32 const r = sRandom(state);
+                switch ((r >> 4) % 16)
+                {
+                    case 0:
+                    {
+                        // A batch, packed into one node where possible
+                        u32 const count = 1 + (r >> 8) % 16;
+                        for (u32 i = 0; i < count; ++i)
+                            sizes[i] = (offset_t)(1 + sRandom(state) % 3000);
+                        u32 const n = block.allocateMany(sizes, count, batch, (offset_t)1 << ((r >> 12) % 8), r & 3);
+                        for (u32 i = 0; i < count && n > 0 && numLive < MAX_LIVE; ++i)
+                        {
+                            if (batch[i] != INVALID_HANDLE)
+                                live[numLive++] = batch[i];
+                        }
+                        break;
+                    }
+                    case 1:
+                    {
+                        // Frees in a batch, the first handle twice and a stale one
+                        u32 count = 0;
+                        while (count < 8 && numLive > 0)
+                        {
+                            u32 const index = sRandom(state) % numLive;
+                            batch[count++]  = live[index];
+                            live[index]     = live[--numLive];
+                        }
+                        if (count > 0)
+                        {
+                            batch[count]     = batch[0];
+                            batch[count + 1] = batch[0] + (1u << 24);
+                            count += 2;
+                        }
+                        block.freeMany(batch, count);
+                        break;
+                    }
+                    case 2:
+                        if (numLive > 0)
+                            block.reallocate(live[(r >> 8) % numLive], (offset_t)(1 + sRandom(state) % 6000));
+                        break;
+                    case 3:
+                        // Too large, fails
+                        block.allocateHandle(heapSize + 1);
+                        break;
+                    case 4:
+                        if ((r >> 8) % 8 == 0)
+                        {
+                            if (block.grow(heapSize + heapSize / 8))
+                                heapSize = block.size();
+                        }
+                        else if ((r >> 8) % 8 == 1)
+                        {
+                            heapSize = block.shrinkToFit();
+                        }
+                        break;
+                    default:
+                        if (numLive == MAX_LIVE || ((r >> 8) % 3 == 0 && numLive > 0))
+                        {
+                            u32 const index = (r >> 10) % numLive;
+                            block.freeHandle(live[index]);
+                            live[index] = live[--numLive];
+                        }
+                        else
+                        {
+                            handle_t const h = block.allocateHandle((offset_t)(1 + (r >> 8) % 5000), (offset_t)1 << ((r >> 20) % 9), r & 3);
+                            if (h != INVALID_HANDLE)
+                                live[numLive++] = h;
+                        }
+                        break;
+                }
+            }
+
+            g_deallocate_array(allocator, sizes);
+            g_deallocate_array(allocator, batch);
+            g_deallocate_array(allocator, live);
+        }
+
+        // Records the workload on a heap with the given configuration and placement, then replays the trace
+        // into an engine of the same configuration
+        template <typename T, typename TEngine>
+        static void sRecordAndReplay(alloc_t* allocator, u32 placement, trace_report_t& outReport, u64& outEvents, bool& outReplayed)
+        {
+            trace_memory_sink_t sink(allocator);
+            {
+                T block;
+                block.init(allocator, 1024 * 1024, 0xffffffff, 1024, placement);
+                trace_recorder_t recorder;
+                recorder.init(allocator, &sink, 1024);
+                block.setTrace(&recorder);
+                sWorkload(allocator, block, 4000);
+                outEvents = recorder.eventCount();
+                block.setTrace(nullptr);
+                recorder.destroy();
+                block.destroy();
+            }
+
+            TEngine          engine(allocator);
+            trace_replayer_t replayer;
+            replayer.init(allocator);
+            outReplayed = replayer.replay(sink.data(), sink.size(), &engine, 100);
+            replayer.getReport(outReport);
+            replayer.destroy();
+        }
+
+        UNITTEST_TEST(replay_reproduces_offsets)
+        {
+            trace_report_t report;
+            u64            events;
+            bool           replayed;
+            sRecordAndReplay<block_allocator_t, block_trace_engine_t>(Allocator, PLACEMENT_FAST, report, events, replayed);
+            CHECK_TRUE(replayed);
+            CHECK_EQUAL(events, report.events);
+            CHECK_EQUAL(0, report.divergences);
+            CHECK_EQUAL(0, report.unknownHandles);
+            CHECK_NOT_EQUAL(0, report.allocate.failures);
+            CHECK_NOT_EQUAL(0, report.reallocate.count);
+        }
+
+        UNITTEST_TEST(ordered_placement)
+        {
+            trace_report_t report;
+            u64            events;
+            bool           replayed;
+            sRecordAndReplay<block_allocator_t, block_trace_engine_t>(Allocator, PLACEMENT_LOWEST_ADDRESS, report, events, replayed);
+            CHECK_TRUE(replayed);
+            CHECK_EQUAL(events, report.events);
+            CHECK_EQUAL(0, report.divergences);
+            sRecordAndReplay<block_allocator_t, block_trace_engine_t>(Allocator, PLACEMENT_BEST_FIT, report, events, replayed);
+            CHECK_TRUE(replayed);
+            CHECK_EQUAL(0, report.divergences);
+        }
+
+        UNITTEST_TEST(configs)
+        {
+            trace_report_t report;
+            u64            events;
+            bool           replayed;
+            sRecordAndReplay<block_allocator16_t, block_trace_engine16_t>(Allocator, PLACEMENT_FAST, report, events, replayed);
+            CHECK_TRUE(replayed);
+            CHECK_EQUAL(events, report.events);
+            CHECK_EQUAL(0, report.divergences);
+            CHECK_EQUAL(0, report.unknownHandles);
+            sRecordAndReplay<block_allocator64_t, block_trace_engine64_t>(Allocator, PLACEMENT_BEST_FIT, report, events, replayed);
+            CHECK_TRUE(replayed);
+            CHECK_EQUAL(events, report.events);
+            CHECK_EQUAL(0, report.divergences);
+            CHECK_EQUAL(0, report.unknownHandles);
+        }
+
+        // Another placement policy replays the same workload with different offsets
+        UNITTEST_TEST(other_placement_diverges)
+        {
+            trace_memory_sink_t sink(Allocator);
+            block_allocator_t   block;
+            block.init(Allocator, 1024 * 1024, 0xffffffff, 1024, PLACEMENT_FAST);
+            trace_recorder_t recorder;
+            recorder.init(Allocator, &sink);
+            block.setTrace(&recorder);
+            sWorkload(Allocator, block, 4000);
+            recorder.destroy();
+            block.destroy();
+
+            block_trace_engine_t engine(Allocator, PLACEMENT_BEST_FIT);
+            trace_replayer_t     replayer;
+            replayer.init(Allocator);
+            CHECK_TRUE(replayer.replay(sink.data(), sink.size(), &engine));
+            trace_report_t report;
+            replayer.getReport(report);
+            CHECK_NOT_EQUAL(0, report.divergences);
+            replayer.destroy();
+        }
+
+        UNITTEST_TEST(batch_frees_count_once)
+        {
+            trace_memory_sink_t sink(Allocator);
+            block_allocator_t   block;
+            block.init(Allocator, 65536);
+            trace_recorder_t recorder;
+            recorder.init(Allocator, &sink);
+            block.setTrace(&recorder);
+
+            handle_t const a = block.allocateHandle(100);
+            handle_t const b = block.allocateHandle(100);
+            handle_t const c = block.allocateHandle(100);
+            block.freeHandle(c);
+            handle_t const batch[] = {a, b, a, c, b};
+            CHECK_EQUAL(2, block.freeMany(batch, 5));
+            recorder.destroy();
+            block.destroy();
+
+            // Begin, 3 allocations, a free, then a batch of 2 frees
+            trace_reader_t reader;
+            CHECK_TRUE(reader.init(sink.data(), sink.size()));
+            trace_event_t event;
+            u32           ops[16];
+            u64           sizes[16];
+            u32           count = 0;
+            while (count < 16 && reader.next(event))
+            {
+                ops[count]   = event.op;
+                sizes[count] = event.size;
+                count++;
+            }
+            CHECK_FALSE(reader.corrupt());
+            CHECK_EQUAL(8, count);
+            CHECK_EQUAL(TRACE_BATCH, ops[5]);
+            CHECK_EQUAL(2, sizes[5]);
+            CHECK_EQUAL(TRACE_FREE, ops[6]);
+            CHECK_EQUAL(TRACE_FREE, ops[7]);
+        }
+
+        // A trace cut anywhere ends at the last complete event, which keeps its time
+        UNITTEST_TEST(truncated_trace)
+        {
+            trace_memory_sink_t sink(Allocator);
+            block_allocator_t   block;
+            block.init(Allocator, 65536);
+            trace_recorder_t recorder;
+            recorder.init(Allocator, &sink);
+            block.setTrace(&recorder);
+            for (u32 i = 0; i < 10; ++i)
+                block.allocateHandle(100);
+            recorder.destroy();
+            block.destroy();
+
+            trace_reader_t reader;
+            trace_event_t  event;
+            u64            times[11];
+            u32            count = 0;
+            CHECK_TRUE(reader.init(sink.data(), sink.size()));
+            while (count < 11 && reader.next(event))
+                times[count++] = event.time;
+            CHECK_EQUAL(11, count);
+            CHECK_FALSE(reader.next(event));
+            CHECK_FALSE(reader.corrupt());
+
+            u32 errors    = 0;
+            u32 lastCount = 0;
+            for (u32 cut = 8; cut < sink.size(); ++cut)
+            {
+                if (!reader.init(sink.data(), cut))
+                    continue;
+                u32 n    = 0;
+                u64 time = 0;
+                while (reader.next(event))
+                {
+                    time = event.time;
+                    n++;
+                }
+                if (n > 11 || n < lastCount || (n > 0 && time != times[n - 1]) || reader.next(event))
+                    errors++;
+                lastCount = n;
+            }
+            CHECK_EQUAL(0, errors);
+            CHECK_EQUAL(10, lastCount);
+
+            // The last event lost its final byte
+            block_trace_engine_t engine(Allocator);
+            trace_replayer_t     replayer;
+            replayer.init(Allocator);
+            CHECK_FALSE(replayer.replay(sink.data(), sink.size() - 1, &engine));
+            trace_report_t report;
+            replayer.getReport(report);
+            CHECK_EQUAL(10, report.events);
+            CHECK_EQUAL(0, report.divergences);
+            replayer.destroy();
+        }
+
+        // Events before the begin event, and a batch count larger than the rest of the trace
+        UNITTEST_TEST(malformed_trace)
+        {
+            trace_memory_sink_t sink(Allocator);
+            block_allocator_t   block;
+            block.init(Allocator, 65536);
+            trace_recorder_t recorder;
+            recorder.init(Allocator, &sink);
+            block.setTrace(&recorder);
+            recorder.destroy();
+            block.destroy();
+
+            // The magic and version of a recorded trace
+            u8 trace[32];
+            memcpy(trace, sink.data(), 6);
+
+            // Allocate with no time delta, size 100, alignment 1, handle 1 and offset 0
+            u8 const allocate[] = {TRACE_ALLOCATE, 0, 100, 0, 1, 0};
+            memcpy(trace + 6, allocate, sizeof(allocate));
+
+            block_trace_engine_t engine(Allocator);
+            trace_replayer_t     replayer;
+            replayer.init(Allocator);
+            CHECK_FALSE(replayer.replay(trace, 6 + sizeof(allocate), &engine));
+            trace_report_t report;
+            replayer.getReport(report);
+            CHECK_EQUAL(0, report.events);
+
+            // Begin with a heap of 65536 bytes, then a batch of 2^32 - 1 events
+            u8 const begin[] = {TRACE_BEGIN, 0, 0x80, 0x80, 0x04, 1, 0, TRACE_BATCH, 0, 0xff, 0xff, 0xff, 0xff, 0x0f};
+            memcpy(trace + 6, begin, sizeof(begin));
+            CHECK_FALSE(replayer.replay(trace, 6 + sizeof(begin), &engine));
+            replayer.getReport(report);
+            CHECK_EQUAL(1, report.events);
+            replayer.destroy();
+        }
+
+        // A trace has no events for moves and snapshots
+        UNITTEST_TEST(refuses_moves_and_snapshots)
+        {
+            trace_memory_sink_t sink(Allocator);
+            block_allocator_t   block;
+            block.init(Allocator, 4096);
+            handle_t const a = block.allocateHandle(128);
+            block.allocateHandle(128);
+            block.freeHandle(a);
+
+            trace_recorder_t recorder;
+            recorder.init(Allocator, &sink);
+
+            // Planned moves have to be committed or cancelled first
+            block_allocator_t::defrag_move_t moves[4];
+            u32                              numMoves;
+            block.defragPlan(moves, 4, numMoves, 4096);
+            CHECK_EQUAL(1, numMoves);
+            CHECK_FALSE(block.setTrace(&recorder));
+            block.defragCancel(moves, numMoves);
+            CHECK_TRUE(block.setTrace(&recorder));
+
+            // No moves while recording
+            CHECK_FALSE(block.defragPlan(moves, 4, numMoves, 4096));
+            CHECK_EQUAL(0, numMoves);
+            CHECK_TRUE(block.setTrace(nullptr));
+
+            // A restored heap
+            u32 const imageSize = block.saveSize();
+            u64*      image     = g_allocate_array<u64>(Allocator, imageSize / 8);
+            block.save(image, imageSize);
+            block_allocator_t copy;
+            copy.restore(Allocator, image, imageSize);
+            CHECK_FALSE(copy.setTrace(&recorder));
+            CHECK_TRUE(copy.setTrace(nullptr));
+
+            copy.destroy();
+            g_deallocate_array(Allocator, image);
+            recorder.destroy();
+            block.destroy();
+        }
+    }
+}
+UNITTEST_SUITE_END
@@ -0,0 +1,239 @@
+#include "ccore/c_target.h"
+#include "cbase/c_allocator.h"
+
+#include "cvkmem/c_vkmem.h"
+#include "cvkmem/c_vkfakedevice.h"
+#include "cvkmem/c_vkupload.h"
+#include "cvkmem/private/c_vkblockallocator.h"
+
+#include "cunittest/cunittest.h"
+#include "csuperalloc/test_allocator.h"
+#include "cvkmem/test_fake_device.h"
+
+using namespace ncore;
+using namespace ncore::nvkmem;
+
+UNITTEST_SUITE_BEGIN(upload)
+{
+    UNITTEST_FIXTURE(main)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FAKE_DEVICE;
+
+        static ring_config_t sStaging(u64 size = 65536)
+        {
+            ring_config_t config;
+            config.size = size;
+            return config;
+        }
+
+        static allocation_t sDestination(u64 size)
+        {
+            memory_requirements_t requirements;
+            requirements.size           = size;
+            requirements.alignment      = 256;
+            requirements.memoryTypeBits = 0xffffffff;
+            allocation_t allocation;
+            s_manager.allocate(requirements, 0, 0, MEMORY_USAGE_GPU_ONLY, nalloc::RESOURCE_LINEAR, allocation);
+            return allocation;
+        }
+
+        static u32 sRandom(u32& state)
+        {
+            state = state * 1664525u + 1013904223u;
+            return state >> 8;
+        }
+
+        UNITTEST_TEST(contiguous_uploads_merge)
+        {
+            upload_stage_t stage;
+            CHECK_TRUE(stage.init(Allocator, &s_manager, sStaging()));
+            allocation_t const destination = sDestination(64 * 1024);
+
+            u8 data[256];
+            for (u32 i = 0; i < 4; ++i)
+                CHECK_TRUE(stage.upload(destination, i * 256, data, 256));
+
+            upload_batch_t batch;
+            stage.submit(1, batch);
+            CHECK_EQUAL(1, batch.numCopies);
+            CHECK_EQUAL(1, batch.numRegions);
+            CHECK_EQUAL(destination.memory, batch.copies[0].dstMemory);
+            CHECK_EQUAL(destination.offset, batch.regions[0].dstOffset);
+            CHECK_EQUAL(1024, batch.regions[0].size);
+
+            stage.reclaim(1);
+            stage.destroy();
+            s_manager.free(destination);
+        }
+
+        UNITTEST_TEST(uploads_that_do_not_follow)
+        {
+            upload_stage_t stage;
+            stage.init(Allocator, &s_manager, sStaging());
+            allocation_t const destination = sDestination(64 * 1024);
+
+            // Reversed, the staging order is the opposite of the destination order
+            u8 data[256];
+            for (u32 i = 4; i > 0; --i)
+                stage.upload(destination, (i - 1) * 256, data, 256);
+            upload_batch_t batch;
+            stage.submit(1, batch);
+            CHECK_EQUAL(1, batch.numCopies);
+            CHECK_EQUAL(4, batch.numRegions);
+            for (u32 i = 1; i < batch.numRegions; ++i)
+                CHECK_TRUE(batch.regions[i - 1].dstOffset < batch.regions[i].dstOffset);
+
+            // A gap in the destination, and alignment padding in the staging memory
+            stage.upload(destination, 0, data, 100);
+            stage.upload(destination, 200, data, 100);
+            stage.upload(destination, 300, data, 100, 256);
+            stage.submit(2, batch);
+            CHECK_EQUAL(3, batch.numRegions);
+
+            upload_stats_t stats;
+            stage.getStats(stats);
+            CHECK_EQUAL(7, stats.totalUploads);
+            CHECK_EQUAL(7, stats.totalRegions);
+            CHECK_EQUAL(2, stats.totalCopies);
+            CHECK_EQUAL(2, stats.totalBatches);
+
+            stage.reclaim(2);
+            stage.getStats(stats);
+            CHECK_EQUAL(0, stats.bytesInFlight);
+            stage.destroy();
+            s_manager.free(destination);
+        }
+
+        UNITTEST_TEST(one_copy_per_memory_pair)
+        {
+            upload_stage_t stage;
+            stage.init(Allocator, &s_manager, sStaging());
+
+            // Dedicated allocations have their own device memory
+            allocation_t const a = sDestination(1024 * 1024);
+            allocation_t const b = sDestination(1024 * 1024);
+            CHECK_NOT_EQUAL(a.memory, b.memory);
+
+            u8 data[256];
+            stage.upload(b, 0, data, 256);
+            stage.upload(a, 0, data, 256);
+            stage.upload(b, 256, data, 256);
+            stage.upload(a, 256, data, 256);
+
+            upload_batch_t batch;
+            stage.submit(1, batch);
+            CHECK_EQUAL(2, batch.numCopies);
+            CHECK_TRUE(batch.copies[0].dstMemory < batch.copies[1].dstMemory);
+            CHECK_EQUAL(4, batch.numRegions);
+            CHECK_EQUAL(2, batch.copies[0].numRegions);
+            CHECK_EQUAL(2, batch.copies[1].firstRegion);
+
+            // Larger than the ring, the staging falls back to a dedicated allocation, another source memory for
+            // the same destination
+            allocation_t const c = sDestination(1024 * 1024);
+            CHECK_NOT_EQUAL(nullptr, stage.reserve(c, 0, 600000));
+            CHECK_NOT_EQUAL(nullptr, stage.reserve(c, 600000, 100));
+            stage.submit(2, batch);
+            CHECK_EQUAL(2, batch.numCopies);
+            CHECK_EQUAL(batch.copies[0].dstMemory, batch.copies[1].dstMemory);
+            CHECK_NOT_EQUAL(batch.copies[0].srcMemory, batch.copies[1].srcMemory);
+            CHECK_EQUAL(2, batch.numRegions);
+            CHECK_EQUAL(600100, batch.regions[0].size + batch.regions[1].size);
+
+            stage.reclaim(2);
+            stage.destroy();
+            s_manager.free(a);
+            s_manager.free(b);
+            s_manager.free(c);
+        }
+
+        // Staging memory that is not host coherent is flushed by submit
+        UNITTEST_TEST(non_coherent_staging)
+        {
+            ring_config_t staging  = sStaging();
+            staging.memoryTypeBits = 1 << 4;
+            u32 const flushCalls   = s_device.flushCalls();
+            u32 const rangeErrors  = s_device.rangeErrors();
+
+            upload_stage_t stage;
+            CHECK_TRUE(stage.init(Allocator, &s_manager, staging));
+            allocation_t const destination = sDestination(64 * 1024);
+
+            u8 data[100];
+            stage.upload(destination, 0, data, 100);
+            stage.upload(destination, 1024, data, 100);
+            upload_batch_t batch;
+            stage.submit(1, batch);
+            CHECK_EQUAL(flushCalls + 1, s_device.flushCalls());
+            CHECK_EQUAL(rangeErrors, s_device.rangeErrors());
+
+            stage.reclaim(1);
+            stage.destroy();
+            s_manager.flushMappedRanges();
+            s_manager.free(destination);
+        }
+
+        // Chunks of the destination uploaded in random order, a chunk merges with the one before it in the
+        // destination only when it was uploaded right after it
+        UNITTEST_TEST(random_order)
+        {
+            upload_stage_t stage;
+            stage.init(Allocator, &s_manager, sStaging(1024 * 1024));
+            allocation_t const destination = sDestination(256 * 1024);
+
+            u32 const count = 200;
+            u32       order[count];
+            u32       position[count];
+            u64       offsets[count + 1];
+            u32       state = 7;
+            for (u32 round = 0; round < 20; ++round)
+            {
+                offsets[0] = 0;
+                for (u32 i = 0; i < count; ++i)
+                {
+                    offsets[i + 1] = offsets[i] + 4 * (1 + sRandom(state) % 64);
+                    order[i]       = i;
+                }
+                for (u32 i = count - 1; i > 0; --i)
+                {
+                    u32 const j    = sRandom(state) % (i + 1);
+                    u32 const swap = order[i];
+                    order[i]       = order[j];
+                    order[j]       = swap;
+                }
+                for (u32 i = 0; i < count; ++i)
+                {
+                    position[order[i]] = i;
+                    stage.reserve(destination, offsets[order[i]], offsets[order[i] + 1] - offsets[order[i]]);
+                }
+
+                u32 expected = count;
+                for (u32 i = 1; i < count; ++i)
+                    expected -= position[i] == position[i - 1] + 1 ? 1 : 0;
+
+                upload_batch_t batch;
+                stage.submit(round + 1, batch);
+                CHECK_EQUAL(1, batch.numCopies);
+                CHECK_EQUAL(expected, batch.numRegions);
+
+                u64 bytes     = 0;
+                u32 unordered = 0;
+                for (u32 i = 0; i < batch.numRegions; ++i)
+                {
+                    bytes += batch.regions[i].size;
+                    if (i > 0 && batch.regions[i - 1].dstOffset + batch.regions[i - 1].size > batch.regions[i].dstOffset)
+                        unordered++;
+                }
+                CHECK_EQUAL(offsets[count], bytes);
+                CHECK_EQUAL(0, unordered);
+                stage.reclaim(round + 1);
+            }
+
+            stage.destroy();
+            s_manager.free(destination);
+        }
+    }
+}
+UNITTEST_SUITE_END
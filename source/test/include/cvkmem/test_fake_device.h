@@ -0,0 +1,30 @@
+#ifndef __TEST_FAKE_DEVICE_H__
+#define __TEST_FAKE_DEVICE_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "cvkmem/c_vkmem.h"
+#include "cvkmem/c_vkfakedevice.h"
+
+// A fake device and a memory manager on top of it, shared by all tests of a fixture. Blocks are 1 MB,
+// requests of 512 KB and up get a dedicated allocation. Follows UNITTEST_ALLOCATOR.
+#define UNITTEST_FAKE_DEVICE                          \
+    static ncore::nvkmem::fake_device_t    s_device;  \
+    static ncore::nvkmem::memory_manager_t s_manager; \
+    UNITTEST_FIXTURE_SETUP()                          \
+    {                                                 \
+        ncore::nvkmem::memory_config_t config;        \
+        config.preferredBlockSize = 1024 * 1024;      \
+        config.dedicatedThreshold = 512 * 1024;       \
+        s_device.init(Allocator);                     \
+        s_manager.init(Allocator, &s_device, config); \
+    }                                                 \
+    UNITTEST_FIXTURE_TEARDOWN()                       \
+    {                                                 \
+        s_manager.destroy();                          \
+        s_device.destroy();                           \
+    }
+
+#endif  // __TEST_FAKE_DEVICE_H__